@@ -38,6 +38,7 @@
 #define RPCID           "ucoindrpc"
 
 #define BUFFER_SIZE     (256 * 1024)
+#define BLOCK_BUFFER_SIZE   (32 * 1024 * 1024)      ///< getblock(verbosity=2)用
 
 #define M_NEXT              ","
 #define M_QQ(str)           "\"" str "\""
@@ -51,6 +52,9 @@
 #define M_HEIGHT            "height"
 #define M_VALUE             "value"
 #define M_TX                "tx"
+#define M_VIN               "vin"
+#define M_TXID              "txid"
+#define M_VOUT              "vout"
 #define M_ERROR             "error"
 #define M_MESSAGE           "message"
 #define M_CODE              "code"
@@ -67,6 +71,7 @@
 typedef struct {
     char    *p_data;
     int     pos;
+    size_t  size;
 } write_result_t;
 
 
@@ -75,18 +80,21 @@ typedef struct {
  **************************************************************************/
 
 static size_t write_response(void *ptr, size_t size, size_t nmemb, void *stream);
+static bool short_channel_txid(char *pJson, char *pTxid, int BHeight, int BIndex);
 static bool getraw_txstr(ucoin_tx_t *pTx, const char *txid);
 static bool getrawtransaction_rpc(char *pJson, const char *pTxid, bool detail);
 static bool signrawtransaction_rpc(char *pJson, const char *pTransaction);
 static bool sendrawtransaction_rpc(char *pJson, const char *pTransaction);
 static bool gettxout_rpc(char *pJson, const char *pTxid, int idx);
 static bool getblock_rpc(char *pJson, const char *pBlock);
+static bool getblock_verbose_rpc(char *pJson, const char *pBlock);
 static bool getblockhash_rpc(char *pJson, int BHeight);
 static bool getblockcount_rpc(char *pJson);
 static bool getnewaddress_rpc(char *pJson);
 static bool estimatefee_rpc(char *pJson, int nBlock);
 //static bool dumpprivkey_rpc(char *pJson, const char *pAddr);
 static int rpc_proc(CURL *curl, char *pJson, char *pData);
+static int rpc_proc_size(CURL *curl, char *pJson, size_t Size, char *pData);
 static int error_result(json_t *p_root);
 
 
@@ -97,6 +105,8 @@ static int error_result(json_t *p_root);
 static char     rpc_url[SZ_RPC_URL];
 static char     rpc_userpwd[SZ_RPC_USER + 1 + SZ_RPC_PASSWD];
 static pthread_mutex_t      mMux;
+static char                 *mpBlockJson;       ///< getblock(verbosity=2)の応答(mMuxBlockで排他)
+static pthread_mutex_t      mMuxBlock;
 
 
 /**************************************************************************
@@ -106,8 +116,12 @@ static pthread_mutex_t      mMux;
 void btcprc_init(const rpc_conf_t *pRpcConf)
 {
     pthread_mutex_init(&mMux, NULL);
+    pthread_mutex_init(&mMuxBlock, NULL);
     curl_global_init(CURL_GLOBAL_ALL);
 
+    //blockごとに確保し直さないよう、起動時に1回だけ確保する
+    mpBlockJson = (char *)APP_MALLOC(BLOCK_BUFFER_SIZE);     //APP_FREE: btcprc_term()
+
     sprintf(rpc_url, "%s:%d", pRpcConf->rpcurl, pRpcConf->rpcport);
     sprintf(rpc_userpwd, "%s:%s", pRpcConf->rpcuser, pRpcConf->rpcpasswd);
     DBG_PRINTF("URL=%s\n", rpc_url);
@@ -119,6 +133,12 @@ void btcprc_init(const rpc_conf_t *pRpcConf)
 void btcprc_term(void)
 {
     curl_global_cleanup();
+
+    pthread_mutex_lock(&mMuxBlock);
+    if (mpBlockJson != NULL) {
+        APP_FREE(mpBlockJson);      //APP_MALLOC: btcprc_init()
+    }
+    pthread_mutex_unlock(&mMuxBlock);
 }
 
 
@@ -370,82 +390,13 @@ bool btcprc_is_short_channel_unspent(int BHeight, int BIndex, int VIndex)
     bool retval;
     char *p_json;
     char txid[UCOIN_SZ_TXID * 2 + 1] = "";
-    char blockhash[UCOIN_SZ_SHA256 * 2 + 1] = "NG";
 
     pthread_mutex_lock(&mMux);
 
     p_json = (char *)APP_MALLOC(BUFFER_SIZE);
 
-    //ブロック高→ブロックハッシュ
-    retval = getblockhash_rpc(p_json, BHeight);
-    if (retval) {
-        json_t *p_root;
-        json_t *p_result;
-        json_error_t error;
-
-        p_root = json_loads(p_json, 0, &error);
-        if (!p_root) {
-            DBG_PRINTF("error: on line %d: %s\n", error.line, error.text);
-            goto LABEL_EXIT;
-        }
-
-        //これ以降は終了時に json_decref()で参照を減らすこと
-        p_result = json_object_get(p_root, M_RESULT);
-        if (!p_result) {
-            DBG_PRINTF("error: M_RESULT\n");
-            goto LABEL_DECREF;
-        }
-        if (json_is_string(p_result)) {
-            strcpy(blockhash, (const char *)json_string_value(p_result));
-        }
-LABEL_DECREF:
-        json_decref(p_root);
-    } else {
-        DBG_PRINTF("fail: getblockhash_rpc\n");
-        goto LABEL_EXIT;
-    }
-
-    //ブロックハッシュ→TXID
-    retval = getblock_rpc(p_json, blockhash);
-    if (retval) {
-        json_t *p_root;
-        json_t *p_result;
-        json_t *p_height;
-        json_t *p_tx;
-        json_error_t error;
-
-        p_root = json_loads(p_json, 0, &error);
-        if (!p_root) {
-            DBG_PRINTF("error: on line %d: %s\n", error.line, error.text);
-            goto LABEL_EXIT;
-        }
-
-        //これ以降は終了時に json_decref()で参照を減らすこと
-        p_result = json_object_get(p_root, M_RESULT);
-        if (!p_result) {
-            DBG_PRINTF("error: M_RESULT\n");
-            goto LABEL_DECREF2;
-        }
-        p_height = json_object_get(p_result, M_HEIGHT);
-        if (json_is_integer(p_height)) {
-            if ((int)json_integer_value(p_height) != BHeight) {
-                DBG_PRINTF("error: M_HEIGHT\n");
-                goto LABEL_DECREF2;
-            }
-        }
-        p_tx = json_object_get(p_result, M_TX);
-        size_t index = 0;
-        json_t *p_value = NULL;
-        json_array_foreach(p_tx, index, p_value) {
-            if ((int)index == BIndex) {
-                strcpy(txid, (const char *)json_string_value(p_value));
-                break;
-            }
-        }
-LABEL_DECREF2:
-        json_decref(p_root);
-    } else {
-        DBG_PRINTF("fail: getblock_rpc\n");
+    retval = short_channel_txid(p_json, txid, BHeight, BIndex);
+    if (!retval) {
         goto LABEL_EXIT;
     }
 
@@ -483,6 +434,28 @@ LABEL_EXIT:
 }
 
 
+bool btcprc_get_short_channel_txid(uint8_t *pTxid, int BHeight, int BIndex)
+{
+    bool ret;
+    char *p_json;
+    char txid[UCOIN_SZ_TXID * 2 + 1] = "";
+
+    pthread_mutex_lock(&mMux);
+
+    p_json = (char *)APP_MALLOC(BUFFER_SIZE);
+    ret = short_channel_txid(p_json, txid, BHeight, BIndex);
+    if (ret) {
+        //TXIDはBE/LE変換
+        ret = misc_str2bin_rev(pTxid, UCOIN_SZ_TXID, txid);
+    }
+    APP_FREE(p_json);
+
+    pthread_mutex_unlock(&mMux);
+
+    return ret;
+}
+
+
 bool btcprc_search_txid_block(ucoin_tx_t *pTx, int BHeight, const uint8_t *pTxid, uint32_t VIndex)
 {
     bool ret = false;
@@ -716,6 +689,147 @@ LABEL_EXIT:
 }
 
 
+bool btcprc_getblock_spent(ucoin_buf_t *pSpent, int BHeight)
+{
+    bool ret = false;
+    bool retval;
+    char *p_json;
+    char blockhash[UCOIN_SZ_SHA256 * 2 + 1];
+
+    ucoin_buf_init(pSpent);
+
+    pthread_mutex_lock(&mMux);
+
+    p_json = (char *)APP_MALLOC(BUFFER_SIZE);
+
+    //ブロック高→ブロックハッシュ
+    retval = getblockhash_rpc(p_json, BHeight);
+    if (retval) {
+        json_t *p_root;
+        json_t *p_result;
+        json_error_t error;
+
+        p_root = json_loads(p_json, 0, &error);
+        if (!p_root) {
+            DBG_PRINTF("error: on line %d: %s\n", error.line, error.text);
+            goto LABEL_EXIT;
+        }
+
+        //取得できなかった場合はgetblockを行わない
+        p_result = json_object_get(p_root, M_RESULT);
+        retval = json_is_string(p_result) && (strlen(json_string_value(p_result)) == UCOIN_SZ_SHA256 * 2);
+        if (retval) {
+            strcpy(blockhash, (const char *)json_string_value(p_result));
+        } else {
+            DBG_PRINTF("error: M_RESULT\n");
+        }
+        json_decref(p_root);
+        if (!retval) {
+            goto LABEL_EXIT;
+        }
+    } else {
+        DBG_PRINTF("fail: getblockhash_rpc\n");
+        goto LABEL_EXIT;
+    }
+    APP_FREE(p_json);
+    pthread_mutex_unlock(&mMux);
+
+    //ブロックハッシュ→transaction(vin展開)
+    //  transactionごとにgetrawtransactionしないよう、1回で取得する
+    //  応答が大きく解析にも時間がかかるため、mMuxは保持しない(curlはRPCごとに作成している)
+    //  応答用バッファは #btcprc_init()で確保したものを使う
+    pthread_mutex_lock(&mMuxBlock);
+    if (mpBlockJson == NULL) {
+        pthread_mutex_unlock(&mMuxBlock);
+        return false;
+    }
+    p_json = mpBlockJson;
+    p_json[0] = '\0';
+    retval = getblock_verbose_rpc(p_json, blockhash);
+    if (retval) {
+        json_t *p_root;
+        json_t *p_result;
+        json_t *p_height;
+        json_t *p_tx;
+        json_error_t error;
+
+        p_root = json_loads(p_json, 0, &error);
+        if (!p_root) {
+            DBG_PRINTF("error: on line %d: %s\n", error.line, error.text);
+            goto LABEL_EXIT2;
+        }
+
+        //これ以降は終了時に json_decref()で参照を減らすこと
+        p_result = json_object_get(p_root, M_RESULT);
+        if (!p_result) {
+            DBG_PRINTF("error: M_RESULT\n");
+            goto LABEL_DECREF2;
+        }
+        p_height = json_object_get(p_result, M_HEIGHT);
+        if (!json_is_integer(p_height) || ((int)json_integer_value(p_height) != BHeight)) {
+            DBG_PRINTF("error: M_HEIGHT\n");
+            goto LABEL_DECREF2;
+        }
+        p_tx = json_object_get(p_result, M_TX);
+        if (!json_is_array(p_tx)) {
+            DBG_PRINTF("error: M_TX\n");
+            goto LABEL_DECREF2;
+        }
+
+        //vin数分を先に確保する
+        size_t index = 0;
+        json_t *p_value = NULL;
+        uint32_t vin_cnt = 0;
+        json_array_foreach(p_tx, index, p_value) {
+            vin_cnt += json_array_size(json_object_get(p_value, M_VIN));
+        }
+        ucoin_buf_alloc(pSpent, sizeof(btcprc_outpoint_t) * vin_cnt);
+
+        btcprc_outpoint_t *p_outpoint = (btcprc_outpoint_t *)pSpent->buf;
+        uint32_t cnt = 0;
+        json_array_foreach(p_tx, index, p_value) {
+            size_t idx_vin = 0;
+            json_t *p_vin = NULL;
+            json_array_foreach(json_object_get(p_value, M_VIN), idx_vin, p_vin) {
+                //coinbaseはtxidを持たない
+                json_t *p_txid = json_object_get(p_vin, M_TXID);
+                json_t *p_vout = json_object_get(p_vin, M_VOUT);
+                if (!json_is_string(p_txid) || !json_is_integer(p_vout)) {
+                    continue;
+                }
+                //TXIDはBE/LE変換
+                if (!misc_str2bin_rev(p_outpoint[cnt].txid, UCOIN_SZ_TXID, json_string_value(p_txid))) {
+                    continue;
+                }
+                p_outpoint[cnt].index = (uint32_t)json_integer_value(p_vout);
+                cnt++;
+            }
+        }
+        pSpent->len = sizeof(btcprc_outpoint_t) * cnt;
+        ret = true;
+LABEL_DECREF2:
+        json_decref(p_root);
+    } else {
+        DBG_PRINTF("fail: getblock_verbose_rpc\n");
+    }
+
+LABEL_EXIT2:
+    pthread_mutex_unlock(&mMuxBlock);
+
+    if (!ret) {
+        ucoin_buf_free(pSpent);
+    }
+    return ret;
+
+LABEL_EXIT:
+    APP_FREE(p_json);
+
+    pthread_mutex_unlock(&mMux);
+
+    return false;
+}
+
+
 bool btcprc_signraw_tx(ucoin_tx_t *pTx, const uint8_t *pData, size_t Len)
 {
     bool ret = false;
@@ -1084,7 +1198,7 @@ static size_t write_response(void *ptr, size_t size, size_t nmemb, void *stream)
 {
     write_result_t *result = (write_result_t *)stream;
 
-    if (result->pos + size * nmemb >= BUFFER_SIZE - 1) {
+    if (result->pos + size * nmemb >= result->size - 1) {
         DBG_PRINTF("error: too small buffer\n");
         DBG_PRINTF("  size: %lu\n", (unsigned long)size);
         DBG_PRINTF("  nmemb: %lu\n", (unsigned long)nmemb);
@@ -1115,6 +1229,103 @@ static size_t write_response(void *ptr, size_t size, size_t nmemb, void *stream)
 }
 
 
+/** short_channel_idのblock height, block indexからTXID(文字列)取得
+ *
+ * @param[out]      pJson       作業用バッファ(BUFFER_SIZE)
+ * @param[out]      pTxid       TXID文字列(UCOIN_SZ_TXID * 2 + 1)
+ * @param[in]       BHeight     block height
+ * @param[in]       BIndex      block index
+ * @retval  true    取得成功
+ * @note
+ *      - mMuxはロック済みで呼び出すこと
+ */
+static bool short_channel_txid(char *pJson, char *pTxid, int BHeight, int BIndex)
+{
+    bool retval;
+    char *p_json = pJson;
+    char blockhash[UCOIN_SZ_SHA256 * 2 + 1] = "NG";
+
+    pTxid[0] = '\0';
+
+    //ブロック高→ブロックハッシュ
+    retval = getblockhash_rpc(p_json, BHeight);
+    if (retval) {
+        json_t *p_root;
+        json_t *p_result;
+        json_error_t error;
+
+        p_root = json_loads(p_json, 0, &error);
+        if (!p_root) {
+            DBG_PRINTF("error: on line %d: %s\n", error.line, error.text);
+            goto LABEL_EXIT;
+        }
+
+        //これ以降は終了時に json_decref()で参照を減らすこと
+        p_result = json_object_get(p_root, M_RESULT);
+        if (!p_result) {
+            DBG_PRINTF("error: M_RESULT\n");
+            goto LABEL_DECREF;
+        }
+        if (json_is_string(p_result)) {
+            strcpy(blockhash, (const char *)json_string_value(p_result));
+        }
+LABEL_DECREF:
+        json_decref(p_root);
+    } else {
+        DBG_PRINTF("fail: getblockhash_rpc\n");
+        goto LABEL_EXIT;
+    }
+
+    //ブロックハッシュ→TXID
+    retval = getblock_rpc(p_json, blockhash);
+    if (retval) {
+        json_t *p_root;
+        json_t *p_result;
+        json_t *p_height;
+        json_t *p_tx;
+        json_error_t error;
+
+        p_root = json_loads(p_json, 0, &error);
+        if (!p_root) {
+            DBG_PRINTF("error: on line %d: %s\n", error.line, error.text);
+            goto LABEL_EXIT;
+        }
+
+        //これ以降は終了時に json_decref()で参照を減らすこと
+        p_result = json_object_get(p_root, M_RESULT);
+        if (!p_result) {
+            DBG_PRINTF("error: M_RESULT\n");
+            goto LABEL_DECREF2;
+        }
+        p_height = json_object_get(p_result, M_HEIGHT);
+        if (json_is_integer(p_height)) {
+            if ((int)json_integer_value(p_height) != BHeight) {
+                DBG_PRINTF("error: M_HEIGHT\n");
+                goto LABEL_DECREF2;
+            }
+        }
+        p_tx = json_object_get(p_result, M_TX);
+        size_t index = 0;
+        json_t *p_value = NULL;
+        json_array_foreach(p_tx, index, p_value) {
+            if ((int)index == BIndex) {
+                strcpy(pTxid, (const char *)json_string_value(p_value));
+                break;
+            }
+        }
+LABEL_DECREF2:
+        json_decref(p_root);
+    } else {
+        DBG_PRINTF("fail: getblock_rpc\n");
+        goto LABEL_EXIT;
+    }
+
+
+LABEL_EXIT:
+    return pTxid[0] != '\0';
+}
+
+
 static bool getraw_txstr(ucoin_tx_t *pTx, const char *txid)
 {
     bool ret = false;
@@ -1307,6 +1518,36 @@ static bool getblock_rpc(char *pJson, const char *pBlock)
 }
 
 
+/** [cURL]getblock(verbosity=2)
+ *
+ * @param[out]  pJson       応答(BLOCK_BUFFER_SIZE)
+ * @param[in]   pBlock      block hash
+ */
+static bool getblock_verbose_rpc(char *pJson, const char *pBlock)
+{
+    int retval = -1;
+    CURL *curl = curl_easy_init();
+
+    if (curl) {
+        char data[512];
+        snprintf(data, sizeof(data),
+            "{"
+                ///////////////////////////////////////////
+                M_1("jsonrpc", "1.0") M_NEXT
+                M_1("id", RPCID) M_NEXT
+
+                ///////////////////////////////////////////
+                M_1("method", "getblock") M_NEXT
+                M_QQ("params") ":[" M_QQ("%s") ", 2]"
+            "}", pBlock);
+
+        retval = rpc_proc_size(curl, pJson, BLOCK_BUFFER_SIZE, data);
+    }
+
+    return retval == 0;
+}
+
+
 static bool getblockhash_rpc(char *pJson, int BHeight)
 {
     int retval = -1;
@@ -1445,6 +1686,18 @@ static bool estimatefee_rpc(char *pJson, int nBlock)
 
 
 static int rpc_proc(CURL *curl, char *pJson, char *pData)
+{
+    return rpc_proc_size(curl, pJson, BUFFER_SIZE, pData);
+}
+
+
+/** [cURL]RPC実行
+ *
+ * @param[out]  pJson       応答(Sizeバイト)
+ * @param[in]   Size        pJsonのサイズ
+ * @param[in]   pData       要求
+ */
+static int rpc_proc_size(CURL *curl, char *pJson, size_t Size, char *pData)
 {
 #ifdef M_DBG_SHOWRPC
     DBG_PRINTF("%s\n", pData);
@@ -1463,6 +1716,7 @@ static int rpc_proc(CURL *curl, char *pJson, char *pData)
     write_result_t result;
     result.p_data = pJson;
     result.pos = 0;
+    result.size = Size;
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &result);
 
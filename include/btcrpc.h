@@ -33,6 +33,19 @@
 #define BTCRPC_ERR_ALREADY_BLOCK            (-27)
 
 
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @struct btcprc_outpoint_t
+ *  @brief  outpoint
+ */
+typedef struct {
+    uint8_t     txid[UCOIN_SZ_TXID];        ///< TXID(Little Endian)
+    uint32_t    index;                      ///< vout index
+} btcprc_outpoint_t;
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
@@ -97,6 +110,16 @@ bool btcprc_get_short_channel_param(int *pBHeight, int *pBIndex, const uint8_t *
 bool btcprc_is_short_channel_unspent(int BHeight, int BIndex, int VIndex);
 
 
+/** [bitcoin rpc]short_channel_idパラメータからTXID取得
+ *
+ * @param[out]  pTxid       TXID
+ * @param[in]   BHeight     block height
+ * @param[in]   BIndex      block index
+ * @retval  true        取得成功
+ */
+bool btcprc_get_short_channel_txid(uint8_t *pTxid, int BHeight, int BIndex);
+
+
 /** [bitcoin rpc]blockからvin[0]が一致するtransactionを検索
  *
  * @param[out]  pTx         トランザクション情報
@@ -119,6 +142,20 @@ bool btcprc_search_txid_block(ucoin_tx_t *pTx, int BHeight, const uint8_t *pTxid
 bool btcprc_search_vout_block(ucoin_buf_t *pTxBuf, int BHeight, const ucoin_buf_t *pVout);
 
 
+/** [bitcoin rpc]blockのtransactionが使用したoutpoint一覧取得
+ *
+ * @param[out]  pSpent      #btcprc_outpoint_t の配列(coinbaseは含まない)
+ * @param[in]   BHeight     block height
+ * @retval  true        取得成功
+ * @note
+ *      - pSpentは使用後 #ucoin_buf_free()で解放すること
+ *      - getblockのverbosity=2を使う(bitcoind v0.15以降)
+ *      - block取得と解析の間は、他のRPCを待たせない
+ *      - blockの応答用バッファは #btcprc_init()で確保したものを使う(同時に1つだけ取得する)
+ */
+bool btcprc_getblock_spent(ucoin_buf_t *pSpent, int BHeight);
+
+
 bool btcprc_signraw_tx(ucoin_tx_t *pTx, const uint8_t *pData, size_t Len);
 
 
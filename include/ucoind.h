@@ -242,6 +242,7 @@ typedef struct {
     uint64_t        htlc_minimum_msat;              ///< 8:  htlc_minimum_msat
     uint32_t        fee_base_msat;                  ///< 4:  fee_base_msat
     uint32_t        fee_prop_millionths;            ///< 4:  fee_proportional_millionths
+    uint32_t        gossip_rate;                    ///< 4:  接続先ごとのannouncement送信帯域[byte/sec](0:デフォルト)
 } anno_conf_t;
 
 
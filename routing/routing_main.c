@@ -31,12 +31,22 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "ln.h"
 #include "ln_db.h"
 #include "ln_db_lmdb.h"
 
 #include "misc.h"
+#include "cJSON.h"
 
 
 /**************************************************************************
@@ -51,11 +61,85 @@
 
 #define OPT_SENDER                          (0x01)  // -s指定あり
 #define OPT_RECVER                          (0x02)  // -r指定あり
+#define OPT_BATCH                           (0x04)  // -i指定あり
+#define OPT_DAEMON                          (0x08)  // -u指定あり
 #define OPT_CLEARSDB                        (0x40)  // clear skip db
 #define OPT_HELP                            (0x80)  // help
 
 
+#define M_BATCH_QUEUE                       (256)   // batch処理の待ち行列数
+#define M_BATCH_THREAD_MAX                  (64)    // batch処理のthread数上限
+#define M_BATCH_LINE                        (512)   // batch入力1行の最大長
+
+#define M_DAEMON_CLIENT_MAX                 (16)    // daemonの同時接続数
+#define M_DAEMON_LINE                       (1024)  // daemon要求1行の最大長
+#define M_DAEMON_RESULT                     (4096)  // daemon応答の最大長
+#define M_DAEMON_POLL_MSEC                  (1000)  // graph更新の確認周期[msec]
+#define M_DAEMON_DB_RELOAD_SEC              (30)    // DBからgraphを差分更新する最短間隔[sec]
+#define M_DAEMON_SEND_MSEC                  (1000)  // daemon応答の送信待ち上限[msec]
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct query_t
+ *  @brief  batch処理の経路計算要求
+ */
+typedef struct {
+    uint32_t            id;                     ///< 入力の行番号
+    uint8_t             payer[UCOIN_SZ_PUBKEY];
+    uint8_t             payee[UCOIN_SZ_PUBKEY];
+    uint64_t            amount_msat;
+    uint32_t            cltv_expiry;
+} query_t;
+
+
+/** @struct batch_t
+ *  @brief  batch処理の待ち行列
+ */
+typedef struct {
+    query_t             queue[M_BATCH_QUEUE];
+    int                 head;                   ///< 次に取り出す位置
+    int                 num;                    ///< 待ち数
+    bool                end;                    ///< true:入力終了
+    pthread_mutex_t     mux;
+    pthread_cond_t      cond_get;               ///< 追加 or 入力終了
+    pthread_cond_t      cond_put;               ///< 空きあり
+    pthread_mutex_t     mux_out;                ///< 結果出力
+    const ln_routing_param_t    *p_param;
+} batch_t;
+
+
+/** @struct client_t
+ *  @brief  daemonの接続
+ */
+typedef struct {
+    int                 fd;                     ///< -1:未使用
+    size_t              len;                    ///< 受信済み長
+    char                buf[M_DAEMON_LINE];     ///< 受信中の要求
+} client_t;
+
+
+/** @struct daemon_t
+ *  @brief  daemonのgraph更新監視
+ */
+typedef struct {
+    const char          *p_snappath;            ///< snapshotファイル(NULL:使わない)
+    bool                snapshot;               ///< true:snapshotからgraph構築中
+    struct stat         snap_stat;              ///< 読み込んだsnapshotの情報
+    MDB_env             *p_db_node;             ///< DB(snapshotを使わない場合に監視)
+    size_t              db_txnid;               ///< graph構築時のDBのtransaction id
+    time_t              db_load;                ///< DBからgraph構築した時間
+} daemon_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
 static FILE *fp_err;
+static volatile sig_atomic_t mDaemonLoop;
 
 
 /********************************************************************
@@ -65,6 +149,22 @@ static FILE *fp_err;
 void ln_lmdb_setenv(MDB_env *p_env, MDB_env *p_anno);
 
 
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static int batch_exec(const char *pFile, int ThreadNum, uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_param_t *pParam);
+static void *batch_thread(void *pArg);
+static bool batch_get(batch_t *pBatch, query_t *pQuery);
+static void batch_put(batch_t *pBatch, const query_t *pQuery);
+static void batch_print(const query_t *pQuery, const char *pResult, lnerr_route_t Err, const ln_routing_result_t *pRoute);
+static int daemon_exec(const char *pSockPath, daemon_t *pDaemon, const uint8_t *pMyNodeId, uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_param_t *pParam);
+static void daemon_refresh(daemon_t *pDaemon);
+static bool daemon_request(int Fd, const char *pReq, const uint8_t *pMyNodeId, uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_param_t *pParam);
+static bool daemon_send(int Fd, const char *pData, size_t Len);
+static void daemon_stop(int Sig);
+
+
 /********************************************************************
  * main entry
  ********************************************************************/
@@ -81,12 +181,20 @@ int main(int argc, char* argv[])
     uint32_t cltv_expiry = LN_MIN_FINAL_CLTV_EXPIRY;
     uint64_t amtmsat = 0;
     bool output_json = false;
+    bool use_snapshot = true;
     char *payment_hash = NULL;
     char *dbdir = strdup(LNDB_DBDIR);
+    char *batch_file = NULL;
+    char *sock_path = NULL;
+    int thread_num = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    ln_routing_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.weight = LN_ROUTING_WEIGHT_AMOUNT;
 
     int opt;
     int options = 0;
-    while ((opt = getopt(argc, argv, "hd:s:r:a:e:p:jc")) != -1) {
+    while ((opt = getopt(argc, argv, "hd:s:r:a:e:p:f:l:bni:t:u:jc")) != -1) {
         switch (opt) {
         case 'd':
             //db directory
@@ -128,6 +236,43 @@ int main(int argc, char* argv[])
             //payment_hash
             payment_hash = strdup(optarg);
             break;
+        case 'f':
+            //max fee
+            errno = 0;
+            param.max_fee_msat = (uint64_t)strtoull(optarg, NULL, 10);
+            if (errno) {
+                fprintf(fp_err, "errno=%s\n", strerror(errno));
+                return -1;
+            }
+            break;
+        case 'l':
+            //max cltv_expiry_delta
+            param.max_cltv_delta = (uint32_t)atoi(optarg);
+            break;
+        case 'b':
+            //base fee weight(旧方式)
+            param.weight = LN_ROUTING_WEIGHT_BASEFEE;
+            break;
+        case 'n':
+            //snapshotを使わない
+            use_snapshot = false;
+            break;
+        case 'i':
+            //batch input
+            free(batch_file);
+            batch_file = strdup(optarg);
+            options |= OPT_BATCH;
+            break;
+        case 't':
+            //batch thread数
+            thread_num = atoi(optarg);
+            break;
+        case 'u':
+            //daemon
+            free(sock_path);
+            sock_path = strdup(optarg);
+            options |= OPT_DAEMON;
+            break;
         case 'j':
             //JSON
             output_json = true;
@@ -146,19 +291,43 @@ int main(int argc, char* argv[])
 
     if ((options == 0) || (options & OPT_HELP)) {
         fprintf(fp_err, "usage:");
-        fprintf(fp_err, "\t%s -s PAYER_NODEID -r PAYEE_NODEID [-d DB_DIR] [-a AMOUNT_MSAT] [-e MIN_FINAL_CLTV_EXPIRY] [-p PAYMENT_HASH] [-j] [-c]\n", argv[0]);
+        fprintf(fp_err, "\t%s -s PAYER_NODEID -r PAYEE_NODEID [-d DB_DIR] [-a AMOUNT_MSAT] [-e MIN_FINAL_CLTV_EXPIRY] [-p PAYMENT_HASH] [-f MAX_FEE_MSAT] [-l MAX_CLTV_DELTA] [-b] [-n] [-j] [-c]\n", argv[0]);
+        fprintf(fp_err, "\t%s -i QUERY_FILE [-t THREADS] [-d DB_DIR] [-a AMOUNT_MSAT] [-e MIN_FINAL_CLTV_EXPIRY] [-f MAX_FEE_MSAT] [-l MAX_CLTV_DELTA] [-b] [-n]\n", argv[0]);
+        fprintf(fp_err, "\t%s -u SOCKET_PATH [-d DB_DIR] [-a AMOUNT_MSAT] [-e MIN_FINAL_CLTV_EXPIRY] [-f MAX_FEE_MSAT] [-l MAX_CLTV_DELTA] [-b] [-n]\n", argv[0]);
         fprintf(fp_err, "\t\t-s : sender(payer) node_id\n");
         fprintf(fp_err, "\t\t-r : receiver(payee) node_id\n");
         fprintf(fp_err, "\t\t-d : db directory\n");
         fprintf(fp_err, "\t\t-a : amount_msat\n");
         fprintf(fp_err, "\t\t-e : min_final_cltv_expiry\n");
         fprintf(fp_err, "\t\t-p : payment_hash\n");
+        fprintf(fp_err, "\t\t-f : max fee_msat(default: no limit)\n");
+        fprintf(fp_err, "\t\t-l : max total cltv_expiry_delta(default: no limit)\n");
+        fprintf(fp_err, "\t\t-b : weight by fee_base_msat only(old behavior)\n");
+        fprintf(fp_err, "\t\t-n : build graph from DB(default: use ucoind graph snapshot if exists)\n");
+        fprintf(fp_err, "\t\t-i : batch mode. read \"PAYER_NODEID PAYEE_NODEID [AMOUNT_MSAT [MIN_FINAL_CLTV_EXPIRY]]\" lines(\"-\": stdin)\n");
+        fprintf(fp_err, "\t\t-t : batch mode thread num(default: CPU num)\n");
+        fprintf(fp_err, "\t\t-u : daemon mode. answer JSON requests on unix domain socket SOCKET_PATH\n");
         fprintf(fp_err, "\t\t-j : output JSON format(default: CSV format)\n");
         fprintf(fp_err, "\t\t-c : clear routing skip channel list\n");
         return -1;
     }
 
-    if ((options & OPT_CLEARSDB) == 0) {
+    if (options & OPT_DAEMON) {
+        if (options != OPT_DAEMON) {
+            fprintf(fp_err, "fail: -u cannot be used with -s, -r, -i or -c\n");
+            return -2;
+        }
+    } else if (options & OPT_BATCH) {
+        if (options != OPT_BATCH) {
+            fprintf(fp_err, "fail: -i cannot be used with -s, -r or -c\n");
+            return -2;
+        }
+        if (thread_num < 1) {
+            thread_num = 1;
+        } else if (thread_num > M_BATCH_THREAD_MAX) {
+            thread_num = M_BATCH_THREAD_MAX;
+        }
+    } else if ((options & OPT_CLEARSDB) == 0) {
         if (options != (OPT_SENDER | OPT_RECVER)) {
             fprintf(fp_err, "fail: need -s and -r\n");
             return -2;
@@ -187,6 +356,7 @@ int main(int argc, char* argv[])
     MDB_env     *pDbNode = NULL;
     char        selfpath[256];
     char        nodepath[256];
+    char        snappath[256];
 
     strcpy(selfpath, dbdir);
     size_t len = strlen(selfpath);
@@ -194,8 +364,10 @@ int main(int argc, char* argv[])
         selfpath[len - 1] = '\0';
     }
     strcpy(nodepath, selfpath);
+    strcpy(snappath, selfpath);
     strcat(selfpath, LNDB_SELFENV_DIR);
     strcat(nodepath, LNDB_NODEENV_DIR);
+    strcat(snappath, LNDB_GRAPH_SNAPSHOT_FILE);
 
     ret = mdb_env_create(&pDbSelf);
     assert(ret == 0);
@@ -240,10 +412,29 @@ int main(int argc, char* argv[])
         return -8;
     }
 
-    if ((options & OPT_CLEARSDB) == 0) {
+    bool snap_loaded = false;
+    if (use_snapshot && ((options & OPT_CLEARSDB) == 0)) {
+        //ucoindが保存したgraphがあれば使う(無ければDBから構築する)
+        snap_loaded = ln_routing_snapshot_load(snappath);
+    }
+
+    if (options & OPT_DAEMON) {
+        daemon_t mon;
+        memset(&mon, 0, sizeof(mon));
+        mon.p_snappath = (use_snapshot) ? snappath : NULL;
+        mon.snapshot = snap_loaded && (stat(snappath, &mon.snap_stat) == 0);
+        mon.p_db_node = pDbNode;
+        ret = daemon_exec(sock_path, &mon, my_nodeid, cltv_expiry, amtmsat, &param);
+        free(sock_path);
+        free(dbdir);
+    } else if (options & OPT_BATCH) {
+        ret = batch_exec(batch_file, thread_num, cltv_expiry, amtmsat, &param);
+        free(batch_file);
+        free(dbdir);
+    } else if ((options & OPT_CLEARSDB) == 0) {
         ln_routing_result_t result;
         lnerr_route_t rerr = ln_routing_calculate(&result, send_nodeid,
-                    recv_nodeid, cltv_expiry, amtmsat, 0, NULL);
+                    recv_nodeid, cltv_expiry, amtmsat, 0, NULL, &param);
         if (rerr == LNROUTE_NONE) {
             //pay.conf形式の出力
             if (payment_hash == NULL) {
@@ -295,3 +486,561 @@ int main(int argc, char* argv[])
 
     return ret;
 }
+
+
+/********************************************************************
+ * batch
+ ********************************************************************/
+
+/** batch処理
+ *
+ * graphを固定して、入力を読みながら複数threadで経路計算する。
+ * 結果は計算が終わった順に1行1JSONで出力する(順番は入力の"id"で対応をとる)。
+ *
+ * @param[in]   pFile           入力ファイル("-":stdin)
+ * @param[in]   ThreadNum       thread数
+ * @param[in]   CltvExpiry      入力で省略時のmin_final_cltv_expiry
+ * @param[in]   AmountMsat      入力で省略時のamount_msat
+ * @param[in]   pParam          探索条件
+ * @retval  0   成功
+ */
+static int batch_exec(const char *pFile, int ThreadNum, uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_param_t *pParam)
+{
+    int ret = 0;
+    FILE *fp;
+
+    if (strcmp(pFile, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(pFile, "r");
+        if (fp == NULL) {
+            fprintf(fp_err, "fail: cannot open[%s]\n", pFile);
+            return -10;
+        }
+    }
+
+    if (!ln_routing_freeze()) {
+        fprintf(fp_err, "fail: load graph\n");
+        if (fp != stdin) {
+            fclose(fp);
+        }
+        return -11;
+    }
+
+    batch_t *p_batch = (batch_t *)malloc(sizeof(batch_t));
+    memset(p_batch, 0, sizeof(batch_t));
+    pthread_mutex_init(&p_batch->mux, NULL);
+    pthread_cond_init(&p_batch->cond_get, NULL);
+    pthread_cond_init(&p_batch->cond_put, NULL);
+    pthread_mutex_init(&p_batch->mux_out, NULL);
+    p_batch->p_param = pParam;
+
+    pthread_t th[M_BATCH_THREAD_MAX];
+    int th_num;
+    for (th_num = 0; th_num < ThreadNum; th_num++) {
+        if (pthread_create(&th[th_num], NULL, batch_thread, p_batch) != 0) {
+            break;
+        }
+    }
+    if (th_num == 0) {
+        fprintf(fp_err, "fail: create thread\n");
+        ret = -12;
+        goto LABEL_EXIT;
+    }
+
+    char line[M_BATCH_LINE];
+    uint32_t id = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        id++;
+
+        char payer[M_BATCH_LINE];
+        char payee[M_BATCH_LINE];
+        query_t query;
+        query.id = id;
+        query.amount_msat = AmountMsat;
+        query.cltv_expiry = CltvExpiry;
+        if ((strchr(line, '\n') == NULL) && !feof(fp)) {
+            //長すぎる行は残りを読み捨て、1行分のエラーにする
+            int c;
+            while (((c = fgetc(fp)) != EOF) && (c != '\n')) {
+            }
+            memset(query.payer, 0, sizeof(query.payer));
+            memset(query.payee, 0, sizeof(query.payee));
+            pthread_mutex_lock(&p_batch->mux_out);
+            batch_print(&query, "too long", LNROUTE_PARAM, NULL);
+            pthread_mutex_unlock(&p_batch->mux_out);
+            continue;
+        }
+        int num = sscanf(line, "%s %s %" SCNu64 " %" SCNu32, payer, payee, &query.amount_msat, &query.cltv_expiry);
+        if ((num <= 0) || (payer[0] == '#')) {
+            //空行, comment
+            continue;
+        }
+        query.cltv_expiry += M_SHADOW_ROUTE;
+        if ((num < 2) ||
+                    !misc_str2bin(query.payer, sizeof(query.payer), payer) ||
+                    !misc_str2bin(query.payee, sizeof(query.payee), payee) ||
+                    (memcmp(query.payer, query.payee, UCOIN_SZ_PUBKEY) == 0)) {
+            memset(query.payer, 0, sizeof(query.payer));
+            memset(query.payee, 0, sizeof(query.payee));
+            pthread_mutex_lock(&p_batch->mux_out);
+            batch_print(&query, "invalid", LNROUTE_PARAM, NULL);
+            pthread_mutex_unlock(&p_batch->mux_out);
+            continue;
+        }
+        batch_put(p_batch, &query);
+    }
+
+    pthread_mutex_lock(&p_batch->mux);
+    p_batch->end = true;
+    pthread_cond_broadcast(&p_batch->cond_get);
+    pthread_mutex_unlock(&p_batch->mux);
+    for (int lp = 0; lp < th_num; lp++) {
+        pthread_join(th[lp], NULL);
+    }
+
+LABEL_EXIT:
+    pthread_mutex_destroy(&p_batch->mux);
+    pthread_cond_destroy(&p_batch->cond_get);
+    pthread_cond_destroy(&p_batch->cond_put);
+    pthread_mutex_destroy(&p_batch->mux_out);
+    free(p_batch);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return ret;
+}
+
+
+/** batch処理thread
+ *
+ */
+static void *batch_thread(void *pArg)
+{
+    batch_t *p_batch = (batch_t *)pArg;
+    query_t query;
+
+    while (batch_get(p_batch, &query)) {
+        ln_routing_result_t result;
+        lnerr_route_t rerr = ln_routing_calculate(&result, query.payer, query.payee,
+                    query.cltv_expiry, query.amount_msat, 0, NULL, p_batch->p_param);
+
+        pthread_mutex_lock(&p_batch->mux_out);
+        batch_print(&query, (rerr == LNROUTE_NONE) ? "OK" : "fail", rerr, &result);
+        pthread_mutex_unlock(&p_batch->mux_out);
+    }
+
+    return NULL;
+}
+
+
+/** batch待ち行列から取得
+ *
+ * @retval  false   入力終了
+ */
+static bool batch_get(batch_t *pBatch, query_t *pQuery)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&pBatch->mux);
+    while ((pBatch->num == 0) && !pBatch->end) {
+        pthread_cond_wait(&pBatch->cond_get, &pBatch->mux);
+    }
+    if (pBatch->num > 0) {
+        *pQuery = pBatch->queue[pBatch->head];
+        pBatch->head = (pBatch->head + 1) % M_BATCH_QUEUE;
+        pBatch->num--;
+        pthread_cond_signal(&pBatch->cond_put);
+        ret = true;
+    }
+    pthread_mutex_unlock(&pBatch->mux);
+
+    return ret;
+}
+
+
+/** batch待ち行列に追加
+ *
+ * 空きが無い場合は、取り出されるまで待つ。
+ */
+static void batch_put(batch_t *pBatch, const query_t *pQuery)
+{
+    pthread_mutex_lock(&pBatch->mux);
+    while (pBatch->num == M_BATCH_QUEUE) {
+        pthread_cond_wait(&pBatch->cond_put, &pBatch->mux);
+    }
+    pBatch->queue[(pBatch->head + pBatch->num) % M_BATCH_QUEUE] = *pQuery;
+    pBatch->num++;
+    pthread_cond_signal(&pBatch->cond_get);
+    pthread_mutex_unlock(&pBatch->mux);
+}
+
+
+/** batch結果出力
+ *
+ * @param[in]   pQuery
+ * @param[in]   pResult         "OK", "fail", "invalid", "too long"
+ * @param[in]   Err             LNROUTE_xxx
+ * @param[in]   pRoute          経路(LNROUTE_NONE時のみ使用)
+ * @note
+ *      - mux_outをlockして呼び出すこと
+ */
+static void batch_print(const query_t *pQuery, const char *pResult, lnerr_route_t Err, const ln_routing_result_t *pRoute)
+{
+    printf("{\"id\":%" PRIu32 ",\"payer\":\"", pQuery->id);
+    ucoin_util_dumpbin(stdout, pQuery->payer, UCOIN_SZ_PUBKEY, false);
+    printf("\",\"payee\":\"");
+    ucoin_util_dumpbin(stdout, pQuery->payee, UCOIN_SZ_PUBKEY, false);
+    printf("\",\"amount_msat\":%" PRIu64 ",\"cltv_expiry\":%" PRIu32 ",\"result\":\"%s\"",
+                pQuery->amount_msat, pQuery->cltv_expiry, pResult);
+    if (Err == LNROUTE_NONE) {
+        printf(",\"hop_num\":%d,\"route\":[", pRoute->hop_num);
+        for (int lp = 0; lp < pRoute->hop_num; lp++) {
+            if (lp != 0) {
+                printf(",");
+            }
+            printf("[\"");
+            ucoin_util_dumpbin(stdout, pRoute->hop_datain[lp].pubkey, UCOIN_SZ_PUBKEY, false);
+            printf("\",\"%016" PRIx64 "\",%" PRIu64 ",%" PRIu32 "]",
+                        pRoute->hop_datain[lp].short_channel_id,
+                        pRoute->hop_datain[lp].amt_to_forward,
+                        pRoute->hop_datain[lp].outgoing_cltv_value);
+        }
+        printf("]");
+    } else {
+        printf(",\"error\":%d", Err);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+/********************************************************************
+ * daemon
+ ********************************************************************/
+
+/** daemon処理
+ *
+ * graphを保持したまま、unix domain socketで受けた経路計算要求に答える。
+ * 要求、応答とも1行1JSONとする。
+ * ucoindのsnapshotが更新されたら読み直す(snapshotが無い場合は、DBが更新されたら差分を反映する)。
+ * 1つの接続が応答を受け取らなくても他の接続を止めないよう、接続はnon-blockingにする。
+ *
+ * @param[in]       pSockPath       unix domain socket
+ * @param[in,out]   pDaemon         graph更新監視
+ * @param[in]       pMyNodeId       要求でpayer省略時のnode_id
+ * @param[in]       CltvExpiry      要求で省略時のmin_final_cltv_expiry
+ * @param[in]       AmountMsat      要求で省略時のamount_msat
+ * @param[in]       pParam          探索条件
+ * @retval  0   成功
+ */
+static int daemon_exec(const char *pSockPath, daemon_t *pDaemon, const uint8_t *pMyNodeId, uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_param_t *pParam)
+{
+    //常駐するのでlandmarkを使う
+    ln_routing_param_t param = *pParam;
+    param.algo = LN_ROUTING_ALGO_ALT;
+
+    if (!ln_routing_init()) {
+        fprintf(fp_err, "fail: load graph\n");
+        return -10;
+    }
+    if (!pDaemon->snapshot) {
+        MDB_envinfo info;
+        mdb_env_info(pDaemon->p_db_node, &info);
+        pDaemon->db_txnid = info.me_last_txnid;
+        pDaemon->db_load = time(NULL);
+    }
+
+    struct sockaddr_un addr;
+    if (strlen(pSockPath) >= sizeof(addr.sun_path)) {
+        fprintf(fp_err, "fail: socket path too long\n");
+        ln_routing_term();
+        return -11;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        fprintf(fp_err, "fail: socket\n");
+        ln_routing_term();
+        return -11;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, pSockPath);
+    unlink(pSockPath);
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(sock, M_DAEMON_CLIENT_MAX) != 0)) {
+        fprintf(fp_err, "fail: bind[%s]\n", pSockPath);
+        close(sock);
+        ln_routing_term();
+        return -12;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, daemon_stop);
+    signal(SIGTERM, daemon_stop);
+
+    client_t *p_client = (client_t *)malloc(sizeof(client_t) * M_DAEMON_CLIENT_MAX);
+    for (int lp = 0; lp < M_DAEMON_CLIENT_MAX; lp++) {
+        p_client[lp].fd = -1;
+    }
+
+    mDaemonLoop = 1;
+    while (mDaemonLoop) {
+        //[0]listen, [1..]client
+        struct pollfd fds[1 + M_DAEMON_CLIENT_MAX];
+        fds[0].fd = sock;
+        fds[0].events = POLLIN;
+        for (int lp = 0; lp < M_DAEMON_CLIENT_MAX; lp++) {
+            fds[1 + lp].fd = p_client[lp].fd;
+            fds[1 + lp].events = POLLIN;
+        }
+        int num = poll(fds, 1 + M_DAEMON_CLIENT_MAX, M_DAEMON_POLL_MSEC);
+        if ((num < 0) && (errno != EINTR)) {
+            fprintf(fp_err, "fail: poll\n");
+            break;
+        }
+
+        //要求の間にgraphを更新する
+        daemon_refresh(pDaemon);
+        if (num <= 0) {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(sock, NULL, NULL);
+            if ((fd >= 0) && (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)) {
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0) {
+                int lp;
+                for (lp = 0; lp < M_DAEMON_CLIENT_MAX; lp++) {
+                    if (p_client[lp].fd == -1) {
+                        p_client[lp].fd = fd;
+                        p_client[lp].len = 0;
+                        break;
+                    }
+                }
+                if (lp == M_DAEMON_CLIENT_MAX) {
+                    //接続数オーバー
+                    close(fd);
+                }
+            }
+        }
+        for (int lp = 0; lp < M_DAEMON_CLIENT_MAX; lp++) {
+            client_t *p_cl = &p_client[lp];
+            if ((p_cl->fd == -1) || ((fds[1 + lp].revents & (POLLIN | POLLHUP | POLLERR)) == 0)) {
+                continue;
+            }
+            ssize_t sz = read(p_cl->fd, p_cl->buf + p_cl->len, sizeof(p_cl->buf) - 1 - p_cl->len);
+            if ((sz < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+                continue;
+            }
+            if (sz <= 0) {
+                close(p_cl->fd);
+                p_cl->fd = -1;
+                continue;
+            }
+            p_cl->len += sz;
+            p_cl->buf[p_cl->len] = '\0';
+
+            //改行までを1要求とする
+            char *p_line = p_cl->buf;
+            char *p_lf;
+            bool ret = true;
+            while (ret && ((p_lf = strchr(p_line, '\n')) != NULL)) {
+                *p_lf = '\0';
+                ret = daemon_request(p_cl->fd, p_line, pMyNodeId, CltvExpiry, AmountMsat, &param);
+                p_line = p_lf + 1;
+            }
+            if (!ret) {
+                //応答を受け取らない
+                close(p_cl->fd);
+                p_cl->fd = -1;
+                continue;
+            }
+            p_cl->len = strlen(p_line);
+            memmove(p_cl->buf, p_line, p_cl->len);
+            if (p_cl->len == sizeof(p_cl->buf) - 1) {
+                //長すぎる要求
+                close(p_cl->fd);
+                p_cl->fd = -1;
+            }
+        }
+    }
+
+    for (int lp = 0; lp < M_DAEMON_CLIENT_MAX; lp++) {
+        if (p_client[lp].fd != -1) {
+            close(p_client[lp].fd);
+        }
+    }
+    free(p_client);
+    close(sock);
+    unlink(pSockPath);
+    ln_routing_term();
+
+    return 0;
+}
+
+
+/** graph更新確認
+ *
+ * snapshotが置き換わっていたら読み直す。
+ * snapshotを使っていない場合は、DBが更新されていればM_DAEMON_DB_RELOAD_SEC間隔で差分を反映する。
+ */
+static void daemon_refresh(daemon_t *pDaemon)
+{
+    struct stat st;
+    if ((pDaemon->p_snappath != NULL) && (stat(pDaemon->p_snappath, &st) == 0)) {
+        //ucoindはgraphに変更が無いとheaderだけ書き換えるので、mtimeは見ない
+        if (!pDaemon->snapshot ||
+                    (st.st_ino != pDaemon->snap_stat.st_ino) || (st.st_size != pDaemon->snap_stat.st_size)) {
+            if (ln_routing_snapshot_load(pDaemon->p_snappath)) {
+                pDaemon->snapshot = true;
+                pDaemon->snap_stat = st;
+            }
+        }
+        if (pDaemon->snapshot) {
+            return;
+        }
+    }
+
+    MDB_envinfo info;
+    mdb_env_info(pDaemon->p_db_node, &info);
+    if ((info.me_last_txnid != pDaemon->db_txnid) && (time(NULL) - pDaemon->db_load >= M_DAEMON_DB_RELOAD_SEC)) {
+        //snapshotから構築していた場合は、DBから構築し直される
+        ln_routing_refresh();
+        pDaemon->snapshot = false;
+        pDaemon->db_txnid = info.me_last_txnid;
+        pDaemon->db_load = time(NULL);
+    }
+}
+
+
+/** daemon要求処理
+ *
+ * 要求: {"payee":"NODEID", "payer":"NODEID", "amount_msat":AMOUNT, "min_final_cltv_expiry":CLTV, "payment_hash":"HASH"}
+ *      - payee以外は省略可能(payer省略時はDBのnode_id)
+ * 応答: -j と同じ形式(改行なし)。失敗時は {"error":"MESSAGE","code":LNROUTE_xxx}
+ *
+ * @retval  true    応答送信成功
+ */
+static bool daemon_request(int Fd, const char *pReq, const uint8_t *pMyNodeId, uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_param_t *pParam)
+{
+    char result[M_DAEMON_RESULT];
+    uint8_t payer[UCOIN_SZ_PUBKEY];
+    uint8_t payee[UCOIN_SZ_PUBKEY];
+    const char *p_hash = "";
+    lnerr_route_t rerr = LNROUTE_PARAM;
+    ln_routing_result_t route;
+
+    memcpy(payer, pMyNodeId, UCOIN_SZ_PUBKEY);
+    cJSON *json = cJSON_Parse(pReq);
+    if (json == NULL) {
+        snprintf(result, sizeof(result), "{\"error\":\"invalid JSON\",\"code\":%d}\n", rerr);
+        goto LABEL_EXIT;
+    }
+
+    cJSON *item = cJSON_GetObjectItem(json, "payee");
+    if ((item == NULL) || (item->type != cJSON_String) || !misc_str2bin(payee, sizeof(payee), item->valuestring)) {
+        snprintf(result, sizeof(result), "{\"error\":\"invalid payee\",\"code\":%d}\n", rerr);
+        goto LABEL_EXIT;
+    }
+    item = cJSON_GetObjectItem(json, "payer");
+    if ((item != NULL) && ((item->type != cJSON_String) || !misc_str2bin(payer, sizeof(payer), item->valuestring))) {
+        snprintf(result, sizeof(result), "{\"error\":\"invalid payer\",\"code\":%d}\n", rerr);
+        goto LABEL_EXIT;
+    }
+    if (memcmp(payer, payee, UCOIN_SZ_PUBKEY) == 0) {
+        snprintf(result, sizeof(result), "{\"error\":\"same payer and payee\",\"code\":%d}\n", rerr);
+        goto LABEL_EXIT;
+    }
+    item = cJSON_GetObjectItem(json, "amount_msat");
+    if ((item != NULL) && (item->type == cJSON_Number)) {
+        AmountMsat = (uint64_t)item->valuedouble;
+    }
+    item = cJSON_GetObjectItem(json, "min_final_cltv_expiry");
+    if ((item != NULL) && (item->type == cJSON_Number)) {
+        CltvExpiry = (uint32_t)item->valueint + M_SHADOW_ROUTE;
+    }
+    item = cJSON_GetObjectItem(json, "payment_hash");
+    if ((item != NULL) && (item->type == cJSON_String) && (strlen(item->valuestring) == LN_SZ_HASH * 2)) {
+        p_hash = item->valuestring;
+    }
+
+    rerr = ln_routing_calculate(&route, payer, payee, CltvExpiry, AmountMsat, 0, NULL, pParam);
+    if (rerr != LNROUTE_NONE) {
+        snprintf(result, sizeof(result), "{\"error\":\"fail\",\"code\":%d}\n", rerr);
+        goto LABEL_EXIT;
+    }
+
+    //-jと同じ形式
+    int len = snprintf(result, sizeof(result), "{\"method\":\"PAY\",\"params\":[\"%s\",%d, [", p_hash, route.hop_num);
+    for (int lp = 0; lp < route.hop_num; lp++) {
+        char node_id[UCOIN_SZ_PUBKEY * 2 + 1];
+        misc_bin2str(node_id, route.hop_datain[lp].pubkey, UCOIN_SZ_PUBKEY);
+        len += snprintf(result + len, sizeof(result) - len, "%s[\"%s\",\"%016" PRIx64 "\",%" PRIu64 ",%" PRIu32 "]",
+                    (lp != 0) ? "," : "", node_id,
+                    route.hop_datain[lp].short_channel_id,
+                    route.hop_datain[lp].amt_to_forward,
+                    route.hop_datain[lp].outgoing_cltv_value);
+    }
+    snprintf(result + len, sizeof(result) - len, "]]}\n");
+
+LABEL_EXIT:
+    if (json != NULL) {
+        cJSON_Delete(json);
+    }
+
+    return daemon_send(Fd, result, strlen(result));
+}
+
+
+/** daemon応答送信
+ *
+ * 送信できるまで最大M_DAEMON_SEND_MSEC待つ。
+ *
+ * @retval  true    全て送信した
+ */
+static bool daemon_send(int Fd, const char *pData, size_t Len)
+{
+    size_t pos = 0;
+    int wait_msec = M_DAEMON_SEND_MSEC;
+    while (pos < Len) {
+        ssize_t sz = write(Fd, pData + pos, Len - pos);
+        if (sz > 0) {
+            pos += sz;
+            continue;
+        }
+        if ((sz < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if ((sz == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+            return false;
+        }
+
+        struct pollfd fds;
+        fds.fd = Fd;
+        fds.events = POLLOUT;
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int num = poll(&fds, 1, wait_msec);
+        if ((num < 0) && (errno != EINTR)) {
+            return false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        wait_msec -= (int)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+        if ((num == 0) || (wait_msec <= 0)) {
+            fprintf(fp_err, "fail: send timeout\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static void daemon_stop(int Sig)
+{
+    (void)Sig;
+    mDaemonLoop = 0;
+}
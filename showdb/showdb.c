@@ -470,14 +470,42 @@ static void dumpit_annoinfo(MDB_txn *txn, MDB_dbi dbi, ln_lmdb_dbtype_t dbtype)
         }
         ucoin_util_dumpbin(stdout, key.mv_data, len, true);
 
-        int nums = data.mv_size / UCOIN_SZ_PUBKEY;
+        //peer index bitmap
         const uint8_t *p_data = (const uint8_t *)data.mv_data;
-        for (int lp = 0; lp < nums; lp++) {
-            printf("  [%2d]", lp);
-            ucoin_util_dumpbin(stdout, p_data, UCOIN_SZ_PUBKEY, true);
-            p_data += UCOIN_SZ_PUBKEY;
+        printf("  peer index:");
+        for (size_t lp = 0; lp < data.mv_size * 8; lp++) {
+            if (p_data[lp / 8] & (1 << (lp % 8))) {
+                printf(" %d", (int)lp);
+            }
         }
-        printf("\n");
+        printf("\n\n");
+    }
+    mdb_cursor_close(cursor);
+}
+
+static void dumpit_peeridx(MDB_txn *txn, MDB_dbi dbi)
+{
+    if ((showflag & SHOW_ANNOINFO) == 0) {
+        return;
+    }
+
+    MDB_cursor  *cursor;
+
+    int retval = mdb_cursor_open(txn, dbi, &cursor);
+    if (retval != 0) {
+        fprintf(stderr, "cursor_open: %d\n", __LINE__);
+        exit(-1);
+    }
+
+    MDB_val key, data;
+    while ((retval = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP)) == 0) {
+        uint16_t idx;
+        if ((key.mv_size != UCOIN_SZ_PUBKEY) || (data.mv_size != sizeof(idx))) {
+            continue;
+        }
+        memcpy(&idx, data.mv_data, sizeof(idx));
+        printf("peer index[%2d]: ", idx);
+        ucoin_util_dumpbin(stdout, key.mv_data, key.mv_size, true);
     }
     mdb_cursor_close(cursor);
 }
@@ -822,6 +850,9 @@ int main(int argc, char *argv[])
                 case LN_LMDB_DBTYPE_NODE_ANNOINFO:
                     dumpit_annoinfo(txn, dbi2, dbtype);
                     break;
+                case LN_LMDB_DBTYPE_PEER_INDEX:
+                    dumpit_peeridx(txn, dbi2);
+                    break;
                 case LN_LMDB_DBTYPE_ANNO_SKIP:
                     dumpit_annoskip(txn, dbi2);
                     break;
@@ -14,6 +14,8 @@ extern "C" {
 #include "ucoin_sw.c"
 #include "ucoin_tx.c"
 #include "ucoin_util.c"
+#include "ucoin_ecc_mbedtls.c"
+#include "ucoin_ecc_secp256k1.c"
 #include "ln.c"
 #include "ln_derkey.c"
 #include "ln_misc.c"
@@ -27,8 +29,15 @@ extern "C" {
 #include "ln_script.c"
 #include "ln_enc_auth.c"
 #include "ln_signer.c"
+#include "ln_db_cnlidx.c"
+#include "ln_db_gossip.c"
+#include "ln_db_prune.c"
 #include "bech32/segwit_addr.c"
+
+//ucoind
+#include "unspent.c"
 }
+#include "routing/ln_routing.cpp"
 
 ////////////////////////////////////////////////////////////////////////
 //FAKE関数
@@ -101,5 +110,11 @@ TEST_F(ucoin, ucoin_setnet_mainnet)
 #include "testinc_ln_bolt4.cpp"
 #include "testinc_ln_bolt8.cpp"
 #include "testinc_ln_misc.cpp"
+#include "testinc_ln_msg_anno.cpp"
+#include "testinc_ln_routing.cpp"
+#include "testinc_ln_db_cnlidx.cpp"
+#include "testinc_ln_db_gossip.cpp"
+#include "testinc_ln_db_prune.cpp"
+#include "testinc_unspent.cpp"
 #include "testinc_recoverpub.cpp"
 #include "testinc_bech32.cpp"
\ No newline at end of file
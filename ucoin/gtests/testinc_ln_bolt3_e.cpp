@@ -25,6 +25,36 @@ public:
         }
         printf("\n");
     }
+
+    //mbedtlsで計算したpPubKey * pMul(pPubKey==NULL時は生成元)
+    //  UCOIN_USE_SECP256K1定義時は、libsecp256k1 backendとの比較に使う
+    static bool MbedtlsMul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul)
+    {
+        mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+        mbedtls_ecp_point pub;
+        mbedtls_ecp_point pnt;
+        mbedtls_mpi m;
+        size_t sz;
+
+        mbedtls_ecp_point_init(&pub);
+        mbedtls_ecp_point_init(&pnt);
+        mbedtls_mpi_init(&m);
+        int ret = (pPubKey != NULL) ? ucoin_util_ecp_point_read_binary2(&pub, pPubKey) :
+                                      mbedtls_ecp_copy(&pub, &p_grp->G);
+        if (ret == 0) {
+            ret = mbedtls_mpi_read_binary(&m, pMul, UCOIN_SZ_PRIVKEY);
+        }
+        if (ret == 0) {
+            ret = mbedtls_ecp_mul(p_grp, &pnt, &m, &pub, NULL, NULL);
+        }
+        if (ret == 0) {
+            ret = mbedtls_ecp_point_write_binary(p_grp, &pnt, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, UCOIN_SZ_PUBKEY);
+        }
+        mbedtls_mpi_free(&m);
+        mbedtls_ecp_point_free(&pnt);
+        mbedtls_ecp_point_free(&pub);
+        return ret == 0;
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -133,3 +163,53 @@ TEST_F(ln_derkey, revoprivkey)
     };
     ASSERT_EQ(0, memcmp(LOCALKEY, privkey, sizeof(LOCALKEY)));
 }
+
+
+////////////////////////////////////////////////////////////////////////
+//ECC backend(ucoin_ecc_priv2pub / ucoin_ecc_mul_pubkey)
+
+TEST_F(ln_derkey, ecc_priv2pub)
+{
+    uint8_t pub[UCOIN_SZ_PUBKEY];
+    uint8_t ref[UCOIN_SZ_PUBKEY];
+
+    ASSERT_TRUE(ucoin_keys_priv2pub(pub, BASE_SECRET));
+    ASSERT_EQ(0, memcmp(BASE_POINT, pub, sizeof(BASE_POINT)));
+    ASSERT_TRUE(MbedtlsMul(ref, NULL, BASE_SECRET));
+    ASSERT_EQ(0, memcmp(ref, pub, sizeof(ref)));
+
+    ASSERT_TRUE(ucoin_keys_priv2pub(pub, PER_COMMIT_SECRET));
+    ASSERT_EQ(0, memcmp(PER_COMMITMENT_POINT, pub, sizeof(PER_COMMITMENT_POINT)));
+    ASSERT_TRUE(MbedtlsMul(ref, NULL, PER_COMMIT_SECRET));
+    ASSERT_EQ(0, memcmp(ref, pub, sizeof(ref)));
+
+    //localprivkey --> localpubkey
+    uint8_t localprivkey[UCOIN_SZ_PRIVKEY];
+    uint8_t localkey[UCOIN_SZ_PUBKEY];
+    ASSERT_TRUE(ln_derkey_privkey(localprivkey, BASE_POINT, PER_COMMITMENT_POINT, BASE_SECRET));
+    ASSERT_TRUE(ln_derkey_pubkey(localkey, BASE_POINT, PER_COMMITMENT_POINT));
+    ASSERT_TRUE(ucoin_keys_priv2pub(pub, localprivkey));
+    ASSERT_EQ(0, memcmp(localkey, pub, sizeof(localkey)));
+}
+
+
+TEST_F(ln_derkey, ecc_mul_pubkey)
+{
+    uint8_t ecdh1[UCOIN_SZ_PUBKEY];
+    uint8_t ecdh2[UCOIN_SZ_PUBKEY];
+    uint8_t ref[UCOIN_SZ_PUBKEY];
+
+    //per_commitment_point * base_secret == base_point * per_commitment_secret
+    ASSERT_TRUE(ucoin_util_mul_pubkey(ecdh1, PER_COMMITMENT_POINT, BASE_SECRET, UCOIN_SZ_PRIVKEY));
+    ASSERT_TRUE(ucoin_util_mul_pubkey(ecdh2, BASE_POINT, PER_COMMIT_SECRET, UCOIN_SZ_PRIVKEY));
+    ASSERT_EQ(0, memcmp(ecdh1, ecdh2, sizeof(ecdh1)));
+    ASSERT_TRUE(MbedtlsMul(ref, PER_COMMITMENT_POINT, BASE_SECRET));
+    ASSERT_EQ(0, memcmp(ref, ecdh1, sizeof(ref)));
+
+    //shared secret = SHA256(ECDH)
+    uint8_t ss1[UCOIN_SZ_HASH256];
+    uint8_t ss2[UCOIN_SZ_HASH256];
+    ucoin_util_generate_shared_secret(ss1, PER_COMMITMENT_POINT, BASE_SECRET);
+    ucoin_util_sha256(ss2, ref, sizeof(ref));
+    ASSERT_EQ(0, memcmp(ss2, ss1, sizeof(ss1)));
+}
@@ -1656,3 +1656,68 @@ TEST_F(onion, test4)
     }
 }
 
+
+
+//LN_HOP_MAX hopで、ephemeral key/shared secret/blinding factorが
+//BOLT#4の定義どおり(hopごとに前までのblinding factorを全部掛ける)に計算した値と一致するか
+TEST_F(onion, create_packet_hop_max)
+{
+    uint8_t session_key[UCOIN_SZ_PRIVKEY];
+    uint8_t onion_privkey[LN_HOP_MAX][UCOIN_SZ_PRIVKEY];
+    ln_hop_datain_t datain[LN_HOP_MAX];
+    uint8_t packet[LN_SZ_ONION_ROUTE];
+
+    memset(session_key, 'A', sizeof(session_key));
+    for (int lp = 0; lp < LN_HOP_MAX; lp++) {
+        datain[lp].short_channel_id = (uint64_t)lp;
+        datain[lp].amt_to_forward = (uint64_t)lp << 32 | lp;
+        datain[lp].outgoing_cltv_value = lp;
+        memset(onion_privkey[lp], lp + 1, UCOIN_SZ_PRIVKEY);
+        ucoin_keys_priv2pub(datain[lp].pubkey, onion_privkey[lp]);
+    }
+
+    bool ret = ln_onion_create_packet(packet, NULL, datain, LN_HOP_MAX, session_key, NULL, 0);
+    ASSERT_TRUE(ret);
+
+    uint8_t eph_pubkey[UCOIN_SZ_PUBKEY];
+    uint8_t shd_secret[M_SZ_SHARED_SECRET];
+    uint8_t blind_factors[M_SZ_BLINDING_FACT * LN_HOP_MAX];
+
+    ucoin_keys_priv2pub(eph_pubkey, session_key);
+    for (int lp = 0; lp < LN_HOP_MAX; lp++) {
+        if (lp > 0) {
+            //eph_pubkey[lp-1] * blind_factors[lp-1]
+            ASSERT_TRUE(blind_group_element(eph_pubkey, eph_pubkey, blind_factors + M_SZ_BLINDING_FACT * (lp - 1)));
+        }
+
+        //SHA256(paymentPath[lp] * session_key * blind_factors[0] * ... * blind_factors[lp-1])
+        uint8_t pub[UCOIN_SZ_PUBKEY];
+        ASSERT_TRUE(blind_group_element(pub, datain[lp].pubkey, session_key));
+        for (int lp2 = 0; lp2 < lp; lp2++) {
+            ASSERT_TRUE(blind_group_element(pub, pub, blind_factors + M_SZ_BLINDING_FACT * lp2));
+        }
+        ucoin_util_sha256(shd_secret, pub, sizeof(pub));
+
+        compute_blinding_factor(blind_factors + M_SZ_BLINDING_FACT * lp, eph_pubkey, shd_secret);
+
+        ASSERT_EQ(0, memcmp(eph_pubkey, spEphPubkey + UCOIN_SZ_PUBKEY * lp, UCOIN_SZ_PUBKEY)) << "hop " << lp;
+        ASSERT_EQ(0, memcmp(shd_secret, spShdSecret + M_SZ_SHARED_SECRET * lp, M_SZ_SHARED_SECRET)) << "hop " << lp;
+        ASSERT_EQ(0, memcmp(blind_factors + M_SZ_BLINDING_FACT * lp, spBlindFactor + M_SZ_BLINDING_FACT * lp, M_SZ_BLINDING_FACT)) << "hop " << lp;
+    }
+
+    //全hopで読める
+    ln_hop_dataout_t dataout;
+    for (int lp = 0; lp < LN_HOP_MAX; lp++) {
+        ln_node_setkey(onion_privkey[lp]);
+        ucoin_buf_t buf_rsn = UCOIN_BUF_INIT;
+        ucoin_push_t push_rsn;
+        ucoin_push_init(&push_rsn, &buf_rsn, 0);
+        ret = ln_onion_read_packet(packet, &dataout, NULL, &push_rsn, packet, NULL, 0);
+        ASSERT_TRUE(ret);
+        ucoin_buf_free(&buf_rsn);
+        ASSERT_EQ(datain[lp].short_channel_id, dataout.short_channel_id);
+        ASSERT_EQ(datain[lp].amt_to_forward, dataout.amt_to_forward);
+        ASSERT_EQ(datain[lp].outgoing_cltv_value, dataout.outgoing_cltv_value);
+        ASSERT_EQ(lp == LN_HOP_MAX - 1, dataout.b_exit);
+    }
+}
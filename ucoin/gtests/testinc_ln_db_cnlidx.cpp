@@ -0,0 +1,176 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, ln_db_node_cur_transaction, void **, ln_db_txn_t, void *);
+FAKE_VOID_FUNC(ln_db_node_cur_commit, void *);
+FAKE_VALUE_FUNC(bool, ln_db_annocnl_cur_open, void **, void *);
+FAKE_VOID_FUNC(ln_db_annocnl_cur_close, void *);
+FAKE_VALUE_FUNC(bool, ln_db_annocnl_cur_get, void *, uint64_t *, char *, uint32_t *, ucoin_buf_t *);
+
+////////////////////////////////////////////////////////////////////////
+
+class cnlidx: public testing::Test {
+protected:
+    virtual void SetUp() {
+        RESET_FAKE(ln_db_node_cur_transaction)
+        RESET_FAKE(ln_db_node_cur_commit)
+        RESET_FAKE(ln_db_annocnl_cur_open)
+        RESET_FAKE(ln_db_annocnl_cur_close)
+        RESET_FAKE(ln_db_annocnl_cur_get)
+        ucoin_init(UCOIN_TESTNET, false);
+        //DBは空
+        ASSERT_TRUE(ln_db_cnlidx_init());
+    }
+
+    virtual void TearDown() {
+        ln_db_cnlidx_term();
+        ASSERT_EQ(0, ucoin_dbg_malloc_cnt());
+        ucoin_term();
+    }
+
+public:
+    static void NodeId(uint8_t *pNodeId, uint32_t Node)
+    {
+        memset(pNodeId, 0, UCOIN_SZ_PUBKEY);
+        pNodeId[0] = 0x02;
+        memcpy(pNodeId + 1, &Node, sizeof(Node));
+    }
+
+    //node_id_1:Node, node_id_2:Node+1
+    static void Add(uint64_t ShortChannelId, uint32_t Node)
+    {
+        uint8_t node1[UCOIN_SZ_PUBKEY];
+        uint8_t node2[UCOIN_SZ_PUBKEY];
+        NodeId(node1, Node);
+        NodeId(node2, Node + 1);
+        cnlidx_add(ShortChannelId, node1, node2);
+    }
+
+    static bool Check(uint64_t ShortChannelId, uint32_t Node)
+    {
+        uint8_t node_id[UCOIN_SZ_PUBKEY];
+        uint8_t expect[UCOIN_SZ_PUBKEY];
+        for (uint8_t dir = 0; dir < 2; dir++) {
+            if (!ln_db_cnlidx_get(node_id, NULL, ShortChannelId, dir)) {
+                return false;
+            }
+            NodeId(expect, Node + dir);
+            if (memcmp(expect, node_id, UCOIN_SZ_PUBKEY) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //channel tableの末尾に入るshort_channel_idを探す
+    static uint64_t SearchLast(uint64_t Start)
+    {
+        uint32_t mask = mCnlIdxSize - 1;
+        uint64_t sci = Start;
+        while ((cnlidx_hash(sci) & mask) != mask) {
+            sci++;
+        }
+        return sci;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(cnlidx, add_get)
+{
+    ASSERT_TRUE(ln_db_cnlidx_valid());
+    Add(0x123456000001000aULL, 1);
+    Add(0x123456000002000bULL, 2);
+    ASSERT_EQ(2, mCnlIdxNum);
+    ASSERT_TRUE(Check(0x123456000001000aULL, 1));
+    ASSERT_TRUE(Check(0x123456000002000bULL, 2));
+
+    //node_idは共有する(1, 2, 3)
+    ASSERT_EQ(3, mNodeIdxNum);
+
+    //上書き
+    Add(0x123456000001000aULL, 5);
+    ASSERT_EQ(2, mCnlIdxNum);
+    ASSERT_TRUE(Check(0x123456000001000aULL, 5));
+
+    //未登録
+    uint8_t node_id[UCOIN_SZ_PUBKEY];
+    ASSERT_FALSE(ln_db_cnlidx_get(node_id, NULL, 0x123456000003000cULL, 0));
+}
+
+
+//table拡張後も全て引けて、削除したものだけ消える
+TEST_F(cnlidx, grow_del)
+{
+    const uint32_t NUM = M_CNLIDX_INIT * 2;
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        Add(((uint64_t)(500000 + lp) << 40) | ((uint64_t)lp << 16) | (lp & 1), lp);
+    }
+    ASSERT_EQ(NUM, mCnlIdxNum);
+    ASSERT_LT(M_CNLIDX_INIT, mCnlIdxSize);
+    ASSERT_LT(M_NODEIDX_INIT, mNodeHashSize);
+
+    for (uint32_t lp = 0; lp < NUM; lp += 2) {
+        ln_db_cnlidx_del(((uint64_t)(500000 + lp) << 40) | ((uint64_t)lp << 16) | (lp & 1));
+    }
+    ASSERT_EQ(NUM / 2, mCnlIdxNum);
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        bool found = Check(((uint64_t)(500000 + lp) << 40) | ((uint64_t)lp << 16) | (lp & 1), lp);
+        ASSERT_EQ((lp & 1) != 0, found);
+    }
+}
+
+
+//末尾から先頭へ回り込んだ要素を、削除で詰めても引ける
+TEST_F(cnlidx, del_wraparound)
+{
+    uint32_t mask = mCnlIdxSize - 1;
+    uint64_t sci1 = SearchLast(1);
+    uint64_t sci2 = SearchLast(sci1 + 1);
+    uint64_t sci3 = SearchLast(sci2 + 1);
+    //先頭に入るshort_channel_id
+    uint64_t sci0 = sci3 + 1;
+    while ((cnlidx_hash(sci0) & mask) != 0) {
+        sci0++;
+    }
+
+    Add(sci1, 1);
+    Add(sci2, 2);
+    Add(sci3, 3);
+    Add(sci0, 4);
+    ASSERT_EQ(sci1, mpCnlIdx[mask].short_channel_id);
+    ASSERT_EQ(sci2, mpCnlIdx[0].short_channel_id);
+    ASSERT_EQ(sci3, mpCnlIdx[1].short_channel_id);
+    ASSERT_EQ(sci0, mpCnlIdx[2].short_channel_id);
+
+    //末尾を削除すると、回り込んだ要素が戻る
+    ln_db_cnlidx_del(sci1);
+    ASSERT_EQ(3, mCnlIdxNum);
+    ASSERT_FALSE(Check(sci1, 1));
+    ASSERT_TRUE(Check(sci2, 2));
+    ASSERT_TRUE(Check(sci3, 3));
+    ASSERT_TRUE(Check(sci0, 4));
+    ASSERT_EQ(sci2, mpCnlIdx[mask].short_channel_id);
+    ASSERT_EQ(sci3, mpCnlIdx[0].short_channel_id);
+    ASSERT_EQ(sci0, mpCnlIdx[1].short_channel_id);
+    ASSERT_EQ(0, mpCnlIdx[2].short_channel_id);
+
+    //先頭を削除
+    ln_db_cnlidx_del(sci3);
+    ASSERT_TRUE(Check(sci2, 2));
+    ASSERT_TRUE(Check(sci0, 4));
+    ASSERT_EQ(sci0, mpCnlIdx[0].short_channel_id);
+    ASSERT_EQ(0, mpCnlIdx[1].short_channel_id);
+
+    //homeが先頭の要素は、homeより前(末尾)へは移さない
+    ln_db_cnlidx_del(sci2);
+    ASSERT_TRUE(Check(sci0, 4));
+    ASSERT_EQ(0, mpCnlIdx[mask].short_channel_id);
+    ASSERT_EQ(sci0, mpCnlIdx[0].short_channel_id);
+
+    ln_db_cnlidx_del(sci0);
+    ASSERT_EQ(0, mCnlIdxNum);
+    for (uint32_t lp = 0; lp < mCnlIdxSize; lp++) {
+        ASSERT_EQ(0, mpCnlIdx[lp].short_channel_id);
+    }
+}
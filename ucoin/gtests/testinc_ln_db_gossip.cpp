@@ -0,0 +1,194 @@
+#include <sys/stat.h>
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//ln_db_node_cur_transaction, ln_db_annocnl_cur_xxxはtestinc_ln_db_cnlidx.cppのものを使う
+FAKE_VALUE_FUNC(bool, ln_db_annonod_cur_open, void **, void *);
+FAKE_VOID_FUNC(ln_db_annonod_cur_close, void *);
+FAKE_VALUE_FUNC(bool, ln_db_annonod_cur_get, void *, ucoin_buf_t *, uint32_t *, uint8_t *);
+FAKE_VALUE_FUNC(bool, ln_db_annocnl_load, ucoin_buf_t *, uint64_t);
+FAKE_VALUE_FUNC(uint64_t, ln_db_node_txnid);
+FAKE_VALUE_FUNC(uint64_t, ln_db_anno_gossip_txnid);
+FAKE_VALUE_FUNC(bool, ln_db_anno_live_begin, void **);
+FAKE_VALUE_FUNC(bool, ln_db_anno_live, void *, char, const uint8_t *, const uint8_t *, uint32_t);
+FAKE_VOID_FUNC(ln_db_anno_live_end, void *);
+
+////////////////////////////////////////////////////////////////////////
+
+namespace LN_DB_GOSSIP {
+    //ln_db_anno_live()でDBに無いとするメッセージ(先頭1byte)
+    std::vector<uint8_t> dead;
+
+    bool live_begin(void **ppDb)
+    {
+        static int db;
+        *ppDb = &db;
+        return true;
+    }
+
+    bool live(void *pDb, char Type, const uint8_t *pKey, const uint8_t *pMsg, uint32_t Len)
+    {
+        return std::find(dead.begin(), dead.end(), pMsg[0]) == dead.end();
+    }
+}
+
+class gossip: public testing::Test {
+protected:
+    virtual void SetUp() {
+        RESET_FAKE(ln_db_node_cur_transaction)
+        RESET_FAKE(ln_db_annonod_cur_open)
+        RESET_FAKE(ln_db_annonod_cur_close)
+        RESET_FAKE(ln_db_annonod_cur_get)
+        RESET_FAKE(ln_db_annocnl_load)
+        RESET_FAKE(ln_db_node_txnid)
+        RESET_FAKE(ln_db_anno_gossip_txnid)
+        RESET_FAKE(ln_db_anno_live_begin)
+        RESET_FAKE(ln_db_anno_live)
+        RESET_FAKE(ln_db_anno_live_end)
+        ln_db_anno_live_begin_fake.custom_fake = LN_DB_GOSSIP::live_begin;
+        ln_db_anno_live_fake.custom_fake = LN_DB_GOSSIP::live;
+        LN_DB_GOSSIP::dead.clear();
+        ucoin_init(UCOIN_TESTNET, false);
+        mkdir(LNDB_DBDIR, 0755);
+        unlink(LNDB_GOSSIP_STORE);
+        //DBは空
+        ASSERT_TRUE(ln_db_gossip_init());
+    }
+
+    virtual void TearDown() {
+        ln_db_gossip_term();
+        unlink(LNDB_GOSSIP_STORE);
+        ASSERT_EQ(0, ucoin_dbg_malloc_cnt());
+        ucoin_term();
+    }
+
+public:
+    //メッセージの先頭1byteで区別する
+    static void Append(char Type, uint64_t ShortChannelId, uint8_t Msg)
+    {
+        uint8_t data[3] = { Msg, 0xaa, 0xbb };
+        ucoin_buf_t buf = { data, sizeof(data) };
+        ln_db_gossip_append(Type, (const uint8_t *)&ShortChannelId, 1000 + Msg, &buf, NULL);
+    }
+
+    //次のメッセージの先頭1byte(0:無し)
+    static uint8_t Next(void *pCur)
+    {
+        ucoin_buf_t buf = UCOIN_BUF_INIT;
+        char type;
+        if (!ln_db_gossip_cur_get(pCur, &buf, &type, NULL)) {
+            return 0;
+        }
+        uint8_t msg = buf.buf[0];
+        ucoin_buf_free(&buf);
+        return msg;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+//DBに無いレコードを取り除き、cursorは次の有効なレコードへ付け替える
+TEST_F(gossip, compact_cursor)
+{
+    uint8_t peer[UCOIN_SZ_PUBKEY];
+    memset(peer, 0x11, sizeof(peer));
+    peer[0] = 0x02;
+
+    Append(LN_DB_CNLANNO_ANNO, 1, 1);
+    Append(LN_DB_CNLANNO_UPD1, 1, 2);
+    Append(LN_DB_CNLANNO_ANNO, 2, 3);
+    Append(LN_DB_CNLANNO_UPD1, 2, 4);
+    Append(LN_DB_CNLANNO_ANNO, 3, 5);
+
+    void *p_cur1;       //2番目(削除)を指す
+    void *p_cur2;       //5番目(有効)を指す
+    void *p_cur3;       //末尾
+    ASSERT_TRUE(ln_db_gossip_cur_open(&p_cur1, peer, true));
+    ASSERT_TRUE(ln_db_gossip_cur_open(&p_cur2, peer, true));
+    ASSERT_TRUE(ln_db_gossip_cur_open(&p_cur3, peer, false));
+    ASSERT_EQ(1, Next(p_cur1));
+    for (uint8_t lp = 1; lp <= 4; lp++) {
+        ASSERT_EQ(lp, Next(p_cur2));
+    }
+    size_t len = mGossipLen;
+
+    LN_DB_GOSSIP::dead.push_back(2);
+    LN_DB_GOSSIP::dead.push_back(3);
+    ln_db_gossip_pruned();
+    ASSERT_TRUE(ln_db_gossip_compact());
+    ASSERT_EQ(1, ln_db_anno_live_begin_fake.call_count);
+    ASSERT_EQ(5, ln_db_anno_live_fake.call_count);
+    ASSERT_EQ(1, ln_db_anno_live_end_fake.call_count);
+    ASSERT_GT(len, mGossipLen);
+    ASSERT_FALSE(mGossipPruned);
+
+    //compaction後の追記も読める
+    Append(LN_DB_CNLANNO_UPD1, 3, 6);
+
+    ASSERT_EQ(4, Next(p_cur1));
+    ASSERT_EQ(5, Next(p_cur1));
+    ASSERT_EQ(6, Next(p_cur1));
+    ASSERT_EQ(0, Next(p_cur1));
+    ASSERT_EQ(5, Next(p_cur2));
+    ASSERT_EQ(6, Next(p_cur2));
+    ASSERT_EQ(6, Next(p_cur3));
+    ASSERT_EQ(0, Next(p_cur3));
+
+    //先頭から読み直しても削除したレコードは返さない
+    void *p_cur4;
+    ASSERT_TRUE(ln_db_gossip_cur_open(&p_cur4, peer, true));
+    ASSERT_EQ(1, Next(p_cur4));
+    ASSERT_EQ(4, Next(p_cur4));
+    ASSERT_EQ(5, Next(p_cur4));
+    ASSERT_EQ(6, Next(p_cur4));
+    ASSERT_EQ(0, Next(p_cur4));
+
+    ln_db_gossip_cur_close(p_cur1);
+    ln_db_gossip_cur_close(p_cur2);
+    ln_db_gossip_cur_close(p_cur3);
+    ln_db_gossip_cur_close(p_cur4);
+}
+
+
+//追記量が少なければcompactionしない
+TEST_F(gossip, compact_skip)
+{
+    Append(LN_DB_CNLANNO_ANNO, 1, 1);
+    LN_DB_GOSSIP::dead.push_back(1);
+    size_t len = mGossipLen;
+    ASSERT_TRUE(ln_db_gossip_compact());
+    ASSERT_EQ(0, ln_db_anno_live_begin_fake.call_count);
+    ASSERT_EQ(len, mGossipLen);
+}
+
+
+//追記前に終了した(DBの方が進んでいる)場合はDBから作り直す
+TEST_F(gossip, txnid_rebuild)
+{
+    Append(LN_DB_CNLANNO_ANNO, 1, 1);
+    size_t len = mGossipLen;
+    unsigned int rebuild = ln_db_node_cur_transaction_fake.call_count;
+
+    ln_db_anno_gossip_txnid_fake.return_val = 5;
+    ln_db_gossip_term();
+    ASSERT_TRUE(ln_db_gossip_init());
+    ASSERT_EQ(len, mGossipLen);
+    ASSERT_EQ(rebuild, ln_db_node_cur_transaction_fake.call_count);
+
+    //announcement以外への書込みでは作り直さない
+    ln_db_node_txnid_fake.return_val = 100;
+    ln_db_gossip_term();
+    ASSERT_TRUE(ln_db_gossip_init());
+    ASSERT_EQ(len, mGossipLen);
+    ASSERT_EQ(rebuild, ln_db_node_cur_transaction_fake.call_count);
+
+    //追記が終わっていない保存があればtransaction idを進めない
+    ln_db_gossip_begin();
+    ln_db_anno_gossip_txnid_fake.return_val = 6;
+    ln_db_gossip_term();
+    ln_db_gossip_end();
+    ASSERT_TRUE(ln_db_gossip_init());
+    ASSERT_EQ(sizeof(gossip_hdr_t), mGossipLen);
+    ASSERT_LT(rebuild, ln_db_node_cur_transaction_fake.call_count);
+}
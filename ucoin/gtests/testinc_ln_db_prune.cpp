@@ -0,0 +1,169 @@
+#include <map>
+
+////////////////////////////////////////////////////////////////////////
+
+namespace LN_DB_PRUNE {
+    const uint32_t NOW = 1600000000;
+    const int32_t HEIGHT = 600000;
+
+    //ln_db_prune_batch()で取得し直すtimestamp
+    std::map<uint64_t, uint32_t> upd_time;
+    std::vector<uint64_t> time_called;
+    //閉鎖済みとするshort_channel_id
+    std::vector<uint64_t> closed;
+    std::vector<uint64_t> closed_called;
+
+    uint32_t cnlupd_time(uint64_t ShortChannelId, void *pParam)
+    {
+        time_called.push_back(ShortChannelId);
+        return upd_time[ShortChannelId];
+    }
+
+    bool is_closed(uint64_t ShortChannelId, void *pParam)
+    {
+        closed_called.push_back(ShortChannelId);
+        return std::find(closed.begin(), closed.end(), ShortChannelId) != closed.end();
+    }
+}
+
+class prune: public testing::Test {
+protected:
+    virtual void SetUp() {
+        LN_DB_PRUNE::upd_time.clear();
+        LN_DB_PRUNE::time_called.clear();
+        LN_DB_PRUNE::closed.clear();
+        LN_DB_PRUNE::closed_called.clear();
+        ucoin_init(UCOIN_TESTNET, false);
+        memset(&mList, 0, sizeof(mList));
+        mList.now = LN_DB_PRUNE::NOW;
+        mList.height = LN_DB_PRUNE::HEIGHT;
+    }
+
+    virtual void TearDown() {
+        ln_db_prune_free(&mList);
+        ASSERT_EQ(0, ucoin_dbg_malloc_cnt());
+        ucoin_term();
+    }
+
+public:
+    ln_db_prune_list_t mList;
+
+    static uint64_t Sci(uint32_t Height)
+    {
+        return ((uint64_t)Height << 40) | ((uint64_t)1 << 16);
+    }
+
+    //Timestamp 0:channel_updateなし
+    ln_db_prune_cnl_t *Add(uint32_t Height, uint32_t TimeStamp)
+    {
+        ln_db_prune_cnl_t *p = ln_db_prune_get(&mList, Sci(Height));
+        p->anno = true;
+        p->timestamp = TimeStamp;
+        LN_DB_PRUNE::upd_time[Sci(Height)] = TimeStamp;
+        return p;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+//同じshort_channel_idが続けば同じ要素を返す
+TEST_F(prune, get)
+{
+    ln_db_prune_cnl_t *p1 = ln_db_prune_get(&mList, Sci(500000));
+    p1->anno = true;
+    ln_db_prune_cnl_t *p2 = ln_db_prune_get(&mList, Sci(500000));
+    ASSERT_EQ(p1, p2);
+    ASSERT_TRUE(p2->anno);
+    ASSERT_EQ(1, mList.num);
+
+    for (uint32_t lp = 1; lp <= 2000; lp++) {
+        ln_db_prune_cnl_t *p = ln_db_prune_get(&mList, Sci(500000 + lp));
+        ASSERT_EQ(Sci(500000 + lp), p->short_channel_id);
+        ASSERT_FALSE(p->anno);
+    }
+    ASSERT_EQ(2001, mList.num);
+    ASSERT_EQ(Sci(500000), mList.p_cnl[0].short_channel_id);
+    ASSERT_TRUE(mList.p_cnl[0].anno);
+}
+
+
+//自nodeのchannelは古くても削除せず、削除対象はMax個ずつ取り出す
+TEST_F(prune, batch_own)
+{
+    const uint32_t OLD = LN_DB_PRUNE::NOW - LN_DB_PRUNE_STALE_SEC;
+    const uint32_t NEW = LN_DB_PRUNE::NOW - 100;
+
+    Add(500000, 0);                 //A: channel_updateなし、block経過で古い
+    Add(500001, OLD);               //B: 古いが自nodeのchannel(self)
+    Add(500002, NEW);               //C: 閉鎖済み
+    Add(500003, OLD);               //D: 集めた後にchannel_updateを受信した
+    Add(500004, 0)->own = true;     //E: 古いが自nodeのchannel(announcement)
+    Add(599000, 0);                 //F: channel_updateなし、block経過が少ない
+    Add(500005, OLD);               //G: 古い
+    Add(500006, OLD);               //H: 古い
+    LN_DB_PRUNE::upd_time[Sci(500003)] = NEW;
+    LN_DB_PRUNE::closed.push_back(Sci(500002));
+
+    //ソートされていない
+    uint64_t self[] = { Sci(700000), Sci(500001), Sci(400000) };
+    ln_db_prune_select(&mList, self, ARRAY_SIZE(self), LN_DB_PRUNE::is_closed, NULL);
+    ASSERT_TRUE(mList.p_cnl[1].own);
+    ASSERT_TRUE(mList.p_cnl[2].closed);
+    ASSERT_EQ(5, mList.del_num);
+    //古くないchannelだけ閉鎖判定する
+    std::vector<uint64_t> expect_closed = { Sci(500001), Sci(500002), Sci(500004), Sci(599000) };
+    ASSERT_EQ(expect_closed, LN_DB_PRUNE::closed_called);
+
+    const ln_db_prune_cnl_t *del[2];
+    int num = ln_db_prune_batch(&mList, del, 2, LN_DB_PRUNE::cnlupd_time, NULL);
+    ASSERT_EQ(2, num);
+    ASSERT_EQ(Sci(500000), del[0]->short_channel_id);
+    ASSERT_FALSE(del[0]->closed);
+    ASSERT_EQ(Sci(500002), del[1]->short_channel_id);
+    ASSERT_TRUE(del[1]->closed);
+
+    num = ln_db_prune_batch(&mList, del, 2, LN_DB_PRUNE::cnlupd_time, NULL);
+    ASSERT_EQ(2, num);
+    ASSERT_EQ(Sci(500005), del[0]->short_channel_id);
+    ASSERT_EQ(Sci(500006), del[1]->short_channel_id);
+    ASSERT_EQ(0, mList.del_num);
+
+    ASSERT_EQ(0, ln_db_prune_batch(&mList, del, 2, LN_DB_PRUNE::cnlupd_time, NULL));
+
+    //自nodeのchannel、閉鎖済みchannelはtimestampを取得し直さない
+    std::vector<uint64_t> expect_time = { Sci(500000), Sci(500003), Sci(500005), Sci(500006) };
+    ASSERT_EQ(expect_time, LN_DB_PRUNE::time_called);
+}
+
+
+//block countが不明ならchannel_updateの無いchannelは削除しない
+TEST_F(prune, no_height)
+{
+    mList.height = 0;
+    Add(500000, 0);
+    Add(500001, LN_DB_PRUNE::NOW - LN_DB_PRUNE_STALE_SEC + 1);
+    Add(500002, LN_DB_PRUNE::NOW + 100);
+    ln_db_prune_select(&mList, NULL, 0, NULL, NULL);
+    ASSERT_EQ(0, mList.del_num);
+
+    const ln_db_prune_cnl_t *del[2];
+    ASSERT_EQ(0, ln_db_prune_batch(&mList, del, 2, LN_DB_PRUNE::cnlupd_time, NULL));
+    ASSERT_TRUE(LN_DB_PRUNE::time_called.empty());
+}
+
+
+//DBのkey順(little endian)で集めても、閉鎖判定はshort_channel_idの昇順に行う
+TEST_F(prune, select_sorted)
+{
+    const uint32_t NEW = LN_DB_PRUNE::NOW - 100;
+
+    Add(500100, NEW);
+    Add(500001, NEW);
+    Add(600000, NEW);
+    Add(500000, NEW);
+    ln_db_prune_select(&mList, NULL, 0, LN_DB_PRUNE::is_closed, NULL);
+
+    std::vector<uint64_t> expect_closed = { Sci(500000), Sci(500001), Sci(500100), Sci(600000) };
+    ASSERT_EQ(expect_closed, LN_DB_PRUNE::closed_called);
+    ASSERT_EQ(0, mList.del_num);
+}
@@ -0,0 +1,320 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+class msg_anno: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        ucoin_init(UCOIN_TESTNET, false);
+        for (int lp = 0; lp < LN_SZ_HASH; lp++) {
+            gGenesisChainHash[lp] = (uint8_t)(0xa0 + lp);
+        }
+    }
+
+    virtual void TearDown() {
+        memset(gGenesisChainHash, 0, sizeof(gGenesisChainHash));
+        ASSERT_EQ(0, ucoin_dbg_malloc_cnt());
+        ucoin_term();
+    }
+
+public:
+    //type(2) + chain_hash(32)の確認
+    static void CheckHeader(const ucoin_buf_t *pBuf, uint16_t Type)
+    {
+        ASSERT_EQ(Type >> 8, pBuf->buf[0]);
+        ASSERT_EQ(Type & 0xff, pBuf->buf[1]);
+        ASSERT_EQ(0, memcmp(gGenesisChainHash, pBuf->buf + 2, LN_SZ_HASH));
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(msg_anno, query_short_ids)
+{
+    uint64_t short_ids[] = { 0x0102030405060708ULL, 0x1112131415161718ULL };
+    ln_query_short_ids_t msg;
+    msg.p_short_ids = short_ids;
+    msg.num = ARRAY_SIZE(short_ids);
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_query_short_ids_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+
+    const uint8_t BODY[] = {
+        //len
+        0x00, 0x11,
+        //encoding_type
+        0x00,
+        //encoded_short_ids
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+    };
+    ASSERT_EQ(2 + LN_SZ_HASH + sizeof(BODY), buf.len);
+    CheckHeader(&buf, MSGTYPE_QUERY_SHORT_CHANNEL_IDS);
+    ASSERT_EQ(0, memcmp(BODY, buf.buf + 2 + LN_SZ_HASH, sizeof(BODY)));
+
+    ln_query_short_ids_t rd;
+    ret = ln_msg_query_short_ids_read(&rd, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(2, rd.num);
+    ASSERT_EQ(short_ids[0], rd.p_short_ids[0]);
+    ASSERT_EQ(short_ids[1], rd.p_short_ids[1]);
+    M_FREE(rd.p_short_ids);
+
+    ucoin_buf_free(&buf);
+}
+
+
+TEST_F(msg_anno, query_short_ids_empty)
+{
+    ln_query_short_ids_t msg;
+    msg.p_short_ids = NULL;
+    msg.num = 0;
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_query_short_ids_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(2 + LN_SZ_HASH + 2 + 1, buf.len);
+
+    ln_query_short_ids_t rd;
+    ret = ln_msg_query_short_ids_read(&rd, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(0, rd.num);
+    ASSERT_TRUE(rd.p_short_ids == NULL);
+
+    ucoin_buf_free(&buf);
+}
+
+
+TEST_F(msg_anno, query_short_ids_too_many)
+{
+    ln_query_short_ids_t msg;
+    msg.p_short_ids = NULL;
+    msg.num = LN_GOSSIPQ_SHORT_IDS_MAX + 1;
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_query_short_ids_create(&buf, &msg);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(0, buf.len);
+}
+
+
+TEST_F(msg_anno, query_short_ids_read_error)
+{
+    uint64_t short_ids[] = { 0x0102030405060708ULL };
+    ln_query_short_ids_t msg;
+    msg.p_short_ids = short_ids;
+    msg.num = ARRAY_SIZE(short_ids);
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_query_short_ids_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+
+    ln_query_short_ids_t rd;
+
+    //lenより短い
+    ret = ln_msg_query_short_ids_read(&rd, buf.buf, buf.len - 1);
+    ASSERT_FALSE(ret);
+
+    //encoding_type=1(zlib)は未対応
+    buf.buf[2 + LN_SZ_HASH + 2] = 0x01;
+    ret = ln_msg_query_short_ids_read(&rd, buf.buf, buf.len);
+    ASSERT_FALSE(ret);
+    buf.buf[2 + LN_SZ_HASH + 2] = 0x00;
+
+    //chain_hash不一致
+    gGenesisChainHash[0] ^= 0xff;
+    ret = ln_msg_query_short_ids_read(&rd, buf.buf, buf.len);
+    ASSERT_FALSE(ret);
+    gGenesisChainHash[0] ^= 0xff;
+
+    //type不一致
+    buf.buf[1] = MSGTYPE_REPLY_CHANNEL_RANGE & 0xff;
+    ret = ln_msg_query_short_ids_read(&rd, buf.buf, buf.len);
+    ASSERT_FALSE(ret);
+
+    ucoin_buf_free(&buf);
+}
+
+
+//BOLT#1: 後ろに追加されたデータは無視する
+TEST_F(msg_anno, query_short_ids_read_extra)
+{
+    uint64_t short_ids[] = { 0x0102030405060708ULL };
+    ln_query_short_ids_t msg;
+    msg.p_short_ids = short_ids;
+    msg.num = ARRAY_SIZE(short_ids);
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_query_short_ids_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+
+    uint8_t data[256];
+    memset(data, 0xcc, sizeof(data));
+    memcpy(data, buf.buf, buf.len);
+
+    ln_query_short_ids_t rd;
+    ret = ln_msg_query_short_ids_read(&rd, data, buf.len + 10);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(1, rd.num);
+    ASSERT_EQ(short_ids[0], rd.p_short_ids[0]);
+    M_FREE(rd.p_short_ids);
+
+    ucoin_buf_free(&buf);
+}
+
+
+TEST_F(msg_anno, reply_short_ids_end)
+{
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_reply_short_ids_end_create(&buf, true);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(2 + LN_SZ_HASH + 1, buf.len);
+    CheckHeader(&buf, MSGTYPE_REPLY_SHORT_CHANNEL_IDS_END);
+    ASSERT_EQ(0x01, buf.buf[2 + LN_SZ_HASH]);
+
+    bool complete = false;
+    ret = ln_msg_reply_short_ids_end_read(&complete, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_TRUE(complete);
+    ucoin_buf_free(&buf);
+
+    ret = ln_msg_reply_short_ids_end_create(&buf, false);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(0x00, buf.buf[2 + LN_SZ_HASH]);
+    ret = ln_msg_reply_short_ids_end_read(&complete, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_FALSE(complete);
+
+    //completeが無い
+    ret = ln_msg_reply_short_ids_end_read(&complete, buf.buf, buf.len - 1);
+    ASSERT_FALSE(ret);
+    ucoin_buf_free(&buf);
+}
+
+
+TEST_F(msg_anno, query_channel_range)
+{
+    ln_query_channel_range_t msg;
+    msg.first_blocknum = 0x00123456;
+    msg.number_of_blocks = 0x89abcdef;
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_query_channel_range_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+
+    const uint8_t BODY[] = {
+        //first_blocknum
+        0x00, 0x12, 0x34, 0x56,
+        //number_of_blocks
+        0x89, 0xab, 0xcd, 0xef,
+    };
+    ASSERT_EQ(2 + LN_SZ_HASH + sizeof(BODY), buf.len);
+    CheckHeader(&buf, MSGTYPE_QUERY_CHANNEL_RANGE);
+    ASSERT_EQ(0, memcmp(BODY, buf.buf + 2 + LN_SZ_HASH, sizeof(BODY)));
+
+    ln_query_channel_range_t rd;
+    ret = ln_msg_query_channel_range_read(&rd, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(msg.first_blocknum, rd.first_blocknum);
+    ASSERT_EQ(msg.number_of_blocks, rd.number_of_blocks);
+
+    ret = ln_msg_query_channel_range_read(&rd, buf.buf, buf.len - 1);
+    ASSERT_FALSE(ret);
+
+    ucoin_buf_free(&buf);
+}
+
+
+TEST_F(msg_anno, reply_channel_range)
+{
+    uint64_t short_ids[] = { 0x0000010000020003ULL, 0x0000010100040005ULL, 0x0000010200060007ULL };
+    ln_reply_channel_range_t msg;
+    msg.first_blocknum = 0x00000100;
+    msg.number_of_blocks = 0x00000010;
+    msg.complete = 1;
+    msg.p_short_ids = short_ids;
+    msg.num = ARRAY_SIZE(short_ids);
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_reply_channel_range_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+
+    const uint8_t BODY[] = {
+        //first_blocknum
+        0x00, 0x00, 0x01, 0x00,
+        //number_of_blocks
+        0x00, 0x00, 0x00, 0x10,
+        //complete
+        0x01,
+        //len
+        0x00, 0x19,
+        //encoding_type
+        0x00,
+        //encoded_short_ids
+        0x00, 0x00, 0x01, 0x00, 0x00, 0x02, 0x00, 0x03,
+        0x00, 0x00, 0x01, 0x01, 0x00, 0x04, 0x00, 0x05,
+        0x00, 0x00, 0x01, 0x02, 0x00, 0x06, 0x00, 0x07,
+    };
+    ASSERT_EQ(2 + LN_SZ_HASH + sizeof(BODY), buf.len);
+    CheckHeader(&buf, MSGTYPE_REPLY_CHANNEL_RANGE);
+    ASSERT_EQ(0, memcmp(BODY, buf.buf + 2 + LN_SZ_HASH, sizeof(BODY)));
+
+    ln_reply_channel_range_t rd;
+    ret = ln_msg_reply_channel_range_read(&rd, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(msg.first_blocknum, rd.first_blocknum);
+    ASSERT_EQ(msg.number_of_blocks, rd.number_of_blocks);
+    ASSERT_EQ(1, rd.complete);
+    ASSERT_EQ(3, rd.num);
+    for (int lp = 0; lp < rd.num; lp++) {
+        ASSERT_EQ(short_ids[lp], rd.p_short_ids[lp]);
+    }
+    M_FREE(rd.p_short_ids);
+
+    //encoded_short_idsが8byte単位ではない
+    buf.buf[2 + LN_SZ_HASH + 10] = 0x18;
+    ret = ln_msg_reply_channel_range_read(&rd, buf.buf, buf.len);
+    ASSERT_FALSE(ret);
+    ASSERT_TRUE(rd.p_short_ids == NULL);
+
+    ucoin_buf_free(&buf);
+}
+
+
+TEST_F(msg_anno, gossip_filter)
+{
+    ln_gossip_filter_t msg;
+    msg.first_timestamp = 0x5b000000;
+    msg.timestamp_range = 0xffffffff;
+
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    bool ret = ln_msg_gossip_filter_create(&buf, &msg);
+    ASSERT_TRUE(ret);
+
+    const uint8_t BODY[] = {
+        //first_timestamp
+        0x5b, 0x00, 0x00, 0x00,
+        //timestamp_range
+        0xff, 0xff, 0xff, 0xff,
+    };
+    ASSERT_EQ(2 + LN_SZ_HASH + sizeof(BODY), buf.len);
+    CheckHeader(&buf, MSGTYPE_GOSSIP_TIMESTAMP_FILTER);
+    ASSERT_EQ(0, memcmp(BODY, buf.buf + 2 + LN_SZ_HASH, sizeof(BODY)));
+
+    ln_gossip_filter_t rd;
+    ret = ln_msg_gossip_filter_read(&rd, buf.buf, buf.len);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(msg.first_timestamp, rd.first_timestamp);
+    ASSERT_EQ(msg.timestamp_range, rd.timestamp_range);
+
+    ret = ln_msg_gossip_filter_read(&rd, buf.buf, buf.len - 1);
+    ASSERT_FALSE(ret);
+
+    ucoin_buf_free(&buf);
+}
@@ -0,0 +1,837 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, ln_db_self_search, ln_db_func_cmp_t, void *);
+
+////////////////////////////////////////////////////////////////////////
+
+class routing: public testing::Test {
+protected:
+    virtual void SetUp() {
+        RESET_FAKE(ln_db_self_search)
+        ucoin_init(UCOIN_TESTNET, true);
+        graph_clear();
+        mMcChan.clear();
+        mMcNode.clear();
+        mSkip.clear();
+        LandmarkClear();
+    }
+
+    virtual void TearDown() {
+        graph_clear();
+        mMcChan.clear();
+        mMcNode.clear();
+        mSkip.clear();
+        LandmarkClear();
+        ASSERT_EQ(0, ucoin_dbg_malloc_cnt());
+        ucoin_term();
+    }
+
+public:
+    static void NodeId(uint8_t *pNodeId, uint8_t Node)
+    {
+        memset(pNodeId, 0, UCOIN_SZ_PUBKEY);
+        pNodeId[0] = 0x02;
+        pNodeId[1] = Node;
+    }
+
+    //From --> To方向だけ有効なchannel
+    static void AddChannel(uint64_t ShortChannelId, uint8_t From, uint8_t To,
+                uint32_t FeeBase, uint16_t CltvDelta)
+    {
+        uint8_t node_from[UCOIN_SZ_PUBKEY];
+        uint8_t node_to[UCOIN_SZ_PUBKEY];
+        NodeId(node_from, From);
+        NodeId(node_to, To);
+        graph_add_channel(ShortChannelId, node_from, node_to);
+        UpdateChannel(ShortChannelId, 0, FeeBase, 0, CltvDelta);   //dir0: node[0] --> node[1]
+    }
+
+    static void UpdateChannel(uint64_t ShortChannelId, uint8_t Flags,
+                uint32_t FeeBase, uint32_t FeeProp, uint16_t CltvDelta, uint32_t Timestamp = 1)
+    {
+        ln_cnl_update_t upd;
+        memset(&upd, 0, sizeof(upd));
+        upd.short_channel_id = ShortChannelId;
+        upd.timestamp = Timestamp;
+        upd.flags = Flags;
+        upd.cltv_expiry_delta = CltvDelta;
+        upd.fee_base_msat = FeeBase;
+        upd.fee_prop_millionths = FeeProp;
+        graph_set_update(&mChannels[ShortChannelId], &upd);
+    }
+
+    static uint32_t Node(uint8_t Node)
+    {
+        uint8_t node_id[UCOIN_SZ_PUBKEY];
+        NodeId(node_id, Node);
+        return node_search(node_id);
+    }
+
+    static void InitParam(ln_routing_param_t *pParam)
+    {
+        memset(pParam, 0, sizeof(ln_routing_param_t));
+        pParam->weight = LN_ROUTING_WEIGHT_AMOUNT;
+        pParam->algo = LN_ROUTING_ALGO_DIJKSTRA;
+        pParam->max_hop = LN_HOP_MAX;
+    }
+
+    static bool RouteCost(const ln_routing_param_t *pParam, uint64_t AmountMsat, const route_t& Route, uint64_t *pCost)
+    {
+        std::vector<const edge_t *> edges;
+        for (size_t lp = 0; lp < Route.size(); lp++) {
+            edges.push_back(&Route[lp]);
+        }
+        overlay_t overlay;
+        return path_cost(pParam, AmountMsat, 9, edges, time(NULL), &overlay, pCost);
+    }
+
+    //landmark_thread()と同じ計算をその場で行う
+    static void LandmarkBuild(void)
+    {
+        lm_graph_t graph;
+        graph.node_num = (uint32_t)mNodes.size();
+        graph.edge_start = mEdgeStart;
+        graph.edges = mEdges;
+        graph.in_start = mInStart;
+        graph.in_edges = mInEdges;
+
+        landmark_select(graph, &mLandmarks);
+        mLmFrom.resize(M_LANDMARK_AMOUNT_NUM * mLandmarks.size() * graph.node_num);
+        mLmTo.resize(M_LANDMARK_AMOUNT_NUM * mLandmarks.size() * graph.node_num);
+        for (int amt = 0; amt < M_LANDMARK_AMOUNT_NUM; amt++) {
+            for (size_t lp = 0; lp < mLandmarks.size(); lp++) {
+                size_t offset = (amt * mLandmarks.size() + lp) * graph.node_num;
+                landmark_dijkstra(graph, mLandmarks[lp], kLmAmount[amt], false, &mLmFrom[offset]);
+                landmark_dijkstra(graph, mLandmarks[lp], kLmAmount[amt], true, &mLmTo[offset]);
+            }
+        }
+        mLmNodeNum = graph.node_num;
+        mLmVersion = mGraphVersion;
+    }
+
+    static void LandmarkClear(void)
+    {
+        mLandmarks.clear();
+        mLmFrom.clear();
+        mLmTo.clear();
+        mLmNodeNum = 0;
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+/*
+ *  1 --> 2 --> 3 --> 4 --> 6   (node4: 手数料は安いがcltv_expiry_deltaが大きい)
+ *              |           ^
+ *              +---> 5 ----+
+ */
+static void routing_budget_graph(void)
+{
+    routing::AddChannel(1, 1, 2, 1000, 50);
+    routing::AddChannel(2, 2, 3, 1000, 50);
+    routing::AddChannel(3, 3, 4, 1000, 50);
+    routing::AddChannel(4, 4, 6, 1000, 100);
+    routing::AddChannel(5, 3, 5, 1000, 50);
+    routing::AddChannel(6, 5, 6, 5000, 10);
+    graph_build_edges();
+}
+
+
+TEST_F(routing, amount_cheapest)
+{
+    routing_budget_graph();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(4, routes[0].size());
+    ASSERT_EQ(1, routes[0][0].short_channel_id);
+    ASSERT_EQ(2, routes[0][1].short_channel_id);
+    ASSERT_EQ(3, routes[0][2].short_channel_id);
+    ASSERT_EQ(4, routes[0][3].short_channel_id);
+}
+
+
+//node3で安い部分経路(cltv_expiry_delta合計150)が先に決まっても、
+//node2でcltv上限を超えたら高い部分経路(合計60)を使う
+TEST_F(routing, amount_cltv_budget)
+{
+    routing_budget_graph();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+    param.max_cltv_delta = 160;
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(4, routes[0].size());
+    ASSERT_EQ(1, routes[0][0].short_channel_id);
+    ASSERT_EQ(2, routes[0][1].short_channel_id);
+    ASSERT_EQ(5, routes[0][2].short_channel_id);
+    ASSERT_EQ(6, routes[0][3].short_channel_id);
+
+    //どちらも超える
+    param.max_cltv_delta = 100;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(0, routes.size());
+}
+
+
+//hop数上限でも同じ
+TEST_F(routing, amount_hop_budget)
+{
+    routing_budget_graph();
+    //node3 --> node6 直接(hop数は少ないが手数料が高い)
+    routing::AddChannel(7, 3, 6, 20000, 10);
+    graph_build_edges();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(4, routes[0].size());
+
+    param.max_hop = 3;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(3, routes[0].size());
+    ASSERT_EQ(7, routes[0][2].short_channel_id);
+}
+
+
+/*
+ *  1 --> 2 --> 11..26 --> 3   (2 --> 1x: 10000, 1x --> 3: 100*x, cltv_expiry_delta 200-10*x)
+ *        |                ^
+ *        +---> 27 --------+   (2 --> 27: 0, 27 --> 3: 2000, cltv_expiry_delta 300)
+ *
+ * node2には支配しあわないlabelがM_LABEL_MAXできた後に、一番安いlabelが届く
+ */
+TEST_F(routing, amount_label_max)
+{
+    routing::AddChannel(1, 1, 2, 0, 10);
+    for (int lp = 1; lp <= M_LABEL_MAX; lp++) {
+        routing::AddChannel(100 + lp, 2, 10 + lp, 10000, 10);
+        routing::AddChannel(200 + lp, 10 + lp, 3, 100 * lp, 200 - 10 * lp);
+    }
+    routing::AddChannel(100 + M_LABEL_MAX + 1, 2, 27, 0, 10);
+    routing::AddChannel(200 + M_LABEL_MAX + 1, 27, 3, 2000, 300);
+    graph_build_edges();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(3), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(3, routes[0].size());
+    ASSERT_EQ(100 + M_LABEL_MAX + 1, routes[0][1].short_channel_id);
+    ASSERT_EQ(200 + M_LABEL_MAX + 1, routes[0][2].short_channel_id);
+
+    //cltv上限内では手数料の一番安いもの
+    param.max_cltv_delta = 200 - 10 * M_LABEL_MAX + 10;
+    calc_route(&routes, 1, Node(1), Node(3), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(200 + M_LABEL_MAX, routes[0][2].short_channel_id);
+}
+
+
+//snapshotから読み込んだgraph(mChannelsが空)でもcacheを使う
+TEST_F(routing, cache_csr)
+{
+    routing_budget_graph();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    cache_add("key", 1, routes, tmp);
+    mChannels.clear();
+
+    std::vector<route_t> cached;
+    ASSERT_TRUE(cache_get(&cached, "key", 1, 9, 100000, tmp, &param));
+    ASSERT_EQ(1, cached.size());
+    ASSERT_EQ(routes[0].size(), cached[0].size());
+
+    //現在の手数料を使う
+    mEdges[mEdgeStart[Node(4)]].fee_base_msat = 2000;
+    ASSERT_TRUE(cache_get(&cached, "key", 1, 9, 100000, tmp, &param));
+    ASSERT_EQ(2000, cached[0][3].fee_base_msat);
+
+    //skipしたchannelを含む経路は使わない
+    mSkip[3] = false;
+    ASSERT_FALSE(cache_get(&cached, "key", 1, 9, 100000, tmp, &param));
+}
+
+
+//CSR: node_from順のedgeと、node_to順の逆引き
+TEST_F(routing, csr_build)
+{
+    routing::AddChannel(10, 1, 2, 100, 10);
+    routing::UpdateChannel(10, 1, 200, 0, 20);      //dir1: node2 --> node1
+    routing::AddChannel(11, 2, 3, 300, 30);
+    routing::AddChannel(12, 1, 3, 400, 40);
+    routing::UpdateChannel(12, LN_CNLUPD_FLAGS_DISABLE, 400, 0, 40, 2);
+    graph_build_edges();
+
+    ASSERT_EQ(3, mNodes.size());
+    ASSERT_EQ(mNodes.size() + 1, mEdgeStart.size());
+    ASSERT_EQ(mNodes.size() + 1, mInStart.size());
+    ASSERT_EQ(3, mEdges.size());
+    ASSERT_EQ(3, mInEdges.size());
+    ASSERT_FALSE(mEdgeDirty);
+
+    ASSERT_EQ(1, mEdgeStart[Node(1) + 1] - mEdgeStart[Node(1)]);
+    ASSERT_EQ(2, mEdgeStart[Node(2) + 1] - mEdgeStart[Node(2)]);
+    ASSERT_EQ(0, mEdgeStart[Node(3) + 1] - mEdgeStart[Node(3)]);
+    for (uint32_t node = 0; node < mNodes.size(); node++) {
+        for (uint32_t lp = mEdgeStart[node]; lp < mEdgeStart[node + 1]; lp++) {
+            ASSERT_EQ(node, mEdges[lp].node_from);
+        }
+        ASSERT_EQ(1, mInStart[node + 1] - mInStart[node]);
+        for (uint32_t lp = mInStart[node]; lp < mInStart[node + 1]; lp++) {
+            ASSERT_EQ(node, mEdges[mInEdges[lp]].node_to);
+        }
+    }
+
+    //channelからedgeを引ける
+    for (int dir = 0; dir < 2; dir++) {
+        const edge_t *p_edge = &mEdges[mChannels[10].dir[dir].edge];
+        ASSERT_EQ(10, p_edge->short_channel_id);
+        ASSERT_EQ(mChannels[10].node[dir], p_edge->node_from);
+        ASSERT_EQ(mChannels[10].node[1 - dir], p_edge->node_to);
+    }
+    ASSERT_EQ(200, mEdges[mChannels[10].dir[1].edge].fee_base_msat);
+    ASSERT_EQ(20, mEdges[mChannels[10].dir[1].edge].cltv_expiry_delta);
+
+    //未登録node
+    uint8_t node_id[UCOIN_SZ_PUBKEY];
+    NodeId(node_id, 9);
+    ASSERT_EQ(M_NODE_NONE, node_search(node_id));
+    //prefixだけ違うnode_idは別node
+    NodeId(node_id, 1);
+    node_id[0] = 0x03;
+    ASSERT_EQ(M_NODE_NONE, node_search(node_id));
+}
+
+
+//壊れたsnapshotは範囲外を参照する前に弾く
+TEST_F(routing, snapshot_check)
+{
+    routing_budget_graph();
+    std::vector<uint32_t> edge_start(mEdgeStart);
+    std::vector<edge_t> edges(mEdges);
+    std::vector<uint32_t> in_start(mInStart);
+    std::vector<uint32_t> in_edges(mInEdges);
+    size_t node_num = mNodes.size();
+    size_t edge_num = mEdges.size();
+    ASSERT_TRUE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+
+    //edge_num超えの開始位置
+    edge_start[node_num] = (uint32_t)edge_num + 1;
+    ASSERT_FALSE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+    edge_start[node_num] = (uint32_t)edge_num;
+
+    //減少する開始位置
+    uint32_t start = edge_start[1];
+    edge_start[1] = edge_start[2] + 1;
+    ASSERT_FALSE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+    edge_start[1] = start;
+
+    //node数を超えるnode番号
+    edges[0].node_to = (uint32_t)node_num;
+    ASSERT_FALSE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+    edges[0].node_to = mEdges[0].node_to;
+
+    //並びと合わないnode_from
+    edges[0].node_from = (uint32_t)node_num - 1;
+    ASSERT_FALSE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+    edges[0].node_from = mEdges[0].node_from;
+
+    //edge数を超える逆引き
+    in_edges[0] = (uint32_t)edge_num;
+    ASSERT_FALSE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+    in_edges[0] = mInEdges[0];
+
+    ASSERT_TRUE(snap_check(node_num, edge_num, edge_start.data(), edges.data(), in_start.data(), in_edges.data()));
+}
+
+
+//有効/無効が変わらないchannel_updateは作り直さずにedgeを書き換える
+TEST_F(routing, csr_update)
+{
+    routing::AddChannel(10, 1, 2, 100, 10);
+    routing::AddChannel(11, 2, 3, 300, 30);
+    graph_build_edges();
+
+    routing::UpdateChannel(11, 0, 333, 7, 33, 2);
+    ASSERT_FALSE(mEdgeDirty);
+    const edge_t *p_edge = &mEdges[mChannels[11].dir[0].edge];
+    ASSERT_EQ(11, p_edge->short_channel_id);
+    ASSERT_EQ(333, p_edge->fee_base_msat);
+    ASSERT_EQ(7, p_edge->fee_prop_millionths);
+    ASSERT_EQ(33, p_edge->cltv_expiry_delta);
+
+    //古いchannel_updateは反映しない
+    routing::UpdateChannel(11, 0, 999, 0, 99, 1);
+    ASSERT_EQ(333, mEdges[mChannels[11].dir[0].edge].fee_base_msat);
+
+    //edgeの無いnode追加は行を足すだけ
+    uint8_t node_id[UCOIN_SZ_PUBKEY];
+    NodeId(node_id, 4);
+    uint32_t node = node_add(node_id);
+    ASSERT_FALSE(mEdgeDirty);
+    ASSERT_EQ(mNodes.size() + 1, mEdgeStart.size());
+    ASSERT_EQ(mNodes.size() + 1, mInStart.size());
+    ASSERT_EQ(mEdgeStart[node], mEdgeStart[node + 1]);
+    ASSERT_EQ(node, node_search(node_id));
+
+    //無効にすると作り直す
+    routing::UpdateChannel(11, LN_CNLUPD_FLAGS_DISABLE, 333, 7, 33, 3);
+    ASSERT_TRUE(mEdgeDirty);
+    graph_build_edges();
+    ASSERT_EQ(1, mEdges.size());
+    ASSERT_EQ(10, mEdges[0].short_channel_id);
+
+    //削除
+    graph_del_channel(10);
+    ASSERT_TRUE(mEdgeDirty);
+    graph_build_edges();
+    ASSERT_EQ(0, mEdges.size());
+}
+
+
+/*
+ *  1 --> 2 --> 6   (2 --> 6: 1000)
+ *  1 --> 3 --> 6   (3 --> 6: 2000)
+ *  1 --> 4 --> 6   (4 --> 6: 3000)
+ *  2 --> 3         (2 --> 3: 500)
+ */
+static void routing_kpaths_graph(void)
+{
+    routing::AddChannel(1, 1, 2, 0, 10);
+    routing::AddChannel(2, 2, 6, 1000, 10);
+    routing::AddChannel(3, 1, 3, 0, 10);
+    routing::AddChannel(4, 3, 6, 2000, 10);
+    routing::AddChannel(5, 1, 4, 0, 10);
+    routing::AddChannel(6, 4, 6, 3000, 10);
+    routing::AddChannel(7, 2, 3, 500, 10);
+    graph_build_edges();
+}
+
+
+//重みの小さい順に、loopしない経路を全部列挙する
+TEST_F(routing, kpaths)
+{
+    routing_kpaths_graph();
+
+    const uint64_t EXPECT[][3] = {
+        { 1, 2, 0 },        //1000
+        { 3, 4, 0 },        //2000
+        { 1, 7, 4 },        //500 + 2000
+        { 5, 6, 0 },        //3000
+    };
+
+    for (int weight = 0; weight < 2; weight++) {
+        ln_routing_param_t param;
+        InitParam(&param);
+        param.weight = (weight == 0) ? LN_ROUTING_WEIGHT_BASEFEE : LN_ROUTING_WEIGHT_AMOUNT;
+
+        std::vector<route_t> routes;
+        overlay_t tmp;
+        calc_route(&routes, 10, Node(1), Node(6), 9, 100000, tmp, &param);
+        ASSERT_EQ(ARRAY_SIZE(EXPECT), routes.size());
+
+        uint64_t prev = 0;
+        for (size_t lp = 0; lp < routes.size(); lp++) {
+            size_t num = (EXPECT[lp][2] != 0) ? 3 : 2;
+            ASSERT_EQ(num, routes[lp].size()) << "route " << lp;
+            for (size_t lp2 = 0; lp2 < num; lp2++) {
+                ASSERT_EQ(EXPECT[lp][lp2], routes[lp][lp2].short_channel_id) << "route " << lp;
+            }
+            uint64_t cost;
+            ASSERT_TRUE(RouteCost(&param, 100000, routes[lp], &cost));
+            ASSERT_LE(prev, cost);
+            prev = cost;
+        }
+
+        //上限数
+        calc_route(&routes, 2, Node(1), Node(6), 9, 100000, tmp, &param);
+        ASSERT_EQ(2, routes.size());
+        ASSERT_EQ(4, routes[1][1].short_channel_id);
+    }
+}
+
+
+//経路数が条件で減る
+TEST_F(routing, kpaths_budget)
+{
+    routing_kpaths_graph();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+    param.max_hop = 2;
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 10, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(3, routes.size());
+    for (size_t lp = 0; lp < routes.size(); lp++) {
+        ASSERT_EQ(2, routes[lp].size());
+    }
+
+    param.max_fee_msat = 2000;
+    calc_route(&routes, 10, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(2, routes.size());
+}
+
+
+//両方向有効なchannelをランダムに張る
+static void routing_random_graph(uint32_t Seed, int NodeNum, int ChanNum)
+{
+    uint32_t r = Seed;
+    for (int lp = 0; lp < ChanNum; lp++) {
+        r = r * 1103515245 + 12345;
+        uint8_t n1 = 1 + (r >> 16) % NodeNum;
+        r = r * 1103515245 + 12345;
+        uint8_t n2 = 1 + (r >> 16) % NodeNum;
+        if (n1 == n2) {
+            continue;
+        }
+        if (n1 > n2) {
+            std::swap(n1, n2);
+        }
+        uint64_t sci = lp + 1;
+        uint8_t node1[UCOIN_SZ_PUBKEY];
+        uint8_t node2[UCOIN_SZ_PUBKEY];
+        routing::NodeId(node1, n1);
+        routing::NodeId(node2, n2);
+        graph_add_channel(sci, node1, node2);
+        for (uint8_t dir = 0; dir < 2; dir++) {
+            r = r * 1103515245 + 12345;
+            routing::UpdateChannel(sci, dir, (r >> 16) % 5000, (r >> 8) % 2000, 10);
+        }
+    }
+    graph_build_edges();
+}
+
+
+//landmarkからの下限は実際の距離を超えない
+TEST_F(routing, alt_lower_bound)
+{
+    routing_random_graph(1, 40, 120);
+    LandmarkBuild();
+    ASSERT_FALSE(mLandmarks.empty());
+
+    lm_graph_t graph;
+    graph.node_num = (uint32_t)mNodes.size();
+    graph.edge_start = mEdgeStart;
+    graph.edges = mEdges;
+    graph.in_start = mInStart;
+    graph.in_edges = mInEdges;
+
+    std::vector<uint64_t> dist(graph.node_num);
+    for (int amt = 0; amt < M_LANDMARK_AMOUNT_NUM; amt++) {
+        for (uint32_t from = 0; from < graph.node_num; from++) {
+            landmark_dijkstra(graph, from, kLmAmount[amt], false, &dist[0]);
+            for (uint32_t to = 0; to < graph.node_num; to++) {
+                if (dist[to] == M_DIST_INF) {
+                    continue;
+                }
+                uint64_t lb = landmark_lb(amt, from, to);
+                ASSERT_NE(M_DIST_INF, lb) << from << " --> " << to;
+                ASSERT_LE(lb, dist[to]) << from << " --> " << to;
+            }
+        }
+    }
+
+    //landmark計算後に追加されたnodeは下限0
+    ASSERT_EQ(0, landmark_lb(0, 0, graph.node_num));
+}
+
+
+//ALTはDijkstraと同じ重みの経路を返す
+TEST_F(routing, alt_same_as_dijkstra)
+{
+    routing_random_graph(2, 40, 120);
+    LandmarkBuild();
+    ASSERT_FALSE(mLandmarks.empty());
+
+    const uint64_t AMOUNT = 5000000;
+    overlay_t tmp;
+    for (int weight = 0; weight < 2; weight++) {
+        ln_routing_param_t param_dij;
+        InitParam(&param_dij);
+        param_dij.weight = (weight == 0) ? LN_ROUTING_WEIGHT_BASEFEE : LN_ROUTING_WEIGHT_AMOUNT;
+        ln_routing_param_t param_alt = param_dij;
+        param_alt.algo = LN_ROUTING_ALGO_ALT;
+
+        int found = 0;
+        for (uint32_t payer = 0; payer < mNodes.size(); payer += 3) {
+            for (uint32_t payee = 1; payee < mNodes.size(); payee += 5) {
+                if (payer == payee) {
+                    continue;
+                }
+                std::vector<route_t> routes_dij;
+                std::vector<route_t> routes_alt;
+                calc_route(&routes_dij, 3, payer, payee, 9, AMOUNT, tmp, &param_dij);
+                calc_route(&routes_alt, 3, payer, payee, 9, AMOUNT, tmp, &param_alt);
+                ASSERT_EQ(routes_dij.size(), routes_alt.size()) << payer << " --> " << payee;
+                for (size_t lp = 0; lp < routes_dij.size(); lp++) {
+                    uint64_t cost_dij;
+                    uint64_t cost_alt;
+                    ASSERT_TRUE(RouteCost(&param_dij, AMOUNT, routes_dij[lp], &cost_dij));
+                    ASSERT_TRUE(RouteCost(&param_alt, AMOUNT, routes_alt[lp], &cost_alt));
+                    ASSERT_EQ(cost_dij, cost_alt) << payer << " --> " << payee << " [" << lp << "]";
+                }
+                found += (routes_dij.empty()) ? 0 : 1;
+            }
+        }
+        ASSERT_LT(0, found);
+    }
+}
+
+
+//graphが変わったらlandmarkは使わない
+TEST_F(routing, alt_stale)
+{
+    routing_budget_graph();
+    LandmarkBuild();
+
+    //手数料を下げると下限が成り立たなくなる
+    routing::UpdateChannel(6, 0, 0, 0, 10, 2);
+    ASSERT_NE(mLmVersion, mGraphVersion);
+
+    ln_routing_param_t param;
+    InitParam(&param);
+    param.algo = LN_ROUTING_ALGO_ALT;
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(4, routes[0].size());
+    ASSERT_EQ(5, routes[0][2].short_channel_id);
+    ASSERT_EQ(6, routes[0][3].short_channel_id);
+}
+
+
+//routing_kpaths_graph()の1 --> 2 --> 6で送金した経路
+static void routing_mc_hops(ln_hop_datain_t *pHop, uint64_t AmountMsat)
+{
+    memset(pHop, 0, sizeof(ln_hop_datain_t) * 3);
+    routing::NodeId(pHop[0].pubkey, 1);
+    pHop[0].short_channel_id = 1;
+    pHop[0].amt_to_forward = AmountMsat + 1000;
+    routing::NodeId(pHop[1].pubkey, 2);
+    pHop[1].short_channel_id = 2;
+    pHop[1].amt_to_forward = AmountMsat;
+    routing::NodeId(pHop[2].pubkey, 6);
+    pHop[2].amt_to_forward = AmountMsat;
+}
+
+
+//残高不足で失敗したchannelは、失敗した金額以上では避ける
+TEST_F(routing, mc_channel)
+{
+    routing_kpaths_graph();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    ln_hop_datain_t hop[3];
+    routing_mc_hops(hop, 100000);
+    ln_onion_err_t err;
+    err.reason = LNONION_TMP_CHAN_FAIL;
+    err.p_data = NULL;
+    ln_routing_mc_fail(hop, 3, 0, &err);     //node2が返したエラー
+
+    uint32_t chan_num;
+    uint32_t node_num;
+    ln_routing_mc_stat(&chan_num, &node_num);
+    ASSERT_EQ(1, chan_num);
+    ASSERT_EQ(0, node_num);
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(4, routes[0][1].short_channel_id);
+
+    calc_route(&routes, 1, Node(1), Node(6), 9, 50000, tmp, &param);
+    ASSERT_EQ(1, routes.size());
+    ASSERT_EQ(2, routes[0][1].short_channel_id);
+
+    //同じ金額で送金できたら取り消す
+    ln_routing_mc_success(hop, 3);
+    ln_routing_mc_stat(&chan_num, &node_num);
+    ASSERT_EQ(0, chan_num);
+    calc_route(&routes, 1, Node(1), Node(6), 9, 100000, tmp, &param);
+    ASSERT_EQ(2, routes[0][1].short_channel_id);
+}
+
+
+//nodeの失敗は、そのnodeから出るedge全部を避ける
+TEST_F(routing, mc_node)
+{
+    routing_kpaths_graph();
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    ln_hop_datain_t hop[3];
+    routing_mc_hops(hop, 100000);
+    ln_onion_err_t err;
+    err.reason = LNONION_TMP_NODE_FAIL;
+    err.p_data = NULL;
+    ln_routing_mc_fail(hop, 3, 0, &err);
+
+    uint32_t chan_num;
+    uint32_t node_num;
+    ln_routing_mc_stat(&chan_num, &node_num);
+    ASSERT_EQ(0, chan_num);
+    ASSERT_EQ(1, node_num);
+
+    std::vector<route_t> routes;
+    overlay_t tmp;
+    calc_route(&routes, 3, Node(1), Node(6), 9, 1000, tmp, &param);
+    ASSERT_EQ(3, routes.size());
+    ASSERT_EQ(3, routes[0][0].short_channel_id);
+    ASSERT_EQ(5, routes[1][0].short_channel_id);
+    //node2を経由する経路は最後
+    ASSERT_EQ(1, routes[2][0].short_channel_id);
+
+    //送金先のエラーは記録しない
+    mMcNode.clear();
+    ln_routing_mc_fail(hop, 3, 1, &err);
+    ln_routing_mc_stat(&chan_num, &node_num);
+    ASSERT_EQ(0, chan_num);
+    ASSERT_EQ(0, node_num);
+
+    //onionを壊したのは転送したnode
+    err.reason = LNONION_INV_ONION_HMAC;
+    ln_routing_mc_fail(hop, 3, 1, &err);
+    ln_routing_mc_stat(&chan_num, &node_num);
+    ASSERT_EQ(1, node_num);
+    node_key_t key;
+    memcpy(key.node_id, hop[1].pubkey, UCOIN_SZ_PUBKEY);
+    ASSERT_TRUE(mMcNode.find(key) != mMcNode.end());
+}
+
+
+//失敗記録は時間とともに戻り、M_MC_FORGETで破棄する
+TEST_F(routing, mc_decay)
+{
+    mc_t mc;
+    mc.fail_time = 1000000;
+    mc.fail_amount = 0;
+    ASSERT_DOUBLE_EQ(0.0, mc_prob(&mc, mc.fail_time));
+    ASSERT_DOUBLE_EQ(0.5, mc_prob(&mc, mc.fail_time + M_MC_HALFLIFE));
+    ASSERT_DOUBLE_EQ(0.75, mc_prob(&mc, mc.fail_time + M_MC_HALFLIFE * 2));
+    mc.fail_time = 0;
+    ASSERT_DOUBLE_EQ(1.0, mc_prob(&mc, 1000000));
+
+    node_key_t key;
+    NodeId(key.node_id, 2);
+    mMcNode[key].fail_time = 1000000;
+    mMcChan[2].dir[0].fail_time = 1000000;
+    mc_prune(1000000 + M_MC_FORGET);
+    ASSERT_EQ(1, mMcNode.size());
+    ASSERT_EQ(1, mMcChan.size());
+    mc_prune(1000000 + M_MC_FORGET + 1);
+    ASSERT_EQ(0, mMcNode.size());
+    ASSERT_EQ(0, mMcChan.size());
+}
+
+
+//自channel(7 --> 1)とr field(6 --> 9)を使うln_routing_calculate()
+static ln_self_t mRoutingSelf;
+
+static bool routing_self_search(ln_db_func_cmp_t pFunc, void *pFuncParam)
+{
+    memset(&mRoutingSelf, 0, sizeof(mRoutingSelf));
+    mRoutingSelf.short_channel_id = 0x700;
+    routing::NodeId(mRoutingSelf.peer_node_id, 1);
+    (*pFunc)(&mRoutingSelf, NULL, pFuncParam);
+    return false;
+}
+
+
+//graphに無いnodeは計算時だけ追加し、graphには残さない
+TEST_F(routing, calculate_tmp_edges)
+{
+    routing_budget_graph();
+    mGraphLoaded = true;
+    mSkipLoaded = true;
+    size_t node_num = mNodes.size();
+    ln_db_self_search_fake.custom_fake = routing_self_search;
+
+    uint8_t payer[UCOIN_SZ_PUBKEY];
+    uint8_t payee[UCOIN_SZ_PUBKEY];
+    NodeId(payer, 7);
+    NodeId(payee, 9);
+    ln_fieldr_t fieldr;
+    memset(&fieldr, 0, sizeof(fieldr));
+    NodeId(fieldr.node_id, 6);
+    fieldr.short_channel_id = 0x600;
+    fieldr.fee_base_msat = 3000;
+    fieldr.cltv_expiry_delta = 40;
+
+    ln_routing_param_t param;
+    InitParam(&param);
+
+    uint64_t hit;
+    uint64_t miss;
+    uint32_t num;
+    ln_routing_cache_stat(&hit, &miss, &num);
+    uint64_t hit_prev = hit;
+    for (int loop = 0; loop < 2; loop++) {
+        ln_routing_result_t result;
+        lnerr_route_t rerr = ln_routing_calculate(&result, payer, payee, 9, 100000, 1, &fieldr, &param);
+        ASSERT_EQ(LNROUTE_NONE, rerr);
+        ASSERT_EQ(1, ln_db_self_search_fake.call_count - loop);
+
+        //7 --> 1 --> 2 --> 3 --> 4 --> 6 --> 9
+        const uint64_t SCI[] = { 0x700, 1, 2, 3, 4, 0x600, 0 };
+        ASSERT_EQ(ARRAY_SIZE(SCI), result.hop_num);
+        for (int lp = 0; lp < result.hop_num; lp++) {
+            ASSERT_EQ(SCI[lp], result.hop_datain[lp].short_channel_id) << "hop " << lp;
+        }
+        ASSERT_EQ(0, memcmp(payer, result.hop_datain[0].pubkey, UCOIN_SZ_PUBKEY));
+        ASSERT_EQ(0, memcmp(fieldr.node_id, result.hop_datain[5].pubkey, UCOIN_SZ_PUBKEY));
+        ASSERT_EQ(0, memcmp(payee, result.hop_datain[6].pubkey, UCOIN_SZ_PUBKEY));
+        ASSERT_EQ(100000, result.hop_datain[6].amt_to_forward);
+        ASSERT_EQ(100000, result.hop_datain[5].amt_to_forward);
+        //r fieldの手数料は6が受け取る
+        ASSERT_EQ(100000 + 3000, result.hop_datain[4].amt_to_forward);
+        ASSERT_EQ(9 + 40, result.hop_datain[4].outgoing_cltv_value);
+
+        ASSERT_EQ(node_num, mNodes.size());
+        ASSERT_EQ(node_num, mNodeIndex.size());
+        ASSERT_EQ(M_NODE_NONE, node_search(payer));
+        ASSERT_EQ(M_NODE_NONE, node_search(payee));
+    }
+
+    //2回目はcacheの経路
+    ln_routing_cache_stat(&hit, &miss, &num);
+    ASSERT_EQ(hit_prev + 1, hit);
+
+    //r fieldが無ければpayeeに届かない
+    ln_routing_result_t result;
+    ASSERT_EQ(LNROUTE_NOGOAL, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, &param));
+    ASSERT_EQ(node_num, mNodes.size());
+}
@@ -0,0 +1,160 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, btcprc_get_short_channel_txid, uint8_t *, int, int);
+FAKE_VALUE_FUNC(bool, btcprc_getxout, bool *, uint64_t *, const uint8_t *, int);
+FAKE_VALUE_FUNC(bool, btcprc_getblock_spent, ucoin_buf_t *, int);
+
+////////////////////////////////////////////////////////////////////////
+
+namespace UNSPENT {
+    const int32_t HEIGHT = 600000;
+
+    //getblockで使用済みとして返すoutpoint
+    std::vector<btcprc_outpoint_t> spent;
+
+    //block height, block indexからtxidを作る
+    void Txid(uint8_t *pTxid, int BHeight, int BIndex)
+    {
+        memset(pTxid, 0, UCOIN_SZ_TXID);
+        memcpy(pTxid, &BHeight, sizeof(BHeight));
+        memcpy(pTxid + sizeof(BHeight), &BIndex, sizeof(BIndex));
+    }
+
+    bool get_short_channel_txid(uint8_t *pTxid, int BHeight, int BIndex)
+    {
+        Txid(pTxid, BHeight, BIndex);
+        return true;
+    }
+
+    bool getxout(bool *pUnspent, uint64_t *pSat, const uint8_t *pTxid, int Txidx)
+    {
+        *pUnspent = true;
+        *pSat = 100000;
+        return true;
+    }
+
+    bool getblock_spent(ucoin_buf_t *pSpent, int BHeight)
+    {
+        ucoin_buf_alloccopy(pSpent, (const uint8_t *)spent.data(), sizeof(btcprc_outpoint_t) * spent.size());
+        return true;
+    }
+}
+
+class unspent: public testing::Test {
+protected:
+    virtual void SetUp() {
+        RESET_FAKE(btcprc_get_short_channel_txid)
+        RESET_FAKE(btcprc_getxout)
+        RESET_FAKE(btcprc_getblock_spent)
+        btcprc_get_short_channel_txid_fake.custom_fake = UNSPENT::get_short_channel_txid;
+        btcprc_getxout_fake.custom_fake = UNSPENT::getxout;
+        btcprc_getblock_spent_fake.custom_fake = UNSPENT::getblock_spent;
+        UNSPENT::spent.clear();
+        ucoin_init(UCOIN_TESTNET, false);
+        unspent_init();
+        unspent_update(UNSPENT::HEIGHT);
+    }
+
+    virtual void TearDown() {
+        unspent_term();
+        ASSERT_EQ(0, ucoin_dbg_malloc_cnt());
+        ucoin_term();
+    }
+
+public:
+    static uint64_t Sci(uint32_t Height, uint32_t BIndex)
+    {
+        return ((uint64_t)Height << 40) | ((uint64_t)BIndex << 16);
+    }
+
+    static void RpcReset()
+    {
+        RESET_FAKE(btcprc_get_short_channel_txid)
+        RESET_FAKE(btcprc_getxout)
+        btcprc_get_short_channel_txid_fake.custom_fake = UNSPENT::get_short_channel_txid;
+        btcprc_getxout_fake.custom_fake = UNSPENT::getxout;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+//初期サイズより多いchannelでも、2回目はbitcoindに問い合わせない
+TEST_F(unspent, second_pass)
+{
+    const uint32_t NUM = 20000;
+    bool unspent;
+
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(unspent_check(Sci(500000 + lp / 100, lp % 100), &unspent));
+        ASSERT_TRUE(unspent);
+    }
+    ASSERT_EQ(NUM, btcprc_get_short_channel_txid_fake.call_count);
+    ASSERT_EQ(NUM, btcprc_getxout_fake.call_count);
+
+    RpcReset();
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(unspent_check(Sci(500000 + lp / 100, lp % 100), &unspent));
+        ASSERT_TRUE(unspent);
+    }
+    ASSERT_EQ(0, btcprc_get_short_channel_txid_fake.call_count);
+    ASSERT_EQ(0, btcprc_getxout_fake.call_count);
+}
+
+
+//新しいblockで使用されたfunding_txだけ使用済みにする
+TEST_F(unspent, spent_in_block)
+{
+    bool unspent;
+
+    for (uint32_t lp = 0; lp < 10; lp++) {
+        ASSERT_TRUE(unspent_check(Sci(500000, lp), &unspent));
+    }
+    btcprc_outpoint_t outpoint;
+    UNSPENT::Txid(outpoint.txid, 500000, 3);
+    outpoint.index = 0;
+    UNSPENT::spent.push_back(outpoint);
+    unspent_update(UNSPENT::HEIGHT + 1);
+    ASSERT_EQ(1, btcprc_getblock_spent_fake.call_count);
+    ASSERT_EQ(UNSPENT::HEIGHT + 1, btcprc_getblock_spent_fake.arg1_val);
+
+    RpcReset();
+    for (uint32_t lp = 0; lp < 10; lp++) {
+        ASSERT_TRUE(unspent_check(Sci(500000, lp), &unspent));
+        ASSERT_EQ(lp != 3, unspent);
+    }
+    ASSERT_TRUE(unspent_is_spent(Sci(500000, 3)));
+    ASSERT_FALSE(unspent_is_spent(Sci(500000, 4)));
+    ASSERT_EQ(0, btcprc_get_short_channel_txid_fake.call_count);
+}
+
+
+//未使用としてキャッシュしているものが無ければblockを取得しない
+TEST_F(unspent, no_getblock)
+{
+    unspent_update(UNSPENT::HEIGHT + 1);
+    ASSERT_EQ(0, btcprc_getblock_spent_fake.call_count);
+
+    bool unspent;
+    ASSERT_TRUE(unspent_check(Sci(500000, 0), &unspent));
+    unspent_update(UNSPENT::HEIGHT + 2);
+    ASSERT_EQ(1, btcprc_getblock_spent_fake.call_count);
+}
+
+
+//問い合わせ失敗は使用済みとせず、キャッシュもしない
+TEST_F(unspent, rpc_fail)
+{
+    bool unspent;
+
+    btcprc_get_short_channel_txid_fake.custom_fake = NULL;
+    btcprc_get_short_channel_txid_fake.return_val = false;
+    ASSERT_FALSE(unspent_check(Sci(500000, 0), &unspent));
+    ASSERT_FALSE(unspent_is_spent(Sci(500000, 0)));
+    ASSERT_EQ(0, btcprc_getxout_fake.call_count);
+
+    RpcReset();
+    ASSERT_TRUE(unspent_check(Sci(500000, 0), &unspent));
+    ASSERT_TRUE(unspent);
+    ASSERT_EQ(1, btcprc_get_short_channel_txid_fake.call_count);
+}
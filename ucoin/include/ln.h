@@ -69,6 +69,7 @@ extern "C" {
 #define LN_NODE_MAX                     (5)         ///< 保持するノード情報数   TODO:暫定
 #define LN_CHANNEL_MAX                  (10)        ///< 保持するチャネル情報数 TODO:暫定
 #define LN_HOP_MAX                      (20)        ///< onion hop数
+#define LN_GOSSIPQ_SHORT_IDS_MAX        (8000)      ///< gossip queriesの1メッセージに載せるshort_channel_id数
 #define LN_FEERATE_PER_KW               (500)       ///< estimate feeできなかった場合のfeerate_per_kw
 #define LN_FEERATE_PER_KW_MIN           (253)       ///< feerate_per_kwの下限
                                                     // https://github.com/ElementsProject/lightning/blob/86290b54d49d183e49f905be6a18bfc65612580e/lightningd/chaintopology.c#L298
@@ -187,7 +188,7 @@ typedef enum {
     LN_CB_FUNDINGTX_WAIT,       ///< funding_tx安定待ち要求
     LN_CB_FUNDINGLOCKED_RECV,   ///< funding_locked受信通知
     LN_CB_CHANNEL_ANNO_RECV,    ///< channel_announcement受信通知
-    LN_CB_NODE_ANNO_RECV,       ///< node_announcement受信通知
+    LN_CB_NODE_ANNO_RECV,       ///< node_announcement受信通知(#ln_anno_verify_start()時は通知しない)
     LN_CB_ANNO_SIGSED,          ///< announcement_signatures完了通知
     LN_CB_ADD_HTLC_RECV_PREV,   ///< update_add_htlc処理前通知
     LN_CB_ADD_HTLC_RECV,        ///< update_add_htlc受信通知
@@ -203,6 +204,11 @@ typedef enum {
     LN_CB_SEND_REQ,             ///< peerへの送信要求
     LN_CB_SET_LATEST_FEERATE,   ///< feerate_per_kw更新要求
     LN_CB_GETBLOCKCOUNT,        ///< getblockcount
+    LN_CB_QUERY_SHORT_IDS_RECV, ///< query_short_channel_ids受信通知
+    LN_CB_REPLY_SHORT_IDS_END_RECV, ///< reply_short_channel_ids_end受信通知
+    LN_CB_REPLY_CHANNEL_RANGE_RECV, ///< reply_channel_range受信通知
+    LN_CB_GOSSIP_FILTER_RECV,   ///< gossip_timestamp_filter受信通知
+    LN_CB_QUERY_CHANNEL_RANGE_RECV, ///< query_channel_range受信通知
     LN_CB_MAX,
 } ln_cb_t;
 
@@ -680,6 +686,45 @@ typedef struct {
 } ln_announce_signs_t;
 
 
+/** @struct     ln_query_short_ids_t
+ *  @brief      query_short_channel_ids
+ */
+typedef struct {
+    uint64_t    *p_short_ids;                       ///< encoded_short_ids(encoding_type=0)
+    int         num;                                ///< p_short_ids数
+} ln_query_short_ids_t;
+
+
+/** @struct     ln_query_channel_range_t
+ *  @brief      query_channel_range
+ */
+typedef struct {
+    uint32_t    first_blocknum;                     ///< 4:  first_blocknum
+    uint32_t    number_of_blocks;                   ///< 4:  number_of_blocks
+} ln_query_channel_range_t;
+
+
+/** @struct     ln_reply_channel_range_t
+ *  @brief      reply_channel_range
+ */
+typedef struct {
+    uint32_t    first_blocknum;                     ///< 4:  first_blocknum
+    uint32_t    number_of_blocks;                   ///< 4:  number_of_blocks
+    uint8_t     complete;                           ///< 1:  complete
+    uint64_t    *p_short_ids;                       ///< encoded_short_ids(encoding_type=0)
+    int         num;                                ///< p_short_ids数
+} ln_reply_channel_range_t;
+
+
+/** @struct     ln_gossip_filter_t
+ *  @brief      gossip_timestamp_filter
+ */
+typedef struct {
+    uint32_t    first_timestamp;                    ///< 4:  first_timestamp
+    uint32_t    timestamp_range;                    ///< 4:  timestamp_range
+} ln_gossip_filter_t;
+
+
 /** @struct     ln_anno_prm_t
  *  @brief      announce関連のパラメータ
  */
@@ -740,6 +785,38 @@ typedef struct {
     ln_hop_datain_t     hop_datain[1 + LN_HOP_MAX];     //先頭は送信者
 } ln_routing_result_t;
 
+
+/** @enum       ln_routing_weight_t
+ *  @brief      #ln_routing_calculate()の重み付け
+ */
+typedef enum {
+    LN_ROUTING_WEIGHT_AMOUNT,               ///< 送金額に対する手数料(payeeから逆順に計算)
+    LN_ROUTING_WEIGHT_BASEFEE,              ///< fee_base_msatのみ
+} ln_routing_weight_t;
+
+
+/** @enum       ln_routing_algo_t
+ *  @brief      #ln_routing_calculate()の探索方法
+ */
+typedef enum {
+    LN_ROUTING_ALGO_DIJKSTRA,               ///< Dijkstra
+    LN_ROUTING_ALGO_ALT,                    ///< landmarkを使ったA*(ALT)。landmark未計算時はDijkstra
+} ln_routing_algo_t;
+
+
+/** @struct     ln_routing_param_t
+ *  @brief      #ln_routing_calculate()の探索条件
+ *  @note
+ *      - budgetを超える経路は探索途中で打ち切る(#LN_ROUTING_WEIGHT_AMOUNT時)
+ */
+typedef struct {
+    ln_routing_weight_t weight;             ///< 重み付け
+    ln_routing_algo_t   algo;               ///< 探索方法(結果は同じ)
+    uint8_t             max_hop;            ///< 経由するchannel数上限(0:#LN_HOP_MAX)
+    uint32_t            max_cltv_delta;     ///< cltv_expiry_delta合計の上限(0:制限なし)
+    uint64_t            max_fee_msat;       ///< 手数料合計の上限(0:制限なし)
+} ln_routing_param_t;
+
 /// @}
 
 
@@ -850,6 +927,16 @@ typedef struct {
 } ln_cb_channel_anno_recv_t;
 
 
+/** @struct ln_cb_short_ids_recv_t
+ *  @brief  short_channel_id一覧受信通知(#LN_CB_QUERY_SHORT_IDS_RECV / #LN_CB_REPLY_CHANNEL_RANGE_RECV)
+ */
+typedef struct {
+    const uint64_t          *p_short_ids;           ///< 受信したshort_channel_id(コールバック中のみ有効)
+    int                     num;                    ///< p_short_ids数
+    bool                    complete;               ///< (reply_channel_range)complete
+} ln_cb_short_ids_recv_t;
+
+
 /**************************************************************************
  * typedefs : 管理データ
  **************************************************************************/
@@ -1453,6 +1540,88 @@ bool ln_create_commit_signed(ln_self_t *self, ucoin_buf_t *pCommSig);
 bool ln_create_update_fee(ln_self_t *self, ucoin_buf_t *pUpdFee, uint32_t FeeratePerKw);
 
 
+/********************************************************************
+ * gossip queries
+ ********************************************************************/
+
+/** gossip queries使用可否
+ *
+ * @param[in]           self            channel情報
+ * @retval      true    init交換でお互いがgossip_queriesを持っている
+ */
+bool ln_is_gossip_queries(const ln_self_t *self);
+
+
+/** query_short_channel_ids作成
+ *
+ * @param[in,out]       self            channel情報
+ * @param[out]          pQuery          生成したquery_short_channel_idsメッセージ
+ * @param[in]           pShortIds       要求するshort_channel_id
+ * @param[in]           Num             pShortIds数(#LN_GOSSIPQ_SHORT_IDS_MAX以下)
+ * @retval      true    成功
+ */
+bool ln_create_query_short_channel_ids(ln_self_t *self, ucoin_buf_t *pQuery, const uint64_t *pShortIds, int Num);
+
+
+/** reply_short_channel_ids_end作成
+ *
+ * @param[in,out]       self            channel情報
+ * @param[out]          pReply          生成したreply_short_channel_ids_endメッセージ
+ * @param[in]           bComplete       true:要求されたshort_channel_idの情報を持っていた
+ * @retval      true    成功
+ */
+bool ln_create_reply_short_channel_ids_end(ln_self_t *self, ucoin_buf_t *pReply, bool bComplete);
+
+
+/** query_channel_range作成
+ *
+ * @param[in,out]       self            channel情報
+ * @param[out]          pQuery          生成したquery_channel_rangeメッセージ
+ * @param[in]           FirstBlock      first_blocknum
+ * @param[in]           Num             number_of_blocks
+ * @retval      true    成功
+ */
+bool ln_create_query_channel_range(ln_self_t *self, ucoin_buf_t *pQuery, uint32_t FirstBlock, uint32_t Num);
+
+
+/** reply_channel_range作成
+ *
+ * @param[in,out]       self            channel情報
+ * @param[out]          pReply          生成したreply_channel_rangeメッセージ
+ * @param[in]           pQuery          受信したquery_channel_range
+ * @param[in]           pShortIds       範囲内のshort_channel_id
+ * @param[in]           Num             pShortIds数(#LN_GOSSIPQ_SHORT_IDS_MAX以下)
+ * @param[in]           bComplete       true:最後のreply_channel_range
+ * @retval      true    成功
+ */
+bool ln_create_reply_channel_range(ln_self_t *self, ucoin_buf_t *pReply, const ln_query_channel_range_t *pQuery, const uint64_t *pShortIds, int Num, bool bComplete);
+
+
+/** gossip_timestamp_filter作成
+ *
+ * @param[in,out]       self            channel情報
+ * @param[out]          pFilter         生成したgossip_timestamp_filterメッセージ
+ * @param[in]           FirstTimeStamp  first_timestamp
+ * @param[in]           Range           timestamp_range
+ * @retval      true    成功
+ */
+bool ln_create_gossip_timestamp_filter(ln_self_t *self, ucoin_buf_t *pFilter, uint32_t FirstTimeStamp, uint32_t Range);
+
+
+/** channel_announcementからshort_channel_idとnode_id取得
+ *
+ * query_short_channel_idsへの応答でnode_announcementを探すために使用する。
+ *
+ * @param[out]          p_short_channel_id  short_channel_id
+ * @param[out]          pNodeId1            node_id_1
+ * @param[out]          pNodeId2            node_id_2
+ * @param[in]           pData               channel_announcement
+ * @param[in]           Len                 pData長
+ * @retval      true    解析成功
+ */
+bool ln_getids_cnl_anno(uint64_t *p_short_channel_id, uint8_t *pNodeId1, uint8_t *pNodeId2, const uint8_t *pData, uint16_t Len);
+
+
 /********************************************************************
  * others
  ********************************************************************/
@@ -2068,6 +2237,32 @@ bool ln_node_search_nodeanno(ln_node_announce_t *pNodeAnno, const uint8_t *pNode
 uint64_t ln_node_total_msat(void);
 
 
+/********************************************************************
+ * ANNOUNCEMENT
+ ********************************************************************/
+
+/** announcement署名検証thread開始
+ *
+ * 受信したchannel_update/node_announcementの署名検証をworker threadで行い、
+ * 検証できたものをまとめてDB保存する。
+ * 開始していない場合は、受信したthreadで検証・保存する。
+ *
+ * @param[in]       Num             thread数(0:CPU数)
+ * @retval      true    成功
+ * @note
+ *      - 開始中は #LN_CB_NODE_ANNO_RECV は通知されない
+ */
+bool ln_anno_verify_start(int Num);
+
+
+/** announcement署名検証thread停止
+ *
+ * 検証待ちのものを全て保存してから停止する。
+ * #ln_db_term() や #ln_routing_term() より前に呼ぶこと。
+ */
+void ln_anno_verify_stop(void);
+
+
 /********************************************************************
  * ONION
  ********************************************************************/
@@ -2143,6 +2338,79 @@ bool ln_onion_read_err(ln_onion_err_t *pOnionErr, const ucoin_buf_t *pReason);
  * routing
  ********************************************************************/
 
+/** routing graph構築
+ *
+ * DBのchannel_announcement/channel_updateからgraphを構築する。
+ * 以降はDBへのchannel_announcement/channel_update保存、削除に合わせて差分更新される。
+ * 呼ばずに #ln_routing_calculate() した場合は、最初の計算時に構築する。
+ * #ln_routing_snapshot_load() で構築済みの場合は、DBから構築し直さない。
+ * また、#LN_ROUTING_ALGO_ALT用のlandmark計算threadを開始する。
+ *
+ * @retval  true    成功
+ */
+bool ln_routing_init(void);
+
+
+/** routing graph解放
+ *
+ */
+void ln_routing_term(void);
+
+
+/** routing graphのsnapshot保存
+ *
+ * graphを #LNDB_GRAPH_SNAPSHOT にmmapでそのまま使える形式で書き出す。
+ * 前回保存からgraphに変更が無い場合は、headerのDB transaction idだけ更新する。
+ * 書込みは一時ファイルからrenameするため、読込み側が途中の状態を見ることはない。
+ *
+ * @retval  true    保存した or 変更なし
+ */
+bool ln_routing_snapshot_save(void);
+
+
+/** routing graphのsnapshot読込み
+ *
+ * #ln_routing_snapshot_save() したファイルからgraphを構築する。
+ * 読み込めない場合は、最初の計算時にDBから構築する。
+ * DBの方が新しく、snapshotが一定時間更新されていない場合(ucoind停止など)や、
+ * CSRの範囲が合わない壊れたファイルも読み込まない。
+ *
+ * @param[in]   pPath           snapshotファイル
+ * @retval  true    成功
+ * @note
+ *      - routingコマンドなど、graphを差分更新しないプロセス用
+ */
+bool ln_routing_snapshot_load(const char *pPath);
+
+
+/** routing graphをDBに合わせて差分更新
+ *
+ * DBのchannel_updateのうち反映済みより新しいものだけを反映し、DBから削除されたchannelを削除する。
+ * 変更の無いchannelを使う経路cacheやlandmarkはそのまま使う。
+ * graph未構築、または #ln_routing_snapshot_load() で構築した場合は、DBから構築し直す。
+ *
+ * @retval  true    成功
+ * @note
+ *      - routingコマンドのdaemonなど、DB保存時の差分更新を受けないプロセス用
+ *      - #ln_routing_freeze() 後は使用できない
+ */
+bool ln_routing_refresh(void);
+
+
+/** routing graph固定
+ *
+ * graphを構築済みでなければDBから構築し、以降は更新しない。
+ * 固定後は #ln_routing_calculate() / #ln_routing_calculate_paths() を複数threadから同時に呼び出せる。
+ * (経路cacheは使わない)
+ *
+ * @retval  true    成功
+ * @note
+ *      - routingコマンドのbatch処理など、graphを更新しないプロセス用
+ *      - 固定後はskip DBやmission controlを更新しないこと
+ */
+bool ln_routing_freeze(void);
+
+
 /** 支払いルート作成
  *
  * @param[out]  pResult
@@ -2152,6 +2420,7 @@ bool ln_onion_read_err(ln_onion_err_t *pOnionErr, const ucoin_buf_t *pReason);
  * @param[in]   AmountMsat
  * @param[in]   AddNum          追加route数(invoiceのr fieldを想定)
  * @param[in]   pAddRoute       追加route(invoiceのr fieldを想定)
+ * @param[in]   pParam          探索条件(NULL時はデフォルト: #LN_ROUTING_WEIGHT_BASEFEE, #LN_ROUTING_ALGO_DIJKSTRA)
  * @return  LNERR_ROUTE_xxx
  */
 lnerr_route_t ln_routing_calculate(
@@ -2161,7 +2430,89 @@ lnerr_route_t ln_routing_calculate(
         uint32_t CltvExpiry,
         uint64_t AmountMsat,
         uint8_t AddNum,
-        const ln_fieldr_t *pAddRoute);
+        const ln_fieldr_t *pAddRoute,
+        const ln_routing_param_t *pParam);
+
+
+/** 支払いルート作成(複数候補)
+ *
+ * 重みの小さい順に、同じnodeを2回経由しない経路を最大*pNum個作成する。
+ * 送金失敗時は再計算せずに次の候補を使うことができる。
+ *
+ * @param[out]      pResult         経路(配列)
+ * @param[in,out]   pNum            [in]pResultの要素数, [out]作成した経路数
+ * @param[in]       pPayerId
+ * @param[in]       pPayeeId
+ * @param[in]       CltvExpiry
+ * @param[in]       AmountMsat
+ * @param[in]       AddNum          追加route数(invoiceのr fieldを想定)
+ * @param[in]       pAddRoute       追加route(invoiceのr fieldを想定)
+ * @param[in]       pParam          探索条件(NULL時はデフォルト)
+ * @return  LNERR_ROUTE_xxx
+ */
+lnerr_route_t ln_routing_calculate_paths(
+        ln_routing_result_t *pResult,
+        uint8_t *pNum,
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_fieldr_t *pAddRoute,
+        const ln_routing_param_t *pParam);
+
+
+/** 経路がskip DBのchannelを含まないか
+ *
+ * #ln_routing_calculate_paths()で作成した候補を使う前にチェックする。
+ *
+ * @param[in]   pResult
+ * @retval  true    skip DBに載ったchannelを含まない
+ */
+bool ln_routing_check_skip(const ln_routing_result_t *pResult);
+
+
+/** 経路cache統計
+ *
+ * 同じpayee/送金額帯/cltv_expiryの経路計算はcacheを使う。
+ *
+ * @param[out]  pHit            cacheを使った回数
+ * @param[out]  pMiss           経路計算した回数
+ * @param[out]  pNum            cache数
+ */
+void ln_routing_cache_stat(uint64_t *pHit, uint64_t *pMiss, uint32_t *pNum);
+
+
+/** 送金失敗の記録(mission control)
+ *
+ * エラーを返したnodeとreasonから失敗したchannel/nodeを判断し、
+ * 経路計算で失敗時間からの経過に応じた重みを加算する。
+ * エラーを返したnodeまでのchannelは送金できたものとして記録する。
+ *
+ * @param[in]   pHopDatain      送金した経路(先頭は送金元)
+ * @param[in]   HopNum          pHopDatainの要素数
+ * @param[in]   ErrHop          エラーを返したnode(#ln_onion_failure_read()のhop。0が送金元の隣)
+ * @param[in]   pOnionErr       #ln_onion_read_err()の結果
+ */
+void ln_routing_mc_fail(const ln_hop_datain_t *pHopDatain, int HopNum, int ErrHop, const ln_onion_err_t *pOnionErr);
+
+
+/** 送金成功の記録(mission control)
+ *
+ * 経路上のchannel/nodeの失敗記録のうち、送金できた金額以下のものを取り消す。
+ *
+ * @param[in]   pHopDatain      送金した経路(先頭は送金元)
+ * @param[in]   HopNum          pHopDatainの要素数
+ */
+void ln_routing_mc_success(const ln_hop_datain_t *pHopDatain, int HopNum);
+
+
+/** mission control統計
+ *
+ * @param[out]  pChanNum        失敗記録のあるchannel数
+ * @param[out]  pNodeNum        失敗記録のあるnode数
+ */
+void ln_routing_mc_stat(uint32_t *pChanNum, uint32_t *pNodeNum);
 
 
 /** routing skip DB削除
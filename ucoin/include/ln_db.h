@@ -40,6 +40,10 @@ extern "C" {
 #define LN_DB_CNLANNO_ANNO          'A'     ///< channel_announcement用KEYの末尾: channel_announcement
 #define LN_DB_CNLANNO_UPD1          'B'     ///< channel_announcement用KEYの末尾: channel_update 1
 #define LN_DB_CNLANNO_UPD2          'C'     ///< channel_announcement用KEYの末尾: channel_update 2
+#define LN_DB_GOSSIP_NODE           'N'     ///< gossip storeのレコード種別: node_announcement
+
+#define LN_DB_PRUNE_STALE_SEC       (1209600)   ///< channel_updateが更新されないchannelを削除するまでの時間[sec](2週間)
+#define LN_DB_PRUNE_STALE_BLK       (2016)      ///< channel_updateが無いchannelを削除するまでのblock数(約2週間)
 
 
 /**************************************************************************
@@ -62,6 +66,18 @@ extern "C" {
 typedef bool (*ln_db_func_cmp_t)(ln_self_t *self, void *p_db_param, void *p_param);
 
 
+/** @typedef    ln_db_func_closed_t
+ *  @brief      channel閉鎖判定(#ln_db_anno_prune())
+ *
+ * DBのトランザクション外から、削除対象になっていないchannelごとにshort_channel_idの昇順で呼び出される。
+ *
+ * @param[in]       ShortChannelId  channel_announcementのshort_channel_id
+ * @param[in]       p_param         #ln_db_anno_prune()に渡したデータポインタ
+ * @retval  true    閉鎖済み(DBから削除する)
+ */
+typedef bool (*ln_db_func_closed_t)(uint64_t ShortChannelId, void *p_param);
+
+
 /** @typedef    ln_db_txn_t
  *  @brief      announcement種別
  */
@@ -72,6 +88,29 @@ typedef enum {
 } ln_db_txn_t;
 
 
+/** @struct     ln_db_anno_save_t
+ *  @brief      announcement一括保存(#ln_db_anno_save_batch())
+ */
+typedef struct {
+    const ucoin_buf_t           *p_buf;         ///< 受信したパケット
+    uint64_t                    short_channel_id;   ///< channel_announcementのshort_channel_id
+    const ln_cnl_update_t       *p_upd;         ///< channel_update(それ以外はNULL)
+    const ln_node_announce_t    *p_nodeanno;    ///< node_announcement(それ以外はNULL)
+    const uint8_t               *p_send_id;     ///< 送信元/先ノード
+} ln_db_anno_save_t;
+
+
+/** @struct     ln_db_prune_t
+ *  @brief      announcement削除結果(#ln_db_anno_prune())
+ */
+typedef struct {
+    int         stale;          ///< 古いため削除したchannel数
+    int         closed;         ///< 閉鎖済みのため削除したchannel数
+    int         node;           ///< channelの無いnode_announcement削除数
+    int         records;        ///< 削除したレコード数(channel_announcement/channel_update/node_announcement)
+} ln_db_prune_t;
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
@@ -171,6 +210,15 @@ bool ln_db_node_cur_transaction(void **ppDb, ln_db_txn_t Type, void *pLockedDb);
 void ln_db_node_cur_commit(void *pDb);
 
 
+/** node DBの最新transaction id
+ *
+ * 他プロセスのcommitも含む。
+ *
+ * @return  transaction id(0:DB未オープン)
+ */
+uint64_t ln_db_node_txnid(void);
+
+
 ////////////////////
 // channel_announcement
 ////////////////////
@@ -217,6 +265,8 @@ bool ln_db_annocnlupd_save(const ucoin_buf_t *pCnlUpd, const ln_cnl_update_t *pU
 
 
 /** channel_announcement削除
+ *
+ * 削除したレコードは、次の #ln_db_gossip_compact() でgossip storeからも取り除かれる。
  *
  * @param[in]       short_channel_id
  * @retval      true    成功
@@ -226,8 +276,8 @@ bool ln_db_annocnlall_del(uint64_t short_channel_id);
 
 /** channel_announcement系の送信元/先ノード追加
  *
- * 
- * 
+ * 送信元/先ノードはpeer indexに変換し、short_channel_idごとのbitmapに記録する。
+ *
  * @param[in,out]   pDb
  * @param[in]       ShortChannelId
  * @param[in]       Type
@@ -269,6 +319,8 @@ void ln_db_annocnl_cur_close(void *pCur);
  * @param[in]       Type                検索するchannel_announcement/channel_update[1/2]
  * @param[in]       pSendId             対象node_id
  * @retval  true    pSendIdへ送信済み
+ * @note
+ *      - pSendIdのpeer indexに対応するbitを参照するのみ
  */
 bool ln_db_annocnls_search_nodeid(void *pDb, uint64_t ShortChannelId, char Type, const uint8_t *pSendId);
 
@@ -285,6 +337,32 @@ bool ln_db_annocnls_search_nodeid(void *pDb, uint64_t ShortChannelId, char Type,
 bool ln_db_annocnl_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, ucoin_buf_t *pBuf);
 
 
+/** channel_announcement関連情報の途中から取得
+ *
+ * 次の #ln_db_annocnl_cur_get() で、指定したkeyの次のデータを取得するよう位置付ける。
+ * 指定したkeyが削除されていた場合は、その後ろの最初のデータから取得する。
+ *
+ * @param[in,out]   pCur                    #ln_db_annocnl_cur_open()でオープンした*ppCur
+ * @param[in]       ShortChannelId          前回取得したshort_channel_id
+ * @param[in]       Type                    前回取得したLN_DB_CNLANNO_xxx
+ * @retval  true    成功
+ * @retval  false   後ろにデータが無い
+ */
+bool ln_db_annocnl_cur_seek(void *pCur, uint64_t ShortChannelId, char Type);
+
+
+/** block heightの範囲にあるchannel_announcementのshort_channel_id取得
+ *
+ * @param[out]  ppShortChannelId    short_channel_id配列(昇順、0件の場合はNULL)
+ * @param[in]   FirstBlock          開始block height
+ * @param[in]   Num                 block数
+ * @return  取得数
+ * @attention
+ *      - *ppShortChannelIdはM_MALLOC()ではなく標準のrealloc()で確保するため、使用後は呼び出し元が free()すること
+ */
+int ln_db_annocnl_get_range(uint64_t **ppShortChannelId, uint32_t FirstBlock, uint32_t Num);
+
+
 ////////////////////
 // channel_announcement
 ////////////////////
@@ -314,6 +392,17 @@ bool ln_db_annoskip_search(void *pDb, uint64_t ShortChannelId);
 bool ln_db_annoskip_drop(bool bTemp);
 
 
+/** "route_skip" 全short_channel_id取得
+ *
+ * @param[out]  ppShortChannelId    short_channel_id配列
+ * @param[out]  ppTemp              true:一時的なskip(ppShortChannelIdと同じ並び)
+ * @return  登録数
+ * @attention
+ *      - 内部で realloc()するため、使用後に両方とも free()すること
+ */
+int ln_db_annoskip_get(uint64_t **ppShortChannelId, bool **ppTemp);
+
+
 /** "routepay" invoice保存
  *
  */
@@ -412,6 +501,58 @@ void ln_db_annonod_cur_close(void *pCur);
 bool ln_db_annonod_cur_get(void *pCur, ucoin_buf_t *pBuf, uint32_t *pTimeStamp, uint8_t *pNodeId);
 
 
+/** node_announcementの途中から取得
+ *
+ * 次の #ln_db_annonod_cur_get() で、指定したnode_idの次のデータを取得するよう位置付ける。
+ *
+ * @param[in,out]   pCur            #ln_db_annonod_cur_open()でオープンしたDB cursor
+ * @param[in]       pNodeId         前回取得したnode_id
+ * @retval  true    成功
+ * @retval  false   後ろにデータが無い
+ */
+bool ln_db_annonod_cur_seek(void *pCur, const uint8_t *pNodeId);
+
+
+////////////////////
+// announcement
+////////////////////
+
+/** channel_announcement/channel_update/node_announcement一括書込み
+ *
+ * 1トランザクションでまとめて保存する。
+ * 各要素は #ln_db_annocnl_save() / #ln_db_annocnlupd_save() / #ln_db_annonod_save() と同じ扱いになる。
+ * p_upd, p_nodeanno共にNULLの要素はchannel_announcementとして扱う。
+ *
+ * @param[in]       pSave           保存するannouncement
+ * @param[in]       Num             pSave要素数
+ * @param[out]      pSaved          (非NULL時)要素ごとの結果(true:保存した、または保存済みより古いため不要)
+ * @return      保存に成功した数
+ */
+int ln_db_anno_save_batch(const ln_db_anno_save_t *pSave, int Num, bool *pSaved);
+
+
+/** 古いchannel/node_announcement削除
+ *
+ * 以下を削除する。
+ *      - 最新のchannel_updateがLN_DB_PRUNE_STALE_SEC以上前のchannel
+ *      - channel_updateが無く、short_channel_idのblockからLN_DB_PRUNE_STALE_BLK以上経過したchannel
+ *      - pFuncが閉鎖済みと判定したchannel
+ *      - 上記を削除した後、どのchannel_announcementにも含まれないnode_announcement(自nodeは除く)
+ *
+ * 自nodeのchannel(channel_announcementに自node_idを含むもの、self DBにあるもの)は古くても削除しない。
+ * channelの判定は読込み専用トランザクションで行い、削除は一定数ずつまとめたトランザクションで行う。
+ * 削除したレコードは、次の #ln_db_gossip_compact() でgossip storeからも取り除かれる。
+ *
+ * @param[out]      pResult         削除結果
+ * @param[in]       Now             現在時刻(epoch)
+ * @param[in]       Height          現在のblock count(0:channel_updateが無いchannelは削除しない)
+ * @param[in]       pFunc           閉鎖判定(NULL:判定しない)
+ * @param[in]       pParam          pFuncに渡すデータポインタ
+ * @retval      true    成功
+ */
+bool ln_db_anno_prune(ln_db_prune_t *pResult, uint32_t Now, int32_t Height, ln_db_func_closed_t pFunc, void *pParam);
+
+
 ////////////////////
 // payment_preimage
 ////////////////////
@@ -534,6 +675,81 @@ bool ln_db_revtx_save(const ln_self_t *self, bool bUpdate, void *pDbParam);
 bool ln_db_ver_check(uint8_t *pMyNodeId, ucoin_genesis_t *pGType);
 
 
+////////////////////
+// gossip store
+////////////////////
+
+/** gossip store使用可否
+ *
+ * @retval  true    使用可能
+ */
+bool ln_db_gossip_available(void);
+
+
+/** gossip store cursorオープン
+ *
+ * @param[out]      ppCur       cursor
+ * @param[in]       pPeerId     接続先node_id(このnodeから受信したものは取得しない)
+ * @param[in]       bFromStart  true:先頭から / false:これから追記されるものから
+ * @retval  true    成功
+ */
+bool ln_db_gossip_cur_open(void **ppCur, const uint8_t *pPeerId, bool bFromStart);
+
+
+/** gossip store cursorクローズ
+ *
+ * @param[in]       pCur        #ln_db_gossip_cur_open()で取得したcursor
+ */
+void ln_db_gossip_cur_close(void *pCur);
+
+
+/** gossip storeの順次取得
+ *
+ * pBufにはコピーして返すため、使用後は #ucoin_buf_free() で解放すること。
+ * gossip storeのロックは関数内でだけ保持する。
+ *
+ * @param[in,out]   pCur            #ln_db_gossip_cur_open()で取得したcursor
+ * @param[out]      pBuf            メッセージ
+ * @param[out]      pType           LN_DB_CNLANNO_xxx / LN_DB_GOSSIP_NODE
+ * @param[out]      pShortChannelId short_channel_id(node_announcementは0)
+ * @retval  true    取得した
+ * @retval  false   未送信のデータが無い
+ */
+bool ln_db_gossip_cur_get(void *pCur, ucoin_buf_t *pBuf, char *pType, uint64_t *pShortChannelId);
+
+
+/** gossip store cursorのtimestamp絞り込み
+ *
+ * gossip_timestamp_filter受信時に呼び、先頭から読み直す。
+ * First <= timestamp < First + Rangeのレコードだけを返すようになる。
+ *
+ * @param[in,out]   pCur            #ln_db_gossip_cur_open()で取得したcursor
+ * @param[in]       First           first_timestamp
+ * @param[in]       Range           timestamp_range
+ * @note
+ *      - channel_announcementはtimestampを持たないため、範囲内のchannel_updateを返す前に
+ *          DBから読み込んで返す(channelごとに1回)。
+ */
+void ln_db_gossip_cur_filter(void *pCur, uint32_t First, uint32_t Range);
+
+
+/** gossip storeの最新timestamp
+ *
+ * @return  保存しているchannel_update/node_announcementのtimestamp最大値(無い場合は0)
+ */
+uint32_t ln_db_gossip_latest(void);
+
+
+/** gossip store compaction
+ *
+ * DBから削除された、あるいは新しいもので置き換えられたレコードを取り除く。
+ * 前回から追記が少ない場合は何もしない。
+ *
+ * @retval  true    成功
+ */
+bool ln_db_gossip_compact(void);
+
+
 ////////////////////
 // others
 ////////////////////
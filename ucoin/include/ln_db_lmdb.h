@@ -57,6 +57,10 @@ extern "C" {
 #define LNDB_NODEENV_DIR        "/dbucoin_node"
 #define LNDB_SELFENV            LNDB_DBDIR LNDB_SELFENV_DIR     ///< LMDB名(self)
 #define LNDB_NODEENV            LNDB_DBDIR LNDB_NODEENV_DIR     ///< LMDB名(self以外)
+#define LNDB_GRAPH_SNAPSHOT_FILE "/graph_snapshot"
+#define LNDB_GRAPH_SNAPSHOT     LNDB_DBDIR LNDB_GRAPH_SNAPSHOT_FILE    ///< routing graph snapshot
+#define LNDB_GOSSIP_STORE_FILE  "/gossip_store"
+#define LNDB_GOSSIP_STORE       LNDB_DBDIR LNDB_GOSSIP_STORE_FILE      ///< announcement送信用ファイル
 
 #define LNDB_DBI_ANNO_SKIP      "route_skip"
 
@@ -75,6 +79,7 @@ typedef enum {
     LN_LMDB_DBTYPE_NODE_ANNO,
     LN_LMDB_DBTYPE_CHANNEL_ANNOINFO,
     LN_LMDB_DBTYPE_NODE_ANNOINFO,
+    LN_LMDB_DBTYPE_PEER_INDEX,
     LN_LMDB_DBTYPE_ANNO_SKIP,
     LN_LMDB_DBTYPE_ANNO_INVOICE,
     LN_LMDB_DBTYPE_PREIMAGE,
@@ -781,6 +781,18 @@ bool ucoin_tx_verify(const ucoin_buf_t *pSig, const uint8_t *pTxHash, const uint
 bool ucoin_tx_verify_rs(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKey);
 
 
+/** 署名チェック(r/s, 非圧縮公開鍵)
+ *
+ * 同じ公開鍵で何度も検証する場合、#ucoin_keys_pubuncomp()で展開しておいたものを使う。
+ *
+ * @param[in]       pRS             署名rs[64]
+ * @param[in]       pTxHash         トランザクションハッシュ
+ * @param[in]       pPubKeyUncomp   非圧縮公開鍵[64](x, y)
+ * @return          true:チェックOK
+ */
+bool ucoin_tx_verify_rs_uncomp(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKeyUncomp);
+
+
 /** P2PKH署名書込み
  *
  * @param[in,out]   pTx             署名書込み先トランザクション
@@ -93,8 +93,15 @@
 #define MSGTYPE_CHANNEL_UPDATE              ((uint16_t)0x0102)
 #define MSGTYPE_ANNOUNCEMENT_SIGNATURES     ((uint16_t)0x0103)
 
+#define MSGTYPE_QUERY_SHORT_CHANNEL_IDS     ((uint16_t)0x0105)
+#define MSGTYPE_REPLY_SHORT_CHANNEL_IDS_END ((uint16_t)0x0106)
+#define MSGTYPE_QUERY_CHANNEL_RANGE         ((uint16_t)0x0107)
+#define MSGTYPE_REPLY_CHANNEL_RANGE         ((uint16_t)0x0108)
+#define MSGTYPE_GOSSIP_TIMESTAMP_FILTER     ((uint16_t)0x0109)
+
 #define MSGTYPE_IS_PINGPONG(type)           (((type) == MSGTYPE_PING) || (type) == MSGTYPE_PONG) 
 #define MSGTYPE_IS_ANNOUNCE(type)           ((MSGTYPE_CHANNEL_ANNOUNCEMENT <= (type)) && ((type) <= MSGTYPE_CHANNEL_UPDATE))
+#define MSGTYPE_IS_GOSSIPQ(type)            ((MSGTYPE_QUERY_SHORT_CHANNEL_IDS <= (type)) && ((type) <= MSGTYPE_GOSSIP_TIMESTAMP_FILTER))
 
 // init.localfeatures
 #define INIT_LF_OPT_DATALOSS_REQ    (1 << 0)    ///< option-data-loss-protect
@@ -104,7 +111,10 @@
 #define INIT_LF_OPT_UPF_SHDN_REQ    (1 << 4)    ///< option_upfront_shutdown_script
 #define INIT_LF_OPT_UPF_SHDN_OPT    (1 << 5)    ///< option_upfront_shutdown_script
 #define INIT_LF_OPT_UPF_SHDN        (INIT_LF_OPT_UPF_SHDN_REQ | INIT_LF_OPT_UPF_SHDN_OPT)
-#define INIT_LF_MASK                (INIT_LF_OPT_DATALOSS | INIT_LF_ROUTE_SYNC | INIT_LF_OPT_UPF_SHDN)
+#define INIT_LF_GOSSIP_QUERY_REQ    (1 << 6)    ///< gossip_queries
+#define INIT_LF_GOSSIP_QUERY_OPT    (1 << 7)    ///< gossip_queries
+#define INIT_LF_GOSSIP_QUERY        (INIT_LF_GOSSIP_QUERY_REQ | INIT_LF_GOSSIP_QUERY_OPT)
+#define INIT_LF_MASK                (INIT_LF_OPT_DATALOSS | INIT_LF_ROUTE_SYNC | INIT_LF_OPT_UPF_SHDN | INIT_LF_GOSSIP_QUERY)
 #define INIT_LF_VALUE               { INIT_LF_ROUTE_SYNC }
 #define INIT_LF_SZ_VALUE            (1)
 
@@ -177,4 +187,363 @@ bool HIDDEN ln_db_init(char *pWif, char *pNodeName, uint16_t *pPort);
  */
 void HIDDEN ln_db_copy_channel(ln_self_t *pOutSelf, const ln_self_t *pInSelf);
 
+
+/** announcementがDBの内容と一致するかの確認開始
+ *
+ * 1つの読込みトランザクションで #ln_db_anno_live() を繰り返し呼べるようにする。
+ *
+ * @param[out]  ppDb        #ln_db_anno_live() / #ln_db_anno_live_end() に渡すDB情報
+ * @retval  true    成功
+ */
+bool HIDDEN ln_db_anno_live_begin(void **ppDb);
+
+
+/** announcementがDBの内容と一致するか
+ *
+ * DBから削除された、あるいは新しいものに置き換えられたannouncementはfalseになる。
+ *
+ * @param[in]   pDb         #ln_db_anno_live_begin()で取得したDB情報
+ * @param[in]   Type        LN_DB_CNLANNO_xxx / LN_DB_GOSSIP_NODE
+ * @param[in]   pKey        short_channel_id / node_id
+ * @param[in]   pMsg        メッセージ
+ * @param[in]   Len         pMsg長
+ * @retval  true    DBと一致する
+ */
+bool HIDDEN ln_db_anno_live(void *pDb, char Type, const uint8_t *pKey, const uint8_t *pMsg, uint32_t Len);
+
+
+/** #ln_db_anno_live_begin()の読込みトランザクション終了
+ *
+ * @param[in]   pDb         #ln_db_anno_live_begin()で取得したDB情報
+ */
+void HIDDEN ln_db_anno_live_end(void *pDb);
+
+
+/** gossip storeに反映が必要な最後のtransaction id
+ *
+ * announcementを追加/削除したtransactionでだけ更新される。
+ * (skip DBなど、他への書込みでは進まない)
+ *
+ * @return  transaction id(0:未保存)
+ */
+uint64_t HIDDEN ln_db_anno_gossip_txnid(void);
+
+
+/**************************************************************************
+ * prototypes(ln_db_gossip.c)
+ **************************************************************************/
+
+/** gossip store初期化
+ *
+ * ファイルが無い、または互換性が無い場合はDBから作成する。
+ *
+ * @retval  true    成功
+ */
+bool HIDDEN ln_db_gossip_init(void);
+
+
+/** gossip store終了
+ *
+ */
+void HIDDEN ln_db_gossip_term(void);
+
+
+/** gossip storeへの追記開始
+ *
+ * 追記するannouncementをDBにcommitする前に呼ぶ。
+ * #ln_db_gossip_end()までは、gossip storeのヘッダに保存する追記済みtransaction idを進めない。
+ */
+void HIDDEN ln_db_gossip_begin(void);
+
+
+/** gossip storeへの追記終了
+ *
+ * #ln_db_gossip_begin()後、commitと追記が終わったら呼ぶ(commit失敗時も呼ぶ)。
+ */
+void HIDDEN ln_db_gossip_end(void);
+
+
+/** gossip storeへの追記
+ *
+ * DBに新規保存したchannel_announcement/channel_update/node_announcementを追記する。
+ * ファイルが一杯の場合は #ln_db_gossip_compact() してから追記し直すため、DBのトランザクション外で呼ぶこと。
+ *
+ * @param[in]   Type            LN_DB_CNLANNO_xxx / LN_DB_GOSSIP_NODE
+ * @param[in]   pKey            short_channel_id / node_id
+ * @param[in]   TimeStamp       timestamp
+ * @param[in]   pMsg            メッセージ
+ * @param[in]   pSendId         受信元node_id(NULL:自分で作成)
+ */
+void HIDDEN ln_db_gossip_append(char Type, const uint8_t *pKey, uint32_t TimeStamp, const ucoin_buf_t *pMsg, const uint8_t *pSendId);
+
+
+/** gossip store compaction要求
+ *
+ * DBからまとめて削除した場合に呼び、次の #ln_db_gossip_compact() で追記量によらずcompactionさせる。
+ */
+void HIDDEN ln_db_gossip_pruned(void);
+
+
+/**************************************************************************
+ * prototypes(ln_db_cnlidx.c)
+ **************************************************************************/
+
+/** short_channel_id index初期化
+ *
+ * DBに保存しているchannel_announcementから作成する。
+ *
+ * @retval  true    成功
+ */
+bool HIDDEN ln_db_cnlidx_init(void);
+
+
+/** short_channel_id index終了
+ *
+ */
+void HIDDEN ln_db_cnlidx_term(void);
+
+
+/** short_channel_id index追加
+ *
+ * DBに新規保存したchannel_announcementを登録する。
+ *
+ * @param[in]   pCnlAnno        channel_announcement
+ */
+void HIDDEN ln_db_cnlidx_add(const ucoin_buf_t *pCnlAnno);
+
+
+/** short_channel_id index削除
+ *
+ * @param[in]   ShortChannelId  short_channel_id
+ */
+void HIDDEN ln_db_cnlidx_del(uint64_t ShortChannelId);
+
+
+/** short_channel_idからnode_id取得
+ *
+ * @param[out]  pNodeId         node_id
+ * @param[out]  pUncomp         node_idの非圧縮公開鍵(NULL時は取得しない)
+ * @param[in]   ShortChannelId  short_channel_id
+ * @param[in]   Dir             0:node_id_1, 1:node_id_2
+ * @retval  true    取得できた
+ */
+bool HIDDEN ln_db_cnlidx_get(uint8_t *pNodeId, uint8_t *pUncomp, uint64_t ShortChannelId, uint8_t Dir);
+
+
+/** short_channel_id index有効
+ *
+ * @retval  true    #ln_db_cnlidx_get()で見つからなければ、DBにも無い
+ */
+bool HIDDEN ln_db_cnlidx_valid(void);
+
+
+/**************************************************************************
+ * typedefs(ln_db_prune.c)
+ **************************************************************************/
+
+/** @typedef    ln_db_prune_cnl_t
+ *  @brief      #ln_db_anno_prune()で集めるchannel情報
+ */
+typedef struct {
+    uint64_t    short_channel_id;
+    uint32_t    timestamp;              ///< 最新のchannel_updateのtimestamp(0:channel_updateなし)
+    bool        anno;                   ///< true:channel_announcementあり
+    bool        closed;                 ///< true:閉鎖済み
+    bool        own;                    ///< true:自nodeのchannel(古くても削除しない)
+} ln_db_prune_cnl_t;
+
+
+/** @typedef    ln_db_prune_list_t
+ *  @brief      #ln_db_anno_prune()で集めたchannel
+ */
+typedef struct {
+    ln_db_prune_cnl_t   *p_cnl;
+    int                 num;            ///< p_cnl数
+    int                 alloc;          ///< p_cnl確保数
+    int                 pos;            ///< 次に削除判定するp_cnlの位置
+    int                 del_num;        ///< 未処理の削除対象channel数
+    uint32_t            now;            ///< 現在時刻
+    int32_t             height;         ///< 現在のblock count(0:channel_updateが無いchannelは判定しない)
+} ln_db_prune_list_t;
+
+
+/**************************************************************************
+ * prototypes(ln_db_prune.c)
+ **************************************************************************/
+
+/** channel情報取得
+ *
+ * 最後に追加したchannelと同じshort_channel_idであればそれを、違えば追加して返す。
+ *
+ * @param[in,out]   pList           channel一覧
+ * @param[in]       ShortChannelId  short_channel_id
+ * @return      channel情報(次の追加まで有効)
+ */
+ln_db_prune_cnl_t HIDDEN *ln_db_prune_get(ln_db_prune_list_t *pList, uint64_t ShortChannelId);
+
+
+/** 削除するchannelの選択
+ *
+ * 自nodeのchannelに印を付け、古いchannelと閉鎖済みchannelを削除対象にする。
+ * 自nodeのchannelは古くても削除対象にしない。
+ * pListはshort_channel_idの昇順に並べ替え、pFuncもその順に呼び出す。
+ *
+ * @param[in,out]   pList           channel一覧(now, heightを設定しておくこと)
+ * @param[in,out]   pSelfSci        自nodeのshort_channel_id(ソートする)
+ * @param[in]       SelfNum         pSelfSci数
+ * @param[in]       pFunc           閉鎖判定(NULL時は判定しない)
+ * @param[in]       pParam          pFuncに渡すデータポインタ
+ */
+void HIDDEN ln_db_prune_select(ln_db_prune_list_t *pList, uint64_t *pSelfSci, int SelfNum,
+                bool (*pFunc)(uint64_t ShortChannelId, void *p_param), void *pParam);
+
+
+/** 1トランザクションで削除するchannelの取り出し
+ *
+ * 古いとしたchannelは、pTimeで取得し直したchannel_updateのtimestampで判定し直す。
+ * 取り出したchannelが無ければ、削除対象は残っていない。
+ *
+ * @param[in,out]   pList           channel一覧
+ * @param[out]      ppDel           削除するchannel(Max個)
+ * @param[in]       Max             取り出す最大数
+ * @param[in]       pTime           最新のchannel_updateのtimestamp取得
+ * @param[in]       pParam          pTimeに渡すデータポインタ
+ * @return      取り出したchannel数
+ */
+int HIDDEN ln_db_prune_batch(ln_db_prune_list_t *pList, const ln_db_prune_cnl_t **ppDel, int Max,
+                uint32_t (*pTime)(uint64_t ShortChannelId, void *p_param), void *pParam);
+
+
+/** channel一覧解放
+ *
+ * @param[in,out]   pList           channel一覧
+ */
+void HIDDEN ln_db_prune_free(ln_db_prune_list_t *pList);
+
+
+/**************************************************************************
+ * prototypes(ln_anno_verify.c)
+ **************************************************************************/
+
+/** 受信済みannouncementチェック
+ *
+ * 最近処理したメッセージのhashを固定サイズで保持しており、一致すればtrueを返す。
+ * 登録は #ln_anno_verify_seen_add() で行う。
+ *
+ * @param[in]   pData           受信したannouncement
+ * @param[in]   Len             pData長
+ * @retval  true    受信済み
+ */
+bool HIDDEN ln_anno_verify_seen(const uint8_t *pData, uint16_t Len);
+
+
+/** 受信済みannouncement登録
+ *
+ * DB保存した(保存済みより古いものを含む)、あるいは解析や署名検証に失敗して
+ * 結果が変わらないことが確定したメッセージだけを登録する。
+ * 検証前に登録すると、保存に失敗した場合や不正な受信元が先に送ってきた場合に、
+ * 正しいメッセージを他のpeerから受信しても捨ててしまう。
+ *
+ * @param[in]   pData           announcement
+ * @param[in]   Len             pData長
+ */
+void HIDDEN ln_anno_verify_seen_add(const uint8_t *pData, uint16_t Len);
+
+
+/** channel_announcementの署名検証要求
+ *
+ * worker threadで署名検証し、DB保存する。
+ * queueが一杯の場合は空くまで待つ。
+ *
+ * @param[in]   pData           channel_announcement
+ * @param[in]   Len             pData長
+ * @param[in]   ShortChannelId  short_channel_id
+ * @param[in]   pSendId         受信元node_id
+ * @retval  true    要求した
+ * @retval  false   worker thread停止中(呼び出し元で検証・保存すること)
+ */
+bool HIDDEN ln_anno_verify_cnlanno(const uint8_t *pData, uint16_t Len, uint64_t ShortChannelId, const uint8_t *pSendId);
+
+
+/** channel_updateの署名検証要求
+ *
+ * worker threadで署名検証し、DB保存する。
+ * 署名者はDBのchannel_announcementから取得するため、同じshort_channel_idのものは受信順に処理する。
+ * queueが一杯の場合は空くまで待つ。
+ * 同じshort_channel_id/directionで検証待ちのものがある場合、timestampが新しい方だけを残す。
+ *
+ * @param[in]   pData           channel_update
+ * @param[in]   Len             pData長
+ * @param[in]   pUpd            pDataの解析結果
+ * @param[in]   pNodeId         channel_announcementがDBに無い場合の署名者node_id(NULL時は検証せずに保存する)
+ * @param[in]   pSendId         受信元node_id
+ * @retval  true    要求した
+ * @retval  false   worker thread停止中(呼び出し元で検証・保存すること)
+ */
+bool HIDDEN ln_anno_verify_cnlupd(const uint8_t *pData, uint16_t Len, const ln_cnl_update_t *pUpd, const uint8_t *pNodeId, const uint8_t *pSendId);
+
+
+/** node_announcementの署名検証要求
+ *
+ * worker threadで署名検証し、DB保存する。
+ * queueが一杯の場合は空くまで待つ。
+ *
+ * @param[in]   pData           node_announcement
+ * @param[in]   Len             pData長
+ * @param[in]   pSendId         受信元node_id
+ * @retval  true    要求した
+ * @retval  false   worker thread停止中(呼び出し元で検証・保存すること)
+ */
+bool HIDDEN ln_anno_verify_nodeanno(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId);
+
+
+/**************************************************************************
+ * prototypes(ln_routing.cpp)
+ **************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** routing graphへのchannel_announcement追加
+ *
+ * DBに新規保存したchannel_announcementをgraphに反映する。
+ *
+ * @param[in]   pCnlAnno        channel_announcement
+ */
+void HIDDEN ln_routing_add_cnlanno(const ucoin_buf_t *pCnlAnno);
+
+
+/** routing graphへのchannel_update反映
+ *
+ * @param[in]   pUpd            DBに保存したchannel_update
+ */
+void HIDDEN ln_routing_set_cnlupd(const ln_cnl_update_t *pUpd);
+
+
+/** routing graphからのchannel削除
+ *
+ * @param[in]   ShortChannelId  削除するshort_channel_id
+ */
+void HIDDEN ln_routing_del_channel(uint64_t ShortChannelId);
+
+
+/** routing skip DBへのchannel追加通知
+ *
+ * @param[in]   ShortChannelId  skip DBに追加したshort_channel_id
+ * @param[in]   bTemp           true:一時的なskip
+ */
+void HIDDEN ln_routing_skip_channel(uint64_t ShortChannelId, bool bTemp);
+
+
+/** routing skip DBからのchannel削除通知
+ *
+ * @param[in]   bTemp           true:一時的なskipのみ削除 / false:全削除
+ */
+void HIDDEN ln_routing_skip_clear(bool bTemp);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* LN_LOCAL_H__ */
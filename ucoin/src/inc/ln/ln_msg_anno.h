@@ -122,6 +122,16 @@ bool HIDDEN ln_msg_cnl_update_read(ln_cnl_update_t *pMsg, const uint8_t *pData,
 bool HIDDEN ln_msg_cnl_update_verify(const uint8_t *pPubkey, const uint8_t *pData, uint16_t Len);
 
 
+/** channel_update署名verify(非圧縮公開鍵)
+ *
+ * @param[in]       pUncomp 非圧縮公開鍵(node_id展開済み)
+ * @param[in]       pData   対象データ
+ * @param[in]       Len     pData長
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_cnl_update_verify_uncomp(const uint8_t *pUncomp, const uint8_t *pData, uint16_t Len);
+
+
 /** announcement_signatures生成
  *
  * @param[out]      pBuf    生成データ
@@ -155,4 +165,99 @@ bool HIDDEN ln_msg_announce_signs_read(ln_announce_signs_t *pMsg, const uint8_t
  */
 void HIDDEN ln_msg_get_anno_signs(ln_self_t *self, uint8_t **pp_sig_node, uint8_t **pp_sig_btc, bool bLocal, ucoin_keys_sort_t Sort);
 
+
+/** query_short_channel_ids生成
+ *
+ * @param[out]      pBuf    生成データ
+ * @param[in]       pMsg    元データ
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_query_short_ids_create(ucoin_buf_t *pBuf, const ln_query_short_ids_t *pMsg);
+
+
+/** query_short_channel_ids読込み
+ *
+ * @param[out]      pMsg    読込み結果(p_short_idsはM_FREE()すること)
+ * @param[in]       pData   対象データ
+ * @param[in]       Len     pData長
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_query_short_ids_read(ln_query_short_ids_t *pMsg, const uint8_t *pData, uint16_t Len);
+
+
+/** reply_short_channel_ids_end生成
+ *
+ * @param[out]      pBuf        生成データ
+ * @param[in]       bComplete   complete
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_reply_short_ids_end_create(ucoin_buf_t *pBuf, bool bComplete);
+
+
+/** reply_short_channel_ids_end読込み
+ *
+ * @param[out]      pComplete   complete
+ * @param[in]       pData       対象データ
+ * @param[in]       Len         pData長
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_reply_short_ids_end_read(bool *pComplete, const uint8_t *pData, uint16_t Len);
+
+
+/** query_channel_range生成
+ *
+ * @param[out]      pBuf    生成データ
+ * @param[in]       pMsg    元データ
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_query_channel_range_create(ucoin_buf_t *pBuf, const ln_query_channel_range_t *pMsg);
+
+
+/** query_channel_range読込み
+ *
+ * @param[out]      pMsg    読込み結果
+ * @param[in]       pData   対象データ
+ * @param[in]       Len     pData長
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_query_channel_range_read(ln_query_channel_range_t *pMsg, const uint8_t *pData, uint16_t Len);
+
+
+/** reply_channel_range生成
+ *
+ * @param[out]      pBuf    生成データ
+ * @param[in]       pMsg    元データ
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_reply_channel_range_create(ucoin_buf_t *pBuf, const ln_reply_channel_range_t *pMsg);
+
+
+/** reply_channel_range読込み
+ *
+ * @param[out]      pMsg    読込み結果(p_short_idsはM_FREE()すること)
+ * @param[in]       pData   対象データ
+ * @param[in]       Len     pData長
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_reply_channel_range_read(ln_reply_channel_range_t *pMsg, const uint8_t *pData, uint16_t Len);
+
+
+/** gossip_timestamp_filter生成
+ *
+ * @param[out]      pBuf    生成データ
+ * @param[in]       pMsg    元データ
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_gossip_filter_create(ucoin_buf_t *pBuf, const ln_gossip_filter_t *pMsg);
+
+
+/** gossip_timestamp_filter読込み
+ *
+ * @param[out]      pMsg    読込み結果
+ * @param[in]       pData   対象データ
+ * @param[in]       Len     pData長
+ * retval   true    成功
+ */
+bool HIDDEN ln_msg_gossip_filter_read(ln_gossip_filter_t *pMsg, const uint8_t *pData, uint16_t Len);
+
 #endif /* LN_MSG_ANNO_H__ */
@@ -198,6 +198,7 @@ void ucoin_util_hash256(uint8_t *pHash256, const uint8_t *pData, uint16_t Len);
  */
 void ucoin_util_sha256cat(uint8_t *pSha256, const uint8_t *pData1, uint16_t Len1, const uint8_t *pData2, uint16_t Len2);
 
+mbedtls_ecp_group *ucoin_util_ecp_group(void);
 int ucoin_util_set_keypair(mbedtls_ecp_keypair *pKeyPair, const uint8_t *pPubKey);
 int ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uint8_t *pPubKey);
 void ucoin_util_create_pkh2wpkh(uint8_t *pWPubKeyHash, const uint8_t *pPubKeyHash);
@@ -213,6 +214,77 @@ void ucoin_util_add_vout_pkh(ucoin_tx_t *pTx, uint64_t Value, const uint8_t *pPu
 int ucoin_util_get_varint_len(uint32_t Len);
 int ucoin_util_set_varint_len(uint8_t *pData, const uint8_t *pOrg, uint32_t Len, bool isScript);
 
+
+/**************************************************************************
+ * prototypes(ECDSA backend)
+ *
+ *  ucoin_ecc_mbedtls.c / ucoin_ecc_secp256k1.c(UCOIN_USE_SECP256K1定義時)
+ **************************************************************************/
+
+/** 署名(r/s)
+ *
+ * RFC6979(SHA256)でkを生成し、sはlow-Sにする。
+ *
+ * @param[out]      pRS             署名(r[32] || s[32])
+ * @param[in]       pHash           署名対象のhash(32byte)
+ * @param[in]       pPrivKey        秘密鍵
+ * @retval  true    成功
+ */
+bool ucoin_ecc_sign_rs(uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPrivKey);
+
+
+/** 署名(r/s)検証
+ *
+ * @param[in]       pRS             署名(r[32] || s[32])
+ * @param[in]       pHash           署名対象のhash(32byte)
+ * @param[in]       pPubKey         公開鍵(圧縮)
+ * @retval  true    検証OK
+ */
+bool ucoin_ecc_verify_rs(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKey);
+
+
+/** 署名(r/s)検証(非圧縮公開鍵)
+ *
+ * @param[in]       pRS             署名(r[32] || s[32])
+ * @param[in]       pHash           署名対象のhash(32byte)
+ * @param[in]       pPubKeyUncomp   公開鍵(非圧縮: X[32] || Y[32])
+ * @retval  true    検証OK
+ */
+bool ucoin_ecc_verify_rs_uncomp(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKeyUncomp);
+
+
+/** 署名(r/s)からの公開鍵復元
+ *
+ * 復元した公開鍵での署名検証は行わない。
+ *
+ * @param[out]      pPubKey         公開鍵(圧縮)
+ * @param[in]       RecId           recovery id(0～3)
+ * @param[in]       pRS             署名(r[32] || s[32])
+ * @param[in]       pHash           署名対象のhash(32byte)
+ * @retval  true    成功
+ */
+bool ucoin_ecc_recover_pubkey(uint8_t *pPubKey, int RecId, const uint8_t *pRS, const uint8_t *pHash);
+
+
+/** 秘密鍵から公開鍵
+ *
+ * @param[out]      pPubKey         公開鍵(圧縮)
+ * @param[in]       pPrivKey        秘密鍵
+ * @retval  true    成功
+ */
+bool ucoin_ecc_priv2pub(uint8_t *pPubKey, const uint8_t *pPrivKey);
+
+
+/** 公開鍵のスカラー倍(ECDH)
+ *
+ * @param[out]      pResult         pPubKey * pMul(圧縮)
+ * @param[in]       pPubKey         公開鍵(圧縮)
+ * @param[in]       pMul            掛ける数(big endian)
+ * @param[in]       MulLen          pMul長(32byte以下)
+ * @retval  true    成功
+ */
+bool ucoin_ecc_mul_pubkey(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul, int MulLen);
+
 #ifdef UCOIN_DEBUG_MEM
 void* ucoin_dbg_malloc(size_t);
 void* ucoin_dbg_realloc(void*, size_t);
@@ -169,6 +169,11 @@ static bool recv_channel_reestablish(ln_self_t *self, const uint8_t *pData, uint
 static bool recv_announcement_signatures(ln_self_t *self, const uint8_t *pData, uint16_t Len);
 static bool recv_channel_announcement(ln_self_t *self, const uint8_t *pData, uint16_t Len);
 static bool recv_channel_update(ln_self_t *self, const uint8_t *pData, uint16_t Len);
+static bool recv_query_short_channel_ids(ln_self_t *self, const uint8_t *pData, uint16_t Len);
+static bool recv_reply_short_channel_ids_end(ln_self_t *self, const uint8_t *pData, uint16_t Len);
+static bool recv_query_channel_range(ln_self_t *self, const uint8_t *pData, uint16_t Len);
+static bool recv_reply_channel_range(ln_self_t *self, const uint8_t *pData, uint16_t Len);
+static bool recv_gossip_timestamp_filter(ln_self_t *self, const uint8_t *pData, uint16_t Len);
 static void start_funding_wait(ln_self_t *self, bool bSendTx);
 static bool set_vin_p2wsh_2of2(ucoin_tx_t *pTx, int Index, ucoin_keys_sort_t Sort,
                     const ucoin_buf_t *pSig1,
@@ -263,6 +268,7 @@ static void proc_rev_and_ack(ln_self_t *self, uint8_t Flag);
 
 static bool chk_peer_node(ln_self_t *self);
 static bool get_nodeid_from_annocnl(ln_self_t *self, uint8_t *pNodeId, uint64_t short_channel_id, uint8_t Dir);;
+static bool get_nodeid_from_self(ln_self_t *self, uint8_t *pNodeId, uint64_t short_channel_id, uint8_t Dir);
 static void clear_htlc(ln_self_t *self, ln_update_add_htlc_t *p_add);
 static bool search_preimage(uint8_t *pPreImage, const uint8_t *pHtlcHash);
 static bool chk_channelid(const uint8_t *recv_id, const uint8_t *mine_id);
@@ -302,7 +308,12 @@ static const struct {
     { MSGTYPE_CHANNEL_ANNOUNCEMENT,         recv_channel_announcement },
     { MSGTYPE_NODE_ANNOUNCEMENT,            ln_node_recv_node_announcement },
     { MSGTYPE_CHANNEL_UPDATE,               recv_channel_update },
-    { MSGTYPE_ANNOUNCEMENT_SIGNATURES,      recv_announcement_signatures }
+    { MSGTYPE_ANNOUNCEMENT_SIGNATURES,      recv_announcement_signatures },
+    { MSGTYPE_QUERY_SHORT_CHANNEL_IDS,      recv_query_short_channel_ids },
+    { MSGTYPE_REPLY_SHORT_CHANNEL_IDS_END,  recv_reply_short_channel_ids_end },
+    { MSGTYPE_QUERY_CHANNEL_RANGE,          recv_query_channel_range },
+    { MSGTYPE_REPLY_CHANNEL_RANGE,          recv_reply_channel_range },
+    { MSGTYPE_GOSSIP_TIMESTAMP_FILTER,      recv_gossip_timestamp_filter }
 };
 
 
@@ -558,6 +569,7 @@ bool ln_recv(ln_self_t *self, const uint8_t *pData, uint16_t Len)
     }
     if ( (type != MSGTYPE_CLOSING_SIGNED) &&
          !MSGTYPE_IS_ANNOUNCE(type) && !MSGTYPE_IS_PINGPONG(type) &&
+         !MSGTYPE_IS_GOSSIPQ(type) &&
          (type != MSGTYPE_ERROR) &&
          M_SHDN_FLAG_EXCHANGED(self->shutdown_flag) ) {
         M_SET_ERR(self, LNERR_INV_STATE, "not closing_signed received : %04x", type);
@@ -600,7 +612,8 @@ bool ln_create_init(ln_self_t *self, ucoin_buf_t *pInit, bool bHaveCnl)
 
 #if 1
     //init_routing_sync=0のままでは既存のannouncementを送ってこない
-    const uint8_t INIT_VAL[] = { INIT_LF_ROUTE_SYNC };
+    //  gossip_queriesはoptionalで要求する(相手が対応していればqueryで同期する)
+    const uint8_t INIT_VAL[] = { INIT_LF_ROUTE_SYNC | INIT_LF_GOSSIP_QUERY_OPT };
     ucoin_buf_alloccopy(&msg.localfeatures, INIT_VAL, sizeof(INIT_VAL));
 #else
     if (bHaveCnl) {
@@ -1386,6 +1399,80 @@ bool ln_create_update_fee(ln_self_t *self, ucoin_buf_t *pUpdFee, uint32_t Feerat
 }
 
 
+/********************************************************************
+ * gossip queries
+ ********************************************************************/
+
+bool ln_is_gossip_queries(const ln_self_t *self)
+{
+    return (self->lfeature_remote & INIT_LF_GOSSIP_QUERY) != 0;
+}
+
+
+bool ln_create_query_short_channel_ids(ln_self_t *self, ucoin_buf_t *pQuery, const uint64_t *pShortIds, int Num)
+{
+    if (!ln_is_gossip_queries(self)) {
+        DBG_PRINTF("fail: gossip_queries not supported\n");
+        return false;
+    }
+
+    ln_query_short_ids_t msg;
+    msg.p_short_ids = (CONST_CAST uint64_t *)pShortIds;
+    msg.num = Num;
+    return ln_msg_query_short_ids_create(pQuery, &msg);
+}
+
+
+bool ln_create_reply_short_channel_ids_end(ln_self_t *self, ucoin_buf_t *pReply, bool bComplete)
+{
+    (void)self;
+
+    return ln_msg_reply_short_ids_end_create(pReply, bComplete);
+}
+
+
+bool ln_create_query_channel_range(ln_self_t *self, ucoin_buf_t *pQuery, uint32_t FirstBlock, uint32_t Num)
+{
+    if (!ln_is_gossip_queries(self)) {
+        DBG_PRINTF("fail: gossip_queries not supported\n");
+        return false;
+    }
+
+    ln_query_channel_range_t msg;
+    msg.first_blocknum = FirstBlock;
+    msg.number_of_blocks = Num;
+    return ln_msg_query_channel_range_create(pQuery, &msg);
+}
+
+
+bool ln_create_reply_channel_range(ln_self_t *self, ucoin_buf_t *pReply, const ln_query_channel_range_t *pQuery, const uint64_t *pShortIds, int Num, bool bComplete)
+{
+    (void)self;
+
+    ln_reply_channel_range_t msg;
+    msg.first_blocknum = pQuery->first_blocknum;
+    msg.number_of_blocks = pQuery->number_of_blocks;
+    msg.complete = (bComplete) ? 1 : 0;
+    msg.p_short_ids = (CONST_CAST uint64_t *)pShortIds;
+    msg.num = Num;
+    return ln_msg_reply_channel_range_create(pReply, &msg);
+}
+
+
+bool ln_create_gossip_timestamp_filter(ln_self_t *self, ucoin_buf_t *pFilter, uint32_t FirstTimeStamp, uint32_t Range)
+{
+    if (!ln_is_gossip_queries(self)) {
+        DBG_PRINTF("fail: gossip_queries not supported\n");
+        return false;
+    }
+
+    ln_gossip_filter_t msg;
+    msg.first_timestamp = FirstTimeStamp;
+    msg.timestamp_range = Range;
+    return ln_msg_gossip_filter_create(pFilter, &msg);
+}
+
+
 /********************************************************************
  * others
  ********************************************************************/
@@ -1759,6 +1846,9 @@ static bool recv_init(ln_self_t *self, const uint8_t *pData, uint16_t Len)
                 }
             }
             initial_routing_sync = (msg.localfeatures.buf[0] & INIT_LF_ROUTE_SYNC);
+            self->lfeature_remote = msg.localfeatures.buf[0];
+        } else {
+            self->lfeature_remote = 0;
         }
     }
     if (ret) {
@@ -3032,6 +3122,11 @@ static bool recv_channel_announcement(ln_self_t *self, const uint8_t *pData, uin
 {
     DBG_PRINTF("\n");
 
+    if (ln_anno_verify_seen(pData, Len)) {
+        //他のpeerからも受信済み
+        return true;
+    }
+
     ln_cnl_announce_read_t ann;
     ln_cb_channel_anno_recv_t param;
 
@@ -3046,20 +3141,41 @@ static bool recv_channel_announcement(ln_self_t *self, const uint8_t *pData, uin
         return true;
     }
 
+    if (!param.is_unspent) {
+        //closeされたとみなして、何もしない
+        DBG_PRINTF("closed channel: not save(%0" PRIx64 ")\n", ann.short_channel_id);
+        return true;
+    }
+
+    //署名検証とDB保存はworker threadで行う
+    if (ln_anno_verify_cnlanno(pData, Len, ann.short_channel_id, ln_their_node_id(self))) {
+        return true;
+    }
+
     ucoin_buf_t buf;
     buf.buf = (CONST_CAST uint8_t *)pData;
     buf.len = Len;
 
-    if (param.is_unspent) {
+    ucoin_buf_t buf_db = UCOIN_BUF_INIT;
+    if (ln_db_annocnl_load(&buf_db, ann.short_channel_id)) {
+        //保存済み
+        if (!ucoin_buf_cmp(&buf_db, &buf)) {
+            DBG_PRINTF("fail: different channel_announcement\n");
+        }
+        ln_anno_verify_seen_add(pData, Len);
+    } else if (ln_msg_cnl_announce_verify(pData, Len)) {
         //DB保存
         ret = ln_db_annocnl_save(&buf, ann.short_channel_id, ln_their_node_id(self));
-        if (!ret) {
+        if (ret) {
+            ln_anno_verify_seen_add(pData, Len);
+        } else {
             DBG_PRINTF("fail: db save\n");
         }
     } else {
-        //closeされたとみなして、何もしない
-        DBG_PRINTF("closed channel: not save(%0" PRIx64 ")\n", ann.short_channel_id);
+        DBG_PRINTF("fail: verify\n");
+        ln_anno_verify_seen_add(pData, Len);
     }
+    ucoin_buf_free(&buf_db);
 
     return true;
 }
@@ -3074,9 +3190,13 @@ static bool recv_channel_announcement(ln_self_t *self, const uint8_t *pData, uin
  */
 static bool recv_channel_update(ln_self_t *self, const uint8_t *pData, uint16_t Len)
 {
-    (void)self;
     DBG_PRINTF("\n");
 
+    if (ln_anno_verify_seen(pData, Len)) {
+        //他のpeerからも受信済み
+        return true;
+    }
+
     ln_cnl_update_t upd;
     memset(&upd, 0, sizeof(upd));
 
@@ -3098,20 +3218,36 @@ static bool recv_channel_update(ln_self_t *self, const uint8_t *pData, uint16_t
 
         //short_channel_id と dir から node_id を取得する
         uint8_t node_id[UCOIN_SZ_PUBKEY];
+        const uint8_t *p_node_id = NULL;
+
+        //署名検証とDB保存はworker threadで行う
+        //  channel_announcementはworker threadで検索するため、ここではこのchannelの場合だけ指定する
+        if (get_nodeid_from_self(self, node_id, upd.short_channel_id, upd.flags & LN_CNLUPD_FLAGS_DIRECTION)) {
+            p_node_id = node_id;
+        }
+        if (ln_anno_verify_cnlupd(pData, Len, &upd, p_node_id, ln_their_node_id(self))) {
+            return true;
+        }
 
+        p_node_id = NULL;
         ret = get_nodeid_from_annocnl(self, node_id, upd.short_channel_id, upd.flags & LN_CNLUPD_FLAGS_DIRECTION);
         if (ret && ucoin_keys_chkpub(node_id)) {
-            ret = ln_msg_cnl_update_verify(node_id, pData, Len);
-            if (!ret) {
-                DBG_PRINTF("fail: verify\n");
-            }
+            p_node_id = node_id;
         } else {
             //該当するchannel_announcementが見つからない
             //  BOLT#11
             //      r fieldでchannel_update相当のデータを送信したい場合に備えて保持する
             //      https://lists.linuxfoundation.org/pipermail/lightning-dev/2018-April/001220.html
             DBG_PRINTF("fail: not found channel_announcement in DB\n");
-            ret = true;
+        }
+
+        ret = true;
+        if (p_node_id != NULL) {
+            ret = ln_msg_cnl_update_verify(p_node_id, pData, Len);
+            if (!ret) {
+                DBG_PRINTF("fail: verify\n");
+                ln_anno_verify_seen_add(pData, Len);
+            }
         }
     } else {
         DBG_PRINTF("fail: channel_update\n");
@@ -3123,7 +3259,9 @@ static bool recv_channel_update(ln_self_t *self, const uint8_t *pData, uint16_t
         buf.buf = (CONST_CAST uint8_t *)pData;
         buf.len = Len;
         ret = ln_db_annocnlupd_save(&buf, &upd, ln_their_node_id(self));
-        if (!ret) {
+        if (ret) {
+            ln_anno_verify_seen_add(pData, Len);
+        } else {
             DBG_PRINTF("fail: db save\n");
         }
         ret = true;
@@ -3136,6 +3274,111 @@ static bool recv_channel_update(ln_self_t *self, const uint8_t *pData, uint16_t
 }
 
 
+/** query_short_channel_ids受信
+ *
+ * 応答(channel_announcement/channel_update/node_announcementとreply_short_channel_ids_end)は
+ * 上位層のgossip送信に任せる。
+ */
+static bool recv_query_short_channel_ids(ln_self_t *self, const uint8_t *pData, uint16_t Len)
+{
+    DBG_PRINTF("\n");
+
+    ln_query_short_ids_t msg;
+    bool ret = ln_msg_query_short_ids_read(&msg, pData, Len);
+    if (ret) {
+        DBG_PRINTF("num=%d\n", msg.num);
+        ln_cb_short_ids_recv_t param;
+        param.p_short_ids = msg.p_short_ids;
+        param.num = msg.num;
+        param.complete = true;
+        (*self->p_callback)(self, LN_CB_QUERY_SHORT_IDS_RECV, &param);
+    }
+    M_FREE(msg.p_short_ids);
+
+    //未対応のencodingなどは切断せずに無視する
+    return true;
+}
+
+
+/** reply_short_channel_ids_end受信
+ *
+ */
+static bool recv_reply_short_channel_ids_end(ln_self_t *self, const uint8_t *pData, uint16_t Len)
+{
+    DBG_PRINTF("\n");
+
+    bool complete;
+    bool ret = ln_msg_reply_short_ids_end_read(&complete, pData, Len);
+    if (ret) {
+        DBG_PRINTF("complete=%d\n", complete);
+        (*self->p_callback)(self, LN_CB_REPLY_SHORT_IDS_END_RECV, &complete);
+    }
+
+    return true;
+}
+
+
+/** query_channel_range受信
+ *
+ * 応答(reply_channel_range)は上位層に任せる。
+ * 範囲が広いと応答が多くなり受信処理が止まってしまうため、ここではDB検索も送信もしない。
+ */
+static bool recv_query_channel_range(ln_self_t *self, const uint8_t *pData, uint16_t Len)
+{
+    DBG_PRINTF("\n");
+
+    ln_query_channel_range_t msg;
+    bool ret = ln_msg_query_channel_range_read(&msg, pData, Len);
+    if (ret) {
+        DBG_PRINTF("first_blocknum=%" PRIu32 ", number_of_blocks=%" PRIu32 "\n", msg.first_blocknum, msg.number_of_blocks);
+        (*self->p_callback)(self, LN_CB_QUERY_CHANNEL_RANGE_RECV, &msg);
+    }
+
+    return true;
+}
+
+
+/** reply_channel_range受信
+ *
+ */
+static bool recv_reply_channel_range(ln_self_t *self, const uint8_t *pData, uint16_t Len)
+{
+    DBG_PRINTF("\n");
+
+    ln_reply_channel_range_t msg;
+    bool ret = ln_msg_reply_channel_range_read(&msg, pData, Len);
+    if (ret) {
+        DBG_PRINTF("num=%d, complete=%d\n", msg.num, msg.complete);
+        ln_cb_short_ids_recv_t param;
+        param.p_short_ids = msg.p_short_ids;
+        param.num = msg.num;
+        param.complete = (msg.complete != 0);
+        (*self->p_callback)(self, LN_CB_REPLY_CHANNEL_RANGE_RECV, &param);
+    }
+    M_FREE(msg.p_short_ids);
+
+    return true;
+}
+
+
+/** gossip_timestamp_filter受信
+ *
+ */
+static bool recv_gossip_timestamp_filter(ln_self_t *self, const uint8_t *pData, uint16_t Len)
+{
+    DBG_PRINTF("\n");
+
+    ln_gossip_filter_t msg;
+    bool ret = ln_msg_gossip_filter_read(&msg, pData, Len);
+    if (ret) {
+        DBG_PRINTF("first_timestamp=%" PRIu32 ", timestamp_range=%" PRIu32 "\n", msg.first_timestamp, msg.timestamp_range);
+        (*self->p_callback)(self, LN_CB_GOSSIP_FILTER_RECV, &msg);
+    }
+
+    return true;
+}
+
+
 /** funding_tx minimum_depth待ち開始
  *
  * @param[in]   self
@@ -4845,6 +5088,16 @@ static bool get_nodeid_from_annocnl(ln_self_t *self, uint8_t *pNodeId, uint64_t
 
     pNodeId[0] = 0x00;
 
+    if (ln_db_cnlidx_valid()) {
+        //DBを読まずにindexから取得する
+        ret = ln_db_cnlidx_get(pNodeId, NULL, short_channel_id, Dir);
+        if (!ret) {
+            // DBには無いが、このchannelの情報
+            ret = get_nodeid_from_self(self, pNodeId, short_channel_id, Dir);
+        }
+        return ret;
+    }
+
     ucoin_buf_t buf_cnl_anno = UCOIN_BUF_INIT;
     ret = ln_db_annocnl_load(&buf_cnl_anno, short_channel_id);
     if (ret) {
@@ -4863,21 +5116,8 @@ static bool get_nodeid_from_annocnl(ln_self_t *self, uint8_t *pNodeId, uint64_t
             DBG_PRINTF("ret=%d\n", ret);
         }
     } else {
-        if (short_channel_id == self->short_channel_id) {
-            // DBには無いが、このchannelの情報
-            ucoin_keys_sort_t mydir = sort_nodeid(self, NULL);
-            if ( ((mydir == UCOIN_KEYS_SORT_ASC) && (Dir == 0)) ||
-                 ((mydir == UCOIN_KEYS_SORT_OTHER) && (Dir == 1)) ) {
-                //自ノード
-                DBG_PRINTF("this channel: my node\n");
-                memcpy(pNodeId, ln_node_getid(), UCOIN_SZ_PUBKEY);
-            } else {
-                //相手ノード
-                DBG_PRINTF("this channel: peer node\n");
-                memcpy(pNodeId, self->peer_node_id, UCOIN_SZ_PUBKEY);
-            }
-            ret = true;
-        }
+        // DBには無いが、このchannelの情報
+        ret = get_nodeid_from_self(self, pNodeId, short_channel_id, Dir);
     }
     ucoin_buf_free(&buf_cnl_anno);
 
@@ -4885,6 +5125,28 @@ static bool get_nodeid_from_annocnl(ln_self_t *self, uint8_t *pNodeId, uint64_t
 }
 
 
+//このchannelのnode_id取得
+static bool get_nodeid_from_self(ln_self_t *self, uint8_t *pNodeId, uint64_t short_channel_id, uint8_t Dir)
+{
+    if (short_channel_id != self->short_channel_id) {
+        return false;
+    }
+
+    ucoin_keys_sort_t mydir = sort_nodeid(self, NULL);
+    if ( ((mydir == UCOIN_KEYS_SORT_ASC) && (Dir == 0)) ||
+         ((mydir == UCOIN_KEYS_SORT_OTHER) && (Dir == 1)) ) {
+        //自ノード
+        DBG_PRINTF("this channel: my node\n");
+        memcpy(pNodeId, ln_node_getid(), UCOIN_SZ_PUBKEY);
+    } else {
+        //相手ノード
+        DBG_PRINTF("this channel: peer node\n");
+        memcpy(pNodeId, self->peer_node_id, UCOIN_SZ_PUBKEY);
+    }
+    return true;
+}
+
+
 //HTLC削除
 static void clear_htlc(ln_self_t *self, ln_update_add_htlc_t *p_add)
 {
@@ -0,0 +1,636 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_anno_verify.c
+ *  @brief  announcement署名検証worker thread
+ *
+ *  channel_announcement/channel_update/node_announcementの署名検証は受信threadで行うと、
+ *  大量のannouncementを受信している間そのchannelの処理が止まってしまう。
+ *  受信threadはqueueに積むだけにし、複数のworker threadで並列に検証する。
+ *  検証できたものは #ln_db_anno_save_batch() でまとめてDB保存する。
+ *  queueが一杯の場合、受信threadは空くまで待つ(受信を止める)。
+ *
+ *  channel_updateの検証にはchannel_announcementのnode_idが必要なため、
+ *  同じshort_channel_idのものは同じworker threadに受信順で渡す。
+ *
+ *  また、複数のpeerから同じannouncementを受信することが多いため、
+ *  処理済みメッセージのhashを固定サイズで覚えておき、解析する前に捨てる。
+ *  覚えるのはDB保存したもの、あるいは解析や署名検証に失敗したものだけである。
+ *
+ *  fee変更などで同じchannelのchannel_updateが短時間に続けて届くことがある。
+ *  worker threadはqueueが少ない場合にM_VERIFY_COALESCE_MSECだけ待ってからまとめて取り出し、
+ *  同じbatch内の同じshort_channel_id/directionのchannel_updateは、署名検証できたものの中で
+ *  timestampが新しいものだけを1トランザクションで保存する。
+ *  未検証のもの同士をtimestampで比較すると、不正な署名で正しいchannel_updateを捨てさせられるため、
+ *  検証済みのものより新しくないものだけを検証せずに捨てる。
+ *
+ *  channel_updateのnode_idはDBを読まず、short_channel_id index(ln_db_cnlidx.c)から取得する。
+ *  indexは非圧縮公開鍵もキャッシュしているため、署名検証のたびに公開鍵を展開しなくてよい。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ln_local.h"
+#include "ln/ln_msg_anno.h"
+
+#include "ln_db.h"
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_VERIFY_QUEUE_MAX      (256)           ///< worker threadごとの検証待ちqueueの最大数
+#define M_VERIFY_BATCH_MAX      (64)            ///< 1回のDB保存でまとめる最大数
+#define M_VERIFY_COALESCE_MSEC  (200)           ///< queueが少ない場合に取り出しを待つ時間[msec]
+#define M_VERIFY_THREAD_MAX     (8)             ///< worker thread最大数
+
+#define M_SEEN_NUM              (8192)          ///< 受信済みhashの保持数(2のべき乗)
+#define M_SEEN_LEN              (16)            ///< 受信済みhashとして保持する長さ
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct verify_job_t
+ *  @brief  検証待ちのannouncement
+ */
+typedef struct {
+    uint16_t    type;                       ///< MSGTYPE_CHANNEL_ANNOUNCEMENT / MSGTYPE_CHANNEL_UPDATE / MSGTYPE_NODE_ANNOUNCEMENT
+    uint16_t    len;                        ///< data長
+    bool        has_node;                   ///< true:node_id有効
+    bool        has_send;                   ///< true:send_id有効
+    uint8_t     dir;                        ///< channel_updateのdirection
+    uint32_t    timestamp;                  ///< channel_updateのtimestamp
+    uint64_t    short_channel_id;           ///< channel_announcement/channel_updateのshort_channel_id
+    uint8_t     node_id[UCOIN_SZ_PUBKEY];   ///< channel_updateの署名者(DBに無い場合に使用する)
+    uint8_t     send_id[UCOIN_SZ_PUBKEY];   ///< 受信元node_id
+    uint8_t     data[];                     ///< 受信したパケット
+} verify_job_t;
+
+
+/** @struct verify_worker_t
+ *  @brief  worker threadごとのqueue
+ */
+typedef struct {
+    pthread_t       th;
+    verify_job_t    *p_queue[M_VERIFY_QUEUE_MAX];
+    int             head;                   ///< 次に取り出す位置
+    int             num;                    ///< queueに積まれている数
+    pthread_cond_t  cond_job;               ///< queueに積まれた
+    pthread_cond_t  cond_space;             ///< queueに空きができた
+} verify_worker_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static verify_worker_t      mVerifyWorker[M_VERIFY_THREAD_MAX];
+static int                  mVerifyThreadNum;
+static bool                 mVerifyRun;         ///< true:worker thread動作中
+static pthread_mutex_t      mMuxVerify = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long        mVerifyCoalesce;    ///< 検証済みのものより古いため捨てたchannel_update数
+
+static uint8_t              mSeen[M_SEEN_NUM][M_SEEN_LEN];
+static pthread_mutex_t      mMuxSeen = PTHREAD_MUTEX_INITIALIZER;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static bool verify_push(int Idx, uint16_t Type, const uint8_t *pData, uint16_t Len, uint64_t ShortChannelId, const ln_cnl_update_t *pUpd, const uint8_t *pNodeId, const uint8_t *pSendId);
+static int verify_coalesce(const ln_db_anno_save_t *pSave, const bool *pVerified, int Num, const ln_cnl_update_t *pUpd);
+static int verify_index_cnl(uint64_t ShortChannelId);
+static void *verify_thread(void *pArg);
+static void verify_batch(verify_job_t **ppJob, int Num);
+static bool verify_cnlupd_nodeid(uint8_t *pNodeId, uint8_t *pUncomp, bool *pUncompOk,
+                    const ln_cnl_update_t *pUpd, const verify_job_t *pJob,
+                    const ln_db_anno_save_t *pSave, const ln_cnl_announce_read_t *pAnn, int Num);
+static bool verify_cnlanno_saved(const ucoin_buf_t *pBuf, uint64_t ShortChannelId);
+static uint32_t seen_hash(uint8_t *pHash, const uint8_t *pData, uint16_t Len);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool ln_anno_verify_start(int Num)
+{
+    pthread_mutex_lock(&mMuxVerify);
+    if (mVerifyRun || (mVerifyThreadNum > 0)) {
+        //開始済み、あるいは #ln_anno_verify_stop()がthread終了待ち
+        bool ret = mVerifyRun;
+        pthread_mutex_unlock(&mMuxVerify);
+        return ret;
+    }
+
+    if (Num <= 0) {
+        long cpu = sysconf(_SC_NPROCESSORS_ONLN);
+        Num = (cpu > 0) ? (int)cpu : 1;
+    }
+    if (Num > M_VERIFY_THREAD_MAX) {
+        Num = M_VERIFY_THREAD_MAX;
+    }
+
+    mVerifyRun = true;
+    mVerifyThreadNum = 0;
+    for (int lp = 0; lp < Num; lp++) {
+        verify_worker_t *p_worker = &mVerifyWorker[lp];
+        p_worker->head = 0;
+        p_worker->num = 0;
+        pthread_cond_init(&p_worker->cond_job, NULL);
+        pthread_cond_init(&p_worker->cond_space, NULL);
+        if (pthread_create(&p_worker->th, NULL, verify_thread, p_worker) != 0) {
+            DBG_PRINTF("fail: thread create\n");
+            pthread_cond_destroy(&p_worker->cond_job);
+            pthread_cond_destroy(&p_worker->cond_space);
+            break;
+        }
+        mVerifyThreadNum++;
+    }
+    if (mVerifyThreadNum == 0) {
+        mVerifyRun = false;
+    }
+    DBG_PRINTF("verify thread=%d\n", mVerifyThreadNum);
+    bool ret = mVerifyRun;
+    pthread_mutex_unlock(&mMuxVerify);
+
+    return ret;
+}
+
+
+void ln_anno_verify_stop(void)
+{
+    pthread_mutex_lock(&mMuxVerify);
+    if (!mVerifyRun) {
+        pthread_mutex_unlock(&mMuxVerify);
+        return;
+    }
+    mVerifyRun = false;
+    for (int lp = 0; lp < mVerifyThreadNum; lp++) {
+        pthread_cond_broadcast(&mVerifyWorker[lp].cond_job);
+        pthread_cond_broadcast(&mVerifyWorker[lp].cond_space);
+    }
+    pthread_mutex_unlock(&mMuxVerify);
+
+    //queueに残っているものは保存してから終了する
+    for (int lp = 0; lp < mVerifyThreadNum; lp++) {
+        pthread_join(mVerifyWorker[lp].th, NULL);
+        pthread_cond_destroy(&mVerifyWorker[lp].cond_job);
+        pthread_cond_destroy(&mVerifyWorker[lp].cond_space);
+    }
+    pthread_mutex_lock(&mMuxVerify);
+    mVerifyThreadNum = 0;
+    pthread_mutex_unlock(&mMuxVerify);
+    DBG_PRINTF("verify thread stop\n");
+}
+
+
+/********************************************************************
+ * HIDDEN
+ ********************************************************************/
+
+bool HIDDEN ln_anno_verify_seen(const uint8_t *pData, uint16_t Len)
+{
+    uint8_t hash[UCOIN_SZ_SHA256];
+    uint32_t idx = seen_hash(hash, pData, Len);
+
+    pthread_mutex_lock(&mMuxSeen);
+    bool seen = (memcmp(mSeen[idx], hash, M_SEEN_LEN) == 0);
+    pthread_mutex_unlock(&mMuxSeen);
+
+    return seen;
+}
+
+
+void HIDDEN ln_anno_verify_seen_add(const uint8_t *pData, uint16_t Len)
+{
+    uint8_t hash[UCOIN_SZ_SHA256];
+    uint32_t idx = seen_hash(hash, pData, Len);
+
+    pthread_mutex_lock(&mMuxSeen);
+    memcpy(mSeen[idx], hash, M_SEEN_LEN);
+    pthread_mutex_unlock(&mMuxSeen);
+}
+
+
+bool HIDDEN ln_anno_verify_cnlanno(const uint8_t *pData, uint16_t Len, uint64_t ShortChannelId, const uint8_t *pSendId)
+{
+    return verify_push(verify_index_cnl(ShortChannelId), MSGTYPE_CHANNEL_ANNOUNCEMENT,
+                    pData, Len, ShortChannelId, NULL, NULL, pSendId);
+}
+
+
+bool HIDDEN ln_anno_verify_cnlupd(const uint8_t *pData, uint16_t Len, const ln_cnl_update_t *pUpd, const uint8_t *pNodeId, const uint8_t *pSendId)
+{
+    return verify_push(verify_index_cnl(pUpd->short_channel_id), MSGTYPE_CHANNEL_UPDATE,
+                    pData, Len, pUpd->short_channel_id, pUpd, pNodeId, pSendId);
+}
+
+
+bool HIDDEN ln_anno_verify_nodeanno(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+{
+    //他との順序関係は無いので、署名の値で振り分ける
+    int idx = (Len > sizeof(uint16_t) + 1) ? pData[sizeof(uint16_t) + 1] : 0;
+    return verify_push(idx, MSGTYPE_NODE_ANNOUNCEMENT, pData, Len, 0, NULL, NULL, pSendId);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 検証待ちqueueに積む
+ *
+ * queueが一杯の場合は空くまで待つ。
+ *
+ * @param[in]   Idx             worker thread選択値(thread数で割った余りを使う)
+ * @param[in]   Type            MSGTYPE_xxx
+ * @param[in]   pData           受信したパケット
+ * @param[in]   Len             pData長
+ * @param[in]   ShortChannelId  short_channel_id(node_announcementは0)
+ * @param[in]   pUpd            (channel_update)解析結果(それ以外はNULL)
+ * @param[in]   pNodeId         (channel_update)DBに無い場合の署名者node_id(NULL時は無し)
+ * @param[in]   pSendId         受信元node_id
+ * @retval  true    queueに積んだ
+ * @retval  false   worker threadが動作していない(呼び出し元で処理すること)
+ */
+static bool verify_push(int Idx, uint16_t Type, const uint8_t *pData, uint16_t Len, uint64_t ShortChannelId, const ln_cnl_update_t *pUpd, const uint8_t *pNodeId, const uint8_t *pSendId)
+{
+    if (!mVerifyRun) {
+        return false;
+    }
+
+    verify_job_t *p_job = (verify_job_t *)M_MALLOC(sizeof(verify_job_t) + Len);
+    p_job->type = Type;
+    p_job->len = Len;
+    p_job->short_channel_id = ShortChannelId;
+    p_job->dir = (pUpd != NULL) ? ln_cnlupd_direction(pUpd) : 0;
+    p_job->timestamp = (pUpd != NULL) ? pUpd->timestamp : 0;
+    p_job->has_node = (pNodeId != NULL);
+    if (p_job->has_node) {
+        memcpy(p_job->node_id, pNodeId, UCOIN_SZ_PUBKEY);
+    }
+    p_job->has_send = (pSendId != NULL);
+    if (p_job->has_send) {
+        memcpy(p_job->send_id, pSendId, UCOIN_SZ_PUBKEY);
+    }
+    memcpy(p_job->data, pData, Len);
+
+    pthread_mutex_lock(&mMuxVerify);
+    bool ret = mVerifyRun;
+    if (ret) {
+        verify_worker_t *p_worker = &mVerifyWorker[Idx % mVerifyThreadNum];
+        while (mVerifyRun && (p_worker->num == M_VERIFY_QUEUE_MAX)) {
+            pthread_cond_wait(&p_worker->cond_space, &mMuxVerify);
+        }
+        ret = mVerifyRun;
+        if (ret) {
+            p_worker->p_queue[(p_worker->head + p_worker->num) % M_VERIFY_QUEUE_MAX] = p_job;
+            p_worker->num++;
+            pthread_cond_signal(&p_worker->cond_job);
+        }
+    }
+    pthread_mutex_unlock(&mMuxVerify);
+
+    if (!ret) {
+        M_FREE(p_job);
+    }
+    return ret;
+}
+
+
+/** short_channel_idからworker thread選択値を求める
+ *
+ * 下位16bitはoutput indexなので、block heightとtx indexを使う。
+ */
+static int verify_index_cnl(uint64_t ShortChannelId)
+{
+    return (int)(((ShortChannelId >> 16) ^ (ShortChannelId >> 40)) & 0x7fffffff);
+}
+
+
+/** worker thread
+ *
+ * queueから取り出して検証・保存する。
+ * 停止要求後もqueueが空になるまでは処理を続ける。
+ */
+static void *verify_thread(void *pArg)
+{
+    verify_worker_t *p_worker = (verify_worker_t *)pArg;
+    verify_job_t *p_jobs[M_VERIFY_BATCH_MAX];
+
+    while (true) {
+        pthread_mutex_lock(&mMuxVerify);
+        while (mVerifyRun && (p_worker->num == 0)) {
+            pthread_cond_wait(&p_worker->cond_job, &mMuxVerify);
+        }
+        if (p_worker->num == 0) {
+            //停止要求 && queueが空
+            pthread_mutex_unlock(&mMuxVerify);
+            break;
+        }
+        if (mVerifyRun && (p_worker->num < M_VERIFY_BATCH_MAX)) {
+            //続けて届くchannel_updateを置き換えられるよう、少し待ってから取り出す
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += M_VERIFY_COALESCE_MSEC * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            while (mVerifyRun && (p_worker->num < M_VERIFY_BATCH_MAX)) {
+                if (pthread_cond_timedwait(&p_worker->cond_job, &mMuxVerify, &ts) != 0) {
+                    break;
+                }
+            }
+        }
+
+        int num = 0;
+        while ((p_worker->num > 0) && (num < M_VERIFY_BATCH_MAX)) {
+            p_jobs[num++] = p_worker->p_queue[p_worker->head];
+            p_worker->head = (p_worker->head + 1) % M_VERIFY_QUEUE_MAX;
+            p_worker->num--;
+        }
+        pthread_cond_broadcast(&p_worker->cond_space);
+        DBG_PRINTF("verify jobs=%d, coalesced=%lu\n", num, __atomic_load_n(&mVerifyCoalesce, __ATOMIC_RELAXED));
+        pthread_mutex_unlock(&mMuxVerify);
+
+        if (num > 0) {
+            verify_batch(p_jobs, num);
+        }
+    }
+
+    return NULL;
+}
+
+
+/** 署名検証して、検証できたものをまとめてDB保存する
+ *
+ * 同じshort_channel_id/directionのchannel_updateは、署名検証できたものの中で最も新しいものだけを保存する。
+ *
+ * @param[in,out]   ppJob       検証するannouncement(受信順。解放する)
+ * @param[in]       Num         ppJob数
+ */
+static void verify_batch(verify_job_t **ppJob, int Num)
+{
+    ln_db_anno_save_t       save[M_VERIFY_BATCH_MAX];
+    ucoin_buf_t             buf[M_VERIFY_BATCH_MAX];
+    ln_cnl_announce_read_t  ann[M_VERIFY_BATCH_MAX];
+    ln_cnl_update_t         upd[M_VERIFY_BATCH_MAX];
+    ln_node_announce_t      anno[M_VERIFY_BATCH_MAX];
+    uint8_t                 node_id[M_VERIFY_BATCH_MAX][UCOIN_SZ_PUBKEY];
+    char                    node_alias[M_VERIFY_BATCH_MAX][LN_SZ_ALIAS + 1];
+    bool                    verified[M_VERIFY_BATCH_MAX];
+    int                     cnt = 0;
+
+    for (int lp = 0; lp < Num; lp++) {
+        const verify_job_t *p_job = ppJob[lp];
+        bool ret;
+        int old = -1;
+
+        buf[cnt].buf = (CONST_CAST uint8_t *)p_job->data;
+        buf[cnt].len = p_job->len;
+        save[cnt].short_channel_id = p_job->short_channel_id;
+        save[cnt].p_upd = NULL;
+        save[cnt].p_nodeanno = NULL;
+        verified[cnt] = false;
+        switch (p_job->type) {
+        case MSGTYPE_CHANNEL_ANNOUNCEMENT:
+            ret = ln_msg_cnl_announce_read(&ann[cnt], p_job->data, p_job->len);
+            if (ret && verify_cnlanno_saved(&buf[cnt], p_job->short_channel_id)) {
+                //保存済み
+                ln_anno_verify_seen_add(p_job->data, p_job->len);
+                continue;
+            }
+            if (ret) {
+                ret = ln_msg_cnl_announce_verify(p_job->data, p_job->len);
+            }
+            verified[cnt] = ret;
+            break;
+        case MSGTYPE_CHANNEL_UPDATE:
+            memset(&upd[cnt], 0, sizeof(ln_cnl_update_t));
+            ret = ln_msg_cnl_update_read(&upd[cnt], p_job->data, p_job->len);
+            if (ret) {
+                old = verify_coalesce(save, verified, cnt, &upd[cnt]);
+                if ((old >= 0) && (save[old].p_upd->timestamp >= upd[cnt].timestamp)) {
+                    //BOLT#7: timestampが新しくないchannel_updateは無視してよい
+                    DBG_PRINTF("coalesce: drop new %016" PRIx64 "\n", upd[cnt].short_channel_id);
+                    __atomic_add_fetch(&mVerifyCoalesce, 1, __ATOMIC_RELAXED);
+                    continue;
+                }
+            }
+            if (ret) {
+                uint8_t upd_node[UCOIN_SZ_PUBKEY];
+                uint8_t upd_uncomp[UCOIN_SZ_PUBKEY_UNCOMP];
+                bool uncomp_ok;
+                if (verify_cnlupd_nodeid(upd_node, upd_uncomp, &uncomp_ok, &upd[cnt], p_job, save, ann, cnt)) {
+                    if (uncomp_ok) {
+                        ret = ln_msg_cnl_update_verify_uncomp(upd_uncomp, p_job->data, p_job->len);
+                    } else {
+                        ret = ln_msg_cnl_update_verify(upd_node, p_job->data, p_job->len);
+                    }
+                    verified[cnt] = ret;
+                } else {
+                    //該当するchannel_announcementが見つからない
+                    //  r fieldでchannel_update相当のデータを送信したい場合に備えて保持する
+                    DBG_PRINTF("not found channel_announcement: %016" PRIx64 "\n", upd[cnt].short_channel_id);
+                }
+            }
+            save[cnt].p_upd = &upd[cnt];
+            break;
+        default:
+            anno[cnt].p_node_id = node_id[cnt];
+            anno[cnt].p_alias = node_alias[cnt];
+            ret = ln_msg_node_announce_read(&anno[cnt], p_job->data, p_job->len);
+            save[cnt].p_nodeanno = &anno[cnt];
+            break;
+        }
+        if (!ret) {
+            //スルーするだけにとどめる(何度受信しても結果は同じ)
+            DBG_PRINTF("fail: verify(%04x)\n", p_job->type);
+            ln_anno_verify_seen_add(p_job->data, p_job->len);
+            continue;
+        }
+
+        if (verified[cnt] && (old >= 0)) {
+            //検証済み同士なので、古い方を保存しない
+            DBG_PRINTF("coalesce: drop old %016" PRIx64 "\n", upd[cnt].short_channel_id);
+            __atomic_add_fetch(&mVerifyCoalesce, 1, __ATOMIC_RELAXED);
+            save[old].p_buf = NULL;
+        }
+
+        save[cnt].p_buf = &buf[cnt];
+        save[cnt].p_send_id = (p_job->has_send) ? p_job->send_id : NULL;
+        cnt++;
+    }
+
+    //置き換えたものを詰める(pAnnとの対応はここ以降使わない)
+    int num_save = 0;
+    for (int lp = 0; lp < cnt; lp++) {
+        if (save[lp].p_buf != NULL) {
+            save[num_save++] = save[lp];
+        }
+    }
+    if (num_save > 0) {
+        bool result[M_VERIFY_BATCH_MAX];
+        int saved = ln_db_anno_save_batch(save, num_save, result);
+        DBG_PRINTF("verified=%d/%d, saved=%d\n", num_save, Num, saved);
+        for (int lp = 0; lp < num_save; lp++) {
+            if (result[lp]) {
+                ln_anno_verify_seen_add(save[lp].p_buf->buf, (uint16_t)save[lp].p_buf->len);
+            }
+        }
+    }
+
+    for (int lp = 0; lp < Num; lp++) {
+        M_FREE(ppJob[lp]);
+    }
+}
+
+
+/** 同じbatchで署名検証済みのchannel_update検索
+ *
+ * @param[in]   pSave           同じbatchで検証したもの
+ * @param[in]   pVerified       pSaveに対応する署名検証結果
+ * @param[in]   Num             pSave数
+ * @param[in]   pUpd            検索するchannel_update
+ * @return      同じshort_channel_id/directionで署名検証済みのchannel_updateのindex(-1:無し)
+ */
+static int verify_coalesce(const ln_db_anno_save_t *pSave, const bool *pVerified, int Num, const ln_cnl_update_t *pUpd)
+{
+    uint8_t dir = ln_cnlupd_direction(pUpd);
+    for (int lp = 0; lp < Num; lp++) {
+        if ( pVerified[lp] && (pSave[lp].p_buf != NULL) && (pSave[lp].p_upd != NULL) &&
+             (pSave[lp].p_upd->short_channel_id == pUpd->short_channel_id) &&
+             (ln_cnlupd_direction(pSave[lp].p_upd) == dir) ) {
+            return lp;
+        }
+    }
+    return -1;
+}
+
+
+/** channel_updateの署名者node_id取得
+ *
+ * DB(index), 同じbatchで検証済みのchannel_announcement, 受信時に指定されたnode_idの順に探す。
+ * indexから取得できた場合は、非圧縮公開鍵も返す。
+ *
+ * @param[out]  pNodeId         署名者node_id
+ * @param[out]  pUncomp         署名者node_idの非圧縮公開鍵
+ * @param[out]  pUncompOk       true:pUncompを取得した
+ * @param[in]   pUpd            channel_update
+ * @param[in]   pJob            channel_updateのjob
+ * @param[in]   pSave           同じbatchで検証済みのもの
+ * @param[in]   pAnn            pSaveに対応するchannel_announcement解析結果
+ * @param[in]   Num             pSave数
+ * @retval  true    取得できた
+ */
+static bool verify_cnlupd_nodeid(uint8_t *pNodeId, uint8_t *pUncomp, bool *pUncompOk,
+                    const ln_cnl_update_t *pUpd, const verify_job_t *pJob,
+                    const ln_db_anno_save_t *pSave, const ln_cnl_announce_read_t *pAnn, int Num)
+{
+    bool ret;
+    const uint8_t *p_node_id = NULL;
+    ln_cnl_announce_read_t ann;
+    uint8_t dir = ln_cnlupd_direction(pUpd);
+
+    *pUncompOk = false;
+    if (ln_db_cnlidx_valid()) {
+        if (ln_db_cnlidx_get(pNodeId, pUncomp, pUpd->short_channel_id, dir)) {
+            *pUncompOk = true;
+            return true;
+        }
+    } else {
+        ucoin_buf_t buf_cnl_anno = UCOIN_BUF_INIT;
+        ret = ln_db_annocnl_load(&buf_cnl_anno, pUpd->short_channel_id);
+        if (ret) {
+            ret = ln_msg_cnl_announce_read(&ann, buf_cnl_anno.buf, buf_cnl_anno.len);
+            if (ret) {
+                p_node_id = (dir == 0) ? ann.node_id1 : ann.node_id2;
+            }
+        }
+        ucoin_buf_free(&buf_cnl_anno);
+    }
+
+    for (int lp = Num - 1; (p_node_id == NULL) && (lp >= 0); lp--) {
+        if ((pSave[lp].p_upd == NULL) && (pSave[lp].p_nodeanno == NULL) &&
+            (pSave[lp].short_channel_id == pUpd->short_channel_id)) {
+            p_node_id = (dir == 0) ? pAnn[lp].node_id1 : pAnn[lp].node_id2;
+        }
+    }
+    if ((p_node_id == NULL) && pJob->has_node) {
+        p_node_id = pJob->node_id;
+    }
+
+    if ((p_node_id != NULL) && ucoin_keys_chkpub(p_node_id)) {
+        memcpy(pNodeId, p_node_id, UCOIN_SZ_PUBKEY);
+        return true;
+    }
+    return false;
+}
+
+
+/** channel_announcement保存済みチェック
+ *
+ * @param[in]   pBuf            channel_announcement
+ * @param[in]   ShortChannelId  short_channel_id
+ * @retval  true    保存済み(内容が異なるものも含む)
+ */
+static bool verify_cnlanno_saved(const ucoin_buf_t *pBuf, uint64_t ShortChannelId)
+{
+    uint8_t node_id[UCOIN_SZ_PUBKEY];
+    if (ln_db_cnlidx_valid() && !ln_db_cnlidx_get(node_id, NULL, ShortChannelId, 0)) {
+        //indexに無ければ未保存
+        return false;
+    }
+
+    ucoin_buf_t buf_cnl_anno = UCOIN_BUF_INIT;
+    bool ret = ln_db_annocnl_load(&buf_cnl_anno, ShortChannelId);
+    if (ret && !ucoin_buf_cmp(&buf_cnl_anno, pBuf)) {
+        DBG_PRINTF("fail: different channel_announcement\n");
+    }
+    ucoin_buf_free(&buf_cnl_anno);
+    return ret;
+}
+
+
+/** 受信済みhash計算
+ *
+ * @param[out]  pHash           SHA256(pData)
+ * @param[in]   pData           announcement
+ * @param[in]   Len             pData長
+ * @return      mSeenのindex
+ */
+static uint32_t seen_hash(uint8_t *pHash, const uint8_t *pData, uint16_t Len)
+{
+    ucoin_util_sha256(pHash, pData, Len);
+    return ((uint32_t)pHash[M_SEEN_LEN] | ((uint32_t)pHash[M_SEEN_LEN + 1] << 8)) & (M_SEEN_NUM - 1);
+}
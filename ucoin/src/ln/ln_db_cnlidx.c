@@ -0,0 +1,416 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_db_cnlidx.c
+ *  @brief  short_channel_id → node_idのメモリ上index
+ *
+ *  channel_updateの署名者を知るためだけにDBからchannel_announcementを読込んで解析すると、
+ *  channel_updateを受信するたびにDBアクセスが発生する。
+ *  DBに保存しているchannel_announcementのnode_id_1/node_id_2をメモリ上に持ち、
+ *  channel_update検証時はここから取得する。
+ *
+ *  多くのchannelで同じnodeが現れるため、node_idは別tableに1つだけ持ち、
+ *  channel側はそのindexを持つ。
+ *  node_idの非圧縮公開鍵は初めて検証に使う時に展開して保持する。
+ *  nodeは削除しない(channelが閉じてもnode数はほとんど増えないため)。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ln_local.h"
+#include "ln/ln_msg_anno.h"
+
+#include "ln_db.h"
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_CNLIDX_INIT           (4096)          ///< channel tableの初期サイズ(2のべき乗)
+#define M_NODEIDX_INIT          (1024)          ///< node hashの初期サイズ(2のべき乗)
+#define M_NODE_NONE             (UINT32_MAX)    ///< node hashの空き
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct cnlidx_t
+ *  @brief  channel table要素
+ */
+typedef struct {
+    uint64_t    short_channel_id;           ///< 0:空き
+    uint32_t    node[2];                    ///< node_id_1/node_id_2のmpNodeIdx index
+} cnlidx_t;
+
+
+/** @struct nodeidx_t
+ *  @brief  node table要素
+ */
+typedef struct {
+    uint8_t     node_id[UCOIN_SZ_PUBKEY];
+    bool        uncomp_ok;                  ///< true:uncomp展開済み
+    uint8_t     uncomp[UCOIN_SZ_PUBKEY_UNCOMP];
+} nodeidx_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+//channel table(open addressing)
+static cnlidx_t             *mpCnlIdx;
+static uint32_t             mCnlIdxSize;
+static uint32_t             mCnlIdxNum;
+
+//node table(追加のみ)と、node_idからの検索用hash
+static nodeidx_t            *mpNodeIdx;
+static uint32_t             mNodeIdxAlloc;
+static uint32_t             mNodeIdxNum;
+static uint32_t             *mpNodeHash;
+static uint32_t             mNodeHashSize;
+
+static bool                 mCnlIdxValid;       ///< true:DBから読込み済み
+static pthread_rwlock_t     mRwCnlIdx = PTHREAD_RWLOCK_INITIALIZER;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void cnlidx_add(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2);
+static cnlidx_t *cnlidx_search(uint64_t ShortChannelId);
+static void cnlidx_grow(void);
+static uint32_t nodeidx_add(const uint8_t *pNodeId);
+static void nodehash_grow(void);
+static inline uint32_t cnlidx_hash(uint64_t ShortChannelId);
+static inline uint32_t nodeidx_hash(const uint8_t *pNodeId);
+
+
+/**************************************************************************
+ * library functions
+ **************************************************************************/
+
+bool HIDDEN ln_db_cnlidx_init(void)
+{
+    void *p_db;
+    void *p_cur;
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+
+    pthread_rwlock_wrlock(&mRwCnlIdx);
+    if (mCnlIdxValid) {
+        pthread_rwlock_unlock(&mRwCnlIdx);
+        return true;
+    }
+    mCnlIdxSize = M_CNLIDX_INIT;
+    mpCnlIdx = (cnlidx_t *)M_MALLOC(sizeof(cnlidx_t) * mCnlIdxSize);
+    memset(mpCnlIdx, 0, sizeof(cnlidx_t) * mCnlIdxSize);
+    mCnlIdxNum = 0;
+    mNodeIdxAlloc = M_NODEIDX_INIT / 2;
+    mpNodeIdx = (nodeidx_t *)M_MALLOC(sizeof(nodeidx_t) * mNodeIdxAlloc);
+    mNodeIdxNum = 0;
+    mNodeHashSize = M_NODEIDX_INIT;
+    mpNodeHash = (uint32_t *)M_MALLOC(sizeof(uint32_t) * mNodeHashSize);
+    memset(mpNodeHash, 0xff, sizeof(uint32_t) * mNodeHashSize);     //M_NODE_NONE
+
+    if (ln_db_node_cur_transaction(&p_db, LN_DB_TXN_CNL, NULL)) {
+        if (ln_db_annocnl_cur_open(&p_cur, p_db)) {
+            uint64_t short_channel_id;
+            char type;
+            while (ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, NULL, &buf)) {
+                if (type == LN_DB_CNLANNO_ANNO) {
+                    ln_cnl_announce_read_t ann;
+                    if (ln_msg_cnl_announce_read(&ann, buf.buf, buf.len)) {
+                        cnlidx_add(ann.short_channel_id, ann.node_id1, ann.node_id2);
+                    }
+                }
+                ucoin_buf_free(&buf);
+            }
+            ln_db_annocnl_cur_close(p_cur);
+        }
+        ln_db_node_cur_commit(p_db);
+    }
+    mCnlIdxValid = true;
+    DBG_PRINTF("channel index: channel=%" PRIu32 ", node=%" PRIu32 "\n", mCnlIdxNum, mNodeIdxNum);
+    pthread_rwlock_unlock(&mRwCnlIdx);
+
+    return true;
+}
+
+
+void HIDDEN ln_db_cnlidx_term(void)
+{
+    pthread_rwlock_wrlock(&mRwCnlIdx);
+    if (mCnlIdxValid) {
+        M_FREE(mpCnlIdx);
+        M_FREE(mpNodeIdx);
+        M_FREE(mpNodeHash);
+        mCnlIdxSize = 0;
+        mCnlIdxNum = 0;
+        mNodeIdxAlloc = 0;
+        mNodeIdxNum = 0;
+        mNodeHashSize = 0;
+        mCnlIdxValid = false;
+    }
+    pthread_rwlock_unlock(&mRwCnlIdx);
+}
+
+
+void HIDDEN ln_db_cnlidx_add(const ucoin_buf_t *pCnlAnno)
+{
+    ln_cnl_announce_read_t ann;
+
+    if (!ln_msg_cnl_announce_read(&ann, pCnlAnno->buf, pCnlAnno->len)) {
+        return;
+    }
+    pthread_rwlock_wrlock(&mRwCnlIdx);
+    if (mCnlIdxValid) {
+        cnlidx_add(ann.short_channel_id, ann.node_id1, ann.node_id2);
+    }
+    pthread_rwlock_unlock(&mRwCnlIdx);
+}
+
+
+void HIDDEN ln_db_cnlidx_del(uint64_t ShortChannelId)
+{
+    pthread_rwlock_wrlock(&mRwCnlIdx);
+    cnlidx_t *p_idx = (mCnlIdxValid) ? cnlidx_search(ShortChannelId) : NULL;
+    if (p_idx != NULL) {
+        //後ろに続く要素を詰める(linear probingのため、削除済み印は使わない)
+        uint32_t mask = mCnlIdxSize - 1;
+        uint32_t hole = (uint32_t)(p_idx - mpCnlIdx);
+        uint32_t pos = hole;
+        while (true) {
+            pos = (pos + 1) & mask;
+            if (mpCnlIdx[pos].short_channel_id == 0) {
+                break;
+            }
+            uint32_t home = cnlidx_hash(mpCnlIdx[pos].short_channel_id) & mask;
+            //homeがhole～posの間(循環考慮)に無ければholeへ移動できる
+            if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+                mpCnlIdx[hole] = mpCnlIdx[pos];
+                hole = pos;
+            }
+        }
+        mpCnlIdx[hole].short_channel_id = 0;
+        mCnlIdxNum--;
+    }
+    pthread_rwlock_unlock(&mRwCnlIdx);
+}
+
+
+bool HIDDEN ln_db_cnlidx_get(uint8_t *pNodeId, uint8_t *pUncomp, uint64_t ShortChannelId, uint8_t Dir)
+{
+    bool ret = false;
+    bool uncomp_ok = false;
+    uint32_t node = M_NODE_NONE;
+
+    pthread_rwlock_rdlock(&mRwCnlIdx);
+    const cnlidx_t *p_idx = (mCnlIdxValid) ? cnlidx_search(ShortChannelId) : NULL;
+    if (p_idx != NULL) {
+        node = p_idx->node[Dir & 1];
+        const nodeidx_t *p_node = &mpNodeIdx[node];
+        memcpy(pNodeId, p_node->node_id, UCOIN_SZ_PUBKEY);
+        uncomp_ok = p_node->uncomp_ok;
+        if ((pUncomp != NULL) && uncomp_ok) {
+            memcpy(pUncomp, p_node->uncomp, UCOIN_SZ_PUBKEY_UNCOMP);
+        }
+        ret = true;
+    }
+    pthread_rwlock_unlock(&mRwCnlIdx);
+
+    if (ret && (pUncomp != NULL) && !uncomp_ok) {
+        //展開はロック外で行い、結果だけ保存する
+        ret = ucoin_keys_pubuncomp(pUncomp, pNodeId);
+        if (ret) {
+            pthread_rwlock_wrlock(&mRwCnlIdx);
+            if (mCnlIdxValid && (node < mNodeIdxNum)) {
+                nodeidx_t *p_node = &mpNodeIdx[node];
+                memcpy(p_node->uncomp, pUncomp, UCOIN_SZ_PUBKEY_UNCOMP);
+                p_node->uncomp_ok = true;
+            }
+            pthread_rwlock_unlock(&mRwCnlIdx);
+        }
+    }
+
+    return ret;
+}
+
+
+bool HIDDEN ln_db_cnlidx_valid(void)
+{
+    return mCnlIdxValid;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** channel追加(ロックして呼ぶこと)
+ *
+ */
+static void cnlidx_add(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2)
+{
+    if (ShortChannelId == 0) {
+        return;
+    }
+    cnlidx_t *p_idx = cnlidx_search(ShortChannelId);
+    if (p_idx == NULL) {
+        if ((mCnlIdxNum + 1) * 2 > mCnlIdxSize) {
+            cnlidx_grow();
+        }
+        uint32_t mask = mCnlIdxSize - 1;
+        uint32_t pos = cnlidx_hash(ShortChannelId) & mask;
+        while (mpCnlIdx[pos].short_channel_id != 0) {
+            pos = (pos + 1) & mask;
+        }
+        p_idx = &mpCnlIdx[pos];
+        p_idx->short_channel_id = ShortChannelId;
+        mCnlIdxNum++;
+    }
+    p_idx->node[0] = nodeidx_add(pNodeId1);
+    p_idx->node[1] = nodeidx_add(pNodeId2);
+}
+
+
+/** channel検索(ロックして呼ぶこと)
+ *
+ * @return  見つからない場合はNULL
+ */
+static cnlidx_t *cnlidx_search(uint64_t ShortChannelId)
+{
+    uint32_t mask = mCnlIdxSize - 1;
+    uint32_t pos = cnlidx_hash(ShortChannelId) & mask;
+    while (mpCnlIdx[pos].short_channel_id != 0) {
+        if (mpCnlIdx[pos].short_channel_id == ShortChannelId) {
+            return &mpCnlIdx[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+    return NULL;
+}
+
+
+/** channel table拡張
+ *
+ */
+static void cnlidx_grow(void)
+{
+    cnlidx_t *p_old = mpCnlIdx;
+    uint32_t old_size = mCnlIdxSize;
+
+    mCnlIdxSize *= 2;
+    mpCnlIdx = (cnlidx_t *)M_MALLOC(sizeof(cnlidx_t) * mCnlIdxSize);
+    memset(mpCnlIdx, 0, sizeof(cnlidx_t) * mCnlIdxSize);
+    uint32_t mask = mCnlIdxSize - 1;
+    for (uint32_t lp = 0; lp < old_size; lp++) {
+        if (p_old[lp].short_channel_id != 0) {
+            uint32_t pos = cnlidx_hash(p_old[lp].short_channel_id) & mask;
+            while (mpCnlIdx[pos].short_channel_id != 0) {
+                pos = (pos + 1) & mask;
+            }
+            mpCnlIdx[pos] = p_old[lp];
+        }
+    }
+    M_FREE(p_old);
+}
+
+
+/** node追加(ロックして呼ぶこと)
+ *
+ * @return  mpNodeIdxのindex(登録済みの場合はそのindex)
+ */
+static uint32_t nodeidx_add(const uint8_t *pNodeId)
+{
+    uint32_t mask = mNodeHashSize - 1;
+    uint32_t pos = nodeidx_hash(pNodeId) & mask;
+    while (mpNodeHash[pos] != M_NODE_NONE) {
+        if (memcmp(mpNodeIdx[mpNodeHash[pos]].node_id, pNodeId, UCOIN_SZ_PUBKEY) == 0) {
+            return mpNodeHash[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    if (mNodeIdxNum == mNodeIdxAlloc) {
+        nodeidx_t *p_old = mpNodeIdx;
+        mNodeIdxAlloc *= 2;
+        mpNodeIdx = (nodeidx_t *)M_MALLOC(sizeof(nodeidx_t) * mNodeIdxAlloc);
+        memcpy(mpNodeIdx, p_old, sizeof(nodeidx_t) * mNodeIdxNum);
+        M_FREE(p_old);
+    }
+    uint32_t node = mNodeIdxNum++;
+    memcpy(mpNodeIdx[node].node_id, pNodeId, UCOIN_SZ_PUBKEY);
+    mpNodeIdx[node].uncomp_ok = false;
+    mpNodeHash[pos] = node;
+    if (mNodeIdxNum * 2 > mNodeHashSize) {
+        nodehash_grow();
+    }
+    return node;
+}
+
+
+/** node hash拡張
+ *
+ */
+static void nodehash_grow(void)
+{
+    M_FREE(mpNodeHash);
+    mNodeHashSize *= 2;
+    mpNodeHash = (uint32_t *)M_MALLOC(sizeof(uint32_t) * mNodeHashSize);
+    memset(mpNodeHash, 0xff, sizeof(uint32_t) * mNodeHashSize);     //M_NODE_NONE
+    uint32_t mask = mNodeHashSize - 1;
+    for (uint32_t node = 0; node < mNodeIdxNum; node++) {
+        uint32_t pos = nodeidx_hash(mpNodeIdx[node].node_id) & mask;
+        while (mpNodeHash[pos] != M_NODE_NONE) {
+            pos = (pos + 1) & mask;
+        }
+        mpNodeHash[pos] = node;
+    }
+}
+
+
+/** short_channel_idのhash
+ *
+ * block height, tx index, output indexを混ぜる。
+ */
+static inline uint32_t cnlidx_hash(uint64_t ShortChannelId)
+{
+    uint64_t h = ShortChannelId * UINT64_C(0x9e3779b97f4a7c15);
+    return (uint32_t)(h >> 32);
+}
+
+
+/** node_idのhash
+ *
+ * 公開鍵のx座標はランダムとみなせるので、そのまま使う。
+ */
+static inline uint32_t nodeidx_hash(const uint8_t *pNodeId)
+{
+    uint32_t h;
+    memcpy(&h, pNodeId + 1, sizeof(h));
+    return h;
+}
@@ -0,0 +1,894 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_db_gossip.c
+ *  @brief  announcement送信用の追記型ファイル
+ *
+ *  channel_announcement/channel_update/node_announcementを、受信した順にファイルへ追記する。
+ *  送信時はmmapしたファイルから読むため、接続先ごとのDB読込みが不要になる。
+ *  取得したレコードはコピーして返し、ロックは取得中だけ保持する(送信やRPC中にcompactionを妨げない)。
+ *  DBが正であり、このファイルは送信順序を保持するだけである。
+ *  DBから削除されたり、新しいもので置き換えられたレコードは #ln_db_gossip_compact() で取り除く。
+ *  追記はDBのcommit後に行うため、ヘッダに追記済みのDB transaction idを保存しておき、
+ *  起動時にDBの方が進んでいれば(追記前に終了した)DBから作り直す。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "ln_local.h"
+
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_GOSSIP_MAGIC          "LNGOSSIP"
+#define M_GOSSIP_VERSION        (2)
+#define M_GOSSIP_MAPSIZE        ((size_t)134217728)         ///< mmapする長さ[byte](ファイルの最大長)
+#define M_GOSSIP_COMPACT_MIN    ((size_t)1048576)           ///< compactionする最小の追記量[byte]
+#define M_GOSSIP_ORIGIN         (8)                         ///< 受信元として保存するnode_id長(先頭の02/03は除く)
+
+#define M_GOSSIP_ALIGN(len)     (((len) + 7) & ~(size_t)7)  ///< レコードは8byte境界
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct gossip_hdr_t
+ *  @brief  ファイルヘッダ
+ */
+typedef struct {
+    char        magic[8];                   ///< M_GOSSIP_MAGIC
+    uint32_t    version;                    ///< M_GOSSIP_VERSION
+    uint32_t    reserved;
+    uint64_t    db_txnid;                   ///< ここまでのannouncement保存/削除transactionは反映済み(#ln_db_anno_gossip_txnid())
+} gossip_hdr_t;
+
+
+/** @struct gossip_rec_t
+ *  @brief  レコードヘッダ
+ *
+ *  直後にlen長のメッセージが続き、8byte境界までpaddingする。
+ */
+typedef struct {
+    uint32_t    len;                        ///< メッセージ長
+    uint32_t    timestamp;                  ///< channel_update/node_announcementのtimestamp(channel_announcementは保存時刻)
+    char        type;                       ///< LN_DB_CNLANNO_xxx / LN_DB_GOSSIP_NODE
+    uint8_t     reserved[3];
+    uint8_t     origin[M_GOSSIP_ORIGIN];    ///< 受信元node_id(自分で作成した場合は0)
+    uint8_t     key[UCOIN_SZ_PUBKEY];       ///< short_channel_id / node_id
+    uint8_t     reserved2[3];
+} gossip_rec_t;
+
+
+/** @struct gossip_cur_t
+ *  @brief  接続先ごとの送信位置
+ */
+typedef struct gossip_cur_t {
+    struct gossip_cur_t *p_next;
+    size_t      offset;                     ///< 次に読むレコードの位置
+    uint8_t     origin[M_GOSSIP_ORIGIN];    ///< 接続先node_id(このnodeから受信したものは返さない)
+    bool        filter;                     ///< true:timestampで絞り込む
+    uint32_t    first;                      ///< (filter)timestamp下限
+    uint32_t    range;                      ///< (filter)timestamp範囲
+    uint64_t    *p_sent;                    ///< (filter)channel_announcementを返したshort_channel_id(open addressing, 0:空き)
+    size_t      sent_num;                   ///< (filter)p_sent登録数
+    size_t      sent_mask;                  ///< (filter)p_sent要素数-1(0:未確保)
+} gossip_cur_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+//  mRwGossip
+//      read lock   : レコード読込み中、追記中(mmap領域は変化しない)
+//      write lock  : compaction(ファイルを置き換える。cursorのoffsetも付け替える)
+//  mMuxGossip
+//      追記とcursor一覧の排他
+//  mMuxCompact
+//      compactionの排他(mmap領域を置き換えるのはcompactionだけなので、DBとの比較はread lockで行える)
+//  ロックはmMuxCompact -> mRwGossip -> mMuxGossipの順で取る。
+static int                  mGossipFd = -1;
+static const uint8_t        *mpGossipMap = NULL;
+static size_t               mGossipLen;         ///< 書込み済み長(追記後に更新)
+static size_t               mGossipLive;        ///< 前回compaction時の長さ
+static bool                 mGossipFull;        ///< true:M_GOSSIP_MAPSIZEに達して追記できなかった(次回必ずcompactionする)
+static volatile bool        mGossipPruned;      ///< true:DBからまとめて削除された(次回必ずcompactionする)
+static gossip_cur_t         *mpGossipCur;       ///< オープン中のcursor
+static uint32_t             mGossipLatest;      ///< channel_update/node_announcementの最新timestamp
+static uint64_t             mGossipTxnid;       ///< ヘッダに保存したdb_txnid
+static int                  mGossipPend;        ///< DB commit後、追記が終わっていない保存数
+static pthread_rwlock_t     mRwGossip;
+static pthread_mutex_t      mMuxGossip = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t      mMuxCompact = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static const uint8_t *gossip_map(int Fd);
+static size_t gossip_check(size_t Len);
+static void gossip_rebuild(void);
+static void gossip_checkpoint(void);
+static bool gossip_write(int Fd, size_t *pLen, char Type, const uint8_t *pKey, size_t KeyLen,
+                uint32_t TimeStamp, const uint8_t *pOrigin, const uint8_t *pMsg, uint32_t MsgLen);
+static uint8_t *gossip_live(size_t Len);
+static int gossip_cur_cmp(const void *pA, const void *pB);
+static bool gossip_sent_add(gossip_cur_t *pCur, uint64_t ShortChannelId);
+static void gossip_sent_clear(gossip_cur_t *pCur);
+
+
+/**************************************************************************
+ * library functions
+ **************************************************************************/
+
+bool HIDDEN ln_db_gossip_init(void)
+{
+    if (mGossipFd != -1) {
+        return true;
+    }
+
+    //compactionが待たされ続けないよう、writerを優先する
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&mRwGossip, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    int fd = open(LNDB_GOSSIP_STORE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        DBG_PRINTF("fail: open %s\n", LNDB_GOSSIP_STORE);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    mpGossipMap = gossip_map(fd);
+    if (mpGossipMap == NULL) {
+        close(fd);
+        return false;
+    }
+
+    size_t len = gossip_check((size_t)st.st_size);
+    if ((len != 0) && (((const gossip_hdr_t *)mpGossipMap)->db_txnid != ln_db_anno_gossip_txnid())) {
+        //DBに保存して追記する前に終了していた
+        DBG_PRINTF("gossip store older than DB\n");
+        len = 0;
+    }
+    if (len == 0) {
+        //新規 or 互換性なし: DBから作り直す
+        gossip_hdr_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, M_GOSSIP_MAGIC, sizeof(hdr.magic));
+        hdr.version = M_GOSSIP_VERSION;
+        if ((ftruncate(fd, 0) != 0) || (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))) {
+            DBG_PRINTF("fail: write header\n");
+            munmap((void *)mpGossipMap, M_GOSSIP_MAPSIZE);
+            mpGossipMap = NULL;
+            close(fd);
+            return false;
+        }
+        mGossipFd = fd;
+        mGossipLen = sizeof(hdr);
+        mGossipTxnid = 0;
+        gossip_rebuild();
+        gossip_checkpoint();
+    } else {
+        if (len < (size_t)st.st_size) {
+            //書込み途中で終了したレコードを捨てる
+            DBG_PRINTF("truncate: %" PRIu64 " -> %" PRIu64 "\n", (uint64_t)st.st_size, (uint64_t)len);
+            if (ftruncate(fd, len) != 0) {
+                DBG_PRINTF("fail: truncate\n");
+            }
+        }
+        mGossipFd = fd;
+        mGossipLen = len;
+        mGossipTxnid = ((const gossip_hdr_t *)mpGossipMap)->db_txnid;
+    }
+    mGossipLive = mGossipLen;
+    mGossipFull = false;
+    DBG_PRINTF("gossip store: %" PRIu64 " bytes\n", (uint64_t)mGossipLen);
+
+    return true;
+}
+
+
+void HIDDEN ln_db_gossip_term(void)
+{
+    if (mGossipFd == -1) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&mRwGossip);
+    gossip_checkpoint();
+    munmap((void *)mpGossipMap, M_GOSSIP_MAPSIZE);
+    mpGossipMap = NULL;
+    close(mGossipFd);
+    mGossipFd = -1;
+    pthread_rwlock_unlock(&mRwGossip);
+    pthread_rwlock_destroy(&mRwGossip);
+}
+
+
+void HIDDEN ln_db_gossip_begin(void)
+{
+    __atomic_add_fetch(&mGossipPend, 1, __ATOMIC_SEQ_CST);
+}
+
+
+void HIDDEN ln_db_gossip_end(void)
+{
+    __atomic_sub_fetch(&mGossipPend, 1, __ATOMIC_SEQ_CST);
+}
+
+
+void HIDDEN ln_db_gossip_append(char Type, const uint8_t *pKey, uint32_t TimeStamp, const ucoin_buf_t *pMsg, const uint8_t *pSendId)
+{
+    if (mGossipFd == -1) {
+        return;
+    }
+
+    uint8_t origin[M_GOSSIP_ORIGIN];
+    if (pSendId != NULL) {
+        memcpy(origin, pSendId + 1, M_GOSSIP_ORIGIN);
+    } else {
+        memset(origin, 0, M_GOSSIP_ORIGIN);
+    }
+    size_t keylen = (Type == LN_DB_GOSSIP_NODE) ? UCOIN_SZ_PUBKEY : LN_SZ_SHORT_CHANNEL_ID;
+
+    //一杯の場合はcompactionしてから1回だけやり直す
+    for (int retry = 0; retry < 2; retry++) {
+        bool compact = false;
+
+        pthread_rwlock_rdlock(&mRwGossip);
+        pthread_mutex_lock(&mMuxGossip);
+        size_t len = mGossipLen;
+        bool ret = gossip_write(mGossipFd, &len, Type, pKey, keylen, TimeStamp, origin, pMsg->buf, pMsg->len);
+        if (ret) {
+            //書込み後に長さを公開する
+            __atomic_store_n(&mGossipLen, len, __ATOMIC_RELEASE);
+        } else {
+            //前回のcompaction以降に追記も削除も無ければ、compactionしても空かない
+            mGossipFull = true;
+            compact = (mGossipLen != mGossipLive) || mGossipPruned;
+        }
+        pthread_mutex_unlock(&mMuxGossip);
+        pthread_rwlock_unlock(&mRwGossip);
+
+        if (ret || !compact || (retry > 0)) {
+            if (!ret) {
+                DBG_PRINTF("fail: drop gossip(%c)\n", Type);
+            }
+            break;
+        }
+        if (!ln_db_gossip_compact()) {
+            DBG_PRINTF("fail: compaction\n");
+            break;
+        }
+    }
+}
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool ln_db_gossip_available(void)
+{
+    return mGossipFd != -1;
+}
+
+
+bool ln_db_gossip_cur_open(void **ppCur, const uint8_t *pPeerId, bool bFromStart)
+{
+    if (mGossipFd == -1) {
+        *ppCur = NULL;
+        return false;
+    }
+
+    gossip_cur_t *p_cur = (gossip_cur_t *)M_MALLOC(sizeof(gossip_cur_t));
+    memcpy(p_cur->origin, pPeerId + 1, M_GOSSIP_ORIGIN);
+    p_cur->filter = false;
+    p_cur->p_sent = NULL;
+    p_cur->sent_num = 0;
+    p_cur->sent_mask = 0;
+
+    pthread_rwlock_rdlock(&mRwGossip);
+    pthread_mutex_lock(&mMuxGossip);
+    p_cur->offset = (bFromStart) ? sizeof(gossip_hdr_t) : mGossipLen;
+    p_cur->p_next = mpGossipCur;
+    mpGossipCur = p_cur;
+    pthread_mutex_unlock(&mMuxGossip);
+    pthread_rwlock_unlock(&mRwGossip);
+
+    *ppCur = p_cur;
+    return true;
+}
+
+
+void ln_db_gossip_cur_close(void *pCur)
+{
+    gossip_cur_t *p_cur = (gossip_cur_t *)pCur;
+
+    pthread_mutex_lock(&mMuxGossip);
+    gossip_cur_t **pp = &mpGossipCur;
+    while (*pp != NULL) {
+        if (*pp == p_cur) {
+            *pp = p_cur->p_next;
+            break;
+        }
+        pp = &(*pp)->p_next;
+    }
+    pthread_mutex_unlock(&mMuxGossip);
+
+    gossip_sent_clear(p_cur);
+    M_FREE(p_cur);
+}
+
+
+bool ln_db_gossip_cur_get(void *pCur, ucoin_buf_t *pBuf, char *pType, uint64_t *pShortChannelId)
+{
+    gossip_cur_t *p_cur = (gossip_cur_t *)pCur;
+    bool ret = false;
+
+    while (true) {
+        uint64_t anno_sci = 0;
+
+        //offsetはcompactionで付け替えられるため、読込み中だけロックすれば常に有効な位置を指す
+        pthread_rwlock_rdlock(&mRwGossip);
+        size_t len = __atomic_load_n(&mGossipLen, __ATOMIC_ACQUIRE);
+        while (p_cur->offset < len) {
+            const gossip_rec_t *p_rec = (const gossip_rec_t *)(mpGossipMap + p_cur->offset);
+            size_t next = p_cur->offset + sizeof(gossip_rec_t) + M_GOSSIP_ALIGN(p_rec->len);
+            if (memcmp(p_rec->origin, p_cur->origin, M_GOSSIP_ORIGIN) == 0) {
+                //受信元には返さない
+                p_cur->offset = next;
+                continue;
+            }
+            if (p_cur->filter) {
+                //BOLT#7: channel_announcementはtimestampを持たないため、範囲内のchannel_updateの直前に返す
+                if ( (p_rec->type == LN_DB_CNLANNO_ANNO) ||
+                     (p_rec->timestamp < p_cur->first) || (p_rec->timestamp - p_cur->first >= p_cur->range) ) {
+                    //gossip_timestamp_filter範囲外
+                    p_cur->offset = next;
+                    continue;
+                }
+                if (p_rec->type != LN_DB_GOSSIP_NODE) {
+                    uint64_t short_channel_id;
+                    memcpy(&short_channel_id, p_rec->key, LN_SZ_SHORT_CHANNEL_ID);
+                    if (gossip_sent_add(p_cur, short_channel_id)) {
+                        //offsetは進めず、次回このchannel_updateを返す
+                        anno_sci = short_channel_id;
+                        break;
+                    }
+                }
+            }
+            p_cur->offset = next;
+
+            //ロック解除後はmmap領域が置き換えられる可能性があるため、コピーして返す
+            ucoin_buf_alloccopy(pBuf, (const uint8_t *)(p_rec + 1), p_rec->len);
+            *pType = p_rec->type;
+            if (pShortChannelId != NULL) {
+                if (p_rec->type != LN_DB_GOSSIP_NODE) {
+                    memcpy(pShortChannelId, p_rec->key, LN_SZ_SHORT_CHANNEL_ID);
+                } else {
+                    *pShortChannelId = 0;
+                }
+            }
+            ret = true;
+            break;
+        }
+        pthread_rwlock_unlock(&mRwGossip);
+
+        if (anno_sci == 0) {
+            break;
+        }
+
+        //channel_announcementはDBから読む(ロック外)
+        if (ln_db_annocnl_load(pBuf, anno_sci)) {
+            *pType = LN_DB_CNLANNO_ANNO;
+            if (pShortChannelId != NULL) {
+                *pShortChannelId = anno_sci;
+            }
+            ret = true;
+            break;
+        }
+
+        //DBから削除済みのchannelなので、channel_updateも返さない
+        //  ロック解除中にcompactionされた場合は、このchannel_updateも取り除かれている
+        pthread_rwlock_rdlock(&mRwGossip);
+        if (p_cur->offset < __atomic_load_n(&mGossipLen, __ATOMIC_ACQUIRE)) {
+            const gossip_rec_t *p_rec = (const gossip_rec_t *)(mpGossipMap + p_cur->offset);
+            if ( (p_rec->type != LN_DB_CNLANNO_ANNO) && (p_rec->type != LN_DB_GOSSIP_NODE) &&
+                 (memcmp(p_rec->key, &anno_sci, LN_SZ_SHORT_CHANNEL_ID) == 0) ) {
+                p_cur->offset += sizeof(gossip_rec_t) + M_GOSSIP_ALIGN(p_rec->len);
+            }
+        }
+        pthread_rwlock_unlock(&mRwGossip);
+    }
+
+    return ret;
+}
+
+
+void ln_db_gossip_cur_filter(void *pCur, uint32_t First, uint32_t Range)
+{
+    gossip_cur_t *p_cur = (gossip_cur_t *)pCur;
+
+    //compactionでoffsetが書き換えられるため、ロックして変更する
+    pthread_rwlock_rdlock(&mRwGossip);
+    pthread_mutex_lock(&mMuxGossip);
+    p_cur->filter = true;
+    p_cur->first = First;
+    p_cur->range = Range;
+    p_cur->offset = sizeof(gossip_hdr_t);
+    pthread_mutex_unlock(&mMuxGossip);
+    pthread_rwlock_unlock(&mRwGossip);
+
+    //先頭から読み直すため、channel_announcement送信済みもやり直す
+    gossip_sent_clear(p_cur);
+}
+
+
+uint32_t ln_db_gossip_latest(void)
+{
+    return __atomic_load_n(&mGossipLatest, __ATOMIC_RELAXED);
+}
+
+
+void HIDDEN ln_db_gossip_pruned(void)
+{
+    mGossipPruned = true;
+}
+
+
+bool ln_db_gossip_compact(void)
+{
+    if (mGossipFd == -1) {
+        return false;
+    }
+
+    pthread_mutex_lock(&mMuxCompact);
+
+    //DBとの比較中は追記も読込みも止めない
+    pthread_rwlock_rdlock(&mRwGossip);
+    gossip_checkpoint();
+    pthread_mutex_lock(&mMuxGossip);
+    size_t end = mGossipLen;
+    size_t appended = end - mGossipLive;
+    bool skip = !mGossipFull && !mGossipPruned && ((appended < M_GOSSIP_COMPACT_MIN) || (appended < mGossipLive));
+    pthread_mutex_unlock(&mMuxGossip);
+    if (skip) {
+        //前回から追記が少なければ何もしない
+        pthread_rwlock_unlock(&mRwGossip);
+        pthread_mutex_unlock(&mMuxCompact);
+        return true;
+    }
+    //比較中に削除されたら、次回もcompactionする
+    bool pruned = __atomic_exchange_n(&mGossipPruned, false, __ATOMIC_RELAXED);
+
+    uint8_t *p_live = gossip_live(end);
+    pthread_rwlock_unlock(&mRwGossip);
+    if (p_live == NULL) {
+        if (pruned) {
+            mGossipPruned = true;
+        }
+        pthread_mutex_unlock(&mMuxCompact);
+        return false;
+    }
+
+    //コピーとcursorの付け替えだけをwrite lockで行う
+    pthread_rwlock_wrlock(&mRwGossip);
+
+    bool ret = false;
+    char tmppath[sizeof(LNDB_GOSSIP_STORE) + 4];
+    sprintf(tmppath, "%s.tmp", LNDB_GOSSIP_STORE);
+    int fd = open(tmppath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        DBG_PRINTF("fail: open %s\n", tmppath);
+        goto LABEL_EXIT;
+    }
+    if (pwrite(fd, mpGossipMap, sizeof(gossip_hdr_t), 0) != sizeof(gossip_hdr_t)) {
+        DBG_PRINTF("fail: write header\n");
+        goto LABEL_EXIT;
+    }
+
+    {
+        pthread_mutex_lock(&mMuxGossip);
+
+        //cursorの位置を新しいファイルに付け替えるため、位置順に並べる
+        size_t cur_num = 0;
+        for (gossip_cur_t *p = mpGossipCur; p != NULL; p = p->p_next) {
+            cur_num++;
+        }
+        gossip_cur_t **pp_cur = (gossip_cur_t **)M_MALLOC(sizeof(gossip_cur_t *) * (cur_num + 1));
+        size_t *p_newoff = (size_t *)M_MALLOC(sizeof(size_t) * (cur_num + 1));
+        cur_num = 0;
+        for (gossip_cur_t *p = mpGossipCur; p != NULL; p = p->p_next) {
+            pp_cur[cur_num++] = p;
+        }
+        qsort(pp_cur, cur_num, sizeof(gossip_cur_t *), gossip_cur_cmp);
+
+        //有効なレコードだけを順番を保ってコピーする(比較後に追記されたレコードは有効)
+        size_t newlen = sizeof(gossip_hdr_t);
+        size_t idx = 0;
+        size_t rec = 0;
+        size_t offset = sizeof(gossip_hdr_t);
+        ret = true;
+        while (ret && (offset < mGossipLen)) {
+            const gossip_rec_t *p_rec = (const gossip_rec_t *)(mpGossipMap + offset);
+            while ((idx < cur_num) && (pp_cur[idx]->offset <= offset)) {
+                p_newoff[idx++] = newlen;
+            }
+            if ((offset >= end) || (p_live[rec / 8] & (1 << (rec % 8)))) {
+                size_t keylen = (p_rec->type == LN_DB_GOSSIP_NODE) ? UCOIN_SZ_PUBKEY : LN_SZ_SHORT_CHANNEL_ID;
+                ret = gossip_write(fd, &newlen, p_rec->type, p_rec->key, keylen,
+                                p_rec->timestamp, p_rec->origin, (const uint8_t *)(p_rec + 1), p_rec->len);
+            }
+            offset += sizeof(gossip_rec_t) + M_GOSSIP_ALIGN(p_rec->len);
+            rec++;
+        }
+        while (idx < cur_num) {
+            p_newoff[idx++] = newlen;
+        }
+
+        const uint8_t *p_map = NULL;
+        if (ret) {
+            p_map = gossip_map(fd);
+            ret = (p_map != NULL);
+        }
+        if (ret) {
+            ret = (rename(tmppath, LNDB_GOSSIP_STORE) == 0);
+            if (!ret) {
+                munmap((void *)p_map, M_GOSSIP_MAPSIZE);
+            }
+        }
+        if (ret) {
+            DBG_PRINTF("compaction: %" PRIu64 " -> %" PRIu64 "\n", (uint64_t)mGossipLen, (uint64_t)newlen);
+            for (idx = 0; idx < cur_num; idx++) {
+                pp_cur[idx]->offset = p_newoff[idx];
+            }
+            munmap((void *)mpGossipMap, M_GOSSIP_MAPSIZE);
+            close(mGossipFd);
+            mpGossipMap = p_map;
+            mGossipFd = fd;
+            fd = -1;
+            mGossipLen = newlen;
+            mGossipLive = newlen;
+            mGossipFull = false;
+        }
+        M_FREE(p_newoff);
+        M_FREE(pp_cur);
+
+        pthread_mutex_unlock(&mMuxGossip);
+    }
+
+LABEL_EXIT:
+    if (fd != -1) {
+        close(fd);
+        unlink(tmppath);
+    }
+    if (!ret && pruned) {
+        mGossipPruned = true;
+    }
+    pthread_rwlock_unlock(&mRwGossip);
+    pthread_mutex_unlock(&mMuxCompact);
+    M_FREE(p_live);
+
+    return ret;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** ファイルをmmapする
+ *
+ * ファイルより長くmapしておき、追記してもmmapし直さないようにする。
+ *
+ * @return      mapした領域(NULL:失敗)
+ */
+static const uint8_t *gossip_map(int Fd)
+{
+    void *p = mmap(NULL, M_GOSSIP_MAPSIZE, PROT_READ, MAP_SHARED, Fd, 0);
+    if (p == MAP_FAILED) {
+        DBG_PRINTF("fail: mmap\n");
+        return NULL;
+    }
+    return (const uint8_t *)p;
+}
+
+
+/** ファイル内容チェック
+ *
+ * @param[in]   Len     ファイル長
+ * @return      有効なレコードまでの長さ(0:ヘッダ不一致)
+ */
+static size_t gossip_check(size_t Len)
+{
+    const gossip_hdr_t *p_hdr = (const gossip_hdr_t *)mpGossipMap;
+    if ((Len < sizeof(gossip_hdr_t)) || (Len > M_GOSSIP_MAPSIZE) ||
+                (memcmp(p_hdr->magic, M_GOSSIP_MAGIC, sizeof(p_hdr->magic)) != 0) ||
+                (p_hdr->version != M_GOSSIP_VERSION)) {
+        DBG_PRINTF("invalid gossip store\n");
+        return 0;
+    }
+
+    size_t offset = sizeof(gossip_hdr_t);
+    while (offset + sizeof(gossip_rec_t) <= Len) {
+        const gossip_rec_t *p_rec = (const gossip_rec_t *)(mpGossipMap + offset);
+        size_t next = offset + sizeof(gossip_rec_t) + M_GOSSIP_ALIGN(p_rec->len);
+        if ((p_rec->len == 0) || (next > Len)) {
+            break;
+        }
+        if ((p_rec->type != LN_DB_CNLANNO_ANNO) && (p_rec->timestamp > mGossipLatest)) {
+            mGossipLatest = p_rec->timestamp;
+        }
+        offset = next;
+    }
+    return offset;
+}
+
+
+/** DBからファイルを作成
+ *
+ * DBの順番で追記する(channel_announcementの後に、そのchannel_updateが続く)。
+ */
+static void gossip_rebuild(void)
+{
+    void *p_db;
+    void *p_cur;
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    uint8_t origin[M_GOSSIP_ORIGIN];
+    uint32_t now = (uint32_t)time(NULL);
+
+    memset(origin, 0, sizeof(origin));
+    if (ln_db_node_cur_transaction(&p_db, LN_DB_TXN_CNL, NULL)) {
+        if (ln_db_annocnl_cur_open(&p_cur, p_db)) {
+            uint64_t short_channel_id;
+            char type;
+            uint32_t timestamp;
+            while (ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, &timestamp, &buf)) {
+                if (type == LN_DB_CNLANNO_ANNO) {
+                    timestamp = now;
+                }
+                gossip_write(mGossipFd, &mGossipLen, type, (const uint8_t *)&short_channel_id, LN_SZ_SHORT_CHANNEL_ID,
+                            timestamp, origin, buf.buf, buf.len);
+                ucoin_buf_free(&buf);
+            }
+            ln_db_annocnl_cur_close(p_cur);
+        }
+        ln_db_node_cur_commit(p_db);
+    }
+    if (ln_db_node_cur_transaction(&p_db, LN_DB_TXN_NODE, NULL)) {
+        if (ln_db_annonod_cur_open(&p_cur, p_db)) {
+            uint8_t node_id[UCOIN_SZ_PUBKEY];
+            uint32_t timestamp;
+            while (ln_db_annonod_cur_get(p_cur, &buf, &timestamp, node_id)) {
+                gossip_write(mGossipFd, &mGossipLen, LN_DB_GOSSIP_NODE, node_id, UCOIN_SZ_PUBKEY,
+                            timestamp, origin, buf.buf, buf.len);
+                ucoin_buf_free(&buf);
+            }
+            ln_db_annonod_cur_close(p_cur);
+        }
+        ln_db_node_cur_commit(p_db);
+    }
+}
+
+
+/** ヘッダのdb_txnid更新
+ *
+ * 追記待ちの保存が無ければ、最後にannouncementを保存/削除したDB transactionまで反映済みとする。
+ * (transaction idを先に読むため、その後にcommitされた保存は次回に回る)
+ * announcement以外への書込みではtransaction idが進まないため、次回起動時に作り直さない。
+ *
+ * @note
+ *      - mRwGossipのread lockかwrite lockを取得して呼び出すこと(#ln_db_gossip_init()中は不要)
+ *      - compactionと同時に呼ばないこと
+ */
+static void gossip_checkpoint(void)
+{
+    uint64_t txnid = ln_db_anno_gossip_txnid();
+    if ((__atomic_load_n(&mGossipPend, __ATOMIC_SEQ_CST) != 0) || (txnid == mGossipTxnid)) {
+        return;
+    }
+    if (pwrite(mGossipFd, &txnid, sizeof(txnid), offsetof(gossip_hdr_t, db_txnid)) == sizeof(txnid)) {
+        mGossipTxnid = txnid;
+    } else {
+        DBG_PRINTF("fail: write header\n");
+    }
+}
+
+
+/** レコード書込み
+ *
+ * @param[in]       Fd          書込み先
+ * @param[in,out]   pLen        [in]書込み位置, [out]書込み後の長さ
+ * @retval  true    成功
+ */
+static bool gossip_write(int Fd, size_t *pLen, char Type, const uint8_t *pKey, size_t KeyLen,
+                uint32_t TimeStamp, const uint8_t *pOrigin, const uint8_t *pMsg, uint32_t MsgLen)
+{
+    size_t padlen = M_GOSSIP_ALIGN(MsgLen) - MsgLen;
+    size_t reclen = sizeof(gossip_rec_t) + MsgLen + padlen;
+    if (*pLen + reclen > M_GOSSIP_MAPSIZE) {
+        DBG_PRINTF("fail: gossip store full\n");
+        return false;
+    }
+
+    gossip_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.len = MsgLen;
+    rec.timestamp = TimeStamp;
+    rec.type = Type;
+    memcpy(rec.origin, pOrigin, M_GOSSIP_ORIGIN);
+    memcpy(rec.key, pKey, KeyLen);
+
+    static const uint8_t PAD[8] = { 0 };
+    struct iovec iov[3];
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = (CONST_CAST uint8_t *)pMsg;
+    iov[1].iov_len = MsgLen;
+    iov[2].iov_base = (CONST_CAST uint8_t *)PAD;
+    iov[2].iov_len = padlen;
+    ssize_t sz = pwritev(Fd, iov, 3, (off_t)*pLen);
+    if (sz != (ssize_t)reclen) {
+        DBG_PRINTF("fail: write\n");
+        return false;
+    }
+    *pLen += reclen;
+    if ((Type != LN_DB_CNLANNO_ANNO) && (TimeStamp > mGossipLatest)) {
+        __atomic_store_n(&mGossipLatest, TimeStamp, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+
+/** 有効なレコードの判定
+ *
+ * DBの1つの読込みトランザクションで、Lenまでのレコードを判定する。
+ * DBから削除された、あるいは新しいものに置き換えられたレコードは無効になる。
+ *
+ * @param[in]   Len     判定する長さ
+ * @return      レコード順のbit列(1:有効)。M_FREEで解放する(NULL:DB読込み失敗)
+ * @note
+ *      - mRwGossipのread lockかwrite lockを取得して呼び出すこと
+ */
+static uint8_t *gossip_live(size_t Len)
+{
+    size_t rec_num = 0;
+    size_t offset = sizeof(gossip_hdr_t);
+    while (offset < Len) {
+        const gossip_rec_t *p_rec = (const gossip_rec_t *)(mpGossipMap + offset);
+        offset += sizeof(gossip_rec_t) + M_GOSSIP_ALIGN(p_rec->len);
+        rec_num++;
+    }
+
+    void *p_db;
+    if (!ln_db_anno_live_begin(&p_db)) {
+        return NULL;
+    }
+    uint8_t *p_live = (uint8_t *)M_CALLOC(1, rec_num / 8 + 1);
+    size_t rec = 0;
+    offset = sizeof(gossip_hdr_t);
+    while (offset < Len) {
+        const gossip_rec_t *p_rec = (const gossip_rec_t *)(mpGossipMap + offset);
+        if (ln_db_anno_live(p_db, p_rec->type, p_rec->key, (const uint8_t *)(p_rec + 1), p_rec->len)) {
+            p_live[rec / 8] |= (uint8_t)(1 << (rec % 8));
+        }
+        offset += sizeof(gossip_rec_t) + M_GOSSIP_ALIGN(p_rec->len);
+        rec++;
+    }
+    ln_db_anno_live_end(p_db);
+
+    return p_live;
+}
+
+
+static int gossip_cur_cmp(const void *pA, const void *pB)
+{
+    const gossip_cur_t *p_a = *(const gossip_cur_t * const *)pA;
+    const gossip_cur_t *p_b = *(const gossip_cur_t * const *)pB;
+    return (p_a->offset < p_b->offset) ? -1 : (p_a->offset > p_b->offset);
+}
+
+
+/** channel_announcement送信済み登録(filter時)
+ *
+ * @param[in,out]   pCur            cursor
+ * @param[in]       ShortChannelId  short_channel_id
+ * @retval  true    新規に登録した(channel_announcementを返すこと)
+ * @retval  false   登録済み
+ */
+static bool gossip_sent_add(gossip_cur_t *pCur, uint64_t ShortChannelId)
+{
+    if (ShortChannelId == 0) {
+        return false;
+    }
+    if ((pCur->sent_num + 1) * 2 > pCur->sent_mask + 1) {
+        //使用率50%を超えないよう、倍に広げて入れ直す
+        size_t mask = (pCur->sent_mask == 0) ? 1023 : pCur->sent_mask * 2 + 1;
+        uint64_t *p_sent = (uint64_t *)M_MALLOC(sizeof(uint64_t) * (mask + 1));
+        memset(p_sent, 0, sizeof(uint64_t) * (mask + 1));
+        for (size_t lp = 0; (pCur->p_sent != NULL) && (lp <= pCur->sent_mask); lp++) {
+            uint64_t sci = pCur->p_sent[lp];
+            if (sci != 0) {
+                size_t idx = (size_t)((sci * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+                while (p_sent[idx] != 0) {
+                    idx = (idx + 1) & mask;
+                }
+                p_sent[idx] = sci;
+            }
+        }
+        if (pCur->p_sent != NULL) {
+            M_FREE(pCur->p_sent);
+        }
+        pCur->p_sent = p_sent;
+        pCur->sent_mask = mask;
+    }
+
+    size_t idx = (size_t)((ShortChannelId * 0x9e3779b97f4a7c15ULL) >> 32) & pCur->sent_mask;
+    while (pCur->p_sent[idx] != 0) {
+        if (pCur->p_sent[idx] == ShortChannelId) {
+            return false;
+        }
+        idx = (idx + 1) & pCur->sent_mask;
+    }
+    pCur->p_sent[idx] = ShortChannelId;
+    pCur->sent_num++;
+    return true;
+}
+
+
+/** channel_announcement送信済み解放
+ *
+ */
+static void gossip_sent_clear(gossip_cur_t *pCur)
+{
+    if (pCur->p_sent != NULL) {
+        M_FREE(pCur->p_sent);
+        pCur->p_sent = NULL;
+    }
+    pCur->sent_num = 0;
+    pCur->sent_mask = 0;
+}
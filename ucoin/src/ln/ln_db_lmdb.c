@@ -29,6 +29,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -73,6 +74,8 @@
 #define M_DBI_PREIMAGE          "preimage"
 #define M_DBI_PAYHASH           "payhash"
 #define M_DBI_VERSION           "version"
+#define M_DBI_PEER_INDEX        "peer_index"
+#define M_DBI_GOSSIP            "gossip"
 
 #define M_SZ_DBNAME_LEN         (M_PREFIX_LEN + LN_SZ_CHANNEL_ID * 2)
 #define M_SZ_HTLC_STR           (3)
@@ -81,9 +84,20 @@
 
 #define M_KEY_SHAREDSECRET      "shared_secret"
 #define M_SZ_SHAREDSECRET       (sizeof(M_KEY_SHAREDSECRET) - 1)
+#define M_KEY_GOSSIP_TXNID      "txnid"
+#define M_SZ_GOSSIP_TXNID       (sizeof(M_KEY_GOSSIP_TXNID) - 1)
 
 #define M_SKIP_TEMP             ((uint8_t)1)
 
+#define M_ANNOSAVE_UPDDB        ((uint8_t)0x01)     ///< announcement保存: DB更新した
+#define M_ANNOSAVE_GOSSIP       ((uint8_t)0x02)     ///< announcement保存: gossip storeに追記する
+
+#define M_PRUNE_BATCH           (512)           ///< #ln_db_anno_prune()で1トランザクションに削除するchannel数
+
+#define M_PEERIDX_MAX           (4096)          ///< peer index最大数(annoinfoのbitmapは最大512byte)
+#define M_PEERIDX_SLOT          (8192)          ///< peer index hash table長(2のべき乗)
+#define M_PEERIDX_EVICT         (512)           ///< peer indexが一杯の場合に解放する数
+
 #define M_DB_VERSION_VAL        ((int32_t)-17)      ///< DBバージョン
 /*
     -1 : first
@@ -182,6 +196,57 @@ typedef struct {
 } preimage_info_t;
 
 
+/** @typedef    annosave_t
+ *  @brief      #ln_db_anno_save_batch()の保存結果(commit後の処理用)
+ */
+typedef struct {
+    uint8_t     flag;                   ///< M_ANNOSAVE_xxx
+    ucoin_buf_t upd[2];                 ///< (channel_announcement)先に保存されていたchannel_update
+    uint32_t    upd_time[2];            ///< (channel_announcement)upd[]のtimestamp
+} annosave_t;
+
+
+/** @typedef    prune_self_t
+ *  @brief      #ln_db_anno_prune()で集める自nodeのshort_channel_id
+ */
+typedef struct {
+    uint64_t    *p_sci;
+    int         num;
+    int         alloc;
+} prune_self_t;
+
+
+/** @typedef    anno_live_t
+ *  @brief      #ln_db_anno_live_begin()で開く読込みtransaction
+ */
+typedef struct {
+    ln_lmdb_db_t    cnl;                ///< channel_announcement/channel_update
+    ln_lmdb_db_t    node;               ///< node_announcement(txnはcnlと共通)
+    bool            cnl_open;           ///< true:cnl.dbiオープン済み
+    bool            node_open;          ///< true:node.dbiオープン済み
+} anno_live_t;
+
+
+/** @typedef    peeridx_t
+ *  @brief      peer index(node_id → annoinfoのbit位置)
+ */
+typedef struct {
+    uint8_t     node_id[UCOIN_SZ_PUBKEY];
+    bool        used;
+    uint32_t    last;                   ///< 最後にannoinfoへ追加した時刻(解放順)
+} peeridx_t;
+
+
+/** @typedef    peeridx_pend_t
+ *  @brief      書込みtransaction中のpeer index変更
+ */
+typedef struct {
+    uint16_t    idx;
+    bool        add;                    ///< true:追加, false:解放
+    uint8_t     node_id[UCOIN_SZ_PUBKEY];
+} peeridx_pend_t;
+
+
 /********************************************************************
  * static variables
  ********************************************************************/
@@ -190,6 +255,17 @@ typedef struct {
 static MDB_env      *mpDbSelf = NULL;           // channel
 static MDB_env      *mpDbNode = NULL;           // node
 
+//peer index
+//  DBの"peer_index"(commit済み)と同じ内容を保持する。
+//  書込みtransaction中の変更はmpPeerIdxPendに貯め、commitしてから反映する。
+//  (LMDBの書込みtransactionは1つずつなので、mpPeerIdxPendも1つでよい)
+static peeridx_t        mPeerIdx[M_PEERIDX_MAX];        ///< index順
+static uint16_t         mPeerIdxHash[M_PEERIDX_SLOT];   ///< node_id → index + 1(0:空き)
+static peeridx_pend_t   *mpPeerIdxPend;
+static int              mPeerIdxPendNum;
+static int              mPeerIdxPendAlloc;
+static pthread_mutex_t  mMuxPeerIdx = PTHREAD_MUTEX_INITIALIZER;
+
 
 static const backup_param_t DBSELF_SECRET[] = {
     M_ITEM(ln_self_priv_t, storage_index),
@@ -361,10 +437,30 @@ static int annocnlupd_save(ln_lmdb_db_t *pDb, const ucoin_buf_t *pCnlUpd, const
 
 static int annonod_load(ln_lmdb_db_t *pDb, ucoin_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8_t *pNodeId);
 static int annonod_save(ln_lmdb_db_t *pDb, const ucoin_buf_t *pNodeAnno, const ln_node_announce_t *pAnno);
+static int annocnl_save_txn(ln_lmdb_db_t *pDb, ln_lmdb_db_t *pDbInfo, const ucoin_buf_t *pCnlAnno, uint64_t ShortChannelId, const uint8_t *pSendId, annosave_t *pResult);
+static int annocnlupd_save_txn(ln_lmdb_db_t *pDb, ln_lmdb_db_t *pDbInfo, const ucoin_buf_t *pCnlUpd, const ln_cnl_update_t *pUpd, const uint8_t *pSendId, uint8_t *pFlag);
+static int annonod_save_txn(ln_lmdb_db_t *pDb, ln_lmdb_db_t *pDbInfo, const ucoin_buf_t *pNodeAnno, const ln_node_announce_t *pAnno, const uint8_t *pSendId, uint8_t *pFlag);
 static bool annonod_cur_open(lmdb_cursor_t *pCur);
+static bool anno_cur_seek(lmdb_cursor_t *pCur, MDB_val *pKey);
+static int sci_cmp(const void *pA, const void *pB);
+static int annocnlall_del_txn(MDB_txn *txn, MDB_dbi Dbi, MDB_dbi DbiInfo, uint64_t ShortChannelId);
+static void gossip_txnid_put(MDB_txn *txn);
+static uint32_t prune_cnlupd_time(uint64_t ShortChannelId, void *pParam);
+static bool prune_self_func(ln_self_t *self, void *p_db_param, void *p_param);
+static int nodeid_cmp(const void *pA, const void *pB);
 
 static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId);
 static bool annoinfo_search(MDB_val *pMdbData, const uint8_t *pNodeId);
+static int peeridx_init(void);
+static uint16_t *peeridx_slot(const uint8_t *pNodeId);
+static void peeridx_rehash(void);
+static int peeridx_get(const uint8_t *pNodeId);
+static int peeridx_add(MDB_txn *txn, const uint8_t *pNodeId);
+static int peeridx_alloc(void);
+static bool peeridx_evict(MDB_txn *txn);
+static bool peeridx_pend_find(int Idx, bool bAdd);
+static void peeridx_pend_add(int Idx, bool bAdd, const uint8_t *pNodeId);
+static void peeridx_txn_end(bool bCommit);
 //static void annoinfo_clear(ln_lmdb_db_t *pDb);
 
 static bool preimg_open(ln_lmdb_db_t *p_db, MDB_txn *txn);
@@ -545,7 +641,17 @@ bool HIDDEN ln_db_init(char *pWif, char *pNodeName, uint16_t *pPort)
         DBG_PRINTF("FAIL: check version db\n");
         goto LABEL_EXIT;
     }
+    retval = peeridx_init();
+    if (retval != 0) {
+        DBG_PRINTF("FAIL: peer index\n");
+        goto LABEL_EXIT;
+    }
     ln_db_annoskip_invoice_drop();
+    if (!ln_db_gossip_init()) {
+        //無くてもDBから送信できる
+        DBG_PRINTF("fail: gossip store\n");
+    }
+    ln_db_cnlidx_init();
 
 LABEL_EXIT:
     if (retval != 0) {
@@ -558,6 +664,15 @@ LABEL_EXIT:
 
 void ln_db_term(void)
 {
+    ln_db_gossip_term();
+    ln_db_cnlidx_term();
+    pthread_mutex_lock(&mMuxPeerIdx);
+    memset(mPeerIdx, 0, sizeof(mPeerIdx));
+    memset(mPeerIdxHash, 0, sizeof(mPeerIdxHash));
+    M_FREE(mpPeerIdxPend);
+    mPeerIdxPendNum = 0;
+    mPeerIdxPendAlloc = 0;
+    pthread_mutex_unlock(&mMuxPeerIdx);
     mdb_env_close(mpDbNode);
     mpDbNode = NULL;
     mdb_env_close(mpDbSelf);
@@ -1028,12 +1143,120 @@ void ln_db_node_cur_commit(void *pDb)
 {
     if (pDb != NULL) {
         ln_lmdb_db_t *p_db = (ln_lmdb_db_t *)pDb;
-        MDB_TXN_COMMIT(p_db->txn);
+        int retval = mdb_txn_commit(p_db->txn);
+        if (retval != 0) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        }
+        peeridx_txn_end(retval == 0);
         M_FREE(pDb);
     }
 }
 
 
+uint64_t ln_db_node_txnid(void)
+{
+    MDB_envinfo info;
+
+    if ((mpDbNode == NULL) || (mdb_env_info(mpDbNode, &info) != 0)) {
+        return 0;
+    }
+    return (uint64_t)info.me_last_txnid;
+}
+
+
+uint64_t HIDDEN ln_db_anno_gossip_txnid(void)
+{
+    int         retval;
+    MDB_txn     *txn;
+    MDB_dbi     dbi;
+    MDB_val     key, data;
+    uint64_t    txnid = 0;
+
+    if (mpDbNode == NULL) {
+        return 0;
+    }
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, MDB_RDONLY, &txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        return 0;
+    }
+    retval = mdb_dbi_open(txn, M_DBI_GOSSIP, 0, &dbi);
+    if (retval == 0) {
+        key.mv_size = M_SZ_GOSSIP_TXNID;
+        key.mv_data = M_KEY_GOSSIP_TXNID;
+        retval = mdb_get(txn, dbi, &key, &data);
+    }
+    if ((retval == 0) && (data.mv_size == sizeof(txnid))) {
+        memcpy(&txnid, data.mv_data, sizeof(txnid));
+    }
+    MDB_TXN_ABORT(txn);
+
+    return txnid;
+}
+
+
+bool HIDDEN ln_db_anno_live_begin(void **ppDb)
+{
+    int retval;
+    anno_live_t *p_live = (anno_live_t *)M_MALLOC(sizeof(anno_live_t));
+
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, MDB_RDONLY, &p_live->cnl.txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        M_FREE(p_live);
+        *ppDb = NULL;
+        return false;
+    }
+    p_live->node.txn = p_live->cnl.txn;
+    p_live->cnl_open = (mdb_dbi_open(p_live->cnl.txn, M_DBI_ANNO_CNL, 0, &p_live->cnl.dbi) == 0);
+    p_live->node_open = (mdb_dbi_open(p_live->node.txn, M_DBI_ANNO_NODE, 0, &p_live->node.dbi) == 0);
+    *ppDb = p_live;
+    return true;
+}
+
+
+bool HIDDEN ln_db_anno_live(void *pDb, char Type, const uint8_t *pKey, const uint8_t *pMsg, uint32_t Len)
+{
+    anno_live_t *p_live = (anno_live_t *)pDb;
+    int retval;
+    ucoin_buf_t buf = UCOIN_BUF_INIT;
+    uint32_t timestamp;
+    uint64_t short_channel_id;
+
+    memcpy(&short_channel_id, pKey, LN_SZ_SHORT_CHANNEL_ID);
+    switch (Type) {
+    case LN_DB_CNLANNO_ANNO:
+        retval = (p_live->cnl_open) ? annocnl_load(&p_live->cnl, &buf, short_channel_id) : MDB_NOTFOUND;
+        break;
+    case LN_DB_CNLANNO_UPD1:
+    case LN_DB_CNLANNO_UPD2:
+        retval = (p_live->cnl_open) ?
+                    annocnlupd_load(&p_live->cnl, &buf, &timestamp, short_channel_id, (Type == LN_DB_CNLANNO_UPD1) ? 0 : 1) :
+                    MDB_NOTFOUND;
+        break;
+    case LN_DB_GOSSIP_NODE:
+        retval = (p_live->node_open) ? annonod_load(&p_live->node, &buf, &timestamp, pKey) : MDB_NOTFOUND;
+        break;
+    default:
+        retval = MDB_NOTFOUND;
+        break;
+    }
+    bool ret = (retval == 0) && (buf.len == Len) && (memcmp(buf.buf, pMsg, Len) == 0);
+    ucoin_buf_free(&buf);
+
+    return ret;
+}
+
+
+void HIDDEN ln_db_anno_live_end(void *pDb)
+{
+    anno_live_t *p_live = (anno_live_t *)pDb;
+
+    MDB_TXN_ABORT(p_live->cnl.txn);
+    M_FREE(p_live);
+}
+
+
 /********************************************************************
  * channel_announcement / channel_update
  *
@@ -1055,13 +1278,22 @@ void ln_db_node_cur_commit(void *pDb)
  * |   +-------------------------------------+
  * |   |channel_announcement                 |
  * |   | key : short_channel_id + 'A'        |
- * |   | data: node_ids[33*n]                |
+ * |   | data: peer index bitmap             |
  * |   +-------------------------------------+
  * |   |channel_update                       |
  * |   | key : short_channel_id + 'B' or 'C' |
- * |   | data: node_ids[33*n]                |
+ * |   | data: peer index bitmap             |
+ * +---+-------------------------------------+
+ *
+ * +-----------------------------------------+
+ * |"peer_index"                             |
+ * |   +-------------------------------------+
+ * |   | key : node_id                       |
+ * |   | data: index[2]                      |
  * +---+-------------------------------------+
  *
+ *  annoinfoのbitmapは、peer indexのbitを送信元/先とする(byte[index / 8]のbit(index % 8))。
+ *
  ********************************************************************/
 
 bool ln_db_annocnl_load(ucoin_buf_t *pCnlAnno, uint64_t ShortChannelId)
@@ -1092,51 +1324,14 @@ LABEL_EXIT:
 
 bool ln_db_annocnl_save(const ucoin_buf_t *pCnlAnno, uint64_t ShortChannelId, const uint8_t *pSendId)
 {
-    int         retval;
-    ln_lmdb_db_t   db, db_info;
-
-    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &db.txn);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        goto LABEL_EXIT;
-    }
-    db_info.txn = db.txn;
-    retval = mdb_dbi_open(db.txn, M_DBI_ANNO_CNL, MDB_CREATE, &db.dbi);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.txn);
-        goto LABEL_EXIT;
-    }
-    retval = mdb_dbi_open(db.txn, M_DBI_ANNOINFO_CNL, MDB_CREATE, &db_info.dbi);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.txn);
-        goto LABEL_EXIT;
-    }
-
-    //channel_announcement
-    ucoin_buf_t buf_ann = UCOIN_BUF_INIT;
-    retval = annocnl_load(&db, &buf_ann, ShortChannelId);
-    if (retval != 0) {
-        //DB保存されていない＝新規channel
-        retval = annocnl_save(&db, pCnlAnno, ShortChannelId);
-        if ((retval == 0) && (pSendId != NULL)) {
-            bool ret = ln_db_annocnls_add_nodeid(&db_info, ShortChannelId, LN_DB_CNLANNO_ANNO, false, pSendId);
-            if (!ret) {
-                retval = -1;
-            }
-        }
-    } else {
-        if (!ucoin_buf_cmp(&buf_ann, pCnlAnno)) {
-            DBG_PRINTF("fail: different channel_announcement\n");
-            retval = -1;
-        }
-    }
-
-    MDB_TXN_COMMIT(db.txn);
-
-LABEL_EXIT:
-    return retval == 0;
+    ln_db_anno_save_t save;
+
+    save.p_buf = pCnlAnno;
+    save.short_channel_id = ShortChannelId;
+    save.p_upd = NULL;
+    save.p_nodeanno = NULL;
+    save.p_send_id = pSendId;
+    return ln_db_anno_save_batch(&save, 1, NULL) == 1;
 }
 
 
@@ -1168,82 +1363,14 @@ LABEL_EXIT:
 
 bool ln_db_annocnlupd_save(const ucoin_buf_t *pCnlUpd, const ln_cnl_update_t *pUpd, const uint8_t *pSendId)
 {
-    int             retval;
-    ln_lmdb_db_t    db, db_info;
-
-    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &db.txn);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        goto LABEL_EXIT;
-    }
-    db_info.txn = db.txn;
-    retval = mdb_dbi_open(db.txn, M_DBI_ANNO_CNL, MDB_CREATE, &db.dbi);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.txn);
-        goto LABEL_EXIT;
-    }
-    retval = mdb_dbi_open(db.txn, M_DBI_ANNOINFO_CNL, MDB_CREATE, &db_info.dbi);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.txn);
-        goto LABEL_EXIT;
-    }
-
-    ucoin_buf_t     buf_upd = UCOIN_BUF_INIT;
-    uint32_t        timestamp;
-    bool            upddb = false;
-    bool            clr = false;
-
-    retval = annocnlupd_load(&db, &buf_upd, &timestamp, pUpd->short_channel_id, ln_cnlupd_direction(pUpd));
-    if (retval == 0) {
-        if (timestamp > pUpd->timestamp) {
-            //自分の方が新しければ、スルー
-            //DBG_PRINTF("my channel_update is newer\n");
-        } else if (timestamp < pUpd->timestamp) {
-            //自分の方が古いので、更新
-            //DBG_PRINTF("gotten channel_update is newer\n");
-            upddb = true;
-
-            //announceし直す必要があるため、クリアする
-            clr = true;
-        } else {
-            if (ucoin_buf_cmp(&buf_upd, pCnlUpd)) {
-                //DBG_PRINTF("same channel_update: %d\n", ln_cnlupd_direction(pUpd));
-            } else {
-                //日時が同じなのにデータが異なる
-                DBG_PRINTF("ERR: channel_update %d mismatch !\n", ln_cnlupd_direction(pUpd));
-                DBG_PRINTF("  db: ");
-                DUMPBIN(buf_upd.buf, buf_upd.len);
-                DBG_PRINTF("  rv: ");
-                DUMPBIN(pCnlUpd->buf, pCnlUpd->len);
-                retval = -1;
-                ucoin_buf_free(&buf_upd);
-                MDB_TXN_ABORT(db.txn);
-                goto LABEL_EXIT;
-            }
-        }
-    } else {
-        //新規
-        upddb = true;
-    }
-    ucoin_buf_free(&buf_upd);
-
-    if (upddb) {
-        retval = annocnlupd_save(&db, pCnlUpd, pUpd);
-    }
-    if ((retval == 0) && (pSendId != NULL)) {
-        char type = ln_cnlupd_direction(pUpd) ?  LN_DB_CNLANNO_UPD2 : LN_DB_CNLANNO_UPD1;
-        bool ret = ln_db_annocnls_add_nodeid(&db_info, pUpd->short_channel_id, type, clr, pSendId);
-        if (!ret) {
-            retval = -1;
-        }
-    }
-
-    MDB_TXN_COMMIT(db.txn);
-
-LABEL_EXIT:
-    return retval == 0;
+    ln_db_anno_save_t save;
+
+    save.p_buf = pCnlUpd;
+    save.short_channel_id = pUpd->short_channel_id;
+    save.p_upd = pUpd;
+    save.p_nodeanno = NULL;
+    save.p_send_id = pSendId;
+    return ln_db_anno_save_batch(&save, 1, NULL) == 1;
 }
 
 
@@ -1252,8 +1379,6 @@ bool ln_db_annocnlall_del(uint64_t ShortChannelId)
     int         retval;
     MDB_txn     *txn;
     MDB_dbi     dbi, dbi_info;
-    MDB_val     key;
-    uint8_t     keydata[M_SZ_ANNOINFO_CNL + 1];
 
     retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &txn);
     if (retval != 0) {
@@ -1274,24 +1399,21 @@ bool ln_db_annocnlall_del(uint64_t ShortChannelId)
         goto LABEL_EXIT;
     }
 
-    M_ANNOINFO_CNL_SET(keydata, key, ShortChannelId, 0);
-
-    char POSTFIX[] = { LN_DB_CNLANNO_ANNO, LN_DB_CNLANNO_UPD1, LN_DB_CNLANNO_UPD2 };
-    for (size_t lp = 0; lp < ARRAY_SIZE(POSTFIX); lp++) {
-        keydata[LN_SZ_SHORT_CHANNEL_ID] = POSTFIX[lp];
-        retval = mdb_del(txn, dbi, &key, NULL);
-        if (retval != 0) {
-            DBG_PRINTF("err[%c]: %s\n", POSTFIX[lp], mdb_strerror(retval));
-        }
-        retval = mdb_del(txn, dbi_info, &key, NULL);
-        if (retval != 0) {
-            DBG_PRINTF("err[%c]: %s\n", POSTFIX[lp], mdb_strerror(retval));
-        }
+    int cnt = annocnlall_del_txn(txn, dbi, dbi_info, ShortChannelId);
+    if (cnt > 0) {
+        gossip_txnid_put(txn);
     }
 
     MDB_TXN_COMMIT(txn);
     retval = 0;
 
+    ln_routing_del_channel(ShortChannelId);
+    ln_db_cnlidx_del(ShortChannelId);
+    if (cnt > 0) {
+        //削除したレコードをgossip storeから取り除く
+        ln_db_gossip_pruned();
+    }
+
 LABEL_EXIT:
     return retval == 0;
 }
@@ -1436,63 +1558,137 @@ bool ln_db_annocnl_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, u
 }
 
 
-int ln_lmdb_annocnl_cur_load(MDB_cursor *cur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, ucoin_buf_t *pBuf)
+bool ln_db_annocnl_cur_seek(void *pCur, uint64_t ShortChannelId, char Type)
 {
-    MDB_val key, data;
-
-    int retval = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP);
-    if (retval == 0) {
-        if (key.mv_size == LN_SZ_SHORT_CHANNEL_ID + 1) {
-            //key = short_channel_id + type
-            memcpy(pShortChannelId, key.mv_data, LN_SZ_SHORT_CHANNEL_ID);
-            *pType = *(char *)((uint8_t *)key.mv_data + LN_SZ_SHORT_CHANNEL_ID);
-            //data
-            uint8_t *pData = (uint8_t *)data.mv_data;
-            if ((*pType == LN_DB_CNLANNO_UPD1) || (*pType == LN_DB_CNLANNO_UPD2)) {
-                if (pTimeStamp != NULL) {
-                    *pTimeStamp = *(uint32_t *)pData;
-                }
-                pData += sizeof(uint32_t);
-                data.mv_size -= sizeof(uint32_t);
-            } else {
-                //channel_announcementにtimestampは無い
-            }
-            ucoin_buf_alloccopy(pBuf, pData, data.mv_size);
-        } else {
-            DBG_PRINTF("fail: invalid key length: %d\n", (int)key.mv_size);
-            DUMPBIN(key.mv_data, key.mv_size);
-            retval = -1;
-        }
-    } else {
-        if (retval != MDB_NOTFOUND) {
-            DBG_PRINTF("fail: mdb_cursor_get(): %s\n", mdb_strerror(retval));
-        }
-    }
+    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
+    MDB_val key;
+    uint8_t keydata[M_SZ_ANNOINFO_CNL + 1];
 
-    return retval;
+    M_ANNOINFO_CNL_SET(keydata, key, ShortChannelId, Type);
+    return anno_cur_seek(p_cur, &key);
 }
 
 
-/********************************************************************
- * skip routing list
- ********************************************************************/
-
-bool ln_db_annoskip_save(uint64_t ShortChannelId, bool bTemp)
+int ln_db_annocnl_get_range(uint64_t **ppShortChannelId, uint32_t FirstBlock, uint32_t Num)
 {
     int         retval;
-    MDB_txn     *txn;
+    MDB_txn     *txn = NULL;
     MDB_dbi     dbi;
-    MDB_val key, data;
+    MDB_val     key, data;
+    MDB_cursor  *cursor;
+    uint64_t    end = (uint64_t)FirstBlock + Num;
 
-    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &txn);
+    *ppShortChannelId = NULL;
+    int cnt = 0;
+    int alloc = 0;
+
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, MDB_RDONLY, &txn);
     if (retval != 0) {
         DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_EXIT;
     }
-    retval = mdb_dbi_open(txn, M_DBI_ANNO_SKIP, MDB_CREATE, &dbi);
+    retval = mdb_dbi_open(txn, M_DBI_ANNO_CNL, 0, &dbi);
     if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(txn);
+        if (retval != MDB_NOTFOUND) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        }
+        MDB_TXN_ABORT(txn);
+        goto LABEL_EXIT;
+    }
+    retval = mdb_cursor_open(txn, dbi, &cursor);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
+        goto LABEL_EXIT;
+    }
+
+    //keyはshort_channel_idのバイト列順に並んでいないため、全件見る(dataは参照しない)
+    while ((retval = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
+        if ( (key.mv_size != LN_SZ_SHORT_CHANNEL_ID + 1) ||
+             (*((const char *)key.mv_data + LN_SZ_SHORT_CHANNEL_ID) != LN_DB_CNLANNO_ANNO) ) {
+            continue;
+        }
+        uint64_t short_channel_id;
+        memcpy(&short_channel_id, key.mv_data, LN_SZ_SHORT_CHANNEL_ID);
+        uint32_t bheight = (uint32_t)(short_channel_id >> 40);
+        if ((bheight < FirstBlock) || (bheight >= end)) {
+            continue;
+        }
+        if (cnt == alloc) {
+            alloc = (alloc == 0) ? 256 : alloc * 2;
+            *ppShortChannelId = (uint64_t *)realloc(*ppShortChannelId, alloc * sizeof(uint64_t));
+        }
+        (*ppShortChannelId)[cnt++] = short_channel_id;
+    }
+    mdb_cursor_close(cursor);
+    MDB_TXN_ABORT(txn);
+
+    if (cnt > 1) {
+        qsort(*ppShortChannelId, cnt, sizeof(uint64_t), sci_cmp);
+    }
+
+LABEL_EXIT:
+    return cnt;
+}
+
+
+int ln_lmdb_annocnl_cur_load(MDB_cursor *cur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, ucoin_buf_t *pBuf)
+{
+    MDB_val key, data;
+
+    int retval = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP);
+    if (retval == 0) {
+        if (key.mv_size == LN_SZ_SHORT_CHANNEL_ID + 1) {
+            //key = short_channel_id + type
+            memcpy(pShortChannelId, key.mv_data, LN_SZ_SHORT_CHANNEL_ID);
+            *pType = *(char *)((uint8_t *)key.mv_data + LN_SZ_SHORT_CHANNEL_ID);
+            //data
+            uint8_t *pData = (uint8_t *)data.mv_data;
+            if ((*pType == LN_DB_CNLANNO_UPD1) || (*pType == LN_DB_CNLANNO_UPD2)) {
+                if (pTimeStamp != NULL) {
+                    *pTimeStamp = *(uint32_t *)pData;
+                }
+                pData += sizeof(uint32_t);
+                data.mv_size -= sizeof(uint32_t);
+            } else {
+                //channel_announcementにtimestampは無い
+            }
+            ucoin_buf_alloccopy(pBuf, pData, data.mv_size);
+        } else {
+            DBG_PRINTF("fail: invalid key length: %d\n", (int)key.mv_size);
+            DUMPBIN(key.mv_data, key.mv_size);
+            retval = -1;
+        }
+    } else {
+        if (retval != MDB_NOTFOUND) {
+            DBG_PRINTF("fail: mdb_cursor_get(): %s\n", mdb_strerror(retval));
+        }
+    }
+
+    return retval;
+}
+
+
+/********************************************************************
+ * skip routing list
+ ********************************************************************/
+
+bool ln_db_annoskip_save(uint64_t ShortChannelId, bool bTemp)
+{
+    int         retval;
+    MDB_txn     *txn;
+    MDB_dbi     dbi;
+    MDB_val key, data;
+
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    retval = mdb_dbi_open(txn, M_DBI_ANNO_SKIP, MDB_CREATE, &dbi);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
         goto LABEL_EXIT;
     }
 
@@ -1514,6 +1710,9 @@ bool ln_db_annoskip_save(uint64_t ShortChannelId, bool bTemp)
     }
 
     MDB_TXN_COMMIT(txn);
+    if (retval == 0) {
+        ln_routing_skip_channel(ShortChannelId, bTemp);
+    }
 
 LABEL_EXIT:
     return retval == 0;
@@ -1584,6 +1783,9 @@ bool ln_db_annoskip_drop(bool bTemp)
     }
 
     MDB_TXN_COMMIT(txn);
+    if (retval == 0) {
+        ln_routing_skip_clear(bTemp);
+    }
 
 LABEL_EXIT:
     DBG_PRINTF("skip drop=%d\n", retval);
@@ -1591,6 +1793,56 @@ LABEL_EXIT:
 }
 
 
+int ln_db_annoskip_get(uint64_t **ppShortChannelId, bool **ppTemp)
+{
+    int         retval;
+    MDB_txn     *txn = NULL;
+    MDB_dbi     dbi;
+    MDB_val     key, data;
+    MDB_cursor  *cursor;
+
+    *ppShortChannelId = NULL;
+    *ppTemp = NULL;
+    int cnt = 0;
+
+    //読込みだけなので、書込みtransactionを待たない
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, MDB_RDONLY, &txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    retval = mdb_dbi_open(txn, M_DBI_ANNO_SKIP, 0, &dbi);
+    if (retval != 0) {
+        if (retval != MDB_NOTFOUND) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        }
+        MDB_TXN_ABORT(txn);
+        goto LABEL_EXIT;
+    }
+    retval = mdb_cursor_open(txn, dbi, &cursor);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
+        goto LABEL_EXIT;
+    }
+
+    while ((retval = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
+        if (key.mv_size == sizeof(uint64_t)) {
+            cnt++;
+            *ppShortChannelId = (uint64_t *)realloc(*ppShortChannelId, cnt * sizeof(uint64_t));
+            *ppTemp = (bool *)realloc(*ppTemp, cnt * sizeof(bool));
+            memcpy(*ppShortChannelId + (cnt - 1), key.mv_data, sizeof(uint64_t));
+            (*ppTemp)[cnt - 1] = (data.mv_size == sizeof(uint8_t)) && (*(uint8_t *)data.mv_data == M_SKIP_TEMP);
+        }
+    }
+    mdb_cursor_close(cursor);
+    MDB_TXN_ABORT(txn);
+
+LABEL_EXIT:
+    return cnt;
+}
+
+
 bool ln_db_annoskip_invoice_save(const char *pInvoice, const uint8_t *pPayHash)
 {
     int         retval;
@@ -1802,79 +2054,14 @@ LABEL_EXIT:
 
 bool ln_db_annonod_save(const ucoin_buf_t *pNodeAnno, const ln_node_announce_t *pAnno, const uint8_t *pSendId)
 {
-    int             retval;
-    ln_lmdb_db_t    db, db_info;
-
-    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &db.txn);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        goto LABEL_EXIT;
-    }
-    db_info.txn = db.txn;
-    retval = mdb_dbi_open(db.txn, M_DBI_ANNO_NODE, MDB_CREATE, &db.dbi);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.txn);
-        goto LABEL_EXIT;
-    }
-    retval = mdb_dbi_open(db.txn, M_DBI_ANNOINFO_NODE, MDB_CREATE, &db_info.dbi);
-    if (retval != 0) {
-        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.txn);
-        goto LABEL_EXIT;
-    }
-
-    ucoin_buf_t buf_node = UCOIN_BUF_INIT;
-    uint32_t    timestamp;
-    bool        upddb = false;
-    bool        clr = false;
-
-    retval = annonod_load(&db, &buf_node, &timestamp, pAnno->p_node_id);
-    if (retval == 0) {
-        if (timestamp > pAnno->timestamp) {
-            //自分の方が新しければ、スルー
-            DBG_PRINTF("my node_announcement is newer\n");
-            retval = 0;
-        } else if (timestamp < pAnno->timestamp) {
-            //自分の方が古いので、更新
-            DBG_PRINTF("gotten node_announcement is newer\n");
-            upddb = true;
-
-            //announceし直す必要があるため、クリアする
-            clr = true;
-        } else {
-            if (ucoin_buf_cmp(&buf_node, pNodeAnno)) {
-                DBG_PRINTF("same node_announcement\n");
-            } else {
-                //日時が同じなのにデータが異なる
-                DBG_PRINTF("ERR: node_announcement mismatch !\n");
-                retval = -1;
-                ucoin_buf_free(&buf_node);
-                MDB_TXN_ABORT(db.txn);
-                goto LABEL_EXIT;
-            }
-        }
-    } else {
-        //新規
-        DBG_PRINTF("new node_announcement\n");
-        upddb = true;
-    }
-    ucoin_buf_free(&buf_node);
-
-    if (upddb) {
-        retval = annonod_save(&db, pNodeAnno, pAnno);
-        if ((retval == 0) && ((pSendId != NULL) || (clr && (pSendId == NULL)))) {
-            bool ret = ln_db_annonod_add_nodeid(&db_info, pAnno->p_node_id, clr, pSendId);
-            if (!ret) {
-                retval = -1;
-            }
-        }
-    }
-
-    MDB_TXN_COMMIT(db.txn);
-
-LABEL_EXIT:
-    return retval == 0;
+    ln_db_anno_save_t save;
+
+    save.p_buf = pNodeAnno;
+    save.short_channel_id = 0;
+    save.p_upd = NULL;
+    save.p_nodeanno = pAnno;
+    save.p_send_id = pSendId;
+    return ln_db_anno_save_batch(&save, 1, NULL) == 1;
 }
 
 
@@ -1982,71 +2169,418 @@ bool ln_db_annonod_cur_get(void *pCur, ucoin_buf_t *pBuf, uint32_t *pTimeStamp,
 }
 
 
-int ln_lmdb_annonod_cur_load(MDB_cursor *cur, ucoin_buf_t *pBuf, uint32_t *pTimeStamp, uint8_t *pNodeId)
+bool ln_db_annonod_cur_seek(void *pCur, const uint8_t *pNodeId)
 {
-    MDB_val key, data;
-
-    int retval = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP);
-    if (retval == 0) {
-        // DBG_PRINTF("key:  ");
-        // DUMPBIN(key.mv_data, key.mv_size);
-        // DBG_PRINTF("data: ");
-        // DUMPBIN(data.mv_data, data.mv_size);
-        if (pNodeId) {
-            memcpy(pNodeId, key.mv_data, key.mv_size);
-        }
-        memcpy(pTimeStamp, data.mv_data, sizeof(uint32_t));
-        ucoin_buf_alloccopy(pBuf, (const uint8_t *)data.mv_data + sizeof(uint32_t), data.mv_size - sizeof(uint32_t));
-    } else {
-        if (retval != MDB_NOTFOUND) {
-            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
-        } else {
-            //end of cursor
-        }
-    }
+    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
+    MDB_val key;
 
-    return retval;
+    key.mv_size = UCOIN_SZ_PUBKEY;
+    key.mv_data = (CONST_CAST uint8_t *)pNodeId;
+    return anno_cur_seek(p_cur, &key);
 }
 
 
-/********************************************************************
- * payment preimage
- ********************************************************************/
+////////////////////
+// announcement
+////////////////////
 
-bool ln_db_preimg_save(const uint8_t *pPreImage, uint64_t Amount, void *pDb)
+int ln_db_anno_save_batch(const ln_db_anno_save_t *pSave, int Num, bool *pSaved)
 {
-    bool ret;
-    ln_lmdb_db_t db;
-    MDB_val key, data;
-    MDB_txn *txn = NULL;
-    preimage_info_t info;
+    int             retval;
+    int             saved = 0;
+    ln_lmdb_db_t    db_cnl, db_cnlinfo, db_nod, db_nodinfo;
+    annosave_t      *p_result = NULL;
 
-    if (pDb != NULL) {
-        txn = ((ln_lmdb_db_t *)pDb)->txn;
+    if (Num <= 0) {
+        return 0;
     }
-    ret = preimg_open(&db, txn);
-    if (!ret) {
-        DBG_PRINTF("fail\n");
-        return false;
+    if (pSaved != NULL) {
+        memset(pSaved, 0, sizeof(bool) * Num);
     }
 
-    key.mv_size = LN_SZ_PREIMAGE;
-    key.mv_data = (CONST_CAST uint8_t *)pPreImage;
-    data.mv_size = sizeof(info);
-    info.amount = Amount;
-    info.creation = time(NULL);
-    data.mv_data = &info;
-    int retval = mdb_put(db.txn, db.dbi, &key, &data, 0);
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &db_cnl.txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    db_cnlinfo.txn = db_cnl.txn;
+    db_nod.txn = db_cnl.txn;
+    db_nodinfo.txn = db_cnl.txn;
+    retval = mdb_dbi_open(db_cnl.txn, M_DBI_ANNO_CNL, MDB_CREATE, &db_cnl.dbi);
     if (retval == 0) {
-        DBG_PRINTF("\n");
-    } else {
+        retval = mdb_dbi_open(db_cnl.txn, M_DBI_ANNOINFO_CNL, MDB_CREATE, &db_cnlinfo.dbi);
+    }
+    if (retval == 0) {
+        retval = mdb_dbi_open(db_cnl.txn, M_DBI_ANNO_NODE, MDB_CREATE, &db_nod.dbi);
+    }
+    if (retval == 0) {
+        retval = mdb_dbi_open(db_cnl.txn, M_DBI_ANNOINFO_NODE, MDB_CREATE, &db_nodinfo.dbi);
+    }
+    if (retval != 0) {
         DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(db_cnl.txn);
+        goto LABEL_EXIT;
     }
 
-    preimg_close(&db, txn);
-
-    return retval == 0;
-}
+    //commit後の処理のため、保存結果を覚えておく
+    p_result = (annosave_t *)M_MALLOC(sizeof(annosave_t) * Num);
+    memset(p_result, 0, sizeof(annosave_t) * Num);
+    for (int lp = 0; lp < Num; lp++) {
+        const ln_db_anno_save_t *p = &pSave[lp];
+        if (p->p_upd != NULL) {
+            retval = annocnlupd_save_txn(&db_cnl, &db_cnlinfo, p->p_buf, p->p_upd, p->p_send_id, &p_result[lp].flag);
+        } else if (p->p_nodeanno != NULL) {
+            retval = annonod_save_txn(&db_nod, &db_nodinfo, p->p_buf, p->p_nodeanno, p->p_send_id, &p_result[lp].flag);
+        } else {
+            retval = annocnl_save_txn(&db_cnl, &db_cnlinfo, p->p_buf, p->short_channel_id, p->p_send_id, &p_result[lp]);
+        }
+        if (retval == 0) {
+            saved++;
+            if (pSaved != NULL) {
+                pSaved[lp] = true;
+            }
+        } else {
+            p_result[lp].flag = 0;
+        }
+    }
+
+    for (int lp = 0; lp < Num; lp++) {
+        if (p_result[lp].flag & M_ANNOSAVE_GOSSIP) {
+            gossip_txnid_put(db_cnl.txn);
+            break;
+        }
+    }
+
+    //commitしてからgossip storeへ追記し終わるまで、gossip storeは追記済みのtransaction idを進めない
+    ln_db_gossip_begin();
+    retval = mdb_txn_commit(db_cnl.txn);
+    peeridx_txn_end(retval == 0);
+    if (retval != 0) {
+        //DBに無いので、routingやgossip storeにも反映しない
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        saved = 0;
+        for (int lp = 0; lp < Num; lp++) {
+            p_result[lp].flag = 0;
+        }
+        if (pSaved != NULL) {
+            memset(pSaved, 0, sizeof(bool) * Num);
+        }
+    }
+
+    for (int lp = 0; lp < Num; lp++) {
+        const ln_db_anno_save_t *p = &pSave[lp];
+        annosave_t *p_res = &p_result[lp];
+        if (p->p_upd != NULL) {
+            if (p_res->flag & M_ANNOSAVE_UPDDB) {
+                ln_routing_set_cnlupd(p->p_upd);
+            }
+            if (p_res->flag & M_ANNOSAVE_GOSSIP) {
+                //channel_announcementが無ければ、channel_announcement保存時に追記する
+                ln_db_gossip_append(ln_cnlupd_direction(p->p_upd) ? LN_DB_CNLANNO_UPD2 : LN_DB_CNLANNO_UPD1,
+                            (const uint8_t *)&p->p_upd->short_channel_id, p->p_upd->timestamp, p->p_buf, p->p_send_id);
+            }
+        } else if (p->p_nodeanno != NULL) {
+            if (p_res->flag & M_ANNOSAVE_GOSSIP) {
+                ln_db_gossip_append(LN_DB_GOSSIP_NODE, p->p_nodeanno->p_node_id, p->p_nodeanno->timestamp, p->p_buf, p->p_send_id);
+            }
+        } else {
+            if (p_res->flag & M_ANNOSAVE_UPDDB) {
+                ln_routing_add_cnlanno(p->p_buf);
+                ln_db_cnlidx_add(p->p_buf);
+            }
+            if (p_res->flag & M_ANNOSAVE_GOSSIP) {
+                ln_db_gossip_append(LN_DB_CNLANNO_ANNO, (const uint8_t *)&p->short_channel_id, (uint32_t)time(NULL), p->p_buf, p->p_send_id);
+
+                //先に受信していたchannel_updateは、channel_announcementの後に送信する
+                for (uint8_t dir = 0; dir < 2; dir++) {
+                    if (p_res->upd[dir].len > 0) {
+                        ln_db_gossip_append((dir == 0) ? LN_DB_CNLANNO_UPD1 : LN_DB_CNLANNO_UPD2,
+                                    (const uint8_t *)&p->short_channel_id, p_res->upd_time[dir], &p_res->upd[dir], NULL);
+                    }
+                }
+            }
+        }
+        ucoin_buf_free(&p_res->upd[0]);
+        ucoin_buf_free(&p_res->upd[1]);
+    }
+    ln_db_gossip_end();
+    M_FREE(p_result);
+
+LABEL_EXIT:
+    return saved;
+}
+
+
+bool ln_db_anno_prune(ln_db_prune_t *pResult, uint32_t Now, int32_t Height, ln_db_func_closed_t pFunc, void *pParam)
+{
+    int         retval;
+    MDB_txn     *txn;
+    MDB_dbi     dbi, dbi_info;
+    MDB_val     key, data;
+    MDB_cursor  *cursor;
+    ln_db_prune_list_t cnl = { NULL, 0, 0, 0, 0, Now, Height };
+    const ln_db_prune_cnl_t **pp_del = NULL;
+    uint8_t     *p_node = NULL;
+    int         node_num = 0;
+    int         node_alloc = 0;
+    prune_self_t self_cnl = { NULL, 0, 0 };
+
+    memset(pResult, 0, sizeof(ln_db_prune_t));
+
+    //channelごとに最新のchannel_updateのtimestampを集める
+    //  keyはshort_channel_id + typeのため、同じchannelは連続している
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, MDB_RDONLY, &txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    retval = mdb_dbi_open(txn, M_DBI_ANNO_CNL, 0, &dbi);
+    if (retval == 0) {
+        retval = mdb_cursor_open(txn, dbi, &cursor);
+    }
+    if (retval == 0) {
+        while (mdb_cursor_get(cursor, &key, &data, MDB_NEXT) == 0) {
+            if (key.mv_size != LN_SZ_SHORT_CHANNEL_ID + 1) {
+                continue;
+            }
+            uint64_t short_channel_id;
+            memcpy(&short_channel_id, key.mv_data, LN_SZ_SHORT_CHANNEL_ID);
+            char type = *((const char *)key.mv_data + LN_SZ_SHORT_CHANNEL_ID);
+            ln_db_prune_cnl_t *p = ln_db_prune_get(&cnl, short_channel_id);
+            if (type == LN_DB_CNLANNO_ANNO) {
+                p->anno = true;
+                ln_cnl_announce_read_t ann;
+                if ( ln_msg_cnl_announce_read(&ann, data.mv_data, data.mv_size) &&
+                     ( (memcmp(ann.node_id1, ln_node_getid(), UCOIN_SZ_PUBKEY) == 0) ||
+                       (memcmp(ann.node_id2, ln_node_getid(), UCOIN_SZ_PUBKEY) == 0) ) ) {
+                    p->own = true;
+                }
+            } else if ((data.mv_size >= sizeof(uint32_t)) && (*(const uint32_t *)data.mv_data > p->timestamp)) {
+                p->timestamp = *(const uint32_t *)data.mv_data;
+            }
+        }
+        mdb_cursor_close(cursor);
+    } else if (retval != MDB_NOTFOUND) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+    }
+    MDB_TXN_ABORT(txn);
+
+    (void)ln_db_self_search(prune_self_func, &self_cnl);
+    ln_db_prune_select(&cnl, self_cnl.p_sci, self_cnl.num, pFunc, pParam);
+
+    //M_PRUNE_BATCH channelずつ削除する
+    if (cnl.del_num > 0) {
+        pp_del = (const ln_db_prune_cnl_t **)M_MALLOC(M_PRUNE_BATCH * sizeof(ln_db_prune_cnl_t *));
+    }
+    while (cnl.del_num > 0) {
+        ln_lmdb_db_t db;
+
+        retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &db.txn);
+        if (retval != 0) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+            goto LABEL_EXIT;
+        }
+        retval = mdb_dbi_open(db.txn, M_DBI_ANNO_CNL, 0, &db.dbi);
+        if (retval == 0) {
+            retval = mdb_dbi_open(db.txn, M_DBI_ANNOINFO_CNL, MDB_CREATE, &dbi_info);
+        }
+        if (retval != 0) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+            MDB_TXN_ABORT(db.txn);
+            goto LABEL_EXIT;
+        }
+
+        int num = ln_db_prune_batch(&cnl, pp_del, M_PRUNE_BATCH, prune_cnlupd_time, &db);
+        int records = 0;
+        for (int lp = 0; lp < num; lp++) {
+            if (pp_del[lp]->closed) {
+                pResult->closed++;
+            } else {
+                pResult->stale++;
+            }
+            records += annocnlall_del_txn(db.txn, db.dbi, dbi_info, pp_del[lp]->short_channel_id);
+        }
+        if (records > 0) {
+            gossip_txnid_put(db.txn);
+            pResult->records += records;
+        }
+
+        MDB_TXN_COMMIT(db.txn);
+
+        for (int lp = 0; lp < num; lp++) {
+            ln_routing_del_channel(pp_del[lp]->short_channel_id);
+            ln_db_cnlidx_del(pp_del[lp]->short_channel_id);
+        }
+    }
+
+    //どのchannel_announcementにも含まれないnode_announcementを削除する
+    //  判定中にchannel_announcementが追加されないよう、1トランザクションで行う
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    retval = mdb_dbi_open(txn, M_DBI_ANNO_CNL, 0, &dbi);
+    if (retval == 0) {
+        retval = mdb_cursor_open(txn, dbi, &cursor);
+    }
+    if (retval == 0) {
+        while (mdb_cursor_get(cursor, &key, &data, MDB_NEXT) == 0) {
+            if ( (key.mv_size != LN_SZ_SHORT_CHANNEL_ID + 1) ||
+                 (*((const char *)key.mv_data + LN_SZ_SHORT_CHANNEL_ID) != LN_DB_CNLANNO_ANNO) ) {
+                continue;
+            }
+            ln_cnl_announce_read_t ann;
+            if (!ln_msg_cnl_announce_read(&ann, data.mv_data, data.mv_size)) {
+                continue;
+            }
+            if (node_num + 2 > node_alloc) {
+                node_alloc = (node_alloc == 0) ? 2048 : node_alloc * 2;
+                p_node = (uint8_t *)M_REALLOC(p_node, node_alloc * UCOIN_SZ_PUBKEY);
+            }
+            memcpy(p_node + UCOIN_SZ_PUBKEY * node_num++, ann.node_id1, UCOIN_SZ_PUBKEY);
+            memcpy(p_node + UCOIN_SZ_PUBKEY * node_num++, ann.node_id2, UCOIN_SZ_PUBKEY);
+        }
+        mdb_cursor_close(cursor);
+    } else if (retval != MDB_NOTFOUND) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
+        goto LABEL_EXIT;
+    }
+    if (node_num > 1) {
+        qsort(p_node, node_num, UCOIN_SZ_PUBKEY, nodeid_cmp);
+    }
+
+    retval = mdb_dbi_open(txn, M_DBI_ANNO_NODE, 0, &dbi);
+    if (retval == 0) {
+        retval = mdb_dbi_open(txn, M_DBI_ANNOINFO_NODE, MDB_CREATE, &dbi_info);
+    }
+    if (retval == 0) {
+        retval = mdb_cursor_open(txn, dbi, &cursor);
+    }
+    if (retval == 0) {
+        while (mdb_cursor_get(cursor, &key, &data, MDB_NEXT) == 0) {
+            if (key.mv_size != UCOIN_SZ_PUBKEY) {
+                continue;
+            }
+            if ( (memcmp(key.mv_data, ln_node_getid(), UCOIN_SZ_PUBKEY) == 0) ||
+                 ((node_num > 0) && (bsearch(key.mv_data, p_node, node_num, UCOIN_SZ_PUBKEY, nodeid_cmp) != NULL)) ) {
+                continue;
+            }
+            //cursor削除後はkeyが無効になるため、annoinfoを先に削除する
+            uint8_t keydata[M_SZ_ANNOINFO_NODE];
+            MDB_val key_info;
+            M_ANNOINFO_NODE_SET(keydata, key_info, key.mv_data);
+            retval = mdb_del(txn, dbi_info, &key_info, NULL);
+            if ((retval != 0) && (retval != MDB_NOTFOUND)) {
+                DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+            }
+            retval = mdb_cursor_del(cursor, 0);
+            if (retval == 0) {
+                pResult->node++;
+                pResult->records++;
+            } else {
+                DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+            }
+        }
+        mdb_cursor_close(cursor);
+    } else if (retval != MDB_NOTFOUND) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
+        goto LABEL_EXIT;
+    }
+    if (pResult->node > 0) {
+        gossip_txnid_put(txn);
+    }
+    MDB_TXN_COMMIT(txn);
+    retval = 0;
+
+    if (pResult->records > 0) {
+        //削除したレコードをgossip storeから取り除く
+        ln_db_gossip_pruned();
+    }
+    DBG_PRINTF("stale=%d, closed=%d, node=%d, records=%d\n", pResult->stale, pResult->closed, pResult->node, pResult->records);
+
+LABEL_EXIT:
+    ln_db_prune_free(&cnl);
+    if (pp_del != NULL) {
+        M_FREE(pp_del);
+    }
+    if (p_node != NULL) {
+        M_FREE(p_node);
+    }
+    if (self_cnl.p_sci != NULL) {
+        M_FREE(self_cnl.p_sci);
+    }
+    return retval == 0;
+}
+
+
+int ln_lmdb_annonod_cur_load(MDB_cursor *cur, ucoin_buf_t *pBuf, uint32_t *pTimeStamp, uint8_t *pNodeId)
+{
+    MDB_val key, data;
+
+    int retval = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP);
+    if (retval == 0) {
+        // DBG_PRINTF("key:  ");
+        // DUMPBIN(key.mv_data, key.mv_size);
+        // DBG_PRINTF("data: ");
+        // DUMPBIN(data.mv_data, data.mv_size);
+        if (pNodeId) {
+            memcpy(pNodeId, key.mv_data, key.mv_size);
+        }
+        memcpy(pTimeStamp, data.mv_data, sizeof(uint32_t));
+        ucoin_buf_alloccopy(pBuf, (const uint8_t *)data.mv_data + sizeof(uint32_t), data.mv_size - sizeof(uint32_t));
+    } else {
+        if (retval != MDB_NOTFOUND) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        } else {
+            //end of cursor
+        }
+    }
+
+    return retval;
+}
+
+
+/********************************************************************
+ * payment preimage
+ ********************************************************************/
+
+bool ln_db_preimg_save(const uint8_t *pPreImage, uint64_t Amount, void *pDb)
+{
+    bool ret;
+    ln_lmdb_db_t db;
+    MDB_val key, data;
+    MDB_txn *txn = NULL;
+    preimage_info_t info;
+
+    if (pDb != NULL) {
+        txn = ((ln_lmdb_db_t *)pDb)->txn;
+    }
+    ret = preimg_open(&db, txn);
+    if (!ret) {
+        DBG_PRINTF("fail\n");
+        return false;
+    }
+
+    key.mv_size = LN_SZ_PREIMAGE;
+    key.mv_data = (CONST_CAST uint8_t *)pPreImage;
+    data.mv_size = sizeof(info);
+    info.amount = Amount;
+    info.creation = time(NULL);
+    data.mv_data = &info;
+    int retval = mdb_put(db.txn, db.dbi, &key, &data, 0);
+    if (retval == 0) {
+        DBG_PRINTF("\n");
+    } else {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+    }
+
+    preimg_close(&db, txn);
+
+    return retval == 0;
+}
 
 
 bool ln_db_preimg_del(const uint8_t *pPreImage)
@@ -2593,6 +3127,9 @@ ln_lmdb_dbtype_t ln_lmdb_get_dbtype(const char *pDbName)
     } else if (strcmp(pDbName, M_DBI_ANNOINFO_NODE) == 0) {
         //node_announcement information
         dbtype = LN_LMDB_DBTYPE_NODE_ANNOINFO;
+    } else if (strcmp(pDbName, M_DBI_PEER_INDEX) == 0) {
+        //annoinfo peer index
+        dbtype = LN_LMDB_DBTYPE_PEER_INDEX;
     } else if (strcmp(pDbName, M_DBI_ANNO_SKIP) == 0) {
         //route skip
         dbtype = LN_LMDB_DBTYPE_ANNO_SKIP;
@@ -3150,65 +3687,675 @@ static int annonod_save(ln_lmdb_db_t *pDb, const ucoin_buf_t *pNodeAnno, const l
 }
 
 
-/** annoinfoにnode_idを追加(channel, node共通)
+/** channel_announcement書込み(トランザクション内)
  *
- * @param[in,out]   pDb         annoinfo
- * @param[in]       pMdbKey     loadしたchannel_announcement infoのkey
- * @param[in]       pMdbData    loadしたchannel_announcement infoのdata
- * @param[in]       pNodeId     追加するnode_id(NULL時はクリア)
+ * 保存済みの場合は何もしない(内容が異なる場合はエラー)。
+ * 新規保存した場合、先に保存されていたchannel_updateをgossip store追記用に読み込んでおく。
+ *
+ * @param[in,out]   pDb                 channel_announcement DB
+ * @param[in,out]   pDbInfo             channel_announcement info DB
+ * @param[in]       pCnlAnno            channel_announcementパケット
+ * @param[in]       ShortChannelId      short_channel_id
+ * @param[in]       pSendId             (非NULL)channel_announcementの送信元/先ノード
+ * @param[out]      pResult             保存結果
+ * @retval      0       成功
  */
-static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId)
+static int annocnl_save_txn(ln_lmdb_db_t *pDb, ln_lmdb_db_t *pDbInfo, const ucoin_buf_t *pCnlAnno, uint64_t ShortChannelId, const uint8_t *pSendId, annosave_t *pResult)
 {
-    uint8_t *p_ids;
-
-    if (pNodeId != NULL) {
-        int nums = pMdbData->mv_size / UCOIN_SZ_PUBKEY;
-        p_ids = (uint8_t *)M_MALLOC((nums + 1) * UCOIN_SZ_PUBKEY);
-        memcpy(p_ids, pMdbData->mv_data, pMdbData->mv_size);
-        memcpy(p_ids + pMdbData->mv_size, pNodeId, UCOIN_SZ_PUBKEY);
-        pMdbData->mv_size += UCOIN_SZ_PUBKEY;
-    } else {
-        pMdbData->mv_size = 0;
-        p_ids = NULL;
-    }
+    int         retval;
+    ucoin_buf_t buf_ann = UCOIN_BUF_INIT;
 
-    pMdbData->mv_data = p_ids;
-    int retval = mdb_put(pDb->txn, pDb->dbi, pMdbKey, pMdbData, 0);
-    if (retval == 0) {
-        DBG_PRINTF("add annoinfo: ");
-        DUMPBIN(pNodeId, UCOIN_SZ_PUBKEY);
+    pResult->flag = 0;
+    retval = annocnl_load(pDb, &buf_ann, ShortChannelId);
+    if (retval != 0) {
+        //DB保存されていない＝新規channel
+        retval = annocnl_save(pDb, pCnlAnno, ShortChannelId);
+        if ((retval == 0) && (pSendId != NULL)) {
+            //annoinfoは送信を減らすためだけの情報なので、失敗してもannouncementは保存する
+            bool ret = ln_db_annocnls_add_nodeid(pDbInfo, ShortChannelId, LN_DB_CNLANNO_ANNO, false, pSendId);
+            if (!ret) {
+                DBG_PRINTF("fail: annoinfo(ignore)\n");
+            }
+        }
+        if (retval == 0) {
+            pResult->flag = M_ANNOSAVE_UPDDB | M_ANNOSAVE_GOSSIP;
+            for (uint8_t dir = 0; dir < 2; dir++) {
+                if (annocnlupd_load(pDb, &pResult->upd[dir], &pResult->upd_time[dir], ShortChannelId, dir) != 0) {
+                    ucoin_buf_init(&pResult->upd[dir]);
+                }
+            }
+        }
     } else {
-        DBG_PRINTF("fail\n");
+        if (!ucoin_buf_cmp(&buf_ann, pCnlAnno)) {
+            DBG_PRINTF("fail: different channel_announcement\n");
+            retval = -1;
+        }
     }
-    M_FREE(p_ids);
+    ucoin_buf_free(&buf_ann);
 
-    return retval == 0;
+    return retval;
 }
 
 
-/** annoinfoからnode_idの有無を検索(channel, node共通)
+/** channel_update書込み(トランザクション内)
  *
- * @param[in]   pMdbData
- * @param[in]   pNodeId
- * @retval  true    検出
+ * 保存済みのものと比較し、新しい場合だけ書き込む。
+ * 同じtimestampでデータが異なる場合は、何も書き込まずにエラーを返す。
+ *
+ * @param[in,out]   pDb                 channel_announcement DB
+ * @param[in,out]   pDbInfo             channel_announcement info DB
+ * @param[in]       pCnlUpd             channel_updateパケット
+ * @param[in]       pUpd                channel_update構造体
+ * @param[in]       pSendId             (非NULL)channel_updateの送信元/先ノード
+ * @param[out]      pFlag               M_ANNOSAVE_xxx
+ * @retval      0       成功
  */
-static bool annoinfo_search(MDB_val *pMdbData, const uint8_t *pNodeId)
+static int annocnlupd_save_txn(ln_lmdb_db_t *pDb, ln_lmdb_db_t *pDbInfo, const ucoin_buf_t *pCnlUpd, const ln_cnl_update_t *pUpd, const uint8_t *pSendId, uint8_t *pFlag)
 {
-    int nums = pMdbData->mv_size / UCOIN_SZ_PUBKEY;
-    //DBG_PRINTF("nums=%d\n", nums);
-    //DBG_PRINTF("search id: ");
-    //DUMPBIN(pNodeId, UCOIN_SZ_PUBKEY);
-    int lp;
-    for (lp = 0; lp < nums; lp++) {
-        //DBG_PRINTF("  node_id[%d]= ", lp);
-        //DUMPBIN(pMdbData->mv_data + UCOIN_SZ_PUBKEY * lp, UCOIN_SZ_PUBKEY);
-        if (memcmp((uint8_t *)pMdbData->mv_data + UCOIN_SZ_PUBKEY * lp, pNodeId, UCOIN_SZ_PUBKEY) == 0) {
-            break;
-        }
-    }
+    int             retval;
+    ucoin_buf_t     buf_upd = UCOIN_BUF_INIT;
+    uint32_t        timestamp;
+    bool            upddb = false;
+    bool            clr = false;
 
-    return lp < nums;
-}
+    *pFlag = 0;
+    retval = annocnlupd_load(pDb, &buf_upd, &timestamp, pUpd->short_channel_id, ln_cnlupd_direction(pUpd));
+    if (retval == 0) {
+        if (timestamp > pUpd->timestamp) {
+            //自分の方が新しければ、スルー
+            //DBG_PRINTF("my channel_update is newer\n");
+        } else if (timestamp < pUpd->timestamp) {
+            //自分の方が古いので、更新
+            //DBG_PRINTF("gotten channel_update is newer\n");
+            upddb = true;
+
+            //announceし直す必要があるため、クリアする
+            clr = true;
+        } else {
+            if (ucoin_buf_cmp(&buf_upd, pCnlUpd)) {
+                //DBG_PRINTF("same channel_update: %d\n", ln_cnlupd_direction(pUpd));
+            } else {
+                //日時が同じなのにデータが異なる
+                DBG_PRINTF("ERR: channel_update %d mismatch !\n", ln_cnlupd_direction(pUpd));
+                DBG_PRINTF("  db: ");
+                DUMPBIN(buf_upd.buf, buf_upd.len);
+                DBG_PRINTF("  rv: ");
+                DUMPBIN(pCnlUpd->buf, pCnlUpd->len);
+                ucoin_buf_free(&buf_upd);
+                return -1;
+            }
+        }
+    } else {
+        //新規
+        upddb = true;
+    }
+    ucoin_buf_free(&buf_upd);
+
+    bool has_anno = false;
+    if (upddb) {
+        retval = annocnl_load(pDb, &buf_upd, pUpd->short_channel_id);
+        has_anno = (retval == 0);
+        ucoin_buf_free(&buf_upd);
+
+        retval = annocnlupd_save(pDb, pCnlUpd, pUpd);
+    }
+    if ((retval == 0) && (pSendId != NULL)) {
+        char type = ln_cnlupd_direction(pUpd) ?  LN_DB_CNLANNO_UPD2 : LN_DB_CNLANNO_UPD1;
+        bool ret = ln_db_annocnls_add_nodeid(pDbInfo, pUpd->short_channel_id, type, clr, pSendId);
+        if (!ret) {
+            DBG_PRINTF("fail: annoinfo(ignore)\n");
+        }
+    }
+    if ((retval == 0) && upddb) {
+        *pFlag |= M_ANNOSAVE_UPDDB;
+        if (has_anno) {
+            *pFlag |= M_ANNOSAVE_GOSSIP;
+        }
+    }
+
+    return retval;
+}
+
+
+/** node_announcement書込み(トランザクション内)
+ *
+ * 保存済みのものと比較し、新しい場合だけ書き込む。
+ * 同じtimestampでデータが異なる場合は、何も書き込まずにエラーを返す。
+ *
+ * @param[in,out]   pDb                 node_announcement DB
+ * @param[in,out]   pDbInfo             node_announcement info DB
+ * @param[in]       pNodeAnno           node_announcementパケット
+ * @param[in]       pAnno               node_announcement構造体
+ * @param[in]       pSendId             node_announcementの送信元/先ノード
+ * @param[out]      pFlag               M_ANNOSAVE_xxx
+ * @retval      0       成功
+ */
+static int annonod_save_txn(ln_lmdb_db_t *pDb, ln_lmdb_db_t *pDbInfo, const ucoin_buf_t *pNodeAnno, const ln_node_announce_t *pAnno, const uint8_t *pSendId, uint8_t *pFlag)
+{
+    int         retval;
+    ucoin_buf_t buf_node = UCOIN_BUF_INIT;
+    uint32_t    timestamp;
+    bool        upddb = false;
+    bool        clr = false;
+
+    *pFlag = 0;
+    retval = annonod_load(pDb, &buf_node, &timestamp, pAnno->p_node_id);
+    if (retval == 0) {
+        if (timestamp > pAnno->timestamp) {
+            //自分の方が新しければ、スルー
+            DBG_PRINTF("my node_announcement is newer\n");
+            retval = 0;
+        } else if (timestamp < pAnno->timestamp) {
+            //自分の方が古いので、更新
+            DBG_PRINTF("gotten node_announcement is newer\n");
+            upddb = true;
+
+            //announceし直す必要があるため、クリアする
+            clr = true;
+        } else {
+            if (ucoin_buf_cmp(&buf_node, pNodeAnno)) {
+                DBG_PRINTF("same node_announcement\n");
+            } else {
+                //日時が同じなのにデータが異なる
+                DBG_PRINTF("ERR: node_announcement mismatch !\n");
+                ucoin_buf_free(&buf_node);
+                return -1;
+            }
+        }
+    } else {
+        //新規
+        DBG_PRINTF("new node_announcement\n");
+        upddb = true;
+    }
+    ucoin_buf_free(&buf_node);
+
+    if (upddb) {
+        retval = annonod_save(pDb, pNodeAnno, pAnno);
+        if ((retval == 0) && ((pSendId != NULL) || (clr && (pSendId == NULL)))) {
+            bool ret = ln_db_annonod_add_nodeid(pDbInfo, pAnno->p_node_id, clr, pSendId);
+            if (!ret) {
+                DBG_PRINTF("fail: annoinfo(ignore)\n");
+            }
+        }
+        if (retval == 0) {
+            *pFlag |= M_ANNOSAVE_UPDDB | M_ANNOSAVE_GOSSIP;
+        }
+    }
+
+    return retval;
+}
+
+
+/** annoinfoにnode_idを追加(channel, node共通)
+ *
+ * @param[in,out]   pDb         annoinfo
+ * @param[in]       pMdbKey     loadしたchannel_announcement infoのkey
+ * @param[in]       pMdbData    loadしたchannel_announcement infoのdata
+ * @param[in]       pNodeId     追加するnode_id(NULL時はクリア)
+ */
+static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId)
+{
+    uint8_t *p_bits = NULL;
+
+    if (pNodeId != NULL) {
+        int idx = peeridx_add(pDb->txn, pNodeId);
+        if (idx < 0) {
+            return false;
+        }
+        size_t len = (size_t)idx / 8 + 1;
+        if (len < pMdbData->mv_size) {
+            len = pMdbData->mv_size;
+        }
+        p_bits = (uint8_t *)M_MALLOC(len);
+        memset(p_bits, 0, len);
+        memcpy(p_bits, pMdbData->mv_data, pMdbData->mv_size);
+        p_bits[idx / 8] |= (uint8_t)(1 << (idx % 8));
+        pMdbData->mv_size = len;
+    } else {
+        pMdbData->mv_size = 0;
+    }
+
+    pMdbData->mv_data = p_bits;
+    int retval = mdb_put(pDb->txn, pDb->dbi, pMdbKey, pMdbData, 0);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+    }
+    M_FREE(p_bits);
+
+    return retval == 0;
+}
+
+
+/** annoinfoからnode_idの有無を検索(channel, node共通)
+ *
+ * @param[in]   pMdbData
+ * @param[in]   pNodeId
+ * @retval  true    検出
+ */
+static bool annoinfo_search(MDB_val *pMdbData, const uint8_t *pNodeId)
+{
+    int idx = peeridx_get(pNodeId);
+    if ((idx < 0) || ((size_t)idx / 8 >= pMdbData->mv_size)) {
+        return false;
+    }
+    return (((const uint8_t *)pMdbData->mv_data)[idx / 8] & (1 << (idx % 8))) != 0;
+}
+
+
+/** peer index初期化
+ *
+ * DBから読み込む。
+ * "peer_index"が無い場合は、annoinfoが旧形式(node_idの配列)のためクリアする。
+ *
+ * @retval  0   成功
+ */
+static int peeridx_init(void)
+{
+    int         retval;
+    MDB_txn     *txn;
+    MDB_dbi     dbi;
+    MDB_cursor  *cursor;
+    MDB_val     key, data;
+
+    retval = MDB_TXN_BEGIN(mpDbNode, NULL, 0, &txn);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+    retval = mdb_dbi_open(txn, M_DBI_PEER_INDEX, 0, &dbi);
+    if (retval == MDB_NOTFOUND) {
+        DBG_PRINTF("create peer index: clear annoinfo\n");
+        const char *DBI_INFO[] = { M_DBI_ANNOINFO_CNL, M_DBI_ANNOINFO_NODE };
+        for (size_t lp = 0; lp < ARRAY_SIZE(DBI_INFO); lp++) {
+            MDB_dbi dbi_info;
+            if (mdb_dbi_open(txn, DBI_INFO[lp], 0, &dbi_info) == 0) {
+                mdb_drop(txn, dbi_info, 0);
+            }
+        }
+        retval = mdb_dbi_open(txn, M_DBI_PEER_INDEX, MDB_CREATE, &dbi);
+        if (retval == 0) {
+            MDB_TXN_COMMIT(txn);
+        } else {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+            MDB_TXN_ABORT(txn);
+        }
+        return retval;
+    } else if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
+        return retval;
+    }
+
+    retval = mdb_cursor_open(txn, dbi, &cursor);
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(txn);
+        return retval;
+    }
+    int num = 0;
+    pthread_mutex_lock(&mMuxPeerIdx);
+    while (mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP) == 0) {
+        uint16_t idx;
+        if ((key.mv_size != UCOIN_SZ_PUBKEY) || (data.mv_size != sizeof(idx))) {
+            continue;
+        }
+        memcpy(&idx, data.mv_data, sizeof(idx));
+        if ((idx < M_PEERIDX_MAX) && !mPeerIdx[idx].used) {
+            memcpy(mPeerIdx[idx].node_id, key.mv_data, UCOIN_SZ_PUBKEY);
+            mPeerIdx[idx].used = true;
+            mPeerIdx[idx].last = 0;
+            num++;
+        }
+    }
+    peeridx_rehash();
+    DBG_PRINTF("peer index: %d\n", num);
+    pthread_mutex_unlock(&mMuxPeerIdx);
+    mdb_cursor_close(cursor);
+    MDB_TXN_ABORT(txn);
+
+    return 0;
+}
+
+
+/** peer index hash tableの位置
+ *
+ * mMuxPeerIdxをlockして呼ぶこと。
+ *
+ * @param[in]   pNodeId     node_id
+ * @return  一致する位置、または追加する位置(一杯の場合はNULL)
+ */
+static uint16_t *peeridx_slot(const uint8_t *pNodeId)
+{
+    //先頭の02/03以外はランダムとみなしてよい
+    uint32_t pos = ((uint32_t)pNodeId[1] | ((uint32_t)pNodeId[2] << 8)) & (M_PEERIDX_SLOT - 1);
+    for (int lp = 0; lp < M_PEERIDX_SLOT; lp++) {
+        uint16_t *p_slot = &mPeerIdxHash[(pos + lp) & (M_PEERIDX_SLOT - 1)];
+        if ((*p_slot == 0) || (memcmp(mPeerIdx[*p_slot - 1].node_id, pNodeId, UCOIN_SZ_PUBKEY) == 0)) {
+            return p_slot;
+        }
+    }
+    return NULL;
+}
+
+
+/** peer index hash table再作成
+ *
+ * open addressingのため、解放した場合は作り直す。
+ * mMuxPeerIdxをlockして呼ぶこと。
+ */
+static void peeridx_rehash(void)
+{
+    memset(mPeerIdxHash, 0, sizeof(mPeerIdxHash));
+    for (int lp = 0; lp < M_PEERIDX_MAX; lp++) {
+        if (mPeerIdx[lp].used) {
+            uint16_t *p_slot = peeridx_slot(mPeerIdx[lp].node_id);
+            *p_slot = (uint16_t)(lp + 1);
+        }
+    }
+}
+
+
+/** peer index取得(commit済みのみ)
+ *
+ * @param[in]   pNodeId     node_id
+ * @return  peer index(未登録の場合は-1)
+ */
+static int peeridx_get(const uint8_t *pNodeId)
+{
+    int idx = -1;
+
+    pthread_mutex_lock(&mMuxPeerIdx);
+    const uint16_t *p_slot = peeridx_slot(pNodeId);
+    if ((p_slot != NULL) && (*p_slot != 0)) {
+        idx = *p_slot - 1;
+    }
+    pthread_mutex_unlock(&mMuxPeerIdx);
+
+    return idx;
+}
+
+
+/** peer index取得(未登録なら登録する)
+ *
+ * 書込みtransactionはLMDBで直列化されるため、登録処理が同時に行われることはない。
+ * 登録はtransaction中の変更として覚えておき、#peeridx_txn_end()で反映する。
+ * 空きが無い場合は、最近使っていないpeer indexを解放して使う。
+ *
+ * @param[in]   txn         書込み中のtransaction
+ * @param[in]   pNodeId     node_id
+ * @return  peer index(登録できない場合は-1)
+ */
+static int peeridx_add(MDB_txn *txn, const uint8_t *pNodeId)
+{
+    int idx = -1;
+    uint32_t now = (uint32_t)time(NULL);
+
+    pthread_mutex_lock(&mMuxPeerIdx);
+    const uint16_t *p_slot = peeridx_slot(pNodeId);
+    if ((p_slot != NULL) && (*p_slot != 0)) {
+        //このtransactionで解放していなければ有効
+        if (!peeridx_pend_find(*p_slot - 1, false)) {
+            idx = *p_slot - 1;
+            mPeerIdx[idx].last = now;
+        }
+    }
+    if (idx < 0) {
+        //このtransactionで登録済み
+        for (int lp = 0; lp < mPeerIdxPendNum; lp++) {
+            if (mpPeerIdxPend[lp].add && (memcmp(mpPeerIdxPend[lp].node_id, pNodeId, UCOIN_SZ_PUBKEY) == 0)) {
+                idx = mpPeerIdxPend[lp].idx;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mMuxPeerIdx);
+    if (idx >= 0) {
+        return idx;
+    }
+
+    idx = peeridx_alloc();
+    if ((idx < 0) && peeridx_evict(txn)) {
+        idx = peeridx_alloc();
+    }
+    if (idx < 0) {
+        DBG_PRINTF("fail: peer index full\n");
+        return -1;
+    }
+
+    MDB_dbi dbi;
+    MDB_val key, data;
+    uint16_t idx16 = (uint16_t)idx;
+
+    int retval = mdb_dbi_open(txn, M_DBI_PEER_INDEX, MDB_CREATE, &dbi);
+    if (retval == 0) {
+        key.mv_size = UCOIN_SZ_PUBKEY;
+        key.mv_data = (CONST_CAST uint8_t *)pNodeId;
+        data.mv_size = sizeof(idx16);
+        data.mv_data = &idx16;
+        retval = mdb_put(txn, dbi, &key, &data, 0);
+    }
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        return -1;
+    }
+    peeridx_pend_add(idx, true, pNodeId);
+
+    DBG_PRINTF("new peer index[%d]: ", idx);
+    DUMPBIN(pNodeId, UCOIN_SZ_PUBKEY);
+
+    return idx;
+}
+
+
+/** 空きpeer index取得
+ *
+ * commit済みで未使用、またはこのtransactionで解放したもののうち、
+ * このtransactionで登録していないもの。
+ *
+ * @return  peer index(空きが無い場合は-1)
+ */
+static int peeridx_alloc(void)
+{
+    int idx = -1;
+
+    pthread_mutex_lock(&mMuxPeerIdx);
+    for (int lp = 0; lp < M_PEERIDX_MAX; lp++) {
+        if ((!mPeerIdx[lp].used || peeridx_pend_find(lp, false)) && !peeridx_pend_find(lp, true)) {
+            idx = lp;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mMuxPeerIdx);
+
+    return idx;
+}
+
+
+/** 最近使っていないpeer indexを解放する
+ *
+ * "peer_index"から削除し、annoinfoのbitもクリアする。
+ * annoinfoを全部書き換えるので、一度に#M_PEERIDX_EVICT個解放する。
+ *
+ * @param[in]   txn         書込み中のtransaction
+ * @retval  true    1つ以上解放した
+ */
+static bool peeridx_evict(MDB_txn *txn)
+{
+    int         retval;
+    MDB_dbi     dbi;
+    MDB_cursor  *cursor;
+    MDB_val     key, data;
+    uint8_t     mask[M_PEERIDX_MAX / 8];
+    uint16_t    *p_idx = (uint16_t *)M_MALLOC(sizeof(uint16_t) * M_PEERIDX_MAX);
+    int         num = 0;
+
+    //解放候補(このtransactionで変更していないもの)を古い順に選ぶ
+    pthread_mutex_lock(&mMuxPeerIdx);
+    for (int lp = 0; lp < M_PEERIDX_MAX; lp++) {
+        if (mPeerIdx[lp].used && !peeridx_pend_find(lp, false) && !peeridx_pend_find(lp, true)) {
+            p_idx[num++] = (uint16_t)lp;
+        }
+    }
+    int evict = (num < M_PEERIDX_EVICT) ? num : M_PEERIDX_EVICT;
+    for (int lp = 0; lp < evict; lp++) {
+        int oldest = lp;
+        for (int lp2 = lp + 1; lp2 < num; lp2++) {
+            if (mPeerIdx[p_idx[lp2]].last < mPeerIdx[p_idx[oldest]].last) {
+                oldest = lp2;
+            }
+        }
+        uint16_t tmp = p_idx[lp];
+        p_idx[lp] = p_idx[oldest];
+        p_idx[oldest] = tmp;
+    }
+    memset(mask, 0, sizeof(mask));
+    for (int lp = 0; lp < evict; lp++) {
+        mask[p_idx[lp] / 8] |= (uint8_t)(1 << (p_idx[lp] % 8));
+    }
+    pthread_mutex_unlock(&mMuxPeerIdx);
+    if (evict == 0) {
+        M_FREE(p_idx);
+        return false;
+    }
+    DBG_PRINTF("evict peer index: %d\n", evict);
+
+    //annoinfoのbitをクリア
+    const char *DBI_INFO[] = { M_DBI_ANNOINFO_CNL, M_DBI_ANNOINFO_NODE };
+    for (size_t lp = 0; lp < ARRAY_SIZE(DBI_INFO); lp++) {
+        retval = mdb_dbi_open(txn, DBI_INFO[lp], 0, &dbi);
+        if (retval != 0) {
+            continue;
+        }
+        retval = mdb_cursor_open(txn, dbi, &cursor);
+        if (retval != 0) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+            continue;
+        }
+        while (mdb_cursor_get(cursor, &key, &data, MDB_NEXT) == 0) {
+            const uint8_t *p_bits = (const uint8_t *)data.mv_data;
+            size_t len = (data.mv_size < sizeof(mask)) ? data.mv_size : sizeof(mask);
+            bool hit = false;
+            for (size_t pos = 0; pos < len; pos++) {
+                if (p_bits[pos] & mask[pos]) {
+                    hit = true;
+                    break;
+                }
+            }
+            if (hit) {
+                uint8_t *p_new = (uint8_t *)M_MALLOC(data.mv_size);
+                memcpy(p_new, data.mv_data, data.mv_size);
+                for (size_t pos = 0; pos < len; pos++) {
+                    p_new[pos] &= (uint8_t)~mask[pos];
+                }
+                data.mv_data = p_new;
+                retval = mdb_cursor_put(cursor, &key, &data, MDB_CURRENT);
+                M_FREE(p_new);
+                if (retval != 0) {
+                    DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+                }
+            }
+        }
+        mdb_cursor_close(cursor);
+    }
+
+    //"peer_index"から削除
+    retval = mdb_dbi_open(txn, M_DBI_PEER_INDEX, 0, &dbi);
+    for (int lp = 0; lp < evict; lp++) {
+        uint8_t node_id[UCOIN_SZ_PUBKEY];
+
+        pthread_mutex_lock(&mMuxPeerIdx);
+        memcpy(node_id, mPeerIdx[p_idx[lp]].node_id, UCOIN_SZ_PUBKEY);
+        pthread_mutex_unlock(&mMuxPeerIdx);
+        if (retval == 0) {
+            key.mv_size = UCOIN_SZ_PUBKEY;
+            key.mv_data = node_id;
+            (void)mdb_del(txn, dbi, &key, NULL);
+        }
+        peeridx_pend_add(p_idx[lp], false, node_id);
+    }
+    M_FREE(p_idx);
+
+    return true;
+}
+
+
+/** このtransactionでの変更を検索
+ *
+ * mMuxPeerIdxをlockして呼ぶこと。
+ *
+ * @param[in]   Idx     peer index
+ * @param[in]   bAdd    true:登録, false:解放
+ * @retval  true    Idxに対する変更あり
+ */
+static bool peeridx_pend_find(int Idx, bool bAdd)
+{
+    for (int lp = 0; lp < mPeerIdxPendNum; lp++) {
+        if ((mpPeerIdxPend[lp].idx == Idx) && (mpPeerIdxPend[lp].add == bAdd)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** このtransactionでの変更を追加
+ *
+ * @param[in]   Idx         peer index
+ * @param[in]   bAdd        true:登録, false:解放
+ * @param[in]   pNodeId     node_id
+ */
+static void peeridx_pend_add(int Idx, bool bAdd, const uint8_t *pNodeId)
+{
+    pthread_mutex_lock(&mMuxPeerIdx);
+    if (mPeerIdxPendNum >= mPeerIdxPendAlloc) {
+        mPeerIdxPendAlloc = (mPeerIdxPendAlloc == 0) ? 16 : mPeerIdxPendAlloc * 2;
+        mpPeerIdxPend = (peeridx_pend_t *)M_REALLOC(mpPeerIdxPend, sizeof(peeridx_pend_t) * mPeerIdxPendAlloc);
+    }
+    peeridx_pend_t *p_pend = &mpPeerIdxPend[mPeerIdxPendNum++];
+    p_pend->idx = (uint16_t)Idx;
+    p_pend->add = bAdd;
+    memcpy(p_pend->node_id, pNodeId, UCOIN_SZ_PUBKEY);
+    pthread_mutex_unlock(&mMuxPeerIdx);
+}
+
+
+/** 書込みtransaction終了時のpeer index反映
+ *
+ * commitできた場合だけ、transaction中の変更をメモリに反映する。
+ *
+ * @param[in]   bCommit     true:commit成功
+ */
+static void peeridx_txn_end(bool bCommit)
+{
+    pthread_mutex_lock(&mMuxPeerIdx);
+    if (bCommit && (mPeerIdxPendNum > 0)) {
+        bool evicted = false;
+        uint32_t now = (uint32_t)time(NULL);
+
+        //変更順に反映する(解放→再登録)
+        for (int lp = 0; lp < mPeerIdxPendNum; lp++) {
+            const peeridx_pend_t *p_pend = &mpPeerIdxPend[lp];
+            peeridx_t *p_peer = &mPeerIdx[p_pend->idx];
+            if (p_pend->add) {
+                memcpy(p_peer->node_id, p_pend->node_id, UCOIN_SZ_PUBKEY);
+                p_peer->used = true;
+                p_peer->last = now;
+                if (!evicted) {
+                    uint16_t *p_slot = peeridx_slot(p_pend->node_id);
+                    *p_slot = (uint16_t)(p_pend->idx + 1);
+                }
+            } else {
+                p_peer->used = false;
+                evicted = true;
+            }
+        }
+        if (evicted) {
+            peeridx_rehash();
+        }
+    }
+    mPeerIdxPendNum = 0;
+    pthread_mutex_unlock(&mMuxPeerIdx);
+}
 
 
 #if 0
@@ -3251,6 +4398,181 @@ LABEL_EXIT:
 }
 
 
+/** announcement cursorの位置付け
+ *
+ * 次のMDB_NEXT_NODUPで、pKeyより後ろのデータを取得するようにする。
+ * pKeyが削除されていた場合は、pKeyより後ろの最初のデータから取得する。
+ *
+ * @param[in,out]   pCur
+ * @param[in]       pKey        前回取得したkey
+ * @retval      true    成功
+ * @retval      false   pKeyより後ろにデータが無い
+ */
+static bool anno_cur_seek(lmdb_cursor_t *pCur, MDB_val *pKey)
+{
+    MDB_val key = *pKey;
+    MDB_val data;
+
+    int retval = mdb_cursor_get(pCur->cursor, &key, &data, MDB_SET_RANGE);
+    if (retval != 0) {
+        if (retval != MDB_NOTFOUND) {
+            DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+        }
+        return false;
+    }
+    if ((key.mv_size == pKey->mv_size) && (memcmp(key.mv_data, pKey->mv_data, key.mv_size) == 0)) {
+        //前回のkeyに位置付いた
+        return true;
+    }
+
+    //前回のkeyは削除済みのため、見つかったデータも取得できるよう1つ戻る
+    retval = mdb_cursor_get(pCur->cursor, &key, &data, MDB_PREV_NODUP);
+    if (retval == MDB_NOTFOUND) {
+        //先頭なので、未位置付けのcursorに戻す
+        mdb_cursor_close(pCur->cursor);
+        retval = mdb_cursor_open(pCur->txn, pCur->dbi, &pCur->cursor);
+    }
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+    }
+    return retval == 0;
+}
+
+
+/** short_channel_id昇順比較(qsort用)
+ *
+ */
+static int sci_cmp(const void *pA, const void *pB)
+{
+    uint64_t a = *(const uint64_t *)pA;
+    uint64_t b = *(const uint64_t *)pB;
+    return (a > b) - (a < b);
+}
+
+
+/** channel_announcement/channel_update削除(トランザクション内)
+ *
+ * @param[in]       txn
+ * @param[in]       Dbi             channel_announcement DB
+ * @param[in]       DbiInfo         channel_announcement送信元/先 DB
+ * @param[in]       ShortChannelId  削除するshort_channel_id
+ * @return      削除したレコード数(channel_announcement/channel_update)
+ */
+static int annocnlall_del_txn(MDB_txn *txn, MDB_dbi Dbi, MDB_dbi DbiInfo, uint64_t ShortChannelId)
+{
+    int         retval;
+    int         cnt = 0;
+    MDB_val     key;
+    uint8_t     keydata[M_SZ_ANNOINFO_CNL + 1];
+
+    M_ANNOINFO_CNL_SET(keydata, key, ShortChannelId, 0);
+
+    char POSTFIX[] = { LN_DB_CNLANNO_ANNO, LN_DB_CNLANNO_UPD1, LN_DB_CNLANNO_UPD2 };
+    for (size_t lp = 0; lp < ARRAY_SIZE(POSTFIX); lp++) {
+        keydata[LN_SZ_SHORT_CHANNEL_ID] = POSTFIX[lp];
+        retval = mdb_del(txn, Dbi, &key, NULL);
+        if (retval == 0) {
+            cnt++;
+        } else {
+            DBG_PRINTF("err[%c]: %s\n", POSTFIX[lp], mdb_strerror(retval));
+        }
+        retval = mdb_del(txn, DbiInfo, &key, NULL);
+        if (retval != 0) {
+            DBG_PRINTF("err[%c]: %s\n", POSTFIX[lp], mdb_strerror(retval));
+        }
+    }
+
+    return cnt;
+}
+
+
+/** gossip storeに反映が必要な変更をしたtransaction idを保存(トランザクション内)
+ *
+ * gossip storeのヘッダと比較するため、announcementを追加/削除するトランザクションでだけ保存する。
+ * (skip DBなど、announcement以外への書込みでは更新しない)
+ *
+ * @param[in]       txn
+ */
+static void gossip_txnid_put(MDB_txn *txn)
+{
+    int         retval;
+    MDB_dbi     dbi;
+    MDB_val     key, data;
+    uint64_t    txnid = (uint64_t)mdb_txn_id(txn);
+
+    retval = mdb_dbi_open(txn, M_DBI_GOSSIP, MDB_CREATE, &dbi);
+    if (retval == 0) {
+        key.mv_size = M_SZ_GOSSIP_TXNID;
+        key.mv_data = M_KEY_GOSSIP_TXNID;
+        data.mv_size = sizeof(txnid);
+        data.mv_data = &txnid;
+        retval = mdb_put(txn, dbi, &key, &data, 0);
+    }
+    if (retval != 0) {
+        DBG_PRINTF("ERR: %s\n", mdb_strerror(retval));
+    }
+}
+
+
+/** 最新のchannel_updateのtimestamp取得(トランザクション内)
+ *
+ * @param[in]       ShortChannelId  short_channel_id
+ * @param[in]       pParam          channel_announcement DB(ln_lmdb_db_t)
+ * @return      timestamp(0:channel_updateなし)
+ */
+static uint32_t prune_cnlupd_time(uint64_t ShortChannelId, void *pParam)
+{
+    ln_lmdb_db_t *p_db = (ln_lmdb_db_t *)pParam;
+    uint32_t    timestamp = 0;
+    MDB_val     key, data;
+    uint8_t     keydata[M_SZ_ANNOINFO_CNL + 1];
+
+    M_ANNOINFO_CNL_SET(keydata, key, ShortChannelId, LN_DB_CNLANNO_UPD1);
+    for (int lp = 0; lp < 2; lp++) {
+        keydata[LN_SZ_SHORT_CHANNEL_ID] = (lp == 0) ? LN_DB_CNLANNO_UPD1 : LN_DB_CNLANNO_UPD2;
+        if ( (mdb_get(p_db->txn, p_db->dbi, &key, &data) == 0) && (data.mv_size >= sizeof(uint32_t)) &&
+             (*(const uint32_t *)data.mv_data > timestamp) ) {
+            timestamp = *(const uint32_t *)data.mv_data;
+        }
+    }
+    return timestamp;
+}
+
+
+/** 自nodeのshort_channel_id収集(#ln_db_self_search()のコールバック)
+ *
+ * @param[in]       self            DBから取得したself
+ * @param[in]       p_db_param      未使用
+ * @param[in,out]   p_param         prune_self_t
+ * @retval  false   (最後まで走査する)
+ */
+static bool prune_self_func(ln_self_t *self, void *p_db_param, void *p_param)
+{
+    (void)p_db_param;
+    prune_self_t *p_self = (prune_self_t *)p_param;
+
+    uint64_t short_channel_id = ln_short_channel_id(self);
+    if (short_channel_id == 0) {
+        return false;
+    }
+    if (p_self->num == p_self->alloc) {
+        p_self->alloc = (p_self->alloc == 0) ? 16 : p_self->alloc * 2;
+        p_self->p_sci = (uint64_t *)M_REALLOC(p_self->p_sci, p_self->alloc * sizeof(uint64_t));
+    }
+    p_self->p_sci[p_self->num++] = short_channel_id;
+    return false;
+}
+
+
+/** node_id比較(qsort/bsearch用)
+ *
+ */
+static int nodeid_cmp(const void *pA, const void *pB)
+{
+    return memcmp(pA, pB, UCOIN_SZ_PUBKEY);
+}
+
+
 static bool preimg_open(ln_lmdb_db_t *p_db, MDB_txn *txn)
 {
     int retval;
@@ -0,0 +1,185 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_db_prune.c
+ *  @brief  #ln_db_anno_prune()で削除するchannelの選択
+ *
+ *  DBから集めたchannel情報から、削除するchannelを選んで数channelずつ取り出す。
+ *  DBへのアクセスは呼び出し元(ln_db_lmdb.c)が行う。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ln_local.h"
+
+#include "ln_db.h"
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static bool prune_is_stale(const ln_db_prune_cnl_t *pCnl, uint32_t Now, int32_t Height);
+static int sci_cmp(const void *pA, const void *pB);
+
+
+/**************************************************************************
+ * library functions
+ **************************************************************************/
+
+ln_db_prune_cnl_t HIDDEN *ln_db_prune_get(ln_db_prune_list_t *pList, uint64_t ShortChannelId)
+{
+    if ((pList->num > 0) && (pList->p_cnl[pList->num - 1].short_channel_id == ShortChannelId)) {
+        return &pList->p_cnl[pList->num - 1];
+    }
+    if (pList->num == pList->alloc) {
+        pList->alloc = (pList->alloc == 0) ? 1024 : pList->alloc * 2;
+        pList->p_cnl = (ln_db_prune_cnl_t *)M_REALLOC(pList->p_cnl, pList->alloc * sizeof(ln_db_prune_cnl_t));
+    }
+    ln_db_prune_cnl_t *p = &pList->p_cnl[pList->num++];
+    memset(p, 0, sizeof(ln_db_prune_cnl_t));
+    p->short_channel_id = ShortChannelId;
+    return p;
+}
+
+
+void HIDDEN ln_db_prune_select(ln_db_prune_list_t *pList, uint64_t *pSelfSci, int SelfNum,
+                bool (*pFunc)(uint64_t ShortChannelId, void *p_param), void *pParam)
+{
+    //自nodeのchannelは、channel_announcementが無くても(未announce)削除しない
+    //  自分のchannel_updateが更新されていなくても、相手との間では使用できるため
+    if (SelfNum > 1) {
+        qsort(pSelfSci, SelfNum, sizeof(uint64_t), sci_cmp);
+    }
+    for (int lp = 0; (lp < pList->num) && (SelfNum > 0); lp++) {
+        ln_db_prune_cnl_t *p = &pList->p_cnl[lp];
+        if (bsearch(&p->short_channel_id, pSelfSci, SelfNum, sizeof(uint64_t), sci_cmp) != NULL) {
+            p->own = true;
+        }
+    }
+
+    //DBのkey順はshort_channel_idの大小順ではないため、閉鎖判定の前に昇順に並べる
+    //  (short_channel_idが先頭メンバなのでsci_cmp()で比較できる)
+    if (pList->num > 1) {
+        qsort(pList->p_cnl, pList->num, sizeof(ln_db_prune_cnl_t), sci_cmp);
+    }
+
+    //閉鎖判定はDBのトランザクション外で行う(bitcoindへの問い合わせを含むため)
+    pList->pos = 0;
+    pList->del_num = 0;
+    for (int lp = 0; lp < pList->num; lp++) {
+        ln_db_prune_cnl_t *p = &pList->p_cnl[lp];
+        if (prune_is_stale(p, pList->now, pList->height)) {
+            pList->del_num++;
+        } else if (p->anno && (pFunc != NULL) && (*pFunc)(p->short_channel_id, pParam)) {
+            p->closed = true;
+            pList->del_num++;
+        }
+    }
+    DBG_PRINTF("channel: %d/%d\n", pList->del_num, pList->num);
+}
+
+
+int HIDDEN ln_db_prune_batch(ln_db_prune_list_t *pList, const ln_db_prune_cnl_t **ppDel, int Max,
+                uint32_t (*pTime)(uint64_t ShortChannelId, void *p_param), void *pParam)
+{
+    int num = 0;
+
+    for ( ; (pList->pos < pList->num) && (pList->del_num > 0) && (num < Max); pList->pos++) {
+        ln_db_prune_cnl_t *p = &pList->p_cnl[pList->pos];
+        if (!p->closed) {
+            if (!prune_is_stale(p, pList->now, pList->height)) {
+                continue;
+            }
+            //集めた後にchannel_updateを受信していれば残す
+            p->timestamp = (*pTime)(p->short_channel_id, pParam);
+            if (!prune_is_stale(p, pList->now, pList->height)) {
+                DBG_PRINTF("updated: %016" PRIx64 "\n", p->short_channel_id);
+                pList->del_num--;
+                continue;
+            }
+        }
+        ppDel[num++] = p;
+        pList->del_num--;
+    }
+    if (pList->pos >= pList->num) {
+        pList->del_num = 0;
+    }
+    return num;
+}
+
+
+void HIDDEN ln_db_prune_free(ln_db_prune_list_t *pList)
+{
+    if (pList->p_cnl != NULL) {
+        M_FREE(pList->p_cnl);
+    }
+    pList->num = 0;
+    pList->alloc = 0;
+    pList->pos = 0;
+    pList->del_num = 0;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** 古いchannelか
+ *
+ * 最新のchannel_updateがLN_DB_PRUNE_STALE_SEC以上前であれば古いとする。
+ * channel_updateが無い場合は、funding_txのblockからLN_DB_PRUNE_STALE_BLK以上経過していれば古いとする。
+ * 自nodeのchannelは古いとしない。
+ *
+ * @param[in]       pCnl            channel情報
+ * @param[in]       Now             現在時刻
+ * @param[in]       Height          現在のblock count(0:channel_updateが無いchannelは判定しない)
+ * @retval  true    古い
+ */
+static bool prune_is_stale(const ln_db_prune_cnl_t *pCnl, uint32_t Now, int32_t Height)
+{
+    if (pCnl->own) {
+        return false;
+    }
+    if (pCnl->timestamp != 0) {
+        return (pCnl->timestamp < Now) && (Now - pCnl->timestamp >= LN_DB_PRUNE_STALE_SEC);
+    }
+
+    uint32_t bheight;
+    uint32_t bindex;
+    uint32_t vindex;
+    ln_get_short_channel_id_param(&bheight, &bindex, &vindex, pCnl->short_channel_id);
+    return (Height > 0) && ((uint32_t)Height > bheight) && ((uint32_t)Height - bheight >= LN_DB_PRUNE_STALE_BLK);
+}
+
+
+/** short_channel_id比較(qsort/bsearch用)
+ *
+ */
+static int sci_cmp(const void *pA, const void *pB)
+{
+    uint64_t a = *(const uint64_t *)pA;
+    uint64_t b = *(const uint64_t *)pB;
+    return (a > b) - (a < b);
+}
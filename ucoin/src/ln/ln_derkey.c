@@ -85,7 +85,7 @@ bool HIDDEN ln_derkey_privkey(uint8_t *pPrivKey,
 {
     int ret;
     mbedtls_sha256_context ctx;
-    mbedtls_ecp_keypair keypair;
+    const mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
 
     //sha256(per-commitment-point || basepoint)
     mbedtls_sha256_init(&ctx);
@@ -99,15 +99,13 @@ bool HIDDEN ln_derkey_privkey(uint8_t *pPrivKey,
     mbedtls_mpi b;
     mbedtls_mpi_init(&a);
     mbedtls_mpi_init(&b);
-    mbedtls_ecp_keypair_init(&keypair);
     mbedtls_mpi_read_binary(&a, pPrivKey, UCOIN_SZ_PRIVKEY);
     mbedtls_mpi_read_binary(&b, pBaseSecret, UCOIN_SZ_PRIVKEY);
     ret = mbedtls_mpi_add_mpi(&a, &a, &b);
     if (ret) {
         goto LABEL_EXIT;
     }
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_mpi_mod_mpi(&a, &a, &keypair.grp.N);
+    ret = mbedtls_mpi_mod_mpi(&a, &a, &p_grp->N);
     if (ret) {
         goto LABEL_EXIT;
     }
@@ -127,7 +125,6 @@ bool HIDDEN ln_derkey_privkey(uint8_t *pPrivKey,
 #endif
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&b);
     mbedtls_mpi_free(&a);
 
@@ -145,7 +142,7 @@ bool HIDDEN ln_derkey_revocationkey(uint8_t *pRevPubKey,
     uint8_t base1[UCOIN_SZ_HASH256];
     uint8_t base2[UCOIN_SZ_HASH256];
     mbedtls_sha256_context ctx;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
 
     //sha256(revocation-basepoint || per-commitment-point)
     mbedtls_sha256_init(&ctx);
@@ -175,7 +172,6 @@ bool HIDDEN ln_derkey_revocationkey(uint8_t *pRevPubKey,
     mbedtls_ecp_point_init(&S1);
     mbedtls_ecp_point_init(&S2);
     mbedtls_ecp_point_init(&S);
-    mbedtls_ecp_keypair_init(&keypair);
 
     mbedtls_mpi_read_binary(&bp1, base1, sizeof(base1));
     ret = ucoin_util_ecp_point_read_binary2(&S1, pBasePoint);
@@ -187,12 +183,11 @@ bool HIDDEN ln_derkey_revocationkey(uint8_t *pRevPubKey,
     if (ret) {
         goto LABEL_EXIT;
     }
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_ecp_muladd(&keypair.grp, &S, &bp1, &S1, &bp2, &S2);
+    ret = mbedtls_ecp_muladd(p_grp, &S, &bp1, &S1, &bp2, &S2);
     if (ret) {
         goto LABEL_EXIT;
     }
-    ret = mbedtls_ecp_point_write_binary(&keypair.grp, &S, MBEDTLS_ECP_PF_COMPRESSED, &sz, pRevPubKey, UCOIN_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_write_binary(p_grp, &S, MBEDTLS_ECP_PF_COMPRESSED, &sz, pRevPubKey, UCOIN_SZ_PUBKEY);
 
 #ifdef M_DBG_PRINT
     DBG_PRINTF("SHA256(revocation_basepoint |x per_commitment_point)\n=> SHA256(");
@@ -205,7 +200,6 @@ bool HIDDEN ln_derkey_revocationkey(uint8_t *pRevPubKey,
 #endif
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_ecp_point_free(&S);
     mbedtls_mpi_free(&bp1);
     mbedtls_mpi_free(&bp2);
@@ -226,7 +220,7 @@ bool HIDDEN ln_derkey_revocationprivkey(uint8_t *pRevPrivKey,
     int ret;
     uint8_t base2[UCOIN_SZ_HASH256];
     mbedtls_sha256_context ctx;
-    mbedtls_ecp_keypair keypair;
+    const mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
 
     //sha256(revocation-basepoint || per-commitment-point)
     mbedtls_sha256_init(&ctx);
@@ -242,7 +236,6 @@ bool HIDDEN ln_derkey_revocationprivkey(uint8_t *pRevPrivKey,
     mbedtls_mpi_init(&a);
     mbedtls_mpi_init(&b);
     mbedtls_mpi_init(&c);
-    mbedtls_ecp_keypair_init(&keypair);
 
     mbedtls_mpi_read_binary(&a, pRevPrivKey, UCOIN_SZ_PRIVKEY);
     mbedtls_mpi_read_binary(&b, pBaseSecret, UCOIN_SZ_PRIVKEY);
@@ -269,8 +262,7 @@ bool HIDDEN ln_derkey_revocationprivkey(uint8_t *pRevPrivKey,
     if (ret) {
         goto LABEL_EXIT;
     }
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_mpi_mod_mpi(&a, &a, &keypair.grp.N);
+    ret = mbedtls_mpi_mod_mpi(&a, &a, &p_grp->N);
     if (ret) {
         goto LABEL_EXIT;
     }
@@ -292,7 +284,6 @@ bool HIDDEN ln_derkey_revocationprivkey(uint8_t *pRevPrivKey,
 #endif
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&c);
     mbedtls_mpi_free(&b);
     mbedtls_mpi_free(&a);
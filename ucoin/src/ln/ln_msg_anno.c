@@ -51,6 +51,8 @@
 #define DBG_PRINT_CREATE_SIG
 #define DBG_PRINT_READ_SIG
 
+#define M_SHORT_IDS_UNCOMPRESSED        (0)     ///< encoded_short_idsのencoding_type: 無圧縮
+
 
 /********************************************************************
  * typedefs
@@ -84,6 +86,8 @@ static const uint8_t M_ADDRLEN2[] = { 0, 6, 18, 12, 37 };    //port考慮
  **************************************************************************/
 
 static bool cnl_announce_ptr(cnl_announce_ptr_t *pPtr, const uint8_t *pData, uint16_t Len);
+static void short_ids_push(ucoin_push_t *pPush, const uint64_t *pShortIds, int Num);
+static bool short_ids_read(uint64_t **ppShortIds, int *pNum, const uint8_t *pData, uint16_t Len);
 
 #if defined(DBG_PRINT_CREATE_NOD) || defined(DBG_PRINT_READ_NOD)
 static void node_announce_print(const ln_node_announce_t *pMsg);
@@ -274,19 +278,19 @@ bool HIDDEN ln_msg_cnl_announce_verify(const uint8_t *pData, uint16_t Len)
     DUMPBIN(hash, UCOIN_SZ_HASH256);
 
     ret = ucoin_tx_verify_rs(ptr.p_node_signature1, hash, ptr.p_node_id1);
-    assert(ret);
 
     if (ret) {
         ret = ucoin_tx_verify_rs(ptr.p_node_signature2, hash, ptr.p_node_id2);
-        assert(ret);
     }
     if (ret) {
         ret = ucoin_tx_verify_rs(ptr.p_btc_signature1, hash, ptr.p_btc_key1);
-        assert(ret);
     }
     if (ret) {
         ret = ucoin_tx_verify_rs(ptr.p_btc_signature2, hash, ptr.p_btc_key2);
-        assert(ret);
+    }
+    if (!ret) {
+        //受信したものを検証するため、assertにはしない
+        DBG_PRINTF("fail: verify\n");
     }
 
     return ret;
@@ -323,6 +327,10 @@ static bool cnl_announce_ptr(cnl_announce_ptr_t *pPtr, const uint8_t *pData, uin
         DUMPBIN(pData + pos, len);
         pos += len;
     }
+    if (pos + LN_SZ_HASH + LN_SZ_SHORT_CHANNEL_ID + UCOIN_SZ_PUBKEY * 4 > Len) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
 
     //    [32:chain_hash]
     int cmp = memcmp(gGenesisChainHash, pData + pos, sizeof(gGenesisChainHash));
@@ -890,6 +898,17 @@ bool HIDDEN ln_msg_cnl_update_verify(const uint8_t *pPubkey, const uint8_t *pDat
 }
 
 
+bool HIDDEN ln_msg_cnl_update_verify_uncomp(const uint8_t *pUncomp, const uint8_t *pData, uint16_t Len)
+{
+    uint8_t hash[UCOIN_SZ_HASH256];
+
+    // channel_updateからsignatureを除いたサイズ
+    ucoin_util_hash256(hash, pData + sizeof(uint16_t) + LN_SZ_SIGNATURE,
+                                Len - (sizeof(uint16_t) + LN_SZ_SIGNATURE));
+    return ucoin_tx_verify_rs_uncomp(pData + sizeof(uint16_t), hash, pUncomp);
+}
+
+
 void HIDDEN ln_msg_cnl_update_print(const ln_cnl_update_t *pMsg)
 {
 #ifdef UCOIN_DEBUG
@@ -1026,6 +1045,410 @@ bool HIDDEN ln_msg_announce_signs_read(ln_announce_signs_t *pMsg, const uint8_t
 }
 
 
+/********************************************************************
+ * gossip queries
+ ********************************************************************/
+
+bool HIDDEN ln_msg_query_short_ids_create(ucoin_buf_t *pBuf, const ln_query_short_ids_t *pMsg)
+{
+    //    type: 261 (query_short_channel_ids)
+    //    data:
+    //        [32:chain_hash]
+    //        [2:len]
+    //        [len:encoded_short_ids]
+
+    ucoin_push_t    proto;
+
+    if ((pMsg->num < 0) || (pMsg->num > LN_GOSSIPQ_SHORT_IDS_MAX)) {
+        DBG_PRINTF("fail: invalid num: %d\n", pMsg->num);
+        return false;
+    }
+    uint16_t len = 1 + LN_SZ_SHORT_CHANNEL_ID * pMsg->num;
+    ucoin_push_init(&proto, pBuf, sizeof(uint16_t) + LN_SZ_HASH + sizeof(uint16_t) + len);
+
+    //    type: 261 (query_short_channel_ids)
+    ln_misc_push16be(&proto, MSGTYPE_QUERY_SHORT_CHANNEL_IDS);
+
+    //        [32:chain_hash]
+    ucoin_push_data(&proto, gGenesisChainHash, sizeof(gGenesisChainHash));
+
+    //        [2:len]
+    //        [len:encoded_short_ids]
+    ln_misc_push16be(&proto, len);
+    short_ids_push(&proto, pMsg->p_short_ids, pMsg->num);
+
+    assert(sizeof(uint16_t) + LN_SZ_HASH + sizeof(uint16_t) + len == pBuf->len);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_query_short_ids_read(ln_query_short_ids_t *pMsg, const uint8_t *pData, uint16_t Len)
+{
+    pMsg->p_short_ids = NULL;
+    pMsg->num = 0;
+
+    if (Len < sizeof(uint16_t) + LN_SZ_HASH + sizeof(uint16_t)) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+
+    uint16_t type = ln_misc_get16be(pData);
+    if (type != MSGTYPE_QUERY_SHORT_CHANNEL_IDS) {
+        DBG_PRINTF("fail: type not match: %04x\n", type);
+        return false;
+    }
+    int pos = sizeof(uint16_t);
+
+    //        [32:chain_hash]
+    if (memcmp(gGenesisChainHash, pData + pos, sizeof(gGenesisChainHash)) != 0) {
+        DBG_PRINTF("fail: chain_hash mismatch\n");
+        return false;
+    }
+    pos += sizeof(gGenesisChainHash);
+
+    //        [2:len]
+    uint16_t len = ln_misc_get16be(pData + pos);
+    pos += sizeof(uint16_t);
+
+    //        [len:encoded_short_ids]
+    //  BOLT#1: 後ろに追加されたデータは無視する
+    if (Len < pos + len) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+    return short_ids_read(&pMsg->p_short_ids, &pMsg->num, pData + pos, len);
+}
+
+
+bool HIDDEN ln_msg_reply_short_ids_end_create(ucoin_buf_t *pBuf, bool bComplete)
+{
+    //    type: 262 (reply_short_channel_ids_end)
+    //    data:
+    //        [32:chain_hash]
+    //        [1:complete]
+
+    ucoin_push_t    proto;
+
+    ucoin_push_init(&proto, pBuf, sizeof(uint16_t) + LN_SZ_HASH + 1);
+
+    //    type: 262 (reply_short_channel_ids_end)
+    ln_misc_push16be(&proto, MSGTYPE_REPLY_SHORT_CHANNEL_IDS_END);
+
+    //        [32:chain_hash]
+    ucoin_push_data(&proto, gGenesisChainHash, sizeof(gGenesisChainHash));
+
+    //        [1:complete]
+    ln_misc_push8(&proto, (bComplete) ? 1 : 0);
+
+    assert(sizeof(uint16_t) + LN_SZ_HASH + 1 == pBuf->len);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_reply_short_ids_end_read(bool *pComplete, const uint8_t *pData, uint16_t Len)
+{
+    if (Len < sizeof(uint16_t) + LN_SZ_HASH + 1) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+
+    uint16_t type = ln_misc_get16be(pData);
+    if (type != MSGTYPE_REPLY_SHORT_CHANNEL_IDS_END) {
+        DBG_PRINTF("fail: type not match: %04x\n", type);
+        return false;
+    }
+    int pos = sizeof(uint16_t);
+
+    //        [32:chain_hash]
+    if (memcmp(gGenesisChainHash, pData + pos, sizeof(gGenesisChainHash)) != 0) {
+        DBG_PRINTF("fail: chain_hash mismatch\n");
+        return false;
+    }
+    pos += sizeof(gGenesisChainHash);
+
+    //        [1:complete]
+    *pComplete = (pData[pos] != 0);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_query_channel_range_create(ucoin_buf_t *pBuf, const ln_query_channel_range_t *pMsg)
+{
+    //    type: 263 (query_channel_range)
+    //    data:
+    //        [32:chain_hash]
+    //        [4:first_blocknum]
+    //        [4:number_of_blocks]
+
+    ucoin_push_t    proto;
+
+    ucoin_push_init(&proto, pBuf, sizeof(uint16_t) + LN_SZ_HASH + 8);
+
+    //    type: 263 (query_channel_range)
+    ln_misc_push16be(&proto, MSGTYPE_QUERY_CHANNEL_RANGE);
+
+    //        [32:chain_hash]
+    ucoin_push_data(&proto, gGenesisChainHash, sizeof(gGenesisChainHash));
+
+    //        [4:first_blocknum]
+    ln_misc_push32be(&proto, pMsg->first_blocknum);
+
+    //        [4:number_of_blocks]
+    ln_misc_push32be(&proto, pMsg->number_of_blocks);
+
+    assert(sizeof(uint16_t) + LN_SZ_HASH + 8 == pBuf->len);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_query_channel_range_read(ln_query_channel_range_t *pMsg, const uint8_t *pData, uint16_t Len)
+{
+    if (Len < sizeof(uint16_t) + LN_SZ_HASH + 8) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+
+    uint16_t type = ln_misc_get16be(pData);
+    if (type != MSGTYPE_QUERY_CHANNEL_RANGE) {
+        DBG_PRINTF("fail: type not match: %04x\n", type);
+        return false;
+    }
+    int pos = sizeof(uint16_t);
+
+    //        [32:chain_hash]
+    if (memcmp(gGenesisChainHash, pData + pos, sizeof(gGenesisChainHash)) != 0) {
+        DBG_PRINTF("fail: chain_hash mismatch\n");
+        return false;
+    }
+    pos += sizeof(gGenesisChainHash);
+
+    //        [4:first_blocknum]
+    pMsg->first_blocknum = ln_misc_get32be(pData + pos);
+    pos += sizeof(uint32_t);
+
+    //        [4:number_of_blocks]
+    pMsg->number_of_blocks = ln_misc_get32be(pData + pos);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_reply_channel_range_create(ucoin_buf_t *pBuf, const ln_reply_channel_range_t *pMsg)
+{
+    //    type: 264 (reply_channel_range)
+    //    data:
+    //        [32:chain_hash]
+    //        [4:first_blocknum]
+    //        [4:number_of_blocks]
+    //        [1:complete]
+    //        [2:len]
+    //        [len:encoded_short_ids]
+
+    ucoin_push_t    proto;
+
+    if ((pMsg->num < 0) || (pMsg->num > LN_GOSSIPQ_SHORT_IDS_MAX)) {
+        DBG_PRINTF("fail: invalid num: %d\n", pMsg->num);
+        return false;
+    }
+    uint16_t len = 1 + LN_SZ_SHORT_CHANNEL_ID * pMsg->num;
+    ucoin_push_init(&proto, pBuf, sizeof(uint16_t) + LN_SZ_HASH + 9 + sizeof(uint16_t) + len);
+
+    //    type: 264 (reply_channel_range)
+    ln_misc_push16be(&proto, MSGTYPE_REPLY_CHANNEL_RANGE);
+
+    //        [32:chain_hash]
+    ucoin_push_data(&proto, gGenesisChainHash, sizeof(gGenesisChainHash));
+
+    //        [4:first_blocknum]
+    ln_misc_push32be(&proto, pMsg->first_blocknum);
+
+    //        [4:number_of_blocks]
+    ln_misc_push32be(&proto, pMsg->number_of_blocks);
+
+    //        [1:complete]
+    ln_misc_push8(&proto, pMsg->complete);
+
+    //        [2:len]
+    //        [len:encoded_short_ids]
+    ln_misc_push16be(&proto, len);
+    short_ids_push(&proto, pMsg->p_short_ids, pMsg->num);
+
+    assert(sizeof(uint16_t) + LN_SZ_HASH + 9 + sizeof(uint16_t) + len == pBuf->len);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_reply_channel_range_read(ln_reply_channel_range_t *pMsg, const uint8_t *pData, uint16_t Len)
+{
+    pMsg->p_short_ids = NULL;
+    pMsg->num = 0;
+
+    if (Len < sizeof(uint16_t) + LN_SZ_HASH + 9 + sizeof(uint16_t)) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+
+    uint16_t type = ln_misc_get16be(pData);
+    if (type != MSGTYPE_REPLY_CHANNEL_RANGE) {
+        DBG_PRINTF("fail: type not match: %04x\n", type);
+        return false;
+    }
+    int pos = sizeof(uint16_t);
+
+    //        [32:chain_hash]
+    if (memcmp(gGenesisChainHash, pData + pos, sizeof(gGenesisChainHash)) != 0) {
+        DBG_PRINTF("fail: chain_hash mismatch\n");
+        return false;
+    }
+    pos += sizeof(gGenesisChainHash);
+
+    //        [4:first_blocknum]
+    pMsg->first_blocknum = ln_misc_get32be(pData + pos);
+    pos += sizeof(uint32_t);
+
+    //        [4:number_of_blocks]
+    pMsg->number_of_blocks = ln_misc_get32be(pData + pos);
+    pos += sizeof(uint32_t);
+
+    //        [1:complete]
+    pMsg->complete = pData[pos];
+    pos++;
+
+    //        [2:len]
+    uint16_t len = ln_misc_get16be(pData + pos);
+    pos += sizeof(uint16_t);
+
+    //        [len:encoded_short_ids]
+    //  BOLT#1: 後ろに追加されたデータは無視する
+    if (Len < pos + len) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+    return short_ids_read(&pMsg->p_short_ids, &pMsg->num, pData + pos, len);
+}
+
+
+bool HIDDEN ln_msg_gossip_filter_create(ucoin_buf_t *pBuf, const ln_gossip_filter_t *pMsg)
+{
+    //    type: 265 (gossip_timestamp_filter)
+    //    data:
+    //        [32:chain_hash]
+    //        [4:first_timestamp]
+    //        [4:timestamp_range]
+
+    ucoin_push_t    proto;
+
+    ucoin_push_init(&proto, pBuf, sizeof(uint16_t) + LN_SZ_HASH + 8);
+
+    //    type: 265 (gossip_timestamp_filter)
+    ln_misc_push16be(&proto, MSGTYPE_GOSSIP_TIMESTAMP_FILTER);
+
+    //        [32:chain_hash]
+    ucoin_push_data(&proto, gGenesisChainHash, sizeof(gGenesisChainHash));
+
+    //        [4:first_timestamp]
+    ln_misc_push32be(&proto, pMsg->first_timestamp);
+
+    //        [4:timestamp_range]
+    ln_misc_push32be(&proto, pMsg->timestamp_range);
+
+    assert(sizeof(uint16_t) + LN_SZ_HASH + 8 == pBuf->len);
+
+    return true;
+}
+
+
+bool HIDDEN ln_msg_gossip_filter_read(ln_gossip_filter_t *pMsg, const uint8_t *pData, uint16_t Len)
+{
+    if (Len < sizeof(uint16_t) + LN_SZ_HASH + 8) {
+        DBG_PRINTF("fail: invalid length: %d\n", Len);
+        return false;
+    }
+
+    uint16_t type = ln_misc_get16be(pData);
+    if (type != MSGTYPE_GOSSIP_TIMESTAMP_FILTER) {
+        DBG_PRINTF("fail: type not match: %04x\n", type);
+        return false;
+    }
+    int pos = sizeof(uint16_t);
+
+    //        [32:chain_hash]
+    if (memcmp(gGenesisChainHash, pData + pos, sizeof(gGenesisChainHash)) != 0) {
+        DBG_PRINTF("fail: chain_hash mismatch\n");
+        return false;
+    }
+    pos += sizeof(gGenesisChainHash);
+
+    //        [4:first_timestamp]
+    pMsg->first_timestamp = ln_misc_get32be(pData + pos);
+    pos += sizeof(uint32_t);
+
+    //        [4:timestamp_range]
+    pMsg->timestamp_range = ln_misc_get32be(pData + pos);
+
+    return true;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** encoded_short_ids書込み(encoding_type=0:無圧縮)
+ *
+ */
+static void short_ids_push(ucoin_push_t *pPush, const uint64_t *pShortIds, int Num)
+{
+    ln_misc_push8(pPush, M_SHORT_IDS_UNCOMPRESSED);
+    for (int lp = 0; lp < Num; lp++) {
+        ln_misc_push64be(pPush, pShortIds[lp]);
+    }
+}
+
+
+/** encoded_short_ids読込み
+ *
+ * zlib圧縮(encoding_type=1)は未対応のため、失敗を返す。
+ *
+ * @param[out]      ppShortIds      short_channel_id配列(M_FREE()すること)
+ * @param[out]      pNum            ppShortIds数
+ * @param[in]       pData           encoded_short_ids
+ * @param[in]       Len             pData長
+ * @retval  true    成功
+ */
+static bool short_ids_read(uint64_t **ppShortIds, int *pNum, const uint8_t *pData, uint16_t Len)
+{
+    *ppShortIds = NULL;
+    *pNum = 0;
+    if (Len == 0) {
+        //short_channel_id無し
+        return true;
+    }
+    if (pData[0] != M_SHORT_IDS_UNCOMPRESSED) {
+        DBG_PRINTF("fail: not supported encoding_type: %02x\n", pData[0]);
+        return false;
+    }
+    if ((Len - 1) % LN_SZ_SHORT_CHANNEL_ID != 0) {
+        DBG_PRINTF("fail: invalid encoded_short_ids length: %d\n", Len);
+        return false;
+    }
+    int num = (Len - 1) / LN_SZ_SHORT_CHANNEL_ID;
+    if (num > 0) {
+        *ppShortIds = (uint64_t *)M_MALLOC(sizeof(uint64_t) * num);
+        for (int lp = 0; lp < num; lp++) {
+            (*ppShortIds)[lp] = ln_misc_get64be(pData + 1 + LN_SZ_SHORT_CHANNEL_ID * lp);
+        }
+    }
+    *pNum = num;
+    return true;
+}
+
+
 #if defined(DBG_PRINT_CREATE_SIG) || defined(DBG_PRINT_READ_SIG)
 static void announce_signs_print(const ln_announce_signs_t *pMsg)
 {
@@ -244,6 +244,16 @@ bool HIDDEN ln_node_recv_node_announcement(ln_self_t *self, const uint8_t *pData
     uint8_t node_id[UCOIN_SZ_PUBKEY];
     char node_alias[LN_SZ_ALIAS + 1];
 
+    if (ln_anno_verify_seen(pData, Len)) {
+        //他のpeerからも受信済み
+        return true;
+    }
+
+    //署名検証とDB保存はworker threadで行う
+    if (ln_anno_verify_nodeanno(pData, Len, ln_their_node_id(self))) {
+        return true;
+    }
+
     anno.p_node_id = node_id;
     anno.p_alias = node_alias;
     ret = ln_msg_node_announce_read(&anno, pData, Len);
@@ -260,6 +270,7 @@ bool HIDDEN ln_node_recv_node_announcement(ln_self_t *self, const uint8_t *pData
     buf_ann.len = Len;
     ret = ln_db_annonod_save(&buf_ann, &anno, ln_their_node_id(self));
     if (ret) {
+        ln_anno_verify_seen_add(pData, Len);
         (*self->p_callback)(self, LN_CB_NODE_ANNO_RECV, &anno);
     }
 
@@ -76,7 +76,7 @@ static const uint8_t AMMAG[] = { 'a', 'm', 'm', 'a', 'g' };
  * prototypes
  **************************************************************************/
 
-static void multi_scalar_mul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactors, int NumHops);
+static bool blind_session_key(uint8_t *pKey, const uint8_t *pBlindingFactor);
 static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor);
 static void compute_blinding_factor(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pSharedSecret);
 static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, int NumHops, const uint8_t *pSharedSecrets);
@@ -103,45 +103,45 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         return false;
     }
 
+    bool ret = false;
     int filler_len;
     uint8_t next_hmac[M_SZ_HMAC];
     uint8_t rho_key[M_SZ_KEYLEN];
     uint8_t mu_key[M_SZ_KEYLEN];
+    uint8_t eph_key[UCOIN_SZ_PRIVKEY];
+
+    //作業領域(LN_HOP_MAX分を固定で持つ)
+    uint8_t eph_pubkeys[UCOIN_SZ_PUBKEY * LN_HOP_MAX];
+    uint8_t shd_secrets[M_SZ_SHARED_SECRET * LN_HOP_MAX];
+    uint8_t blind_factors[M_SZ_BLINDING_FACT * LN_HOP_MAX];
+    uint8_t filler[M_SZ_HOP_DATA * (LN_HOP_MAX - 1)];
+    uint8_t mix_header[M_SZ_ROUTING_INFO];
+    uint8_t stream_bytes[M_SZ_STREAM_BYTES];
+
+    memset(mix_header, 0, sizeof(mix_header));
+
+    //eph_key: セッション鍵にblind_factors[0～lp-1]を掛けた秘密鍵
+    //  eph_pubkeys[lp] = eph_key * G
+    //  shd_secrets[lp] = SHA256(paymentPath[lp] * eph_key)
+    //となるので、hopごとの点の乗算は2回で済む。
+    memcpy(eph_key, pSessionKey, UCOIN_SZ_PRIVKEY);
+    for (int lp = 0; lp < NumHops; lp++) {
+        if (lp > 0) {
+            //eph_key * blind_factors[lp - 1] --> eph_key
+            if (!blind_session_key(eph_key, blind_factors + M_SZ_BLINDING_FACT * (lp - 1))) {
+                DBG_PRINTF("fail: blind session key\n");
+                goto LABEL_EXIT;
+            }
+        }
 
-    //メモリ確保
-    uint8_t *eph_pubkeys = (uint8_t *)M_MALLOC(UCOIN_SZ_PUBKEY * NumHops);
-    uint8_t *shd_secrets = (uint8_t *)M_MALLOC(M_SZ_SHARED_SECRET * NumHops);
-    uint8_t *blind_factors = (uint8_t *)M_MALLOC(M_SZ_BLINDING_FACT * NumHops);
-    uint8_t *filler = (uint8_t *)M_MALLOC(M_SZ_HOP_DATA * (LN_HOP_MAX - 1));
-    //メモリ確保(初期値0)
-    uint8_t *mix_header = (uint8_t *)M_CALLOC(1, M_SZ_ROUTING_INFO);
-    uint8_t *stream_bytes = (uint8_t *)M_CALLOC(1, M_SZ_STREAM_BYTES);
-
-    //[0]は最初に作る
-
-    //セッション鍵のpubkey --> eph_pubkeys[0]
-    ucoin_keys_priv2pub(eph_pubkeys, pSessionKey);
-
-    //セッション鍵とpaymentPathの先頭から作った共有鍵のSHA256 --> shd_secrets[0]
-    ucoin_util_generate_shared_secret(shd_secrets, pHopData[0].pubkey, pSessionKey);
-
-    //eph_pubkeys[0]とshd_secrets[0]から計算 --> blind_factors[0]
-    compute_blinding_factor(blind_factors, eph_pubkeys, shd_secrets);
-
-    for (int lp = 1; lp < NumHops; lp++) {
-        //eph_pubkeys[lp-1] * blind_factors[lp - 1] --> eph_pubkeys[lp]
-        blind_group_element(eph_pubkeys + UCOIN_SZ_PUBKEY * lp,
-                            eph_pubkeys + UCOIN_SZ_PUBKEY * (lp - 1),
-                            blind_factors + M_SZ_BLINDING_FACT * (lp - 1));
-
-        //paymentPath[lp] * セッション鍵 --> yToX(公開鍵)
-        //yToXにblind_factors[0～lp]までを掛けていった結果をSHA256 --> shd_secrets[lp]
-        uint8_t yToX[UCOIN_SZ_PUBKEY];
-        uint8_t buf[UCOIN_SZ_PUBKEY];
+        //eph_key * G --> eph_pubkeys[lp]
+        if (!ucoin_keys_priv2pub(eph_pubkeys + UCOIN_SZ_PUBKEY * lp, eph_key)) {
+            DBG_PRINTF("fail: ephemeral pubkey\n");
+            goto LABEL_EXIT;
+        }
 
-        blind_group_element(yToX, pHopData[lp].pubkey, pSessionKey);
-        multi_scalar_mul(buf, yToX, blind_factors, lp);
-        ucoin_util_sha256(shd_secrets + M_SZ_SHARED_SECRET * lp, buf, sizeof(buf));
+        //SHA256(paymentPath[lp] * eph_key) --> shd_secrets[lp]
+        ucoin_util_generate_shared_secret(shd_secrets + M_SZ_SHARED_SECRET * lp, pHopData[lp].pubkey, eph_key);
 
         //SHA256(eph_pubkeys[lp] || shd_secrets[lp]) --> blind_factors[lp]
         compute_blinding_factor(blind_factors + M_SZ_BLINDING_FACT * lp,
@@ -172,7 +172,7 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         generate_key(rho_key, RHO, sizeof(RHO), shd_secrets + M_SZ_SHARED_SECRET * lp);
         generate_key(mu_key, MU, sizeof(MU), shd_secrets + M_SZ_SHARED_SECRET * lp);
 
-        generate_cipher_stream(stream_bytes, rho_key, M_SZ_STREAM_BYTES);
+        generate_cipher_stream(stream_bytes, rho_key, sizeof(stream_bytes));
 
         right_shift(mix_header);
         //[ 0] realm
@@ -217,15 +217,12 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         ucoin_buf_alloccopy(pSecrets, shd_secrets, M_SZ_SHARED_SECRET * NumHops);
     }
 
-    //メモリ解放
-    M_FREE(stream_bytes);
-    M_FREE(mix_header);
-    M_FREE(filler);
-    M_FREE(blind_factors);
-    M_FREE(shd_secrets);
-    M_FREE(eph_pubkeys);
+    ret = true;
 
-    return true;
+LABEL_EXIT:
+    memset(eph_key, 0, sizeof(eph_key));        //clear for security
+
+    return ret;
 }
 
 
@@ -538,17 +535,44 @@ bool ln_onion_read_err(ln_onion_err_t *pOnionErr, const ucoin_buf_t *pReason)
  * private functions
  **************************************************************************/
 
-/** loop{ PubKey * BlindingFactor[lp] } --> pOutput
+/** Key * BlindingFactor mod n --> pKey
  *
- * @param[out]      pResult         UCOIN_SZ_PUBKEY
+ * @param[in,out]   pKey            UCOIN_SZ_PRIVKEY
+ * @param[in]       pBlindingFactor M_SZ_BLINDING_FACT
  */
-static void multi_scalar_mul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactors, int NumHops)
+static bool blind_session_key(uint8_t *pKey, const uint8_t *pBlindingFactor)
 {
-    memcpy(pResult, pPubKey, UCOIN_SZ_PUBKEY);
-    for (int lp = 0; lp < NumHops; lp++) {
-        //前の結果公開鍵 * pBlindingFactors[lp] --> 結果公開鍵
-        blind_group_element(pResult, pResult, pBlindingFactors + M_SZ_BLINDING_FACT * lp);
+    int ret;
+    mbedtls_mpi k;
+    mbedtls_mpi b;
+    const mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+
+    mbedtls_mpi_init(&k);
+    mbedtls_mpi_init(&b);
+    ret = mbedtls_mpi_read_binary(&k, pKey, UCOIN_SZ_PRIVKEY);
+    if (ret) {
+        goto LABEL_EXIT;
     }
+    ret = mbedtls_mpi_read_binary(&b, pBlindingFactor, M_SZ_BLINDING_FACT);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_mul_mpi(&k, &k, &b);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_mod_mpi(&k, &k, &p_grp->N);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_write_binary(&k, pKey, UCOIN_SZ_PRIVKEY);
+
+LABEL_EXIT:
+    mbedtls_mpi_lset(&k, 0);            //clear for security
+    mbedtls_mpi_free(&k);
+    mbedtls_mpi_free(&b);
+
+    return ret == 0;
 }
 
 
@@ -584,7 +608,7 @@ static void compute_blinding_factor(uint8_t *pResult, const uint8_t *pPubKey, co
  */
 static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, int NumHops, const uint8_t *pSharedSecrets)
 {
-    uint8_t *streamBytes = (uint8_t *)M_MALLOC(M_SZ_STREAM_BYTES);
+    uint8_t streamBytes[M_SZ_STREAM_BYTES];
     uint8_t streamKey[M_SZ_KEYLEN];
     int len = 0;
 
@@ -594,7 +618,7 @@ static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int
         generate_key(streamKey, pKeyStr, StrLen, pSharedSecrets + M_SZ_SHARED_SECRET * (lp - 1));
 
         //chacha20
-        generate_cipher_stream(streamBytes, streamKey, M_SZ_STREAM_BYTES);
+        generate_cipher_stream(streamBytes, streamKey, sizeof(streamBytes));
 
         //filler:      M_SZ_HOP_DATA * (NumHops - 1)
         //streamBytes: M_SZ_HOP_DATA * lp
@@ -602,8 +626,6 @@ static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int
         xor_bytes(pResult, pResult, streamBytes + sz, len);
     }
 
-    M_FREE(streamBytes);
-
     return len;
 }
 
@@ -30,31 +30,60 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <time.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ln_local.h"
 #include "ln_db.h"
 #include "ln_db_lmdb.h"
 #include "segwit_addr.h"
 
-#include <iostream>
-#include <fstream>
+#include <algorithm>
 #include <deque>
+#include <functional>
+#include <map>
+#include <queue>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
-#include <boost/config.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/dijkstra_shortest_paths.hpp>
-#include <boost/graph/graph_traits.hpp>
-#include <boost/property_map/property_map.hpp>
-
-
-using namespace boost;
 
 /**************************************************************************
  * macros
  **************************************************************************/
 
-#define M_CLTV_INIT                         ((uint16_t)0xffff)
+#define M_NODE_NONE                         ((uint32_t)0xffffffff)
+#define M_DIST_INF                          ((uint64_t)UINT64_MAX)
+
+#define M_POT_UNKNOWN                       ((uint64_t)UINT64_MAX - 1)  ///< A*ポテンシャル未計算
+
+#define M_LANDMARK_NUM                      (8)         ///< landmark数
+#define M_LANDMARK_DELAY                    (5)         ///< graph変更からlandmark再計算までの待ち時間[sec]
+#define M_LANDMARK_AMOUNT_NUM               (4)         ///< landmarkの距離を求める送金額の数
+#define M_POT_FROM_MAX                      (32)        ///< payerのedge数がこれ以下なら接続先から下限を求める
+#define M_LABEL_NONE                        ((uint32_t)0xffffffff)
+#define M_LABEL_MAX                         (16)        ///< 1nodeで保持するlabel数上限(#LN_ROUTING_WEIGHT_AMOUNT)
+
+#define M_CACHE_MAX                         (256)       ///< 経路cacheの最大数
+#define M_CACHE_LIFETIME                    (600)       ///< 経路cacheの有効時間[sec]
+
+#define M_SNAP_MAGIC                        "LNGRAPH"   ///< snapshotファイル識別子(終端含め8byte)
+#define M_SNAP_VERSION                      (2)         ///< snapshotファイル形式
+#define M_SNAP_STALE_SEC                    (90)        ///< DBより古いsnapshotを使う期限[sec](ucoindは30秒毎に更新する)
+#define M_SNAP_ALIGN(sz)                    (((sz) + 7) & ~(size_t)7)   ///< snapshotの各領域は8byte境界
+
+#define M_MC_HALFLIFE                       (3600)      ///< 失敗記録の成功確率が半分戻るまでの時間[sec]
+#define M_MC_FORGET                         (M_MC_HALFLIFE * 10)    ///< 失敗記録を破棄するまでの時間[sec]
+#define M_MC_PROB_MIN                       (0.01)      ///< 成功確率の下限
+#define M_MC_ATTEMPT_MSAT                   (100000)    ///< 送金試行1回に相当する重み[msat]
+#define M_MC_ATTEMPT_PPM                    (1000)      ///< 送金試行1回に相当する重み(送金額に対する割合)[ppm]
 
 
 /**************************************************************************
@@ -66,253 +95,2350 @@ extern "C" {
     bool ln_getparams_cnl_upd(ln_cnl_update_t *pUpd, const uint8_t *pData, uint16_t Len);
 }
 
-struct Node {
-    //std::string name;
-    const uint8_t*  p_node;
+
+/** @struct node_key_t
+ *  @brief  node_id(node番号検索用)
+ */
+struct node_key_t {
+    uint8_t     node_id[UCOIN_SZ_PUBKEY];
+
+    bool operator==(const node_key_t& Other) const {
+        return memcmp(node_id, Other.node_id, UCOIN_SZ_PUBKEY) == 0;
+    }
+};
+
+
+/** @struct node_hash_t
+ *  @brief  node_idのhash
+ *
+ * 先頭のprefix(0x02/0x03)を除いたX座標をそのまま使う。
+ */
+struct node_hash_t {
+    size_t operator()(const node_key_t& Key) const {
+        size_t h;
+        memcpy(&h, Key.node_id + 1, sizeof(h));
+        return h;
+    }
+};
+
+typedef std::unordered_map<node_key_t, uint32_t, node_hash_t> node_index_t;
+
+
+/** @struct edge_t
+ *  @brief  CSR形式のedge
+ */
+struct edge_t {
+    uint64_t    short_channel_id;
+    uint64_t    htlc_minimum_msat;
+    uint32_t    node_from;                  ///< 接続元node番号
+    uint32_t    node_to;                    ///< 接続先node番号
+    uint32_t    fee_base_msat;
+    uint32_t    fee_prop_millionths;
+    uint16_t    cltv_expiry_delta;
+};
+
+
+/** @struct chan_dir_t
+ *  @brief  channel_update 1方向分
+ */
+struct chan_dir_t {
+    bool        enable;                     ///< true:edgeとして有効
+    uint32_t    timestamp;                  ///< 反映済みchannel_updateのtimestamp
+    uint32_t    fee_base_msat;
+    uint32_t    fee_prop_millionths;
+    uint16_t    cltv_expiry_delta;
+    uint64_t    htlc_minimum_msat;
+    uint32_t    edge;                       ///< mEdges上の位置(mEdgeDirty時は無効)
+};
+
+
+/** @struct channel_t
+ *  @brief  graphに登録済みのchannel
+ */
+struct channel_t {
+    uint32_t    node[2];                    ///< [0]node_id_1, [1]node_id_2 のnode番号
+    chan_dir_t  dir[2];                     ///< [0]channel_updateのdir0, [1]dir1
+};
+
+typedef std::unordered_map<uint64_t, channel_t> channel_map_t;
+
+
+/** @struct mc_t
+ *  @brief  送金失敗の記録(mission control)
+ */
+struct mc_t {
+    time_t      fail_time;                  ///< 最後に失敗した時間(0:記録なし)
+    uint64_t    fail_amount;                ///< この金額以上の送金が失敗する
+};
+
+
+/** @struct mc_chan_t
+ *  @brief  channelの送金失敗の記録
+ */
+struct mc_chan_t {
+    mc_t        dir[2];                     ///< [0]dir0, [1]dir1
 };
 
-struct Fee {
-    //std::string name;
+typedef std::unordered_map<uint64_t, mc_chan_t> mc_chan_map_t;
+typedef std::unordered_map<node_key_t, mc_t, node_hash_t> mc_node_map_t;
+
+
+/** @struct tmp_edge_t
+ *  @brief  計算時だけ追加するedge(自channel, invoiceのr field)
+ */
+struct tmp_edge_t {
+    uint8_t     node_from[UCOIN_SZ_PUBKEY];
+    uint8_t     node_to[UCOIN_SZ_PUBKEY];
     uint64_t    short_channel_id;
     uint32_t    fee_base_msat;
     uint32_t    fee_prop_millionths;
     uint16_t    cltv_expiry_delta;
-    const uint8_t   *node_id;
 };
 
-typedef adjacency_list <
-                listS,
-                vecS,
-                bidirectionalS,
-                Node,
-                Fee
-        > graph_t;
-typedef graph_traits < graph_t >::vertex_descriptor vertex_descriptor;
-typedef graph_traits < graph_t >::vertex_iterator vertex_iterator;
-
-struct nodes_t {
-    uint64_t    short_channel_id;
-    struct {
-        uint8_t     node_id[UCOIN_SZ_PUBKEY];
-        uint16_t    cltv_expiry_delta;
-        uint64_t    htlc_minimum_msat;
-        uint32_t    fee_base_msat;
-        uint32_t    fee_prop_millionths;
-    } ninfo[2];         //[0]channel_updateのdir0, [1]channel_updateのdir1
-};
 
-struct nodes_result_t {
-    uint32_t    node_num;
-    nodes_t     *p_nodes;
-};
+struct param_self_t {
+    std::vector<tmp_edge_t>     *p_edges;
+    const uint8_t               *p_payer;
+};
+
+
+/** @struct overlay_t
+ *  @brief  計算時だけ追加するnodeとedge
+ *
+ * graphに無いnodeはmNodes.size()以降のnode番号を割り当て、計算が終わったら破棄する。
+ * graph(mNodes/mNodeIndex)には登録しない。
+ */
+struct overlay_t {
+    std::vector<node_key_t>     nodes;              ///< [node番号 - mNodes.size()]node_id
+    std::vector<edge_t>         edges;              ///< 計算時だけ追加するedge
+};
+
+
+/** @struct search_t
+ *  @brief  経路探索の作業領域
+ */
+struct search_t {
+    typedef std::pair<uint64_t, uint32_t> queue_t;     ///< first:weight, second:node番号(#LN_ROUTING_WEIGHT_AMOUNT時はlabel番号)
+
+    /** @struct label_t
+     *  @brief  payeeからnodeまでの部分経路(#LN_ROUTING_WEIGHT_AMOUNT)
+     *
+     * 手数料とcltv_expiry_deltaの上限は経路全体にかかるため、nodeごとに重み最小の1つだけ残すと
+     * 安いが上限を超える部分経路が、上限内に収まる部分経路を消してしまう。
+     * そのため、他のlabelに支配されない(weight, amount, cltv, hopのいずれかが小さい)labelをnodeごとに残す。
+     */
+    struct label_t {
+        uint64_t        weight;                     ///< 重み(mission controlの重みを含む)
+        uint64_t        amount;                     ///< nodeに届く金額
+        uint32_t        cltv;                       ///< nodeに届くcltv_expiry
+        uint8_t         hop;                        ///< 経由したchannel数
+        bool            dead;                       ///< true:他のlabelに支配された
+        uint32_t        node;                       ///< node番号
+        uint32_t        prev;                       ///< payee側のlabel番号(M_LABEL_NONE:payee)
+        uint32_t        next;                       ///< 同じnodeの次のlabel番号
+        const edge_t    *p_edge;                    ///< prevとのedge
+    };
+
+    std::vector<uint64_t>       weight;             ///< 重み(mission controlの重みを含む)
+    std::vector<uint8_t>        hop;                ///< 経由したchannel数
+    std::vector<uint32_t>       link;               ///< 経路上で隣のnode番号(探索元の方向)
+    std::vector<const edge_t *> link_edge;          ///< linkとのedge
+    std::vector<label_t>        label;              ///< 部分経路(#LN_ROUTING_WEIGHT_AMOUNT)
+    std::vector<uint32_t>       label_head;         ///< nodeの先頭label番号
+    std::vector<uint8_t>        label_num;          ///< nodeの有効label数
+    uint32_t                    label_goal;         ///< 探索終了nodeに到達したlabel番号
+    std::priority_queue<queue_t, std::vector<queue_t>, std::greater<queue_t> > que;
+    std::vector<uint8_t>        ban_node;           ///< 1:経由しないnode(k-shortest paths用)
+    std::vector<const edge_t *> ban_edge;           ///< 使用しないedge(k-shortest paths用。std::less順)
+    std::vector<uint64_t>       pot;                ///< A*ポテンシャル(#LN_ROUTING_ALGO_ALT)
+
+    const ln_routing_param_t    *p_param;
+    uint32_t                    payer;
+    uint32_t                    payee;
+    uint64_t                    amount_msat;        ///< 送金額
+    uint32_t                    cltv_expiry;        ///< payeeのcltv_expiry
+    time_t                      now;                ///< mission controlの経過時間計算用
+    uint32_t                    node_num;           ///< graphとoverlayのnode数
+    const overlay_t             *p_overlay;         ///< 計算時だけ追加するnodeとedge
+    const std::vector<edge_t>   *p_tmp_out;         ///< 計算時だけ追加するedge(node_from順)
+    const std::vector<edge_t>   *p_tmp_in;          ///< 計算時だけ追加するedge(node_to順)
+
+    bool                        alt;                ///< true:landmarkでA*
+    int                         pot_amount;         ///< 使用するlandmark距離(kLmAmount[]のindex)
+    uint32_t                    pot_end;            ///< 探索終了node番号(ポテンシャル0)
+    std::vector<uint32_t>       pot_goal;           ///< 探索終了node番号(payerの場合はpayerの接続先)
+    uint64_t                    pot_adjust;         ///< pot_goalからの下限から引く値(payerから出るedgeの手数料上限)
+    std::vector<uint32_t>       pot_tmp;            ///< 計算時だけ追加するedgeの端点(探索終了nodeと同じ扱い)
+};
+
+
+/** @struct path_t
+ *  @brief  経路候補
+ */
+struct path_t {
+    uint64_t                    cost;               ///< 重み(#LN_ROUTING_WEIGHT_AMOUNT時はpayerが送る金額 + mission controlの重み)
+    std::vector<const edge_t *> edges;              ///< payer側から並べたedge
+
+    bool operator<(const path_t& Other) const {
+        return cost < Other.cost;
+    }
+};
+
+
+typedef std::vector<edge_t> route_t;               ///< payer側から並べたedge(コピー)
+
+
+/** @struct cache_t
+ *  @brief  経路計算結果のcache
+ */
+struct cache_t {
+    time_t                      created;
+    uint8_t                     req_num;            ///< 計算時に要求した経路数
+    std::vector<route_t>        routes;
+    uint32_t                    node_num;           ///< 計算時のmNodes.size()(以降のnode番号はtmp_nodes)
+    std::vector<node_key_t>     tmp_nodes;          ///< 計算時のoverlayのnode
+};
+
+typedef std::map<std::string, cache_t> cache_map_t;
+
+
+/** @struct snap_hdr_t
+ *  @brief  graph snapshotファイルのheader
+ *
+ * headerに続いて、以下の順に8byte境界で並べる。
+ *      - node_key_t[node_num]
+ *      - uint32_t[node_num + 1]    edge_start
+ *      - edge_t[edge_num]
+ *      - uint32_t[node_num + 1]    in_start
+ *      - uint32_t[edge_num]        in_edges
+ */
+struct snap_hdr_t {
+    char        magic[8];                   ///< M_SNAP_MAGIC
+    uint32_t    version;                    ///< M_SNAP_VERSION
+    uint32_t    edge_size;                  ///< sizeof(edge_t)(ビルドの違い検出用)
+    uint64_t    created;                    ///< 作成時間
+    uint32_t    seq;                        ///< 作成時のmGraphSeq
+    uint32_t    node_num;
+    uint32_t    edge_num;
+    uint32_t    reserved;
+    uint64_t    db_txnid;                   ///< graphに反映済みのnode DB transaction id
+    uint64_t    updated;                    ///< db_txnid更新時間
+};
+
+
+/** @struct lm_graph_t
+ *  @brief  landmark計算用のgraphコピー
+ */
+struct lm_graph_t {
+    uint32_t                    node_num;
+    std::vector<uint32_t>       edge_start;
+    std::vector<edge_t>         edges;
+    std::vector<uint32_t>       in_start;
+    std::vector<uint32_t>       in_edges;
+};
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+//ucoindでは起動時に構築し、DB保存時に差分更新する
+static std::vector<node_key_t>  mNodes;             ///< [node番号]node_id
+static node_index_t             mNodeIndex;         ///< node_id --> node番号
+static channel_map_t            mChannels;          ///< short_channel_id --> channel
+static std::vector<uint32_t>    mEdgeStart;         ///< [node番号]mEdgesの開始位置(要素数:node数+1)
+static std::vector<edge_t>      mEdges;             ///< node_from順のedge
+static std::vector<uint32_t>    mInStart;           ///< [node番号]mInEdgesの開始位置(要素数:node数+1)
+static std::vector<uint32_t>    mInEdges;           ///< node_to順のmEdges位置
+static bool                     mEdgeDirty = true;  ///< true:mEdgeStart/mEdges/mInStart/mInEdges再作成が必要
+static bool                     mGraphLoaded = false;
+static bool                     mGraphSnap = false; ///< true:snapshotから構築(mChannelsが空)
+static uint32_t                 mGraphSeq = 0;      ///< graph変更で更新
+static uint32_t                 mSnapSeq = 0;       ///< snapshot保存時のmGraphSeq
+static uint64_t                 mSnapTxnid = 0;     ///< snapshot保存時のnode DB transaction id
+
+//graph固定(#ln_routing_freeze())
+//  固定後はgraphを更新しないので、経路計算をmRwGraphの共有lockで並列に行う。
+//  mGraphLoaded/mGraphFrozenはmMuxGraphをlockして更新する(mGraphFrozenはlock無しでも読めるようatomicに書く)。
+//  自channelのDB検索はmRwGraphの排他lockで行う。
+static bool                     mGraphFrozen = false;
+static pthread_rwlock_t         mRwGraph = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t          mMuxGraph = PTHREAD_MUTEX_INITIALIZER;
+
+//経路cache(mMuxGraphで保護)
+//  経路上のchannelがchannel_update/削除/skip DB追加されると破棄する
+static cache_map_t              mCache;             ///< key --> 経路
+static std::unordered_map<uint64_t, uint32_t> mCacheSci;    ///< cache中の経路が使っているshort_channel_idの参照数
+static uint64_t                 mCacheHit = 0;
+static uint64_t                 mCacheMiss = 0;
+
+//routing skip DBのコピー(mMuxGraphで保護)
+//  ln_db_annoskip_save()/ln_db_annoskip_drop()で更新する
+static std::unordered_map<uint64_t, bool> mSkip;    ///< short_channel_id --> true:一時的なskip
+static bool                     mSkipLoaded = false;
+
+//mission control(mMuxGraphで保護)
+//  送金失敗したchannel/nodeの記録。経過時間で成功確率を戻し、M_MC_FORGET経過で破棄する。
+static mc_chan_map_t            mMcChan;            ///< short_channel_id --> 失敗記録
+static mc_node_map_t            mMcNode;            ///< node_id --> 失敗記録
+
+//landmark(mMuxGraphで保護)
+//  kLmAmount[]を送金する場合の手数料を重みとした、各landmarkとの距離。
+//  手数料が下がる変更があるとmGraphVersionが進み、再計算するまで使わない。
+static uint32_t                 mGraphVersion = 0;  ///< 距離が短くなりうるgraph変更で更新
+static pthread_cond_t           mCondGraph = PTHREAD_COND_INITIALIZER;
+static std::vector<uint32_t>    mLandmarks;         ///< landmarkのnode番号
+static std::vector<uint64_t>    mLmFrom;            ///< [(送金額 * landmark数 + landmark) * mLmNodeNum + node番号]landmark --> node
+static std::vector<uint64_t>    mLmTo;              ///< [(送金額 * landmark数 + landmark) * mLmNodeNum + node番号]node --> landmark
+static uint32_t                 mLmNodeNum = 0;     ///< 計算時のnode数
+static uint32_t                 mLmVersion = 0;     ///< 計算時のmGraphVersion
+static pthread_t                mLmThread;
+
+//landmarkの距離を求める送金額
+//  各nodeに届く金額は送金額以上なので、送金額以下で一番大きいものの手数料は実際の手数料以下になる
+static const uint64_t           kLmAmount[M_LANDMARK_AMOUNT_NUM] = {
+    0, 100000, 10000000, 1000000000
+};
+static bool                     mLmThreadRun = false;
+static bool                     mLmTerm = false;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void cache_clear(void);
+static void cache_invalidate(uint64_t ShortChannelId);
+
+
+/********************************************************************
+ * functions
+ ********************************************************************/
+
+static uint64_t edgefee(uint64_t amtmsat, uint32_t fee_base_msat, uint32_t fee_prop_millionths)
+{
+    return (uint64_t)fee_base_msat + (uint64_t)((amtmsat * fee_prop_millionths) / 1000000);
+}
+
+
+/** channel_updateのdirection
+ *
+ * node_idの小さい方がnode_id_1(dir0)になる。
+ */
+static int mc_dir(const uint8_t *pNodeFrom, const uint8_t *pNodeTo)
+{
+    return (memcmp(pNodeFrom, pNodeTo, UCOIN_SZ_PUBKEY) < 0) ? 0 : 1;
+}
+
+
+/** node番号のnode_id
+ *
+ * mNodes.size()以降はoverlayのnode。
+ */
+static const node_key_t& node_key(uint32_t Node, const overlay_t *pOverlay)
+{
+    return (Node < mNodes.size()) ? mNodes[Node] : pOverlay->nodes[Node - mNodes.size()];
+}
+
+
+/** 失敗記録からの成功確率
+ *
+ * 失敗直後を0とし、M_MC_HALFLIFEごとに1との差が半分になる。
+ */
+static double mc_prob(const mc_t *pMc, time_t Now)
+{
+    if (pMc->fail_time == 0) {
+        return 1.0;
+    }
+    time_t elapsed = (Now > pMc->fail_time) ? Now - pMc->fail_time : 0;
+    return 1.0 - exp2(-(double)elapsed / M_MC_HALFLIFE);
+}
+
+
+/** mission controlによる重み
+ *
+ * 失敗記録のあるchannel/nodeを使う場合、成功確率が低いほど大きな重みを加算する。
+ * 重みは0以上なので、landmarkの下限はそのまま使える。
+ *
+ * @param[in]   pEdge
+ * @param[in]   AmountMsat      edgeで送る金額
+ * @param[in]   Now
+ * @param[in]   pOverlay        計算時だけ追加するnode
+ * @return  加算する重み[msat]
+ */
+static uint64_t mc_penalty(const edge_t *pEdge, uint64_t AmountMsat, time_t Now, const overlay_t *pOverlay)
+{
+    double prob = 1.0;
+
+    if (!mMcChan.empty()) {
+        mc_chan_map_t::const_iterator it = mMcChan.find(pEdge->short_channel_id);
+        if (it != mMcChan.end()) {
+            const mc_t *p_mc = &it->second.dir[mc_dir(node_key(pEdge->node_from, pOverlay).node_id, node_key(pEdge->node_to, pOverlay).node_id)];
+            if (AmountMsat >= p_mc->fail_amount) {
+                prob *= mc_prob(p_mc, Now);
+            }
+        }
+    }
+    if (!mMcNode.empty()) {
+        //失敗したnodeから転送するedge
+        mc_node_map_t::const_iterator it = mMcNode.find(node_key(pEdge->node_from, pOverlay));
+        if (it != mMcNode.end()) {
+            prob *= mc_prob(&it->second, Now);
+        }
+    }
+    if (prob >= 1.0) {
+        return 0;
+    }
+    if (prob < M_MC_PROB_MIN) {
+        prob = M_MC_PROB_MIN;
+    }
+
+    //送金試行1回分を成功確率で割ったものから、成功確率1の場合を引く
+    uint64_t attempt = M_MC_ATTEMPT_MSAT + (AmountMsat * M_MC_ATTEMPT_PPM) / 1000000;
+    return (uint64_t)((double)attempt * (1.0 / prob - 1.0));
+}
+
+
+/** 距離が短くなりうるgraph変更
+ *
+ * landmarkを無効にし、計算threadに通知する。
+ */
+static void graph_changed(void)
+{
+    mGraphVersion++;
+    pthread_cond_signal(&mCondGraph);
+}
+
+
+static uint32_t node_search(const uint8_t *pNodeId)
+{
+    node_key_t key;
+    memcpy(key.node_id, pNodeId, UCOIN_SZ_PUBKEY);
+    node_index_t::const_iterator it = mNodeIndex.find(key);
+    return (it != mNodeIndex.end()) ? it->second : M_NODE_NONE;
+}
+
+
+static uint32_t node_add(const uint8_t *pNodeId)
+{
+    node_key_t key;
+    memcpy(key.node_id, pNodeId, UCOIN_SZ_PUBKEY);
+    std::pair<node_index_t::iterator, bool> ret = mNodeIndex.insert(std::make_pair(key, (uint32_t)mNodes.size()));
+    if (ret.second) {
+        mNodes.push_back(key);
+        if (!mEdgeDirty) {
+            //edgeの無いnodeは、空の行を追加するだけでよい
+            mEdgeStart.push_back(mEdgeStart.back());
+            mInStart.push_back(mInStart.back());
+        }
+    }
+    return ret.first->second;
+}
+
+
+/** node番号検索(overlay含む)
+ *
+ */
+static uint32_t overlay_search(const overlay_t *pOverlay, const uint8_t *pNodeId)
+{
+    uint32_t node = node_search(pNodeId);
+    for (size_t lp = 0; (node == M_NODE_NONE) && (lp < pOverlay->nodes.size()); lp++) {
+        if (memcmp(pOverlay->nodes[lp].node_id, pNodeId, UCOIN_SZ_PUBKEY) == 0) {
+            node = (uint32_t)(mNodes.size() + lp);
+        }
+    }
+    return node;
+}
+
+
+/** graphに無いnodeをoverlayに追加
+ *
+ * @return  node番号(graphにあればgraphのnode番号)
+ */
+static uint32_t overlay_add(overlay_t *pOverlay, const uint8_t *pNodeId)
+{
+    uint32_t node = overlay_search(pOverlay, pNodeId);
+    if (node == M_NODE_NONE) {
+        node_key_t key;
+        memcpy(key.node_id, pNodeId, UCOIN_SZ_PUBKEY);
+        node = (uint32_t)(mNodes.size() + pOverlay->nodes.size());
+        pOverlay->nodes.push_back(key);
+    }
+    return node;
+}
+
+
+static void graph_clear(void)
+{
+    mNodes.clear();
+    mNodeIndex.clear();
+    mChannels.clear();
+    mEdgeStart.clear();
+    mEdges.clear();
+    mInStart.clear();
+    mInEdges.clear();
+    mEdgeDirty = true;
+    mGraphLoaded = false;
+    mGraphSnap = false;
+    mCache.clear();
+    mCacheSci.clear();
+    graph_changed();
+}
+
+
+/** mChannelsからCSR形式のedge作成
+ *
+ */
+static void graph_build_edges(void)
+{
+    size_t node_num = mNodes.size();
+
+    mEdgeStart.assign(node_num + 1, 0);
+    mInStart.assign(node_num + 1, 0);
+    for (channel_map_t::const_iterator it = mChannels.begin(); it != mChannels.end(); it++) {
+        for (int dir = 0; dir < 2; dir++) {
+            if (it->second.dir[dir].enable) {
+                mEdgeStart[it->second.node[dir] + 1]++;
+                mInStart[it->second.node[1 - dir] + 1]++;
+            }
+        }
+    }
+    for (size_t lp = 0; lp < node_num; lp++) {
+        mEdgeStart[lp + 1] += mEdgeStart[lp];
+        mInStart[lp + 1] += mInStart[lp];
+    }
+
+    std::vector<uint32_t> pos(mEdgeStart.begin(), mEdgeStart.end() - 1);
+    mEdges.resize(mEdgeStart[node_num]);
+    for (channel_map_t::iterator it = mChannels.begin(); it != mChannels.end(); it++) {
+        for (int dir = 0; dir < 2; dir++) {
+            chan_dir_t *p_dir = &it->second.dir[dir];
+            if (!p_dir->enable) {
+                continue;
+            }
+            uint32_t idx = pos[it->second.node[dir]]++;
+            edge_t *p_edge = &mEdges[idx];
+            p_edge->short_channel_id = it->first;
+            p_edge->htlc_minimum_msat = p_dir->htlc_minimum_msat;
+            p_edge->node_from = it->second.node[dir];
+            p_edge->node_to = it->second.node[1 - dir];
+            p_edge->fee_base_msat = p_dir->fee_base_msat;
+            p_edge->fee_prop_millionths = p_dir->fee_prop_millionths;
+            p_edge->cltv_expiry_delta = p_dir->cltv_expiry_delta;
+            p_dir->edge = idx;
+        }
+    }
+
+    //payeeから逆順に探索するための逆引き
+    std::vector<uint32_t> pos_in(mInStart.begin(), mInStart.end() - 1);
+    mInEdges.resize(mInStart[node_num]);
+    for (uint32_t lp = 0; lp < mEdges.size(); lp++) {
+        mInEdges[pos_in[mEdges[lp].node_to]++] = lp;
+    }
+    mEdgeDirty = false;
+}
+
+
+/** channel_announcementのgraph追加
+ *
+ * 登録済みの場合は何もしない。
+ */
+static channel_t *graph_add_channel(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2)
+{
+    channel_map_t::iterator it = mChannels.find(ShortChannelId);
+    if (it != mChannels.end()) {
+        return &it->second;
+    }
+
+    channel_t chan;
+    memset(&chan, 0, sizeof(chan));
+    chan.node[0] = node_add(pNodeId1);
+    chan.node[1] = node_add(pNodeId2);
+    mGraphSeq++;
+    return &(mChannels[ShortChannelId] = chan);
+}
+
+
+/** channel_updateのgraph反映
+ *
+ * 有効/無効が変わらない場合は、edgeを直接書き換える。
+ */
+static void graph_set_update(channel_t *pChan, const ln_cnl_update_t *pUpd)
+{
+    chan_dir_t *p_dir = &pChan->dir[ln_cnlupd_direction(pUpd)];
+
+    if (p_dir->timestamp > pUpd->timestamp) {
+        //反映済みの方が新しい
+        return;
+    }
+    p_dir->timestamp = pUpd->timestamp;
+    mGraphSeq++;
+
+    bool enable = ((pUpd->flags & LN_CNLUPD_FLAGS_DISABLE) == 0) && (pChan->node[0] != pChan->node[1]);
+    if (enable && (!p_dir->enable ||
+                (pUpd->fee_base_msat < p_dir->fee_base_msat) || (pUpd->fee_prop_millionths < p_dir->fee_prop_millionths))) {
+        graph_changed();
+    }
+    if (enable != p_dir->enable) {
+        p_dir->enable = enable;
+        mEdgeDirty = true;
+    }
+    p_dir->fee_base_msat = pUpd->fee_base_msat;
+    p_dir->fee_prop_millionths = pUpd->fee_prop_millionths;
+    p_dir->cltv_expiry_delta = pUpd->cltv_expiry_delta;
+    p_dir->htlc_minimum_msat = pUpd->htlc_minimum_msat;
+    if (enable && !mEdgeDirty) {
+        edge_t *p_edge = &mEdges[p_dir->edge];
+        p_edge->htlc_minimum_msat = p_dir->htlc_minimum_msat;
+        p_edge->fee_base_msat = p_dir->fee_base_msat;
+        p_edge->fee_prop_millionths = p_dir->fee_prop_millionths;
+        p_edge->cltv_expiry_delta = p_dir->cltv_expiry_delta;
+    }
+}
+
+
+static void graph_del_channel(uint64_t ShortChannelId)
+{
+    channel_map_t::iterator it = mChannels.find(ShortChannelId);
+    if (it == mChannels.end()) {
+        return;
+    }
+    if (it->second.dir[0].enable || it->second.dir[1].enable) {
+        mEdgeDirty = true;
+    }
+    mChannels.erase(it);
+    mGraphSeq++;
+}
+
+
+/** routing skip DBの読込み
+ *
+ * @note
+ *      - mMuxGraphをlockして呼び出すこと
+ */
+static void skip_load(void)
+{
+    uint64_t *p_sci;
+    bool *p_temp;
+
+    mSkip.clear();
+    int cnt = ln_db_annoskip_get(&p_sci, &p_temp);
+    for (int lp = 0; lp < cnt; lp++) {
+        mSkip[p_sci[lp]] = p_temp[lp];
+    }
+    free(p_sci);        //ln_lmdbでrealloc()している
+    free(p_temp);
+    mSkipLoaded = true;
+    DBG_PRINTF("routing skip: %d\n", cnt);
+}
+
+
+/** DBのchannel_announcement/channel_updateをgraphに反映
+ *
+ * @param[out]  pSci        NULL以外: 差分更新(DBにあったshort_channel_idを返す)
+ * @retval  true    成功
+ * @note
+ *      - mMuxGraphをlockして呼び出すこと
+ */
+static bool graph_read_db(std::vector<uint64_t> *pSci)
+{
+    bool ret;
+    void *p_db_anno;
+    void *p_cur;
+
+    ret = ln_db_node_cur_transaction(&p_db_anno, LN_DB_TXN_CNL, NULL);
+    if (!ret) {
+        DBG_PRINTF("fail\n");
+        return false;
+    }
+    ret = ln_db_annocnl_cur_open(&p_cur, p_db_anno);
+    if (ret) {
+        uint64_t short_channel_id;
+        char type;
+        ucoin_buf_t buf_cnl = UCOIN_BUF_INIT;
+        channel_t *p_chan = NULL;
+        uint64_t chan_sci = 0;
+
+        while (ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl)) {
+            switch (type) {
+            case LN_DB_CNLANNO_ANNO:
+                {
+                    uint8_t node_id1[UCOIN_SZ_PUBKEY];
+                    uint8_t node_id2[UCOIN_SZ_PUBKEY];
+
+                    p_chan = NULL;
+                    if (ln_getids_cnl_anno(&chan_sci, node_id1, node_id2, buf_cnl.buf, buf_cnl.len)) {
+                        p_chan = graph_add_channel(chan_sci, node_id1, node_id2);
+                        if (pSci != NULL) {
+                            pSci->push_back(chan_sci);
+                        }
+                    }
+                }
+                break;
+            case LN_DB_CNLANNO_UPD1:
+            case LN_DB_CNLANNO_UPD2:
+                if (p_chan != NULL) {
+                    ln_cnl_update_t upd;
+                    bool bret = ln_getparams_cnl_upd(&upd, buf_cnl.buf, buf_cnl.len);
+                    if (bret && (chan_sci == upd.short_channel_id)) {
+                        //channel_announcement.short_channel_idと一致
+                        if (pSci == NULL) {
+                            graph_set_update(p_chan, &upd);
+                        } else if (p_chan->dir[ln_cnlupd_direction(&upd)].timestamp < upd.timestamp) {
+                            //反映済みより新しいものだけ
+                            graph_set_update(p_chan, &upd);
+                            cache_invalidate(chan_sci);
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+            ucoin_buf_free(&buf_cnl);
+        }
+        ln_db_annocnl_cur_close(p_cur);
+    }
+
+    ln_db_node_cur_commit(p_db_anno);
+    return ret;
+}
+
+
+/** DBからgraph構築
+ *
+ * @note
+ *      - mMuxGraphをlockして呼び出すこと
+ */
+static bool graph_load(void)
+{
+    graph_clear();
+    if (!graph_read_db(NULL)) {
+        return false;
+    }
+
+    graph_build_edges();
+    skip_load();
+    mGraphLoaded = true;
+    mGraphSeq++;
+    DBG_PRINTF("routing graph: node=%d, channel=%d, edge=%d\n", (int)mNodes.size(), (int)mChannels.size(), (int)mEdges.size());
+
+    return true;
+}
+
+
+/** DBとの差分をgraphに反映
+ *
+ * 新しいchannel_updateだけを反映し、DBから削除されたchannelはgraphから削除する。
+ * 変更の無いchannelを使う経路cacheやlandmarkは、そのまま使い続ける。
+ *
+ * @note
+ *      - mMuxGraphをlockして呼び出すこと
+ *      - DBから構築したgraphであること(snapshotから構築した場合はchannel情報が無い)
+ */
+static bool graph_refresh(void)
+{
+    std::vector<uint64_t> sci;
+    if (!graph_read_db(&sci)) {
+        return false;
+    }
+
+    std::sort(sci.begin(), sci.end());
+    std::vector<uint64_t> del;
+    for (channel_map_t::const_iterator it = mChannels.begin(); it != mChannels.end(); it++) {
+        if (!std::binary_search(sci.begin(), sci.end(), it->first)) {
+            del.push_back(it->first);
+        }
+    }
+    for (size_t lp = 0; lp < del.size(); lp++) {
+        graph_del_channel(del[lp]);
+        cache_invalidate(del[lp]);
+    }
+
+    std::unordered_map<uint64_t, bool> skip(mSkip);
+    skip_load();
+    if (skip != mSkip) {
+        cache_clear();
+    }
+    if (mEdgeDirty) {
+        graph_build_edges();
+    }
+    DBG_PRINTF("routing graph refresh: node=%d, channel=%d, edge=%d, del=%d\n",
+                (int)mNodes.size(), (int)mChannels.size(), (int)mEdges.size(), (int)del.size());
+
+    return true;
+}
+
+
+//開設済みで生きている送金元channelは、announcementの有無にかかわらず検索候補に追加する
+static bool comp_func_self(ln_self_t *self, void *p_db_param, void *p_param)
+{
+    (void)p_db_param;
+
+    param_self_t *p_prm_self = (param_self_t *)p_param;
+
+    if ((self->short_channel_id != 0) && ((self->fund_flag & LN_FUNDFLAG_CLOSE) == 0)) {
+        //チャネルは開設している && close処理をしていない
+        //  skip DBに載っているchannelは探索時に除外する
+
+        if (memcmp(self->peer_node_id, p_prm_self->p_payer, UCOIN_SZ_PUBKEY) == 0) {
+            return false;
+        }
+
+        //両方向とも手数料なしで追加
+        tmp_edge_t edge;
+        memset(&edge, 0, sizeof(edge));
+        edge.short_channel_id = self->short_channel_id;
+        memcpy(edge.node_from, p_prm_self->p_payer, UCOIN_SZ_PUBKEY);
+        memcpy(edge.node_to, self->peer_node_id, UCOIN_SZ_PUBKEY);
+        p_prm_self->p_edges->push_back(edge);
+        memcpy(edge.node_from, self->peer_node_id, UCOIN_SZ_PUBKEY);
+        memcpy(edge.node_to, p_prm_self->p_payer, UCOIN_SZ_PUBKEY);
+        p_prm_self->p_edges->push_back(edge);
+    }
+
+    return false;   //false=検索継続
+}
+
+
+static bool edge_from_less(const edge_t& Edge1, const edge_t& Edge2)
+{
+    return Edge1.node_from < Edge2.node_from;
+}
+
+
+static bool edge_to_less(const edge_t& Edge1, const edge_t& Edge2)
+{
+    return Edge1.node_to < Edge2.node_to;
+}
+
+
+static bool search_skip_sci(uint64_t ShortChannelId)
+{
+    //skip DBに載っているchannelは使用しない
+    return mSkip.find(ShortChannelId) != mSkip.end();
+}
+
+
+static bool search_skip(const search_t *pSearch, const edge_t *pEdge)
+{
+    if (!pSearch->ban_edge.empty() &&
+                std::binary_search(pSearch->ban_edge.begin(), pSearch->ban_edge.end(), pEdge, std::less<const edge_t *>())) {
+        return true;
+    }
+    return search_skip_sci(pEdge->short_channel_id);
+}
+
+
+/** landmarkを使ったnode間距離(手数料合計)の下限
+ *
+ * 三角不等式から d(From,To) >= d(L,To) - d(L,From), d(From,To) >= d(From,L) - d(To,L)。
+ *
+ * @param[in]   Amount      kLmAmount[]のindex
+ * @return  下限(M_DIST_INF:到達できない)
+ */
+static uint64_t landmark_lb(int Amount, uint32_t From, uint32_t To)
+{
+    if ((From >= mLmNodeNum) || (To >= mLmNodeNum)) {
+        //landmark計算後に追加されたnode
+        return 0;
+    }
+
+    uint64_t lb = 0;
+    for (size_t lp = 0; lp < mLandmarks.size(); lp++) {
+        size_t offset = (Amount * mLandmarks.size() + lp) * mLmNodeNum;
+        const uint64_t *p_from = &mLmFrom[offset];
+        const uint64_t *p_to = &mLmTo[offset];
+
+        if (p_from[From] != M_DIST_INF) {
+            if (p_from[To] == M_DIST_INF) {
+                //L-->Fromがあるのに、L-->Toが無い
+                return M_DIST_INF;
+            }
+            if (p_from[To] > p_from[From] + lb) {
+                lb = p_from[To] - p_from[From];
+            }
+        }
+        if (p_to[To] != M_DIST_INF) {
+            if (p_to[From] == M_DIST_INF) {
+                //To-->Lがあるのに、From-->Lが無い
+                return M_DIST_INF;
+            }
+            if (p_to[From] > p_to[To] + lb) {
+                lb = p_to[From] - p_to[To];
+            }
+        }
+    }
+    return lb;
+}
+
+
+/** A*ポテンシャル
+ *
+ * 探索終了nodeまでの重みの下限をlandmarkの距離から求める。
+ * 計算時だけ追加するedgeはgraphに含まれないため、その端点も探索終了nodeとみなして最小値をとる。
+ *
+ * @return  ポテンシャル(M_DIST_INF:探索終了nodeに到達できない)
+ */
+static uint64_t search_pot(search_t *pSearch, uint32_t Node)
+{
+    if (!pSearch->alt) {
+        return 0;
+    }
+    uint64_t& pot = pSearch->pot[Node];
+    if (pot != M_POT_UNKNOWN) {
+        return pot;
+    }
+    if (Node == pSearch->pot_end) {
+        pot = 0;
+        return pot;
+    }
+
+    bool backward = (pSearch->p_param->weight == LN_ROUTING_WEIGHT_AMOUNT);
+    pot = M_DIST_INF;
+    for (size_t lp = 0; lp < pSearch->pot_goal.size(); lp++) {
+        //payeeから探索: 探索終了node --> Node
+        //payerから探索: Node --> 探索終了node
+        uint64_t lb = (backward) ? landmark_lb(pSearch->pot_amount, pSearch->pot_goal[lp], Node) :
+                                   landmark_lb(pSearch->pot_amount, Node, pSearch->pot_goal[lp]);
+        if (lb != M_DIST_INF) {
+            lb = (lb > pSearch->pot_adjust) ? lb - pSearch->pot_adjust : 0;
+        }
+        pot = std::min(pot, lb);
+    }
+    for (size_t lp = 0; lp < pSearch->pot_tmp.size(); lp++) {
+        uint64_t lb = (backward) ? landmark_lb(pSearch->pot_amount, pSearch->pot_tmp[lp], Node) :
+                                   landmark_lb(pSearch->pot_amount, Node, pSearch->pot_tmp[lp]);
+        pot = std::min(pot, lb);
+    }
+    return pot;
+}
+
+
+/** fee_base_msatで重み付け(payerから探索)
+ *
+ */
+static void search_relax_basefee(search_t *pSearch, const edge_t *pEdge)
+{
+    if (search_skip(pSearch, pEdge)) {
+        return;
+    }
+
+    uint32_t from = pEdge->node_from;
+    uint32_t to = pEdge->node_to;
+    uint64_t weight = pSearch->weight[from] + pEdge->fee_base_msat +
+                        mc_penalty(pEdge, pSearch->amount_msat, pSearch->now, pSearch->p_overlay);
+    if ((weight < pSearch->weight[to]) && !pSearch->ban_node[to]) {
+        uint64_t pot = search_pot(pSearch, to);
+        if (pot == M_DIST_INF) {
+            return;
+        }
+        pSearch->weight[to] = weight;
+        pSearch->hop[to] = pSearch->hop[from] + 1;
+        pSearch->link[to] = from;
+        pSearch->link_edge[to] = pEdge;
+        pSearch->que.push(search_t::queue_t(weight + pot, to));
+    }
+}
+
+
+/** 送金額に対する手数料で重み付け(payeeから探索)
+ *
+ * 各nodeに届く金額を手数料込みで求め、送金できないedgeや条件を超える経路は打ち切る。
+ * payerから出るedgeは自分の手数料になるため加算しない。
+ * 追加するlabelが既存labelに支配される場合は追加せず、追加するlabelが支配する既存labelは無効にする。
+ *
+ * @param[in,out]   pSearch
+ * @param[in]       Label       edgeのnode_to側label番号
+ * @param[in]       pEdge
+ */
+static void search_relax_amount(search_t *pSearch, uint32_t Label, const edge_t *pEdge)
+{
+    const search_t::label_t cur = pSearch->label[Label];
+    uint32_t from = pEdge->node_from;
+    const ln_routing_param_t *p_param = pSearch->p_param;
+
+    if (cur.amount < pEdge->htlc_minimum_msat) {
+        //htlc_minimum_msat未満は送金できない
+        return;
+    }
+    uint8_t hop = cur.hop + 1;
+    if (hop > p_param->max_hop) {
+        return;
+    }
+
+    uint64_t amount = cur.amount;
+    uint32_t cltv = cur.cltv;
+    if (from != pSearch->payer) {
+        amount += edgefee(amount, pEdge->fee_base_msat, pEdge->fee_prop_millionths);
+        cltv += pEdge->cltv_expiry_delta;
+    }
+    if ((p_param->max_fee_msat != 0) && (amount - pSearch->amount_msat > p_param->max_fee_msat)) {
+        return;
+    }
+    if ((p_param->max_cltv_delta != 0) && (cltv - pSearch->cltv_expiry > p_param->max_cltv_delta)) {
+        return;
+    }
+    uint64_t weight = cur.weight + (amount - cur.amount) +
+                        mc_penalty(pEdge, cur.amount, pSearch->now, pSearch->p_overlay);
+    if (pSearch->ban_node[from]) {
+        return;
+    }
+    for (uint32_t lp = pSearch->label_head[from]; lp != M_LABEL_NONE; lp = pSearch->label[lp].next) {
+        const search_t::label_t& other = pSearch->label[lp];
+        if (!other.dead && (other.weight <= weight) && (other.amount <= amount) &&
+                    (other.cltv <= cltv) && (other.hop <= hop)) {
+            //既存labelの方が良い
+            return;
+        }
+    }
+    if (search_skip(pSearch, pEdge)) {
+        return;
+    }
+    uint64_t pot = search_pot(pSearch, from);
+    if (pot == M_DIST_INF) {
+        return;
+    }
+    for (uint32_t lp = pSearch->label_head[from]; lp != M_LABEL_NONE; lp = pSearch->label[lp].next) {
+        search_t::label_t& other = pSearch->label[lp];
+        if (!other.dead && (weight <= other.weight) && (amount <= other.amount) &&
+                    (cltv <= other.cltv) && (hop <= other.hop)) {
+            other.dead = true;
+            pSearch->label_num[from]--;
+        }
+    }
+    if (pSearch->label_num[from] >= M_LABEL_MAX) {
+        //組合せが多すぎる場合は、重みが一番大きいlabelと入れ替える
+        //  重みの小さい順に取り出すので、入れ替えるlabelはまだ取り出されていない
+        uint32_t worst = M_LABEL_NONE;
+        for (uint32_t lp = pSearch->label_head[from]; lp != M_LABEL_NONE; lp = pSearch->label[lp].next) {
+            const search_t::label_t& other = pSearch->label[lp];
+            if (!other.dead && ((worst == M_LABEL_NONE) || (other.weight > pSearch->label[worst].weight))) {
+                worst = lp;
+            }
+        }
+        if ((worst == M_LABEL_NONE) || (pSearch->label[worst].weight <= weight)) {
+            return;
+        }
+        pSearch->label[worst].dead = true;
+        pSearch->label_num[from]--;
+    }
+
+    search_t::label_t label;
+    label.weight = weight;
+    label.amount = amount;
+    label.cltv = cltv;
+    label.hop = hop;
+    label.dead = false;
+    label.node = from;
+    label.prev = Label;
+    label.next = pSearch->label_head[from];
+    label.p_edge = pEdge;
+    uint32_t idx = (uint32_t)pSearch->label.size();
+    pSearch->label.push_back(label);
+    pSearch->label_head[from] = idx;
+    pSearch->label_num[from]++;
+    pSearch->que.push(search_t::queue_t(weight + pot, idx));
+}
+
+
+/** 送金額に対する手数料で重み付けした経路探索(payeeから探索)
+ *
+ * 探索終了nodeのlabelが最初に取り出された時点で、条件を満たす重み最小の経路が決まる。
+ *
+ * @param[in,out]   pSearch
+ * @param[in]       Start       探索開始node番号(payee)
+ * @param[in]       Goal        探索終了node番号
+ * @retval  true    経路あり(pSearch->label_goal)
+ */
+static bool search_run_amount(search_t *pSearch, uint32_t Start, uint32_t Goal)
+{
+    uint64_t pot = search_pot(pSearch, Start);
+    if (pot == M_DIST_INF) {
+        return false;
+    }
+
+    search_t::label_t label;
+    label.weight = pSearch->amount_msat;
+    label.amount = pSearch->amount_msat;
+    label.cltv = pSearch->cltv_expiry;
+    label.hop = 0;
+    label.dead = false;
+    label.node = Start;
+    label.prev = M_LABEL_NONE;
+    label.next = M_LABEL_NONE;
+    label.p_edge = NULL;
+    pSearch->label.push_back(label);
+    pSearch->label_head[Start] = 0;
+    pSearch->label_num[Start] = 1;
+    pSearch->que.push(search_t::queue_t(label.weight + pot, 0));
+    while (!pSearch->que.empty()) {
+        uint32_t idx = pSearch->que.top().second;
+        pSearch->que.pop();
+
+        if (pSearch->label[idx].dead) {
+            //他のlabelに支配された
+            continue;
+        }
+        uint32_t now = pSearch->label[idx].node;
+        if (now == Goal) {
+            pSearch->label_goal = idx;
+            return true;
+        }
+
+        if (now < mNodes.size()) {
+            //overlayのnodeはgraphのedgeを持たない
+            for (uint32_t lp = mInStart[now]; lp < mInStart[now + 1]; lp++) {
+                search_relax_amount(pSearch, idx, &mEdges[mInEdges[lp]]);
+            }
+        }
+        edge_t key;
+        key.node_to = now;
+        std::pair<std::vector<edge_t>::const_iterator, std::vector<edge_t>::const_iterator> range =
+                std::equal_range(pSearch->p_tmp_in->begin(), pSearch->p_tmp_in->end(), key, edge_to_less);
+        for (std::vector<edge_t>::const_iterator it = range.first; it != range.second; it++) {
+            search_relax_amount(pSearch, idx, &*it);
+        }
+    }
+    return false;
+}
+
+
+/** fee_base_msatで重み付けした経路探索(payerから探索)
+ *
+ * @param[in,out]   pSearch
+ * @param[in]       Start       探索開始node番号
+ * @param[in]       Goal        探索終了node番号
+ * @retval  true    経路あり
+ */
+static bool search_run(search_t *pSearch, uint32_t Start, uint32_t Goal)
+{
+    pSearch->weight[Start] = 0;
+    pSearch->hop[Start] = 0;
+    uint64_t pot = search_pot(pSearch, Start);
+    if (pot == M_DIST_INF) {
+        return false;
+    }
+    pSearch->que.push(search_t::queue_t(pSearch->weight[Start] + pot, Start));
+    while (!pSearch->que.empty()) {
+        search_t::queue_t top = pSearch->que.top();
+        pSearch->que.pop();
+
+        uint32_t now = top.second;
+        if (top.first > pSearch->weight[now] + search_pot(pSearch, now)) {
+            //処理済み
+            continue;
+        }
+        if (now == Goal) {
+            return true;
+        }
+
+        if (now < mNodes.size()) {
+            //overlayのnodeはgraphのedgeを持たない
+            for (uint32_t lp = mEdgeStart[now]; lp < mEdgeStart[now + 1]; lp++) {
+                search_relax_basefee(pSearch, &mEdges[lp]);
+            }
+        }
+        edge_t key;
+        key.node_from = now;
+        std::pair<std::vector<edge_t>::const_iterator, std::vector<edge_t>::const_iterator> range =
+                std::equal_range(pSearch->p_tmp_out->begin(), pSearch->p_tmp_out->end(), key, edge_from_less);
+        for (std::vector<edge_t>::const_iterator it = range.first; it != range.second; it++) {
+            search_relax_basefee(pSearch, &*it);
+        }
+    }
+    return false;
+}
+
+
+static void search_reset(search_t *pSearch)
+{
+    size_t node_num = pSearch->node_num;
+
+    if (pSearch->p_param->weight == LN_ROUTING_WEIGHT_AMOUNT) {
+        pSearch->label.clear();
+        pSearch->label_head.assign(node_num, M_LABEL_NONE);
+        pSearch->label_num.assign(node_num, 0);
+        pSearch->label_goal = M_LABEL_NONE;
+    } else {
+        pSearch->weight.assign(node_num, M_DIST_INF);
+        pSearch->hop.assign(node_num, 0);
+        pSearch->link.assign(node_num, M_NODE_NONE);
+        pSearch->link_edge.assign(node_num, NULL);
+    }
+    if (pSearch->alt) {
+        pSearch->pot.assign(node_num, M_POT_UNKNOWN);
+    }
+    pSearch->que = std::priority_queue<search_t::queue_t, std::vector<search_t::queue_t>, std::greater<search_t::queue_t> >();
+}
+
+
+/** node間の最短経路
+ *
+ * @param[in,out]   pSearch
+ * @param[in]       From        経路の開始node番号(payer側)
+ * @param[out]      pEdges      payer側から並べたedge
+ * @retval  true    経路あり
+ */
+static bool search_path(search_t *pSearch, uint32_t From, std::vector<const edge_t *> *pEdges)
+{
+    bool bret;
+
+    pEdges->clear();
+    if (pSearch->p_param->weight == LN_ROUTING_WEIGHT_AMOUNT) {
+        //overlayのnodeはgraphのedgeを持たない
+        uint32_t edge_begin = (From < mNodes.size()) ? mEdgeStart[From] : 0;
+        uint32_t edge_end = (From < mNodes.size()) ? mEdgeStart[From + 1] : 0;
+
+        pSearch->pot_end = From;
+        pSearch->pot_goal.clear();
+        pSearch->pot_adjust = 0;
+        if ((From == pSearch->payer) && (edge_end - edge_begin <= M_POT_FROM_MAX)) {
+            //payerから出るedgeは手数料を加算しないので、接続先までの下限を使う
+            for (uint32_t lp = edge_begin; lp < edge_end; lp++) {
+                pSearch->pot_goal.push_back(mEdges[lp].node_to);
+            }
+        } else {
+            pSearch->pot_goal.push_back(From);
+            if (pSearch->alt && (From == pSearch->payer)) {
+                //edgeが多い場合は、手数料の上限を下限から引く
+                for (uint32_t lp = edge_begin; lp < edge_end; lp++) {
+                    uint64_t fee = edgefee(kLmAmount[pSearch->pot_amount], mEdges[lp].fee_base_msat, mEdges[lp].fee_prop_millionths);
+                    pSearch->pot_adjust = std::max(pSearch->pot_adjust, fee);
+                }
+            }
+        }
+        search_reset(pSearch);
+        bret = search_run_amount(pSearch, pSearch->payee, From);
+        for (uint32_t lp = pSearch->label_goal; bret && (pSearch->label[lp].prev != M_LABEL_NONE); lp = pSearch->label[lp].prev) {
+            pEdges->push_back(pSearch->label[lp].p_edge);
+        }
+    } else {
+        pSearch->pot_end = pSearch->payee;
+        pSearch->pot_goal.assign(1, pSearch->payee);
+        pSearch->pot_adjust = 0;
+        search_reset(pSearch);
+        bret = search_run(pSearch, From, pSearch->payee);
+        for (uint32_t v = pSearch->payee; bret && (v != From); v = pSearch->link[v]) {
+            pEdges->insert(pEdges->begin(), pSearch->link_edge[v]);
+        }
+    }
+    return bret;
+}
+
+
+/** 経路の重み計算
+ *
+ * @param[in]       pParam      探索条件
+ * @param[in]       AmountMsat  送金額
+ * @param[in]       CltvExpiry  payeeのcltv_expiry
+ * @param[in]       Edges       payer側から並べたedge
+ * @param[in]       Now         mission controlの経過時間計算用
+ * @param[in]       pOverlay    計算時だけ追加するnode
+ * @param[out]      pCost       重み(#LN_ROUTING_WEIGHT_AMOUNT時はpayerが送る金額 + mission controlの重み)
+ * @retval  true    探索条件を満たす
+ */
+static bool path_cost(const ln_routing_param_t *pParam, uint64_t AmountMsat, uint32_t CltvExpiry,
+                const std::vector<const edge_t *>& Edges, time_t Now, const overlay_t *pOverlay, uint64_t *pCost)
+{
+    if (Edges.size() > pParam->max_hop) {
+        return false;
+    }
+    if (pParam->weight == LN_ROUTING_WEIGHT_BASEFEE) {
+        *pCost = 0;
+        for (size_t lp = 0; lp < Edges.size(); lp++) {
+            *pCost += Edges[lp]->fee_base_msat + mc_penalty(Edges[lp], AmountMsat, Now, pOverlay);
+        }
+        return true;
+    }
+
+    //payee側から積み上げる(payerのedgeは加算しない)
+    uint64_t amount = AmountMsat;
+    uint32_t cltv = CltvExpiry;
+    uint64_t penalty = 0;
+    for (size_t lp = Edges.size(); lp > 1; lp--) {
+        const edge_t *p_edge = Edges[lp - 1];
+        if (amount < p_edge->htlc_minimum_msat) {
+            return false;
+        }
+        penalty += mc_penalty(p_edge, amount, Now, pOverlay);
+        amount += edgefee(amount, p_edge->fee_base_msat, p_edge->fee_prop_millionths);
+        cltv += p_edge->cltv_expiry_delta;
+    }
+    if ((pParam->max_fee_msat != 0) && (amount - AmountMsat > pParam->max_fee_msat)) {
+        return false;
+    }
+    if ((pParam->max_cltv_delta != 0) && (cltv - CltvExpiry > pParam->max_cltv_delta)) {
+        return false;
+    }
+    if (!Edges.empty()) {
+        penalty += mc_penalty(Edges[0], amount, Now, pOverlay);
+    }
+    *pCost = amount + penalty;
+    return true;
+}
+
+
+/** 重みの小さい順にloopしない経路を列挙(Yen's algorithm)
+ *
+ * 直前に確定した経路の各nodeを分岐点(spur node)とし、
+ * 分岐点までの経路(root path)を固定して残りを探索し直したものを候補とする。
+ * 確定済み経路と同じroot pathを持つ経路の分岐edgeと、root path上のnodeは使用しない。
+ *
+ * @param[in,out]   pSearch
+ * @param[in]       MaxNum      列挙する経路数上限
+ * @param[out]      pPaths      重みの小さい順
+ */
+static void search_paths(search_t *pSearch, size_t MaxNum, std::vector<path_t> *pPaths)
+{
+    std::vector<path_t> cands;
+    path_t path;
+
+    pPaths->clear();
+    pSearch->ban_node.assign(pSearch->node_num, 0);
+    pSearch->ban_edge.clear();
+    if (!search_path(pSearch, pSearch->payer, &path.edges) ||
+                !path_cost(pSearch->p_param, pSearch->amount_msat, pSearch->cltv_expiry, path.edges,
+                        pSearch->now, pSearch->p_overlay, &path.cost)) {
+        return;
+    }
+    pPaths->push_back(path);
+
+    while (pPaths->size() < MaxNum) {
+        const std::vector<const edge_t *> prev = pPaths->back().edges;
+
+        for (size_t spur = 0; spur < prev.size(); spur++) {
+            pSearch->ban_node.assign(pSearch->node_num, 0);
+            pSearch->ban_edge.clear();
+            for (size_t lp = 0; lp < spur; lp++) {
+                pSearch->ban_node[prev[lp]->node_from] = 1;
+            }
+            for (size_t lp = 0; lp < pPaths->size(); lp++) {
+                const std::vector<const edge_t *>& edges = (*pPaths)[lp].edges;
+                if ((edges.size() > spur) && std::equal(prev.begin(), prev.begin() + spur, edges.begin())) {
+                    pSearch->ban_edge.push_back(edges[spur]);
+                }
+            }
+            //edgeを緩和するたびに検索するので、二分探索できるようにする
+            std::sort(pSearch->ban_edge.begin(), pSearch->ban_edge.end(), std::less<const edge_t *>());
+
+            std::vector<const edge_t *> spur_edges;
+            if (!search_path(pSearch, prev[spur]->node_from, &spur_edges)) {
+                continue;
+            }
+            path.edges.assign(prev.begin(), prev.begin() + spur);
+            path.edges.insert(path.edges.end(), spur_edges.begin(), spur_edges.end());
+            if (!path_cost(pSearch->p_param, pSearch->amount_msat, pSearch->cltv_expiry, path.edges,
+                        pSearch->now, pSearch->p_overlay, &path.cost)) {
+                continue;
+            }
+            bool found = false;
+            for (size_t lp = 0; !found && (lp < cands.size()); lp++) {
+                found = (cands[lp].edges == path.edges);
+            }
+            if (!found) {
+                cands.push_back(path);
+            }
+        }
+        if (cands.empty()) {
+            break;
+        }
+
+        std::vector<path_t>::iterator it = std::min_element(cands.begin(), cands.end());
+        pPaths->push_back(*it);
+        cands.erase(it);
+    }
+}
+
+
+/** 経路計算
+ *
+ * @param[out]      pRoutes     重みの小さい順の経路
+ * @param[in]       MaxNum      経路数上限
+ * @param[in]       Overlay     計算時だけ追加するnodeとedge
+ * @note
+ *      - mMuxGraphをlockして呼び出すこと
+ */
+static void calc_route(
+        std::vector<route_t> *pRoutes,
+        size_t MaxNum,
+        uint32_t Payer,
+        uint32_t Payee,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        const overlay_t& Overlay,
+        const ln_routing_param_t *pParam)
+{
+    const std::vector<edge_t>& tmp_edges = Overlay.edges;
+    std::vector<edge_t> tmp_out(tmp_edges);
+    std::vector<edge_t> tmp_in(tmp_edges);
+    std::stable_sort(tmp_out.begin(), tmp_out.end(), edge_from_less);
+    std::stable_sort(tmp_in.begin(), tmp_in.end(), edge_to_less);
+
+    search_t search;
+    search.p_param = pParam;
+    search.payer = Payer;
+    search.payee = Payee;
+    search.amount_msat = AmountMsat;
+    search.cltv_expiry = CltvExpiry;
+    search.now = time(NULL);
+    search.node_num = (uint32_t)(mNodes.size() + Overlay.nodes.size());
+    search.p_overlay = &Overlay;
+    search.p_tmp_out = &tmp_out;
+    search.p_tmp_in = &tmp_in;
+    search.alt = (pParam->algo == LN_ROUTING_ALGO_ALT) && !mLandmarks.empty() && (mLmVersion == mGraphVersion);
+    search.pot_amount = 0;
+    if (search.alt) {
+        //fee_base_msatだけの場合は送金額0の距離を使う
+        for (int lp = 1; (pParam->weight == LN_ROUTING_WEIGHT_AMOUNT) && (lp < M_LANDMARK_AMOUNT_NUM); lp++) {
+            if (kLmAmount[lp] <= AmountMsat) {
+                search.pot_amount = lp;
+            }
+        }
+        for (size_t lp = 0; lp < tmp_edges.size(); lp++) {
+            uint32_t node;
+            if (pParam->weight == LN_ROUTING_WEIGHT_AMOUNT) {
+                //payerは探索終了nodeとして扱う
+                node = tmp_edges[lp].node_to;
+                if (node == Payer) {
+                    continue;
+                }
+            } else {
+                node = tmp_edges[lp].node_from;
+            }
+            if (std::find(search.pot_tmp.begin(), search.pot_tmp.end(), node) == search.pot_tmp.end()) {
+                search.pot_tmp.push_back(node);
+            }
+        }
+    }
+    DBG_PRINTF("search: %s\n", (search.alt) ? "ALT" : "Dijkstra");
+
+    std::vector<path_t> paths;
+    search_paths(&search, MaxNum, &paths);
+
+    //tmp_out/tmp_inは解放されるのでコピーする
+    pRoutes->clear();
+    for (size_t lp = 0; lp < paths.size(); lp++) {
+        route_t route;
+        for (size_t lp2 = 0; lp2 < paths[lp].edges.size(); lp2++) {
+            route.push_back(*paths[lp].edges[lp2]);
+        }
+        pRoutes->push_back(route);
+    }
+}
+
+
+/** 経路cacheのkey作成
+ *
+ * 送金額はbit長でまとめる(同じbucketでは同じ経路を使う)。
+ */
+static std::string cache_key(
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_fieldr_t *pAddRoute,
+        const ln_routing_param_t *pParam)
+{
+    std::string key;
+    uint8_t bucket = 0;
+
+    for (uint64_t amt = AmountMsat; amt != 0; amt >>= 1) {
+        bucket++;
+    }
+    key.append((const char *)pPayerId, UCOIN_SZ_PUBKEY);
+    key.append((const char *)pPayeeId, UCOIN_SZ_PUBKEY);
+    key.append((const char *)&CltvExpiry, sizeof(CltvExpiry));
+    key.append((const char *)&bucket, sizeof(bucket));
+    key.append((const char *)&pParam->weight, sizeof(pParam->weight));
+    key.append((const char *)&pParam->max_hop, sizeof(pParam->max_hop));
+    key.append((const char *)&pParam->max_cltv_delta, sizeof(pParam->max_cltv_delta));
+    key.append((const char *)&pParam->max_fee_msat, sizeof(pParam->max_fee_msat));
+    for (uint8_t lp = 0; lp < AddNum; lp++) {
+        key.append((const char *)pAddRoute[lp].node_id, UCOIN_SZ_PUBKEY);
+        key.append((const char *)&pAddRoute[lp].short_channel_id, sizeof(pAddRoute[lp].short_channel_id));
+        key.append((const char *)&pAddRoute[lp].fee_base_msat, sizeof(pAddRoute[lp].fee_base_msat));
+        key.append((const char *)&pAddRoute[lp].fee_prop_millionths, sizeof(pAddRoute[lp].fee_prop_millionths));
+        key.append((const char *)&pAddRoute[lp].cltv_expiry_delta, sizeof(pAddRoute[lp].cltv_expiry_delta));
+    }
+    return key;
+}
+
+
+static void cache_erase(cache_map_t::iterator It)
+{
+    for (size_t lp = 0; lp < It->second.routes.size(); lp++) {
+        const route_t& route = It->second.routes[lp];
+        for (size_t lp2 = 0; lp2 < route.size(); lp2++) {
+            std::unordered_map<uint64_t, uint32_t>::iterator it_sci = mCacheSci.find(route[lp2].short_channel_id);
+            if ((it_sci != mCacheSci.end()) && (--it_sci->second == 0)) {
+                mCacheSci.erase(it_sci);
+            }
+        }
+    }
+    mCache.erase(It);
+}
+
+
+static void cache_clear(void)
+{
+    mCache.clear();
+    mCacheSci.clear();
+}
+
+
+/** 経路探索で使うedgeの検索
+ *
+ * snapshotから読み込んだ場合はmChannelsが空なので、CSR形式のedgeから探す。
+ *
+ * @param[in]   pEdge       経路cacheのedge
+ * @return  graphのedge(NULL:無い、または無効)
+ */
+static const edge_t *edge_find(const edge_t *pEdge)
+{
+    if ((pEdge->node_from >= mNodes.size()) || (pEdge->node_from + 1 >= mEdgeStart.size())) {
+        return NULL;
+    }
+    for (uint32_t lp = mEdgeStart[pEdge->node_from]; lp < mEdgeStart[pEdge->node_from + 1]; lp++) {
+        const edge_t *p_edge = &mEdges[lp];
+        if ((p_edge->short_channel_id == pEdge->short_channel_id) && (p_edge->node_to == pEdge->node_to)) {
+            return (search_skip_sci(p_edge->short_channel_id)) ? NULL : p_edge;
+        }
+    }
+    return NULL;
+}
+
+
+/** 経路cacheのnode番号を今回のnode番号に変換
+ *
+ * overlayのnode番号は計算ごとに変わるため、node_idで今回のgraphとoverlayから探し直す。
+ *
+ * @return  今回のnode番号(M_NODE_NONE:無い)
+ */
+static uint32_t cache_node(const cache_t& Cache, uint32_t Node, const overlay_t& Overlay)
+{
+    if (Node < Cache.node_num) {
+        //graphのnode番号は変わらない(graph_clear()でcacheも破棄する)
+        return Node;
+    }
+    return overlay_search(&Overlay, Cache.tmp_nodes[Node - Cache.node_num].node_id);
+}
+
+
+/** 経路cache取得
+ *
+ * 今回の送金額で条件を満たさなくなった経路や、閉じた自channelを使う経路は除く。
+ * 経路探索と同じCSR形式のedgeで確認し、手数料などは現在の値に置き換える。
+ *
+ * @retval  true    cacheの経路を使う
+ */
+static bool cache_get(
+        std::vector<route_t> *pRoutes,
+        const std::string& Key,
+        size_t MaxNum,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        const overlay_t& Overlay,
+        const ln_routing_param_t *pParam)
+{
+    cache_map_t::iterator it = mCache.find(Key);
+    if (it == mCache.end()) {
+        return false;
+    }
+    if ((time(NULL) - it->second.created > M_CACHE_LIFETIME) || (it->second.req_num < MaxNum)) {
+        cache_erase(it);
+        return false;
+    }
+
+    pRoutes->clear();
+    for (size_t lp = 0; (lp < it->second.routes.size()) && (pRoutes->size() < MaxNum); lp++) {
+        const route_t& route = it->second.routes[lp];
+        std::vector<const edge_t *> edges;
+        bool valid = true;
+        for (size_t lp2 = 0; valid && (lp2 < route.size()); lp2++) {
+            edge_t key = route[lp2];
+            key.node_from = cache_node(it->second, key.node_from, Overlay);
+            key.node_to = cache_node(it->second, key.node_to, Overlay);
+            const edge_t *p_edge = NULL;
+            if ((key.node_from != M_NODE_NONE) && (key.node_to != M_NODE_NONE)) {
+                p_edge = edge_find(&key);
+            }
+            if ((p_edge == NULL) && (key.node_from != M_NODE_NONE) && (key.node_to != M_NODE_NONE)) {
+                //graphに無いchannel(自channel, r field)は今回も追加されているか
+                const std::vector<edge_t>& tmp_edges = Overlay.edges;
+                for (size_t lp3 = 0; (p_edge == NULL) && (lp3 < tmp_edges.size()); lp3++) {
+                    if ((tmp_edges[lp3].short_channel_id == key.short_channel_id) &&
+                            (tmp_edges[lp3].node_from == key.node_from) &&
+                            (tmp_edges[lp3].node_to == key.node_to)) {
+                        p_edge = &tmp_edges[lp3];
+                    }
+                }
+            }
+            valid = (p_edge != NULL);
+            edges.push_back(p_edge);
+        }
+        uint64_t cost;
+        if (valid && path_cost(pParam, AmountMsat, CltvExpiry, edges, time(NULL), &Overlay, &cost)) {
+            //手数料などは現在のedgeを使う
+            route_t cur;
+            for (size_t lp2 = 0; lp2 < edges.size(); lp2++) {
+                cur.push_back(*edges[lp2]);
+            }
+            pRoutes->push_back(cur);
+        }
+    }
+    return !pRoutes->empty();
+}
+
+
+static void cache_add(const std::string& Key, size_t ReqNum, const std::vector<route_t>& Routes, const overlay_t& Overlay)
+{
+    cache_map_t::iterator it = mCache.find(Key);
+    if (it != mCache.end()) {
+        cache_erase(it);
+    }
+    if (mCache.size() >= M_CACHE_MAX) {
+        //一番古いものを捨てる
+        cache_map_t::iterator it_old = mCache.begin();
+        for (it = mCache.begin(); it != mCache.end(); it++) {
+            if (it->second.created < it_old->second.created) {
+                it_old = it;
+            }
+        }
+        cache_erase(it_old);
+    }
+
+    cache_t& cache = mCache[Key];
+    cache.created = time(NULL);
+    cache.req_num = (uint8_t)ReqNum;
+    cache.routes = Routes;
+    cache.node_num = (uint32_t)mNodes.size();
+    cache.tmp_nodes = Overlay.nodes;
+    for (size_t lp = 0; lp < Routes.size(); lp++) {
+        for (size_t lp2 = 0; lp2 < Routes[lp].size(); lp2++) {
+            mCacheSci[Routes[lp][lp2].short_channel_id]++;
+        }
+    }
+}
+
+
+/** short_channel_idを使う経路cacheの破棄
+ *
+ */
+static void cache_invalidate(uint64_t ShortChannelId)
+{
+    if (mCacheSci.find(ShortChannelId) == mCacheSci.end()) {
+        return;
+    }
+
+    cache_map_t::iterator it = mCache.begin();
+    while (it != mCache.end()) {
+        bool found = false;
+        for (size_t lp = 0; !found && (lp < it->second.routes.size()); lp++) {
+            const route_t& route = it->second.routes[lp];
+            for (size_t lp2 = 0; !found && (lp2 < route.size()); lp2++) {
+                found = (route[lp2].short_channel_id == ShortChannelId);
+            }
+        }
+        if (found) {
+            cache_map_t::iterator it_del = it++;
+            cache_erase(it_del);
+        } else {
+            it++;
+        }
+    }
+    DBG_PRINTF("route cache invalidate: %016" PRIx64 "\n", ShortChannelId);
+}
+
+
+/** node送金失敗の記録
+ *
+ * nodeの失敗はどのchannelに影響するか分からないため、経路cacheは全部破棄する。
+ */
+static void mc_fail_node(const uint8_t *pNodeId, time_t Now)
+{
+    node_key_t key;
+    memcpy(key.node_id, pNodeId, UCOIN_SZ_PUBKEY);
+    mc_t *p_mc = &mMcNode[key];
+    p_mc->fail_time = Now;
+    p_mc->fail_amount = 0;
+    cache_clear();
+    DBG_PRINTF("mission control: node ");
+    DUMPBIN(pNodeId, UCOIN_SZ_PUBKEY);
+}
+
+
+/** 送金できたchannel/nodeの失敗記録を取り消す
+ *
+ * pHopDatain[0]からChanNum個のchannelで送金できた場合に呼び出す。
+ * 送金した金額より大きい金額で失敗した記録は残す。
+ * 取り消すと今まで避けていた経路が使えるようになるため、経路cacheを破棄する。
+ *
+ * @param[in]   pHopDatain      送金した経路(先頭は送金元)
+ * @param[in]   ChanNum         送金できたchannel数
+ */
+static void mc_success_hops(const ln_hop_datain_t *pHopDatain, int ChanNum)
+{
+    bool removed = false;
+
+    for (int lp = 0; lp < ChanNum; lp++) {
+        const ln_hop_datain_t *p_hop = &pHopDatain[lp];
+        mc_chan_map_t::iterator it = mMcChan.find(p_hop->short_channel_id);
+        if (it != mMcChan.end()) {
+            mc_t *p_mc = &it->second.dir[mc_dir(p_hop->pubkey, pHopDatain[lp + 1].pubkey)];
+            if ((p_mc->fail_time != 0) && (p_mc->fail_amount <= p_hop->amt_to_forward)) {
+                p_mc->fail_time = 0;
+                p_mc->fail_amount = 0;
+                removed = true;
+            }
+            if ((it->second.dir[0].fail_time == 0) && (it->second.dir[1].fail_time == 0)) {
+                mMcChan.erase(it);
+            }
+        }
+        if (lp > 0) {
+            //送金元以外はchannelに転送できている
+            node_key_t key;
+            memcpy(key.node_id, p_hop->pubkey, UCOIN_SZ_PUBKEY);
+            removed |= (mMcNode.erase(key) != 0);
+        }
+    }
+    if (removed) {
+        cache_clear();
+    }
+}
+
+
+/** 古い失敗記録の破棄
+ *
+ */
+static void mc_prune(time_t Now)
+{
+    mc_chan_map_t::iterator it_chan = mMcChan.begin();
+    while (it_chan != mMcChan.end()) {
+        for (int dir = 0; dir < 2; dir++) {
+            mc_t *p_mc = &it_chan->second.dir[dir];
+            if ((p_mc->fail_time != 0) && (Now - p_mc->fail_time > M_MC_FORGET)) {
+                p_mc->fail_time = 0;
+                p_mc->fail_amount = 0;
+            }
+        }
+        if ((it_chan->second.dir[0].fail_time == 0) && (it_chan->second.dir[1].fail_time == 0)) {
+            it_chan = mMcChan.erase(it_chan);
+        } else {
+            it_chan++;
+        }
+    }
+
+    mc_node_map_t::iterator it_node = mMcNode.begin();
+    while (it_node != mMcNode.end()) {
+        if (Now - it_node->second.fail_time > M_MC_FORGET) {
+            it_node = mMcNode.erase(it_node);
+        } else {
+            it_node++;
+        }
+    }
+}
+
+
+/** 経路をln_routing_result_tに変換
+ *
+ */
+static void route_result(ln_routing_result_t *pResult, const route_t& Route, const uint8_t *pPayeeId,
+                uint32_t CltvExpiry, uint64_t AmountMsat, const overlay_t& Overlay)
+{
+    //payee側から金額とcltvを積み上げる
+    //  先頭(payer)のedgeは自分の手数料になるため加算しない
+    pResult->hop_num = (uint8_t)(Route.size() + 1);
+    for (int lp = pResult->hop_num - 1; lp >= 0; lp--) {
+        ln_hop_datain_t *p_hop = &pResult->hop_datain[lp];
+        if (lp == pResult->hop_num - 1) {
+            p_hop->short_channel_id = 0;
+            memcpy(p_hop->pubkey, pPayeeId, UCOIN_SZ_PUBKEY);
+        } else {
+            p_hop->short_channel_id = Route[lp].short_channel_id;
+            memcpy(p_hop->pubkey, node_key(Route[lp].node_from, &Overlay).node_id, UCOIN_SZ_PUBKEY);
+        }
+        p_hop->amt_to_forward = AmountMsat;
+        p_hop->outgoing_cltv_value = CltvExpiry;
+        if ((lp > 0) && (lp < pResult->hop_num - 1)) {
+            AmountMsat += edgefee(AmountMsat, Route[lp].fee_base_msat, Route[lp].fee_prop_millionths);
+            CltvExpiry += Route[lp].cltv_expiry_delta;
+        }
+    }
+}
+
+
+/** 経路取得(cache or 計算)
+ *
+ * @note
+ *      - mMuxGraphをlockして呼び出すこと
+ */
+static lnerr_route_t calc_paths(
+        ln_routing_result_t *pResult,
+        uint8_t *pNum,
+        uint8_t MaxNum,
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_fieldr_t *pAddRoute,
+        const overlay_t& Overlay,
+        const ln_routing_param_t *pParam)
+{
+    uint32_t pnt_start = overlay_search(&Overlay, pPayerId);
+    uint32_t pnt_goal = overlay_search(&Overlay, pPayeeId);
+
+    if (pnt_start == M_NODE_NONE) {
+        DBG_PRINTF("fail: no start node\n");
+        return LNROUTE_NOSTART;
+    }
+    if (pnt_goal == M_NODE_NONE) {
+        DBG_PRINTF("fail: no goal node\n");
+        return LNROUTE_NOGOAL;
+    }
+
+    //hop数上限は探索後に判定する
+    ln_routing_param_t param = *pParam;
+    if (param.weight == LN_ROUTING_WEIGHT_BASEFEE) {
+        param.max_hop = UINT8_MAX;
+    }
+
+    std::vector<route_t> routes;
+    if (mGraphFrozen) {
+        //並列に計算するため、cacheは使わない
+        calc_route(&routes, MaxNum, pnt_start, pnt_goal, CltvExpiry, AmountMsat, Overlay, &param);
+    } else {
+        std::string key = cache_key(pPayerId, pPayeeId, CltvExpiry, AmountMsat, AddNum, pAddRoute, pParam);
+        if (cache_get(&routes, key, MaxNum, CltvExpiry, AmountMsat, Overlay, &param)) {
+            DBG_PRINTF("route cache hit\n");
+            mCacheHit++;
+        } else {
+            mCacheMiss++;
+            calc_route(&routes, MaxNum, pnt_start, pnt_goal, CltvExpiry, AmountMsat, Overlay, &param);
+            if (!routes.empty()) {
+                cache_add(key, MaxNum, routes, Overlay);
+            }
+        }
+    }
+
+    if (routes.empty()) {
+        DBG_PRINTF("fail: cannot find route\n");
+        return LNROUTE_NOTFOUND;
+    }
+    for (size_t lp = 0; lp < routes.size(); lp++) {
+        if (routes[lp].size() > pParam->max_hop) {
+            continue;
+        }
+        route_result(&pResult[*pNum], routes[lp], pPayeeId, CltvExpiry, AmountMsat, Overlay);
+        (*pNum)++;
+    }
+    if (*pNum == 0) {
+        DBG_PRINTF("fail: too many hops\n");
+        return LNROUTE_TOOMANYHOP;
+    }
+
+    return LNROUTE_NONE;
+}
+
+
+/** landmarkからの距離(手数料合計)
+ *
+ * 手数料はAmountMsatを送金する場合の額とする。
+ *
+ * @param[in]   Graph
+ * @param[in]   Landmark    landmarkのnode番号
+ * @param[in]   AmountMsat  送金額
+ * @param[in]   Reverse     true:node --> landmark, false:landmark --> node
+ * @param[out]  pDist       [node番号]距離(M_DIST_INF:到達できない)
+ */
+static void landmark_dijkstra(const lm_graph_t& Graph, uint32_t Landmark, uint64_t AmountMsat, bool Reverse, uint64_t *pDist)
+{
+    typedef std::pair<uint64_t, uint32_t> queue_t;
+    std::priority_queue<queue_t, std::vector<queue_t>, std::greater<queue_t> > que;
+
+    std::fill(pDist, pDist + Graph.node_num, M_DIST_INF);
+    pDist[Landmark] = 0;
+    que.push(queue_t(0, Landmark));
+    while (!que.empty()) {
+        queue_t top = que.top();
+        que.pop();
+
+        uint32_t now = top.second;
+        if (top.first > pDist[now]) {
+            continue;
+        }
+        uint32_t num = (Reverse) ? Graph.in_start[now + 1] - Graph.in_start[now] : Graph.edge_start[now + 1] - Graph.edge_start[now];
+        for (uint32_t lp = 0; lp < num; lp++) {
+            const edge_t *p_edge = (Reverse) ? &Graph.edges[Graph.in_edges[Graph.in_start[now] + lp]] : &Graph.edges[Graph.edge_start[now] + lp];
+            uint32_t next = (Reverse) ? p_edge->node_from : p_edge->node_to;
+            uint64_t dist = pDist[now] + edgefee(AmountMsat, p_edge->fee_base_msat, p_edge->fee_prop_millionths);
+            if (dist < pDist[next]) {
+                pDist[next] = dist;
+                que.push(queue_t(dist, next));
+            }
+        }
+    }
+}
+
+
+/** landmark選択
+ *
+ * 最初はedgeが一番多いnode、以降は選択済みlandmarkからのhop数が一番遠いnodeを選ぶ。
+ */
+static void landmark_select(const lm_graph_t& Graph, std::vector<uint32_t> *pLandmarks)
+{
+    pLandmarks->clear();
+    if (Graph.node_num == 0) {
+        return;
+    }
+
+    uint32_t next = 0;
+    uint32_t max_edge = 0;
+    for (uint32_t lp = 0; lp < Graph.node_num; lp++) {
+        uint32_t num = (Graph.edge_start[lp + 1] - Graph.edge_start[lp]) + (Graph.in_start[lp + 1] - Graph.in_start[lp]);
+        if (num > max_edge) {
+            max_edge = num;
+            next = lp;
+        }
+    }
+
+    std::vector<uint32_t> min_hop(Graph.node_num, UINT32_MAX);
+    std::vector<uint32_t> hop(Graph.node_num);
+    std::deque<uint32_t> que;
+    while ((pLandmarks->size() < M_LANDMARK_NUM) && (max_edge > 0)) {
+        pLandmarks->push_back(next);
+
+        //hop数(向きは区別しない)
+        std::fill(hop.begin(), hop.end(), UINT32_MAX);
+        hop[next] = 0;
+        que.push_back(next);
+        while (!que.empty()) {
+            uint32_t now = que.front();
+            que.pop_front();
+            for (uint32_t lp = Graph.edge_start[now]; lp < Graph.edge_start[now + 1]; lp++) {
+                uint32_t node = Graph.edges[lp].node_to;
+                if (hop[node] == UINT32_MAX) {
+                    hop[node] = hop[now] + 1;
+                    que.push_back(node);
+                }
+            }
+            for (uint32_t lp = Graph.in_start[now]; lp < Graph.in_start[now + 1]; lp++) {
+                uint32_t node = Graph.edges[Graph.in_edges[lp]].node_from;
+                if (hop[node] == UINT32_MAX) {
+                    hop[node] = hop[now] + 1;
+                    que.push_back(node);
+                }
+            }
+        }
+
+        //edgeがあるnodeのうち、選択済みlandmarkから一番遠いもの(届かないnodeを優先)
+        uint32_t far = 0;
+        max_edge = 0;
+        for (uint32_t lp = 0; lp < Graph.node_num; lp++) {
+            min_hop[lp] = std::min(min_hop[lp], hop[lp]);
+            uint32_t num = (Graph.edge_start[lp + 1] - Graph.edge_start[lp]) + (Graph.in_start[lp + 1] - Graph.in_start[lp]);
+            if ((num > 0) && (min_hop[lp] > far)) {
+                far = min_hop[lp];
+                next = lp;
+                max_edge = num;
+            }
+        }
+    }
+}
+
 
-struct param_self_t {
-    nodes_result_t  result;
-    const uint8_t   *p_payer;
-};
+/** snapshotファイルの領域書込み
+ *
+ * 次の領域が8byte境界になるよう0を詰める。
+ */
+static bool snap_write(FILE *fp, const void *pData, size_t Len)
+{
+    static const uint8_t kPad[8] = { 0 };
 
+    if ((Len > 0) && (fwrite(pData, 1, Len, fp) != Len)) {
+        return false;
+    }
+    size_t pad = M_SNAP_ALIGN(Len) - Len;
+    return (pad == 0) || (fwrite(kPad, 1, pad, fp) == pad);
+}
 
-/********************************************************************
- * functions
- ********************************************************************/
 
-static int direction(const uint8_t **ppNode1, const uint8_t **ppNode2, const uint8_t *pNode1, const uint8_t *pNode2)
+/** snapshotファイルのheaderだけ更新
+ *
+ * graphに変更が無くてもDBは更新されるため、db_txnidとupdatedだけ書き換える。
+ * (読込み側が古いsnapshotと判定しないようにする)
+ */
+static bool snap_write_txnid(uint64_t Txnid)
 {
-    int lp2;
-    for (lp2 = 0; lp2 < UCOIN_SZ_PUBKEY; lp2++) {
-        if (pNode1[lp2] != pNode2[lp2]) {
-            break;
-        }
+    int fd = open(LNDB_GRAPH_SNAPSHOT, O_WRONLY);
+    if (fd < 0) {
+        return false;
     }
-    int dir = (pNode1[lp2] < pNode2[lp2]) ? 0 : 1;
-    if (dir == 0) {
-        *ppNode1 = pNode1;
-        *ppNode2 = pNode2;
-    } else {
-        *ppNode2 = pNode1;
-        *ppNode1 = pNode2;
+    //snap_hdr_t.db_txnid, updated
+    uint64_t val[2] = { Txnid, (uint64_t)time(NULL) };
+    bool ret = (pwrite(fd, val, sizeof(val), offsetof(snap_hdr_t, db_txnid)) == (ssize_t)sizeof(val));
+    if (close(fd) != 0) {
+        ret = false;
     }
-    return dir;
+    return ret;
 }
 
 
-static uint64_t edgefee(uint64_t amtmsat, uint32_t fee_base_msat, uint32_t fee_prop_millionths)
+/** snapshotのCSR開始位置チェック
+ *
+ * @param[in]   pStart      開始位置(要素数:NodeNum+1)
+ * @retval  true    0から始まって減少せず、EdgeNumで終わる
+ */
+static bool snap_check_start(const uint32_t *pStart, size_t NodeNum, size_t EdgeNum)
 {
-    return (uint64_t)fee_base_msat + (uint64_t)((amtmsat * fee_prop_millionths) / 1000000);
+    if (pStart[0] != 0) {
+        return false;
+    }
+    for (size_t lp = 0; lp < NodeNum; lp++) {
+        if (pStart[lp] > pStart[lp + 1]) {
+            return false;
+        }
+    }
+    return pStart[NodeNum] == EdgeNum;
 }
 
 
-static void dumpit_chan(nodes_result_t *p_result, char type, const ucoin_buf_t *p_buf)
-{
-    nodes_t *p_nodes;
-
-    switch (type) {
-    case LN_DB_CNLANNO_ANNO:
-        p_result->node_num++;
-        p_result->p_nodes = (nodes_t *)realloc(p_result->p_nodes, sizeof(nodes_t) * p_result->node_num);
-        p_nodes = &p_result->p_nodes[p_result->node_num - 1];
-
-        ln_getids_cnl_anno(
-                            &p_nodes->short_channel_id,
-                            p_nodes->ninfo[0].node_id,
-                            p_nodes->ninfo[1].node_id,
-                            p_buf->buf, p_buf->len);
-        p_nodes->ninfo[0].cltv_expiry_delta = M_CLTV_INIT;     //未設定判定用
-        p_nodes->ninfo[1].cltv_expiry_delta = M_CLTV_INIT;     //未設定判定用
-        break;
-    case LN_DB_CNLANNO_UPD1:
-    case LN_DB_CNLANNO_UPD2:
-        if (p_result->node_num > 0) {
-            p_nodes = &p_result->p_nodes[p_result->node_num - 1];
-
-            ln_cnl_update_t upd;
-            int idx = type - LN_DB_CNLANNO_UPD1;
-            bool bret = ln_getparams_cnl_upd(&upd, p_buf->buf, p_buf->len);
-            if ( bret && ((upd.flags & LN_CNLUPD_FLAGS_DISABLE) == 0) &&
-                 (p_nodes->short_channel_id == upd.short_channel_id) ) {
-                //disable状態ではない && channel_announcement.short_channel_idと一致
-                p_nodes->ninfo[idx].cltv_expiry_delta = upd.cltv_expiry_delta;
-                p_nodes->ninfo[idx].htlc_minimum_msat = upd.htlc_minimum_msat;
-                p_nodes->ninfo[idx].fee_base_msat = upd.fee_base_msat;
-                p_nodes->ninfo[idx].fee_prop_millionths = upd.fee_prop_millionths;
-            } else {
-                //disableの場合は、対象外にされるよう初期値にしておく
-                p_nodes->ninfo[idx].cltv_expiry_delta = M_CLTV_INIT;
+/** snapshotのgraphチェック
+ *
+ * ファイルが壊れていても範囲外を参照しないよう、node番号とedge位置を確認する。
+ */
+static bool snap_check(size_t NodeNum, size_t EdgeNum,
+                const uint32_t *pEdgeStart, const edge_t *pEdges,
+                const uint32_t *pInStart, const uint32_t *pInEdges)
+{
+    if (!snap_check_start(pEdgeStart, NodeNum, EdgeNum) || !snap_check_start(pInStart, NodeNum, EdgeNum)) {
+        return false;
+    }
+    for (uint32_t node = 0; node < NodeNum; node++) {
+        for (uint32_t lp = pEdgeStart[node]; lp < pEdgeStart[node + 1]; lp++) {
+            if ((pEdges[lp].node_from != node) || (pEdges[lp].node_to >= NodeNum)) {
+                return false;
+            }
+        }
+        for (uint32_t lp = pInStart[node]; lp < pInStart[node + 1]; lp++) {
+            if ((pInEdges[lp] >= EdgeNum) || (pEdges[pInEdges[lp]].node_to != node)) {
+                return false;
             }
         }
-        break;
-    default:
-        break;
     }
+    return true;
 }
 
 
-//開設済みで生きている送金元channelは、announcementの有無にかかわらず検索候補に追加する
-static bool comp_func_self(ln_self_t *self, void *p_db_param, void *p_param)
+/** landmark計算thread
+ *
+ * graphが変わったら、しばらく待ってからgraphをコピーして計算する。
+ * 計算中はmMuxGraphをlockしないため、経路計算を止めない。
+ */
+static void *landmark_thread(void *pArg)
 {
-    (void)p_db_param;
+    (void)pArg;
 
-    bool bret;
-    param_self_t *p_prm_self = (param_self_t *)p_param;
+    pthread_mutex_lock(&mMuxGraph);
+    while (!mLmTerm) {
+        if (!mGraphLoaded || (mLmVersion == mGraphVersion)) {
+            pthread_cond_wait(&mCondGraph, &mMuxGraph);
+            continue;
+        }
 
-    if ((self->short_channel_id != 0) && ((self->fund_flag & LN_FUNDFLAG_CLOSE) == 0)) {
-        //チャネルは開設している && close処理をしていない
+        //連続した更新はまとめる
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += M_LANDMARK_DELAY;
+        while (!mLmTerm && (pthread_cond_timedwait(&mCondGraph, &mMuxGraph, &ts) != ETIMEDOUT)) {
+        }
+        if (mLmTerm || !mGraphLoaded) {
+            continue;
+        }
 
-        void *p_db_skip;
-        bret = ln_db_node_cur_transaction(&p_db_skip, LN_DB_TXN_SKIP, NULL);
-        if (bret) {
-            bret = ln_db_annoskip_search(p_db_skip, self->short_channel_id);
-            if (bret) {
-                //skip DBに載っているchannelは使用しない
-                DBG_PRINTF("skip : %016" PRIx64 "\n", self->short_channel_id);
-                ln_db_node_cur_commit(p_db_skip);
-                return false;
+        if (mEdgeDirty) {
+            graph_build_edges();
+        }
+        lm_graph_t graph;
+        graph.node_num = (uint32_t)mNodes.size();
+        graph.edge_start = mEdgeStart;
+        graph.edges = mEdges;
+        graph.in_start = mInStart;
+        graph.in_edges = mInEdges;
+        uint32_t version = mGraphVersion;
+        pthread_mutex_unlock(&mMuxGraph);
+
+        std::vector<uint32_t> landmarks;
+        landmark_select(graph, &landmarks);
+        std::vector<uint64_t> dist_from(M_LANDMARK_AMOUNT_NUM * landmarks.size() * graph.node_num);
+        std::vector<uint64_t> dist_to(M_LANDMARK_AMOUNT_NUM * landmarks.size() * graph.node_num);
+        for (int amt = 0; amt < M_LANDMARK_AMOUNT_NUM; amt++) {
+            for (size_t lp = 0; lp < landmarks.size(); lp++) {
+                size_t offset = (amt * landmarks.size() + lp) * graph.node_num;
+                landmark_dijkstra(graph, landmarks[lp], kLmAmount[amt], false, &dist_from[offset]);
+                landmark_dijkstra(graph, landmarks[lp], kLmAmount[amt], true, &dist_to[offset]);
             }
-            ln_db_node_cur_commit(p_db_skip);
         }
 
-        if (memcmp(self->peer_node_id, p_prm_self->p_payer, UCOIN_SZ_PUBKEY) == 0) {
-            return false;
-        }
+        pthread_mutex_lock(&mMuxGraph);
+        //計算中にgraphが変わっていたら、mLmVersionが一致しないので使われない
+        mLandmarks.swap(landmarks);
+        mLmFrom.swap(dist_from);
+        mLmTo.swap(dist_to);
+        mLmNodeNum = graph.node_num;
+        mLmVersion = version;
+        DBG_PRINTF("landmark: num=%d, node=%d, version=%" PRIu32 "\n", (int)mLandmarks.size(), (int)mLmNodeNum, mLmVersion);
+    }
+    pthread_mutex_unlock(&mMuxGraph);
 
-        // DBG_PRINTF("p_self->short_channel_id: %" PRIx64 "\n", self->short_channel_id);
-        // DBG_PRINTF("p_payer= ");
-        // DUMPBIN(p_prm_self->p_payer, UCOIN_SZ_PUBKEY);
-        // DBG_PRINTF("self->peer_node_id= ");
-        // DUMPBIN(self->peer_node_id, UCOIN_SZ_PUBKEY);
+    return NULL;
+}
 
-        p_prm_self->result.node_num++;
-        p_prm_self->result.p_nodes = (nodes_t *)realloc(p_prm_self->result.p_nodes, sizeof(nodes_t) * p_prm_self->result.node_num);
-        p_prm_self->result.p_nodes[p_prm_self->result.node_num - 1].short_channel_id = self->short_channel_id;
 
-        nodes_t *p_nodes_result = &p_prm_self->result.p_nodes[p_prm_self->result.node_num - 1];
-        const uint8_t *p1, *p2;
-        direction(&p1, &p2, p_prm_self->p_payer, self->peer_node_id);
-        memcpy(p_nodes_result->ninfo[0].node_id, p1, UCOIN_SZ_PUBKEY);
-        memcpy(p_nodes_result->ninfo[1].node_id, p2, UCOIN_SZ_PUBKEY);
-        for (int lp = 0; lp < 2; lp++) {
-            p_nodes_result->ninfo[lp].cltv_expiry_delta = 0;
-            p_nodes_result->ninfo[lp].htlc_minimum_msat = 0;
-            p_nodes_result->ninfo[lp].fee_base_msat = 0;
-            p_nodes_result->ninfo[lp].fee_prop_millionths = 0;
+bool ln_routing_init(void)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    //snapshotから構築済みならそのまま使う
+    bool ret = mGraphLoaded || graph_load();
+    pthread_mutex_unlock(&mMuxGraph);
+
+    if (ret && !mLmThreadRun) {
+        mLmTerm = false;
+        mLmThreadRun = (pthread_create(&mLmThread, NULL, landmark_thread, NULL) == 0);
+        if (!mLmThreadRun) {
+            DBG_PRINTF("fail: landmark thread\n");
         }
     }
 
-    return false;   //false=検索継続
+    return ret;
 }
 
 
-/**
- * @param[in]       pPayerId            送金元node_id
- */
-static bool loaddb(nodes_result_t *p_result, const uint8_t *pPayerId)
+void ln_routing_term(void)
 {
-    int ret;
-    bool bret;
-
-    //self
-    param_self_t prm_self;
+    if (mLmThreadRun) {
+        pthread_mutex_lock(&mMuxGraph);
+        mLmTerm = true;
+        pthread_cond_signal(&mCondGraph);
+        pthread_mutex_unlock(&mMuxGraph);
+        pthread_join(mLmThread, NULL);
+        mLmThreadRun = false;
+    }
 
-    memset(&prm_self.result, 0, sizeof(nodes_result_t));
-    prm_self.p_payer = pPayerId;
-    ln_db_self_search(comp_func_self, &prm_self);
+    pthread_mutex_lock(&mMuxGraph);
+    graph_clear();
+    mLandmarks.clear();
+    mLmFrom.clear();
+    mLmTo.clear();
+    mLmNodeNum = 0;
+    pthread_mutex_unlock(&mMuxGraph);
+}
 
-    //channel_anno
-    void *p_db_anno;
-    void *p_cur;
 
-    ret = ln_db_node_cur_transaction(&p_db_anno, LN_DB_TXN_CNL, NULL);
-    if (!ret) {
-        DBG_PRINTF("fail\n");
+bool ln_routing_snapshot_save(void)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    if (!mGraphLoaded) {
+        pthread_mutex_unlock(&mMuxGraph);
+        return true;
+    }
+    //graphはDB commit後に更新するため、直前のcommitが未反映のことはある(graphが変わるので次回書き直す)
+    uint64_t txnid = ln_db_node_txnid();
+    if (mSnapSeq == mGraphSeq) {
+        bool update = (txnid != mSnapTxnid);
+        pthread_mutex_unlock(&mMuxGraph);
+        if (!update) {
+            return true;
+        }
+        if (snap_write_txnid(txnid)) {
+            pthread_mutex_lock(&mMuxGraph);
+            mSnapTxnid = txnid;
+            pthread_mutex_unlock(&mMuxGraph);
+            return true;
+        }
+        //headerを書けなければ全体を書き直す
+        pthread_mutex_lock(&mMuxGraph);
+    }
+    if (mEdgeDirty) {
+        graph_build_edges();
+    }
+    //書込み中は経路計算を止めないようコピーする
+    std::vector<node_key_t> nodes(mNodes);
+    std::vector<uint32_t> edge_start(mEdgeStart);
+    std::vector<edge_t> edges(mEdges);
+    std::vector<uint32_t> in_start(mInStart);
+    std::vector<uint32_t> in_edges(mInEdges);
+    uint32_t seq = mGraphSeq;
+    pthread_mutex_unlock(&mMuxGraph);
+
+    snap_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, M_SNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = M_SNAP_VERSION;
+    hdr.edge_size = sizeof(edge_t);
+    hdr.created = (uint64_t)time(NULL);
+    hdr.seq = seq;
+    hdr.node_num = (uint32_t)nodes.size();
+    hdr.edge_num = (uint32_t)edges.size();
+    hdr.db_txnid = txnid;
+    hdr.updated = hdr.created;
+
+    char tmppath[sizeof(LNDB_GRAPH_SNAPSHOT) + 4];
+    sprintf(tmppath, "%s.tmp", LNDB_GRAPH_SNAPSHOT);
+    FILE *fp = fopen(tmppath, "wb");
+    if (fp == NULL) {
+        DBG_PRINTF("fail: open %s\n", tmppath);
         return false;
     }
-    ret = ln_db_annocnl_cur_open(&p_cur, p_db_anno);
+    bool ret = snap_write(fp, &hdr, sizeof(hdr)) &&
+                snap_write(fp, nodes.data(), sizeof(node_key_t) * nodes.size()) &&
+                snap_write(fp, edge_start.data(), sizeof(uint32_t) * edge_start.size()) &&
+                snap_write(fp, edges.data(), sizeof(edge_t) * edges.size()) &&
+                snap_write(fp, in_start.data(), sizeof(uint32_t) * in_start.size()) &&
+                snap_write(fp, in_edges.data(), sizeof(uint32_t) * in_edges.size());
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
     if (ret) {
-        uint64_t short_channel_id;
-        char type;
-        ucoin_buf_t buf_cnl = UCOIN_BUF_INIT;
+        ret = (rename(tmppath, LNDB_GRAPH_SNAPSHOT) == 0);
+    }
+    if (ret) {
+        pthread_mutex_lock(&mMuxGraph);
+        mSnapSeq = seq;
+        mSnapTxnid = txnid;
+        pthread_mutex_unlock(&mMuxGraph);
+        DBG_PRINTF("snapshot: node=%" PRIu32 ", edge=%" PRIu32 ", seq=%" PRIu32 "\n", hdr.node_num, hdr.edge_num, seq);
+    } else {
+        DBG_PRINTF("fail: write snapshot\n");
+        unlink(tmppath);
+    }
+    return ret;
+}
 
-        while ((ret = ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
-            void *p_db_skip;
-            bret = ln_db_node_cur_transaction(&p_db_skip, LN_DB_TXN_SKIP, p_db_anno);
-            if (bret) {
-                bret = ln_db_annoskip_search(p_db_skip, short_channel_id);
-                if (bret) {
-                    ucoin_buf_free(&buf_cnl);
-                    continue;
-                }
-            }
 
-            dumpit_chan(p_result, type, &buf_cnl);
-            ucoin_buf_free(&buf_cnl);
+bool ln_routing_snapshot_load(const char *pPath)
+{
+    int fd = open(pPath, O_RDONLY);
+    if (fd < 0) {
+        DBG_PRINTF("no snapshot: %s\n", pPath);
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(snap_hdr_t))) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void *p_map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p_map == MAP_FAILED) {
+        DBG_PRINTF("fail: mmap\n");
+        return false;
+    }
+
+    bool ret = false;
+    const uint8_t *p = (const uint8_t *)p_map;
+    const snap_hdr_t *p_hdr = (const snap_hdr_t *)p;
+    if ((memcmp(p_hdr->magic, M_SNAP_MAGIC, sizeof(p_hdr->magic)) != 0) ||
+                (p_hdr->version != M_SNAP_VERSION) || (p_hdr->edge_size != sizeof(edge_t))) {
+        DBG_PRINTF("fail: snapshot version\n");
+        goto LABEL_EXIT;
+    }
+    //DBの変更が反映されないまま時間が経ったsnapshot(ucoind停止など)は使わない
+    if ((ln_db_node_txnid() > p_hdr->db_txnid) && ((uint64_t)time(NULL) > p_hdr->updated + M_SNAP_STALE_SEC)) {
+        DBG_PRINTF("fail: snapshot older than DB(%" PRIu64 ")\n", p_hdr->db_txnid);
+        goto LABEL_EXIT;
+    }
+
+    {
+        size_t node_num = p_hdr->node_num;
+        size_t edge_num = p_hdr->edge_num;
+        size_t off_nodes = M_SNAP_ALIGN(sizeof(snap_hdr_t));
+        size_t off_edge_start = off_nodes + M_SNAP_ALIGN(sizeof(node_key_t) * node_num);
+        size_t off_edges = off_edge_start + M_SNAP_ALIGN(sizeof(uint32_t) * (node_num + 1));
+        size_t off_in_start = off_edges + M_SNAP_ALIGN(sizeof(edge_t) * edge_num);
+        size_t off_in_edges = off_in_start + M_SNAP_ALIGN(sizeof(uint32_t) * (node_num + 1));
+        if (off_in_edges + M_SNAP_ALIGN(sizeof(uint32_t) * edge_num) != size) {
+            DBG_PRINTF("fail: snapshot size\n");
+            goto LABEL_EXIT;
+        }
+
+        const node_key_t *p_nodes = (const node_key_t *)(p + off_nodes);
+        const uint32_t *p_edge_start = (const uint32_t *)(p + off_edge_start);
+        const edge_t *p_edges = (const edge_t *)(p + off_edges);
+        const uint32_t *p_in_start = (const uint32_t *)(p + off_in_start);
+        const uint32_t *p_in_edges = (const uint32_t *)(p + off_in_edges);
+        if (!snap_check(node_num, edge_num, p_edge_start, p_edges, p_in_start, p_in_edges)) {
+            DBG_PRINTF("fail: snapshot broken\n");
+            goto LABEL_EXIT;
         }
+
+        pthread_mutex_lock(&mMuxGraph);
+        graph_clear();
+        mNodes.assign(p_nodes, p_nodes + node_num);
+        mNodeIndex.reserve(node_num);
+        for (uint32_t lp = 0; lp < node_num; lp++) {
+            mNodeIndex.insert(std::make_pair(mNodes[lp], lp));
+        }
+        mEdgeStart.assign(p_edge_start, p_edge_start + node_num + 1);
+        mEdges.assign(p_edges, p_edges + edge_num);
+        mInStart.assign(p_in_start, p_in_start + node_num + 1);
+        mInEdges.assign(p_in_edges, p_in_edges + edge_num);
+        //channel情報は持たないので、edgeを作り直さない
+        mEdgeDirty = false;
+        skip_load();
+        mGraphLoaded = true;
+        mGraphSnap = true;
+        pthread_mutex_unlock(&mMuxGraph);
+        DBG_PRINTF("snapshot: node=%d, edge=%d, created=%" PRIu64 "\n", (int)node_num, (int)edge_num, p_hdr->created);
+        ret = true;
     }
 
-    ln_db_node_cur_commit(p_db_anno);
+LABEL_EXIT:
+    munmap(p_map, size);
+    return ret;
+}
 
-    return true;
+
+bool ln_routing_refresh(void)
+{
+    bool ret;
+
+    pthread_mutex_lock(&mMuxGraph);
+    if (mGraphFrozen) {
+        DBG_PRINTF("fail: graph frozen\n");
+        ret = false;
+    } else if (!mGraphLoaded || mGraphSnap) {
+        //差分を取れないので構築し直す
+        ret = graph_load();
+    } else {
+        ret = graph_refresh();
+    }
+    pthread_mutex_unlock(&mMuxGraph);
+
+    return ret;
 }
 
 
-static graph_t::vertex_descriptor ver_add(graph_t& g, const uint8_t *pNodeId)
+bool ln_routing_freeze(void)
 {
-    graph_t::vertex_descriptor v = static_cast<graph_t::vertex_descriptor>(-1);
-    bool ret = false;
+    bool ret = true;
 
-    std::pair<graph_t::vertex_iterator, graph_t::vertex_iterator> ver_its = vertices(g);
-    for (graph_t::vertex_iterator st = ver_its.first, et = ver_its.second; st != et; st++) {
-        if (memcmp(g[*st].p_node, pNodeId, UCOIN_SZ_PUBKEY) == 0) {
-            ret = true;
-            v = *st;
-            break;
-        }
+    pthread_mutex_lock(&mMuxGraph);
+    if (!mGraphLoaded) {
+        ret = graph_load();
     }
-    if (!ret) {
-        v = add_vertex(g);
-        g[v].p_node = pNodeId;
+    if (ret) {
+        if (mEdgeDirty) {
+            graph_build_edges();
+        }
+        __atomic_store_n(&mGraphFrozen, true, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&mMuxGraph);
 
-    return v;
+    return ret;
 }
 
 
@@ -323,47 +2449,77 @@ lnerr_route_t ln_routing_calculate(
         uint32_t CltvExpiry,
         uint64_t AmountMsat,
         uint8_t AddNum,
-        const ln_fieldr_t *pAddRoute)
+        const ln_fieldr_t *pAddRoute,
+        const ln_routing_param_t *pParam)
 {
-    pResult->hop_num = 0;
+    uint8_t num = 1;
+    return ln_routing_calculate_paths(pResult, &num, pPayerId, pPayeeId,
+                    CltvExpiry, AmountMsat, AddNum, pAddRoute, pParam);
+}
+
+
+lnerr_route_t ln_routing_calculate_paths(
+        ln_routing_result_t *pResult,
+        uint8_t *pNum,
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_fieldr_t *pAddRoute,
+        const ln_routing_param_t *pParam)
+{
+    uint8_t max_num = *pNum;
 
-    nodes_result_t rt_res;
-    rt_res.node_num = 0;
-    rt_res.p_nodes = NULL;
+    *pNum = 0;
+    if (max_num == 0) {
+        return LNROUTE_PARAM;
+    }
+    pResult->hop_num = 0;
 
     if ((pPayerId == NULL) || (pPayeeId == NULL)) {
         DBG_PRINTF("fail: null input\n");
         return LNROUTE_PARAM;
     }
 
-    bool ret = loaddb(&rt_res, pPayerId);
-    if (!ret) {
-        DBG_PRINTF("fail: loaddb\n");
-        return LNROUTE_LOADDB;
+    ln_routing_param_t param;
+    if (pParam != NULL) {
+        param = *pParam;
+    } else {
+        //既存の呼び出し元と同じ結果になるよう、fee_base_msatだけで探索する
+        memset(&param, 0, sizeof(param));
+        param.weight = LN_ROUTING_WEIGHT_BASEFEE;
+        param.algo = LN_ROUTING_ALGO_DIJKSTRA;
+    }
+    if ((param.max_hop == 0) || (param.max_hop > LN_HOP_MAX)) {
+        param.max_hop = LN_HOP_MAX;
+    }
+
+    //graph固定時は、DB検索を排他にする(mdb_dbi_open()は並列に呼べない)
+    //  固定は解除されないので、lock前に参照してよい
+    bool frozen = __atomic_load_n(&mGraphFrozen, __ATOMIC_ACQUIRE);
+    if (frozen) {
+        pthread_rwlock_wrlock(&mRwGraph);
     }
 
-    if (AddNum > 0) {
-        int node_num = rt_res.node_num;
-        rt_res.node_num += AddNum;
-        rt_res.p_nodes = (nodes_t *)realloc(rt_res.p_nodes, sizeof(nodes_t) * rt_res.node_num);
+    //self
+    std::vector<tmp_edge_t> tmp_edges;
+    param_self_t prm_self;
 
-        for (uint8_t lp = 0; lp < AddNum; lp++) {
-            nodes_t *p_nodes = &rt_res.p_nodes[node_num - 1];
+    prm_self.p_edges = &tmp_edges;
+    prm_self.p_payer = pPayerId;
+    ln_db_self_search(comp_func_self, &prm_self);
 
-            // add_node(0) --> payee(1)
-            p_nodes->short_channel_id = pAddRoute[lp].short_channel_id;
-            const uint8_t *p1, *p2;
-            int dir = direction(&p1, &p2, pAddRoute[lp].node_id, pPayeeId);
-            memcpy(p_nodes->ninfo[0].node_id, p1, UCOIN_SZ_PUBKEY);
-            memcpy(p_nodes->ninfo[1].node_id, p2, UCOIN_SZ_PUBKEY);
-            p_nodes->ninfo[0].cltv_expiry_delta = M_CLTV_INIT;     //未設定
-            p_nodes->ninfo[1].cltv_expiry_delta = M_CLTV_INIT;     //未設定
-            p_nodes->ninfo[dir].fee_base_msat = pAddRoute[lp].fee_base_msat;
-            p_nodes->ninfo[dir].fee_prop_millionths = pAddRoute[lp].fee_prop_millionths;
-            p_nodes->ninfo[dir].cltv_expiry_delta = pAddRoute[lp].cltv_expiry_delta;
-            p_nodes->ninfo[dir].htlc_minimum_msat = 0;
-            node_num++;
-        }
+    //r field: add_node --> payee
+    for (uint8_t lp = 0; lp < AddNum; lp++) {
+        tmp_edge_t edge;
+        memcpy(edge.node_from, pAddRoute[lp].node_id, UCOIN_SZ_PUBKEY);
+        memcpy(edge.node_to, pPayeeId, UCOIN_SZ_PUBKEY);
+        edge.short_channel_id = pAddRoute[lp].short_channel_id;
+        edge.fee_base_msat = pAddRoute[lp].fee_base_msat;
+        edge.fee_prop_millionths = pAddRoute[lp].fee_prop_millionths;
+        edge.cltv_expiry_delta = pAddRoute[lp].cltv_expiry_delta;
+        tmp_edges.push_back(edge);
     }
 
     DBG_PRINTF("start nodeid : ");
@@ -371,168 +2527,157 @@ lnerr_route_t ln_routing_calculate(
     DBG_PRINTF("end nodeid   : ");
     ucoin_util_dumpbin(stderr, pPayeeId, UCOIN_SZ_PUBKEY, true);
 
-    graph_t g;
+    lnerr_route_t rerr = LNROUTE_NONE;
 
-    bool set_start = false;
-    bool set_goal = false;
-    graph_t::vertex_descriptor pnt_start = static_cast<graph_t::vertex_descriptor>(-1);
-    graph_t::vertex_descriptor pnt_goal = static_cast<graph_t::vertex_descriptor>(-1);
-
-    //Edge追加
-    for (uint32_t lp = 0; lp < rt_res.node_num; lp++) {
-        // DBG_PRINTF("  short_channel_id=%016" PRIx64 "\n", rt_res.p_nodes[lp].short_channel_id);
-        // DBG_PRINTF("    [1]");
-        // ucoin_util_dumpbin(stderr, rt_res.p_nodes[lp].ninfo[0].node_id, UCOIN_SZ_PUBKEY, true);
-        // DBG_PRINTF("    [2]");
-        // ucoin_util_dumpbin(stderr, rt_res.p_nodes[lp].ninfo[1].node_id, UCOIN_SZ_PUBKEY, true);
-        // DBG_PRINTF("\n");
-
-        graph_t::vertex_descriptor node1 = ver_add(g, rt_res.p_nodes[lp].ninfo[0].node_id);
-        graph_t::vertex_descriptor node2 = ver_add(g, rt_res.p_nodes[lp].ninfo[1].node_id);
+    if (!frozen) {
+        pthread_mutex_lock(&mMuxGraph);
+        if (mGraphFrozen) {
+            //lock待ちの間に固定された
+            pthread_mutex_unlock(&mMuxGraph);
+            frozen = true;
+            pthread_rwlock_wrlock(&mRwGraph);
+        }
+    }
 
-        if (!set_start) {
-            if (memcmp(rt_res.p_nodes[lp].ninfo[0].node_id, pPayerId, UCOIN_SZ_PUBKEY) == 0) {
-                pnt_start = node1;
-                set_start = true;
-            } else if (memcmp(rt_res.p_nodes[lp].ninfo[1].node_id, pPayerId, UCOIN_SZ_PUBKEY) == 0) {
-                pnt_start = node2;
-                set_start = true;
-            }
+    if (!mGraphLoaded) {
+        //ucoind以外(routingコマンドなど)は、最初の計算時に構築する
+        if (!graph_load()) {
+            DBG_PRINTF("fail: loaddb\n");
+            rerr = LNROUTE_LOADDB;
         }
-        if (!set_goal) {
-            if (memcmp(rt_res.p_nodes[lp].ninfo[0].node_id, pPayeeId, UCOIN_SZ_PUBKEY) == 0) {
-                pnt_goal = node1;
-                set_goal = true;
-            } else if (memcmp(rt_res.p_nodes[lp].ninfo[1].node_id, pPayeeId, UCOIN_SZ_PUBKEY) == 0) {
-                pnt_goal = node2;
-                set_goal = true;
-            }
+    }
+    if (rerr == LNROUTE_NONE) {
+        if (mEdgeDirty) {
+            graph_build_edges();
+        }
+        if (frozen) {
+            //探索はgraphを参照するだけなので共有lockにする
+            pthread_rwlock_unlock(&mRwGraph);
+            pthread_rwlock_rdlock(&mRwGraph);
         }
 
-        if (node1 != node2) {
-            if (rt_res.p_nodes[lp].ninfo[0].cltv_expiry_delta != M_CLTV_INIT) {
-                //channel_update1
-                bool inserted = false;
-                graph_t::edge_descriptor e1;
-
-                boost::tie(e1, inserted) = add_edge(node1, node2, g);
-                g[e1].short_channel_id = rt_res.p_nodes[lp].short_channel_id;
-                g[e1].fee_base_msat = rt_res.p_nodes[lp].ninfo[0].fee_base_msat;
-                g[e1].fee_prop_millionths = rt_res.p_nodes[lp].ninfo[0].fee_prop_millionths;
-                g[e1].cltv_expiry_delta = rt_res.p_nodes[lp].ninfo[0].cltv_expiry_delta;
-                g[e1].node_id = rt_res.p_nodes[lp].ninfo[0].node_id;
-            }
-            if (rt_res.p_nodes[lp].ninfo[1].cltv_expiry_delta != M_CLTV_INIT) {
-                //channel_update2
-                bool inserted = false;
-                graph_t::edge_descriptor e2;
-
-                boost::tie(e2, inserted) = add_edge(node2, node1, g);
-                g[e2].short_channel_id = rt_res.p_nodes[lp].short_channel_id;
-                g[e2].fee_base_msat = rt_res.p_nodes[lp].ninfo[1].fee_base_msat;
-                g[e2].fee_prop_millionths = rt_res.p_nodes[lp].ninfo[1].fee_prop_millionths;
-                g[e2].cltv_expiry_delta = rt_res.p_nodes[lp].ninfo[1].cltv_expiry_delta;
-                g[e2].node_id = rt_res.p_nodes[lp].ninfo[1].node_id;
+        //計算時だけ追加するedge
+        //  graphに無いnodeはoverlayに追加し、計算後に破棄する
+        overlay_t overlay;
+        for (size_t lp = 0; lp < tmp_edges.size(); lp++) {
+            edge_t edge;
+            edge.node_from = overlay_add(&overlay, tmp_edges[lp].node_from);
+            edge.node_to = overlay_add(&overlay, tmp_edges[lp].node_to);
+            if (edge.node_from == edge.node_to) {
+                continue;
             }
+            edge.short_channel_id = tmp_edges[lp].short_channel_id;
+            edge.htlc_minimum_msat = 0;
+            edge.fee_base_msat = tmp_edges[lp].fee_base_msat;
+            edge.fee_prop_millionths = tmp_edges[lp].fee_prop_millionths;
+            edge.cltv_expiry_delta = tmp_edges[lp].cltv_expiry_delta;
+            overlay.edges.push_back(edge);
         }
+
+        rerr = calc_paths(pResult, pNum, max_num, pPayerId, pPayeeId,
+                    CltvExpiry, AmountMsat, AddNum, pAddRoute, overlay, &param);
     }
 
-    //DBG_PRINTF("pnt_start=%d, pnt_goal=%d\n", (int)pnt_start, (int)pnt_goal);
-    if (!set_start) {
-        DBG_PRINTF("fail: no start node\n");
-        return LNROUTE_NOSTART;
+    if (frozen) {
+        pthread_rwlock_unlock(&mRwGraph);
+    } else {
+        pthread_mutex_unlock(&mMuxGraph);
     }
-    if (!set_goal) {
-        DBG_PRINTF("fail: no goal node\n");
-        return LNROUTE_NOGOAL;
+
+    return rerr;
+}
+
+
+void ln_routing_cache_stat(uint64_t *pHit, uint64_t *pMiss, uint32_t *pNum)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    *pHit = mCacheHit;
+    *pMiss = mCacheMiss;
+    *pNum = (uint32_t)mCache.size();
+    pthread_mutex_unlock(&mMuxGraph);
+}
+
+
+void ln_routing_mc_fail(const ln_hop_datain_t *pHopDatain, int HopNum, int ErrHop, const ln_onion_err_t *pOnionErr)
+{
+    //pHopDatain[0]は送金元なので、エラーを返したnodeはpHopDatain[ErrHop + 1]
+    int err_node = ErrHop + 1;
+    if ((err_node < 1) || (err_node >= HopNum)) {
+        DBG_PRINTF("fail: invalid hop(%d)\n", ErrHop);
+        return;
     }
 
-    std::vector<vertex_descriptor> p(num_vertices(g));      //parent
-    std::vector<int> d(num_vertices(g));
-    dijkstra_shortest_paths(g, pnt_start,
-                        weight_map(boost::get(&Fee::fee_base_msat, g)).
-                        predecessor_map(&p[0]).
-                        distance_map(&d[0]));
+    time_t now = time(NULL);
+    pthread_mutex_lock(&mMuxGraph);
 
-    if (p[pnt_goal] == pnt_goal) {
-        DBG_PRINTF("fail: cannot find route\n");
-        free(rt_res.p_nodes);
-        return LNROUTE_NOTFOUND;
+    mc_prune(now);
+    if (pOnionErr->reason & LNERR_ONION_BADONION) {
+        //onionを転送したnodeが壊した
+        mc_success_hops(pHopDatain, err_node - 1);
+        if (err_node >= 2) {
+            mc_fail_node(pHopDatain[err_node - 1].pubkey, now);
+        }
+    } else {
+        //エラーを返したnodeまでは送金できている
+        mc_success_hops(pHopDatain, err_node);
+        if (err_node == HopNum - 1) {
+            //送金先のエラーは経路によらない
+        } else if (pOnionErr->reason & LNERR_ONION_NODE) {
+            mc_fail_node(pHopDatain[err_node].pubkey, now);
+        } else {
+            //temporary_channel_failureは残高不足とみなし、送金額以上だけ失敗扱い
+            const ln_hop_datain_t *p_hop = &pHopDatain[err_node];
+            uint64_t amount = (pOnionErr->reason == LNONION_TMP_CHAN_FAIL) ? p_hop->amt_to_forward : 0;
+            mc_t *p_mc = &mMcChan[p_hop->short_channel_id].dir[mc_dir(p_hop->pubkey, pHopDatain[err_node + 1].pubkey)];
+            if ((p_mc->fail_time != 0) && (p_mc->fail_amount < amount)) {
+                amount = p_mc->fail_amount;
+            }
+            p_mc->fail_time = now;
+            p_mc->fail_amount = amount;
+            cache_invalidate(p_hop->short_channel_id);
+            DBG_PRINTF("mission control: channel %016" PRIx64 ", amount=%" PRIu64 "\n", p_hop->short_channel_id, amount);
+        }
     }
 
-    //逆順に入っているので、並べ直す
-    //ついでに、min_final_cltv_expiryを足す
-    std::deque<vertex_descriptor> route;        //std::vectorにはpush_front()がない
-    std::deque<uint64_t> msat;
-    std::deque<uint32_t> cltv;
+    pthread_mutex_unlock(&mMuxGraph);
+}
 
-    route.push_front(pnt_goal);
-    msat.push_front(AmountMsat);
-    cltv.push_front(CltvExpiry);
 
-    for (vertex_descriptor v = pnt_goal; v != pnt_start; v = p[v]) {
-        bool found;
-        graph_t::edge_descriptor e;
-        boost::tie(e, found) = edge(p[v], v, g);
-        if (!found) {
-            DBG_PRINTF("not foooooooooound\n");
-            abort();
-        }
+void ln_routing_mc_success(const ln_hop_datain_t *pHopDatain, int HopNum)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    mc_success_hops(pHopDatain, HopNum - 1);
+    pthread_mutex_unlock(&mMuxGraph);
+}
 
-        route.push_front(p[v]);
-        msat.push_front(AmountMsat);
-        cltv.push_front(CltvExpiry);
 
-        AmountMsat = AmountMsat + edgefee(AmountMsat, g[e].fee_base_msat, g[e].fee_prop_millionths);
-        CltvExpiry += g[e].cltv_expiry_delta;
-    }
+void ln_routing_mc_stat(uint32_t *pChanNum, uint32_t *pNodeNum)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    *pChanNum = (uint32_t)mMcChan.size();
+    *pNodeNum = (uint32_t)mMcNode.size();
+    pthread_mutex_unlock(&mMuxGraph);
+}
 
-    if (route.size() > LN_HOP_MAX + 1) {
-        //先頭に自ノードが入るため+1
-        DBG_PRINTF("fail: too many hops\n");
-        free(rt_res.p_nodes);
-        return LNROUTE_TOOMANYHOP;
-    }
 
-    //戻り値の作成
-    pResult->hop_num = (uint8_t)route.size();
-    const uint8_t *p_next;
+bool ln_routing_check_skip(const ln_routing_result_t *pResult)
+{
+    bool ret = true;
 
+    pthread_mutex_lock(&mMuxGraph);
+    if (!mSkipLoaded) {
+        skip_load();
+    }
     for (int lp = 0; lp < pResult->hop_num - 1; lp++) {
-        const uint8_t *p_now  = g[route[lp]].p_node;
-        p_next = g[route[lp + 1]].p_node;
-
-        const uint8_t *p_node_id1;
-        const uint8_t *p_node_id2;
-        direction(&p_node_id1, &p_node_id2, p_now, p_next);
-        uint64_t sci = 0;
-        for (uint32_t lp3 = 0; lp3 < rt_res.node_num; lp3++) {
-            if ( (memcmp(p_node_id1, rt_res.p_nodes[lp3].ninfo[0].node_id, UCOIN_SZ_PUBKEY) == 0) &&
-                 (memcmp(p_node_id2, rt_res.p_nodes[lp3].ninfo[1].node_id, UCOIN_SZ_PUBKEY) == 0) ) {
-                sci = rt_res.p_nodes[lp3].short_channel_id;
-                break;
-            }
-        }
-        if (sci == 0) {
-            DBG_PRINTF("not match!\n");
-            abort();
+        if (mSkip.find(pResult->hop_datain[lp].short_channel_id) != mSkip.end()) {
+            DBG_PRINTF("skip : %016" PRIx64 "\n", pResult->hop_datain[lp].short_channel_id);
+            ret = false;
+            break;
         }
-
-        pResult->hop_datain[lp].short_channel_id = sci;
-        pResult->hop_datain[lp].amt_to_forward = msat[lp];
-        pResult->hop_datain[lp].outgoing_cltv_value = cltv[lp];
-        memcpy(pResult->hop_datain[lp].pubkey, p_now, UCOIN_SZ_PUBKEY);
     }
+    pthread_mutex_unlock(&mMuxGraph);
 
-    //最後
-    pResult->hop_datain[pResult->hop_num - 1].short_channel_id = 0;
-    pResult->hop_datain[pResult->hop_num - 1].amt_to_forward = msat[pResult->hop_num - 1];
-    pResult->hop_datain[pResult->hop_num - 1].outgoing_cltv_value = cltv[pResult->hop_num - 1];
-    memcpy(pResult->hop_datain[pResult->hop_num - 1].pubkey, p_next, UCOIN_SZ_PUBKEY);
-
-    free(rt_res.p_nodes);
-
-    return LNROUTE_NONE;
+    return ret;
 }
 
 
@@ -546,3 +2691,105 @@ void ln_routing_clear_skipdb(void)
     bret = ln_db_annoskip_invoice_drop();
     DBG_PRINTF("%s: clear invoice DB\n", (bret) ? "OK" : "fail");
 }
+
+
+/********************************************************************
+ * graph更新(ln_db_lmdb.c)
+ ********************************************************************/
+
+void HIDDEN ln_routing_add_cnlanno(const ucoin_buf_t *pCnlAnno)
+{
+    uint64_t short_channel_id;
+    uint8_t node_id1[UCOIN_SZ_PUBKEY];
+    uint8_t node_id2[UCOIN_SZ_PUBKEY];
+
+    if (!ln_getids_cnl_anno(&short_channel_id, node_id1, node_id2, pCnlAnno->buf, pCnlAnno->len)) {
+        return;
+    }
+
+    //channel_announcementより先に受信したchannel_updateがDBにあれば反映する
+    ln_cnl_update_t upd[2];
+    bool ret[2];
+    for (int lp = 0; lp < 2; lp++) {
+        ucoin_buf_t buf_upd = UCOIN_BUF_INIT;
+        uint32_t timestamp;
+
+        ret[lp] = ln_db_annocnlupd_load(&buf_upd, &timestamp, short_channel_id, lp);
+        if (ret[lp]) {
+            ret[lp] = ln_getparams_cnl_upd(&upd[lp], buf_upd.buf, buf_upd.len);
+        }
+        ucoin_buf_free(&buf_upd);
+    }
+
+    pthread_mutex_lock(&mMuxGraph);
+    if (mGraphLoaded && !mGraphFrozen) {
+        channel_t *p_chan = graph_add_channel(short_channel_id, node_id1, node_id2);
+        for (int lp = 0; lp < 2; lp++) {
+            if (ret[lp]) {
+                graph_set_update(p_chan, &upd[lp]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&mMuxGraph);
+}
+
+
+void HIDDEN ln_routing_set_cnlupd(const ln_cnl_update_t *pUpd)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    if (mGraphLoaded && !mGraphFrozen) {
+        channel_map_t::iterator it = mChannels.find(pUpd->short_channel_id);
+        if (it != mChannels.end()) {
+            graph_set_update(&it->second, pUpd);
+            cache_invalidate(pUpd->short_channel_id);
+        } else {
+            //channel_announcement受信時に反映する
+        }
+    }
+    pthread_mutex_unlock(&mMuxGraph);
+}
+
+
+void HIDDEN ln_routing_del_channel(uint64_t ShortChannelId)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    if (mGraphLoaded && !mGraphFrozen) {
+        graph_del_channel(ShortChannelId);
+        cache_invalidate(ShortChannelId);
+    }
+    pthread_mutex_unlock(&mMuxGraph);
+}
+
+
+void HIDDEN ln_routing_skip_channel(uint64_t ShortChannelId, bool bTemp)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    if (mSkipLoaded) {
+        mSkip[ShortChannelId] = bTemp;
+    }
+    cache_invalidate(ShortChannelId);
+    pthread_mutex_unlock(&mMuxGraph);
+}
+
+
+void HIDDEN ln_routing_skip_clear(bool bTemp)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    size_t num = mSkip.size();
+    if (bTemp) {
+        for (std::unordered_map<uint64_t, bool>::iterator it = mSkip.begin(); it != mSkip.end(); ) {
+            if (it->second) {
+                it = mSkip.erase(it);
+            } else {
+                it++;
+            }
+        }
+    } else {
+        mSkip.clear();
+    }
+    if (!mSkipLoaded || (num != mSkip.size())) {
+        //除外していたchannelが使えるようになるので、全経路を計算し直す
+        cache_clear();
+    }
+    pthread_mutex_unlock(&mMuxGraph);
+}
@@ -0,0 +1,342 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ucoin_ecc_mbedtls.c
+ *  @brief  bitcoin処理: ECDSA(mbedtls)
+ *
+ *  UCOIN_USE_SECP256K1未定義時のECDSA backend。
+ */
+#ifndef UCOIN_USE_SECP256K1
+
+#include "ucoin_local.h"
+
+#include "mbedtls/ecdsa.h"
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool ucoin_ecc_sign_rs(uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPrivKey)
+{
+    int ret;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+    mbedtls_mpi d;
+    mbedtls_mpi r, s;
+
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    ret = mbedtls_mpi_read_binary(&d, pPrivKey, UCOIN_SZ_PRIVKEY);
+    if (ret) {
+        DBG_PRINTF("FAIL: ecdsa_sign: %d\n", ret);
+        goto LABEL_EXIT;
+    }
+
+    //canonizeするため、ecdsa.cのmbedtls_ecdsa_write_signature()をまねる
+    ret = mbedtls_ecdsa_sign_det(p_grp, &r, &s, &d,
+                    pHash, UCOIN_SZ_HASH256, MBEDTLS_MD_SHA256);
+    if (ret) {
+        DBG_PRINTF("FAIL: ecdsa_sign: %d\n", ret);
+        goto LABEL_EXIT;
+    }
+    mbedtls_mpi half_n;
+    mbedtls_mpi_init(&half_n);
+    mbedtls_mpi_copy(&half_n, &p_grp->N);
+    mbedtls_mpi_shift_r(&half_n, 1);
+    if (mbedtls_mpi_cmp_mpi(&s, &half_n) == 1) {
+        mbedtls_mpi_sub_mpi(&s, &p_grp->N, &s);
+    }
+    mbedtls_mpi_free(&half_n);
+
+    ret = mbedtls_mpi_write_binary(&r, pRS, UCOIN_SZ_FIELD);
+    if (ret == 0) {
+        ret = mbedtls_mpi_write_binary(&s, pRS + UCOIN_SZ_FIELD, UCOIN_SZ_FIELD);
+    }
+
+LABEL_EXIT:
+    mbedtls_mpi_lset(&d, 0);            //clear for security
+    mbedtls_mpi_free(&d);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+
+    return ret == 0;
+}
+
+
+bool ucoin_ecc_verify_rs(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKey)
+{
+    int ret;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+    mbedtls_mpi r, s;
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
+
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    ret = mbedtls_mpi_read_binary(&r, pRS, UCOIN_SZ_FIELD);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_read_binary(&s, pRS + UCOIN_SZ_FIELD, UCOIN_SZ_FIELD);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = ucoin_util_ecp_point_read_binary2(&Q, pPubKey);
+    if (!ret) {
+        ret = mbedtls_ecdsa_verify(p_grp, pHash, UCOIN_SZ_HASH256, &Q, &r, &s);
+    } else {
+        DBG_PRINTF("fail pubkey\n");
+    }
+
+LABEL_EXIT:
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+
+    return ret == 0;
+}
+
+
+bool ucoin_ecc_verify_rs_uncomp(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKeyUncomp)
+{
+    int ret;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+    mbedtls_mpi r, s;
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
+
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    ret = mbedtls_mpi_read_binary(&r, pRS, UCOIN_SZ_FIELD);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_read_binary(&s, pRS + UCOIN_SZ_FIELD, UCOIN_SZ_FIELD);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+
+    //圧縮公開鍵の展開(平方根計算)を行わずに済む
+    uint8_t pub[1 + UCOIN_SZ_PUBKEY_UNCOMP];
+    pub[0] = 0x04;
+    memcpy(pub + 1, pPubKeyUncomp, UCOIN_SZ_PUBKEY_UNCOMP);
+    ret = mbedtls_ecp_point_read_binary(p_grp, &Q, pub, sizeof(pub));
+    if (!ret) {
+        ret = mbedtls_ecdsa_verify(p_grp, pHash, UCOIN_SZ_HASH256, &Q, &r, &s);
+    } else {
+        DBG_PRINTF("fail pubkey\n");
+    }
+
+LABEL_EXIT:
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+
+    return ret == 0;
+}
+
+
+bool ucoin_ecc_recover_pubkey(uint8_t *pPubKey, int RecId, const uint8_t *pRS, const uint8_t *pHash)
+{
+    bool bret = false;
+    int ret;
+
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+    mbedtls_mpi me;
+    mbedtls_mpi r, s;
+    mbedtls_mpi inv_r;
+    mbedtls_mpi x;
+    mbedtls_mpi tmpx;
+    mbedtls_ecp_point R;
+    mbedtls_ecp_point nR;
+    mbedtls_ecp_point pub;
+
+    mbedtls_mpi_init(&me);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    mbedtls_mpi_init(&inv_r);
+    mbedtls_mpi_init(&x);
+    mbedtls_mpi_init(&tmpx);
+    mbedtls_ecp_point_init(&R);
+    mbedtls_ecp_point_init(&nR);
+    mbedtls_ecp_point_init(&pub);
+
+    // 1.5
+    //      e = Hash(M)
+    //      me = -e
+    ret = mbedtls_mpi_read_binary(&me, pHash, UCOIN_SZ_SIGHASH);
+    assert(ret == 0);
+
+    mbedtls_mpi zero;
+    mbedtls_mpi_init(&zero);
+    mbedtls_mpi_lset(&zero, 0);
+    ret = mbedtls_mpi_sub_mpi(&me, &zero, &me);
+    assert(ret == 0);
+    ret = mbedtls_mpi_mod_mpi(&me, &me, &p_grp->N);
+    assert(ret == 0);
+    mbedtls_mpi_free(&zero);
+
+    ret = mbedtls_mpi_read_binary(&r, pRS, UCOIN_SZ_FIELD);
+    assert(ret == 0);
+    ret = mbedtls_mpi_read_binary(&s, pRS + UCOIN_SZ_FIELD, UCOIN_SZ_FIELD);
+    assert(ret == 0);
+
+    //      inv_r = r^-1
+    ret = mbedtls_mpi_inv_mod(&inv_r, &r, &p_grp->N);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+
+    // 1.1
+    //      x = r + jn  (j: RecIdのb1)
+    ret = mbedtls_mpi_mul_int(&tmpx, &p_grp->N, (RecId & 0x02) >> 1);
+    assert(ret == 0);
+    ret = mbedtls_mpi_add_mpi(&x, &r, &tmpx);
+    assert(ret == 0);
+    p_grp->modp(&x);
+
+    // 1.3
+    //      R = 02 || x
+    uint8_t pubx[UCOIN_SZ_PUBKEY];
+    pubx[0] = 0x02;
+    ret = mbedtls_mpi_write_binary(&x, pubx + 1, UCOIN_SZ_FIELD);
+    assert(ret == 0);
+    ret = ucoin_util_ecp_point_read_binary2(&R, pubx);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+
+    // 1.4
+    //      error if nR != 0
+    ret = mbedtls_ecp_mul(p_grp, &nR, &p_grp->N, &R, NULL, NULL);
+    if ((ret == 0) || !mbedtls_ecp_is_zero(&nR)) {
+        DBG_PRINTF2("[%d]1.4 error(ret=%04x)\n", RecId, ret);
+        goto LABEL_EXIT;
+    }
+
+    // 1.6.3
+    //      RecIdのb0が1ならば-R
+    if (RecId & 0x01) {
+        ret = mbedtls_mpi_sub_mpi(&R.Y, &p_grp->P, &R.Y);        // -R.Y = P - R.Yになる(mod P不要)
+        assert(ret == 0);
+    }
+
+    // 1.6.1
+    //      Q = r^-1 * (sR - eG)
+
+    //      (sR - eG)
+    ret = mbedtls_ecp_muladd(p_grp, &pub, &s, &R, &me, &p_grp->G);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    //      Q = r^-1 * Q
+    ret = mbedtls_ecp_mul(p_grp, &pub, &inv_r, &pub, NULL, NULL);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+
+    size_t sz;
+    ret = mbedtls_ecp_point_write_binary(
+                        p_grp, &pub, MBEDTLS_ECP_PF_COMPRESSED,
+                        &sz, pPubKey, UCOIN_SZ_PUBKEY);
+    bret = (ret == 0);
+
+LABEL_EXIT:
+    mbedtls_ecp_point_free(&pub);
+    mbedtls_ecp_point_free(&nR);
+    mbedtls_ecp_point_free(&R);
+    mbedtls_mpi_free(&tmpx);
+    mbedtls_mpi_free(&x);
+    mbedtls_mpi_free(&s);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&inv_r);
+    mbedtls_mpi_free(&me);
+
+    return bret;
+}
+
+
+bool ucoin_ecc_priv2pub(uint8_t *pPubKey, const uint8_t *pPrivKey)
+{
+    int ret;
+
+    mbedtls_ecp_point P;
+    mbedtls_mpi m;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+
+    mbedtls_ecp_point_init(&P);
+    mbedtls_mpi_init(&m);
+
+    //P:result, m:掛ける数値, grp.G:point
+    ret = mbedtls_mpi_read_binary(&m, pPrivKey, UCOIN_SZ_PRIVKEY);
+    if (ret) {
+        assert(0);
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_ecp_mul(p_grp, &P, &m, &p_grp->G, NULL, NULL);
+    if (ret) {
+        assert(0);
+        goto LABEL_EXIT;
+    }
+
+    size_t sz;
+    ret = mbedtls_ecp_point_write_binary(p_grp, &P, MBEDTLS_ECP_PF_COMPRESSED, &sz, pPubKey, UCOIN_SZ_PUBKEY);
+
+LABEL_EXIT:
+    mbedtls_ecp_point_free(&P);
+    mbedtls_mpi_lset(&m, 0);            //clear for security
+    mbedtls_mpi_free(&m);
+
+    return ret == 0;
+}
+
+
+bool ucoin_ecc_mul_pubkey(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul, int MulLen)
+{
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+    mbedtls_ecp_point pub;
+    mbedtls_ecp_point_init(&pub);
+
+    int ret = ucoin_util_ecp_point_read_binary2(&pub, pPubKey);
+    if (!ret) {
+        mbedtls_ecp_point pnt;
+        mbedtls_mpi m;
+
+        mbedtls_ecp_point_init(&pnt);
+        mbedtls_mpi_init(&m);
+
+        mbedtls_mpi_read_binary(&m, pMul, MulLen);
+        mbedtls_ecp_mul(p_grp, &pnt, &m, &pub, NULL, NULL);  //TODO: RNGを指定すべきか？
+
+        //圧縮公開鍵
+        size_t sz;
+        ret = mbedtls_ecp_point_write_binary(p_grp, &pnt, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, UCOIN_SZ_PUBKEY);
+
+        mbedtls_ecp_point_free(&pnt);
+        mbedtls_mpi_free(&m);
+    }
+    mbedtls_ecp_point_free(&pub);
+
+    return ret == 0;
+}
+
+#endif  //!UCOIN_USE_SECP256K1
@@ -0,0 +1,218 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ucoin_ecc_secp256k1.c
+ *  @brief  bitcoin処理: ECDSA(libsecp256k1)
+ *
+ *  UCOIN_USE_SECP256K1定義時のECDSA backend。
+ *  libsecp256k1はsecp256k1専用の体演算、GLV endomorphismによるスカラー倍算、
+ *  生成元の事前計算テーブルを使うため、mbedtlsの汎用素体演算よりも署名/検証が速い。
+ *  署名、公開鍵生成、ECDHはconstant-timeで行われる(ECDHはecdh moduleを使う)。
+ *
+ *  署名はどちらのbackendもRFC6979(SHA256)によるk生成、low-Sのため、同じ結果になる。
+ */
+#ifdef UCOIN_USE_SECP256K1
+
+#include <pthread.h>
+
+#include "secp256k1.h"
+#include "secp256k1_recovery.h"
+#include "secp256k1_ecdh.h"
+
+#include "ucoin_local.h"
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static secp256k1_context    *mpCtx;                 ///< 署名/検証用context(生成後は読込みのみ)
+static pthread_once_t       mCtxOnce = PTHREAD_ONCE_INIT;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void ctx_create(void);
+static const secp256k1_context *ctx_get(void);
+static bool verify(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPub, size_t PubLen);
+static int ecdh_point(unsigned char *pOutput, const unsigned char *pX, const unsigned char *pY, void *pData);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool ucoin_ecc_sign_rs(uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPrivKey)
+{
+    secp256k1_ecdsa_signature sig;
+
+    //nonce生成はRFC6979、sはlow-Sになる
+    int ret = secp256k1_ecdsa_sign(ctx_get(), &sig, pHash, pPrivKey, NULL, NULL);
+    if (!ret) {
+        DBG_PRINTF("FAIL: ecdsa_sign\n");
+        return false;
+    }
+    secp256k1_ecdsa_signature_serialize_compact(ctx_get(), pRS, &sig);
+    return true;
+}
+
+
+bool ucoin_ecc_verify_rs(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKey)
+{
+    return verify(pRS, pHash, pPubKey, UCOIN_SZ_PUBKEY);
+}
+
+
+bool ucoin_ecc_verify_rs_uncomp(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKeyUncomp)
+{
+    uint8_t pub[1 + UCOIN_SZ_PUBKEY_UNCOMP];
+
+    pub[0] = 0x04;
+    memcpy(pub + 1, pPubKeyUncomp, UCOIN_SZ_PUBKEY_UNCOMP);
+    return verify(pRS, pHash, pub, sizeof(pub));
+}
+
+
+bool ucoin_ecc_recover_pubkey(uint8_t *pPubKey, int RecId, const uint8_t *pRS, const uint8_t *pHash)
+{
+    secp256k1_ecdsa_recoverable_signature sig;
+    secp256k1_pubkey pubkey;
+
+    int ret = secp256k1_ecdsa_recoverable_signature_parse_compact(ctx_get(), &sig, pRS, RecId);
+    if (ret) {
+        ret = secp256k1_ecdsa_recover(ctx_get(), &pubkey, &sig, pHash);
+    }
+    if (ret) {
+        size_t len = UCOIN_SZ_PUBKEY;
+        ret = secp256k1_ec_pubkey_serialize(ctx_get(), pPubKey, &len, &pubkey, SECP256K1_EC_COMPRESSED);
+    }
+    return ret != 0;
+}
+
+
+bool ucoin_ecc_priv2pub(uint8_t *pPubKey, const uint8_t *pPrivKey)
+{
+    secp256k1_pubkey pubkey;
+
+    int ret = secp256k1_ec_pubkey_create(ctx_get(), &pubkey, pPrivKey);
+    if (ret) {
+        size_t len = UCOIN_SZ_PUBKEY;
+        ret = secp256k1_ec_pubkey_serialize(ctx_get(), pPubKey, &len, &pubkey, SECP256K1_EC_COMPRESSED);
+    }
+    return ret != 0;
+}
+
+
+bool ucoin_ecc_mul_pubkey(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul, int MulLen)
+{
+    secp256k1_pubkey pubkey;
+    uint8_t mul[UCOIN_SZ_PRIVKEY];
+
+    if ((MulLen <= 0) || (MulLen > UCOIN_SZ_PRIVKEY)) {
+        DBG_PRINTF("fail: length\n");
+        return false;
+    }
+    int ret = secp256k1_ec_pubkey_parse(ctx_get(), &pubkey, pPubKey, UCOIN_SZ_PUBKEY);
+    if (!ret) {
+        DBG_PRINTF("fail: pubkey\n");
+        return false;
+    }
+    memset(mul, 0, sizeof(mul));
+    memcpy(mul + sizeof(mul) - MulLen, pMul, MulLen);
+    //hashせずに圧縮公開鍵を返す
+    ret = secp256k1_ecdh(ctx_get(), pResult, &pubkey, mul, ecdh_point, NULL);
+    memset(mul, 0, sizeof(mul));        //clear for security
+    return ret != 0;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** context生成
+ *
+ * 生成元の事前計算テーブルを作るため時間がかかる。プロセスで1回だけ行う。
+ */
+static void ctx_create(void)
+{
+    mpCtx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
+    assert(mpCtx != NULL);
+}
+
+
+/** context取得
+ *
+ * secp256k1_context_randomize()以外はcontextを書き換えないため、複数threadから同時に使用できる。
+ */
+static const secp256k1_context *ctx_get(void)
+{
+    pthread_once(&mCtxOnce, ctx_create);
+    return mpCtx;
+}
+
+
+/** 署名検証
+ *
+ * mbedtls backendと合わせるため、high-Sの署名も受け付ける。
+ *
+ * @param[in]   pRS         署名(r[32] || s[32])
+ * @param[in]   pHash       署名対象のhash
+ * @param[in]   pPub        公開鍵(圧縮 or 非圧縮)
+ * @param[in]   PubLen      pPub長
+ * @retval  true    検証OK
+ */
+static bool verify(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPub, size_t PubLen)
+{
+    secp256k1_ecdsa_signature sig;
+    secp256k1_pubkey pubkey;
+
+    int ret = secp256k1_ec_pubkey_parse(ctx_get(), &pubkey, pPub, PubLen);
+    if (!ret) {
+        DBG_PRINTF("fail keypair\n");
+        return false;
+    }
+    ret = secp256k1_ecdsa_signature_parse_compact(ctx_get(), &sig, pRS);
+    if (!ret) {
+        DBG_PRINTF("fail: signature\n");
+        return false;
+    }
+    (void)secp256k1_ecdsa_signature_normalize(ctx_get(), &sig, &sig);
+    return secp256k1_ecdsa_verify(ctx_get(), &sig, pHash, &pubkey) != 0;
+}
+
+
+/** ECDH結果の出力
+ *
+ * secp256k1_ecdh()標準のSHA256ではなく、mbedtls backendと同じ圧縮公開鍵を出力する。
+ */
+static int ecdh_point(unsigned char *pOutput, const unsigned char *pX, const unsigned char *pY, void *pData)
+{
+    (void)pData;
+
+    pOutput[0] = 0x02 | (pY[UCOIN_SZ_FIELD - 1] & 0x01);
+    memcpy(pOutput + 1, pX, UCOIN_SZ_FIELD);
+    return 1;
+}
+
+#endif  //UCOIN_USE_SECP256K1
@@ -106,39 +106,7 @@ bool ucoin_keys_priv2wif(char *pWifPriv, const uint8_t *pPrivKey)
 
 bool ucoin_keys_priv2pub(uint8_t *pPubKey, const uint8_t *pPrivKey)
 {
-    int ret;
-
-    mbedtls_ecp_point P;
-    mbedtls_mpi m;
-    mbedtls_ecp_keypair keypair;
-
-    mbedtls_ecp_point_init(&P);
-    mbedtls_mpi_init(&m);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    //P:result, m:掛ける数値, grp.G:point
-    ret = mbedtls_mpi_read_binary(&m, pPrivKey, UCOIN_SZ_PRIVKEY);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = mbedtls_ecp_mul(&keypair.grp, &P, &m, &keypair.grp.G, NULL, NULL);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-
-    size_t sz;
-    ret = mbedtls_ecp_point_write_binary(&keypair.grp, &P, MBEDTLS_ECP_PF_COMPRESSED, &sz, pPubKey, UCOIN_SZ_PUBKEY);
-
-LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-    mbedtls_ecp_point_free(&P);
-    mbedtls_mpi_lset(&m, 0);            //clear for security
-    mbedtls_mpi_free(&m);
-
-    return ret == 0;
+    return ucoin_ecc_priv2pub(pPubKey, pPrivKey);
 }
 
 
@@ -246,16 +214,15 @@ bool ucoin_keys_wit2waddr(char *pWAddr, const ucoin_buf_t *pWitScript)
 
 bool ucoin_keys_pubuncomp(uint8_t *pUncomp, const uint8_t *pPubKey)
 {
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
 
-    int ret = ucoin_util_set_keypair(&keypair, pPubKey);
+    int ret = ucoin_util_ecp_point_read_binary2(&Q, pPubKey);
     if (!ret) {
-        mbedtls_mpi_write_binary(&(keypair.Q.X), pUncomp, UCOIN_SZ_PUBKEY - 1);
-        mbedtls_mpi_write_binary(&(keypair.Q.Y), pUncomp + UCOIN_SZ_PUBKEY - 1, UCOIN_SZ_PUBKEY - 1);
+        mbedtls_mpi_write_binary(&(Q.X), pUncomp, UCOIN_SZ_PUBKEY - 1);
+        mbedtls_mpi_write_binary(&(Q.Y), pUncomp + UCOIN_SZ_PUBKEY - 1, UCOIN_SZ_PUBKEY - 1);
     }
-    mbedtls_ecp_keypair_free(&keypair);
+    mbedtls_ecp_point_free(&Q);
 
     return ret == 0;
 }
@@ -265,9 +232,7 @@ bool ucoin_keys_chkpriv(const uint8_t *pPrivKey)
 {
     bool cmp;
     mbedtls_mpi priv;
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    const mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
 
     mbedtls_mpi_init(&priv);
     mbedtls_mpi_read_binary(&priv, pPrivKey, UCOIN_SZ_PRIVKEY);
@@ -275,11 +240,10 @@ bool ucoin_keys_chkpriv(const uint8_t *pPrivKey)
     //pPrivKey = [0x01,  0xFFFF FFFF FFFF FFFF FFFF FFFF FFFF FFFE BAAE DCE6 AF48 A03B BFD2 5E8C D036 4140]
     cmp = (mbedtls_mpi_cmp_int(&priv, (mbedtls_mpi_sint)0) == 1);
     if (cmp) {
-        cmp = (mbedtls_mpi_cmp_mpi(&priv, &keypair.grp.N) == -1);
+        cmp = (mbedtls_mpi_cmp_mpi(&priv, &p_grp->N) == -1);
     }
 
     mbedtls_mpi_free(&priv);
-    mbedtls_ecp_keypair_free(&keypair);
 
     return cmp;
 }
@@ -287,12 +251,11 @@ bool ucoin_keys_chkpriv(const uint8_t *pPrivKey)
 
 bool ucoin_keys_chkpub(const uint8_t *pPubKey)
 {
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
 
-    int ret = ucoin_util_set_keypair(&keypair, pPubKey);
-    mbedtls_ecp_keypair_free(&keypair);
+    int ret = ucoin_util_ecp_point_read_binary2(&Q, pPubKey);
+    mbedtls_ecp_point_free(&Q);
 
     return ret == 0;
 }
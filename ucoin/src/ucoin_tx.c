@@ -26,7 +26,7 @@
 #include "ucoin_local.h"
 
 #include "mbedtls/asn1write.h"
-#include "mbedtls/ecdsa.h"
+#include "mbedtls/ecdsa.h"     //MBEDTLS_ECDSA_MAX_LEN
 
 #ifdef UCOIN_USE_PRINTFUNC
 #include <time.h>
@@ -38,9 +38,9 @@
  **************************************************************************/
 
 static bool is_valid_signature_encoding(const uint8_t *sig, uint16_t size);
-static int sign_rs(mbedtls_mpi *p_r, mbedtls_mpi *p_s, const uint8_t *pTxHash, const uint8_t *pPrivKey);
 static int ecdsa_signature_to_asn1( const mbedtls_mpi *r, const mbedtls_mpi *s,
                                     unsigned char *sig, size_t *slen );
+static bool signature_der2rs(uint8_t *pRS, const uint8_t *pSig);
 static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pOrgPubKey);
 
 static int get_varint(uint16_t *pLen, const uint8_t *pData);
@@ -602,19 +602,29 @@ bool ucoin_tx_sign_(ucoin_buf_t *pSig, const uint8_t *pTxHash, const uint8_t *pP
 {
     int ret;
     bool bret;
+    uint8_t rs[UCOIN_SZ_SIGN_RS];
     mbedtls_mpi r, s;
     unsigned char sig[MBEDTLS_ECDSA_MAX_LEN + 1];   //141 + 1 byte
     size_t slen = 0;
 
     ucoin_buf_init(pSig);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
 
-    ret = sign_rs(&r, &s, pTxHash, pPrivKey);
-    if (ret) {
+    bret = ucoin_ecc_sign_rs(rs, pTxHash, pPrivKey);
+    if (!bret) {
         assert(0);
+        ret = -1;
         goto LABEL_EXIT;
     }
 
-    ret = ecdsa_signature_to_asn1(&r, &s, sig, &slen);
+    ret = mbedtls_mpi_read_binary(&r, rs, UCOIN_SZ_FIELD);
+    if (ret == 0) {
+        ret = mbedtls_mpi_read_binary(&s, rs + UCOIN_SZ_FIELD, UCOIN_SZ_FIELD);
+    }
+    if (ret == 0) {
+        ret = ecdsa_signature_to_asn1(&r, &s, sig, &slen);
+    }
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
@@ -644,75 +654,43 @@ LABEL_EXIT:
 
 bool ucoin_tx_sign_rs_(uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPrivKey)
 {
-    int ret;
-    mbedtls_mpi r, s;
-
-    ret = sign_rs(&r, &s, pTxHash, pPrivKey);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-
-    ret = mbedtls_mpi_write_binary(&r, pRS, 32);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = mbedtls_mpi_write_binary(&s, pRS + 32, 32);
-    if (ret) {
+    bool ret = ucoin_ecc_sign_rs(pRS, pTxHash, pPrivKey);
+    if (!ret) {
         assert(0);
-        goto LABEL_EXIT;
-    }
-
-LABEL_EXIT:
-    mbedtls_mpi_free( &r );
-    mbedtls_mpi_free( &s );
-
-    if (ret) {
         DBG_PRINTF("fail\n");
     }
-    return ret == 0;
+    return ret;
 }
 
 
 bool ucoin_tx_verify(const ucoin_buf_t *pSig, const uint8_t *pTxHash, const uint8_t *pPubKey)
 {
-    int ret;
-    bool bret;
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    bool ret;
+    uint8_t rs[UCOIN_SZ_SIGN_RS];
 
     if (pSig->buf[pSig->len - 1] != SIGHASH_ALL) {
         //assert(0);
         DBG_PRINTF("fail: not SIGHASH_ALL\n");
-        ret = -1;
+        ret = false;
         goto LABEL_EXIT;
     }
-    bret = is_valid_signature_encoding(pSig->buf, pSig->len);
-    if (!bret) {
+    ret = is_valid_signature_encoding(pSig->buf, pSig->len);
+    if (!ret) {
         //assert(0);
         DBG_PRINTF("fail: invalid signature\n");
-        ret = -1;
         goto LABEL_EXIT;
     }
 
-    ret = ucoin_util_set_keypair(&keypair, pPubKey);
-    if (!ret) {
-        ret = mbedtls_ecdsa_read_signature((mbedtls_ecdsa_context *)&keypair,
-                    pTxHash, UCOIN_SZ_HASH256,
-                    pSig->buf, pSig->len - 1);
-    } else {
-        DBG_PRINTF("fail keypair\n");
+    ret = signature_der2rs(rs, pSig->buf);
+    if (ret) {
+        ret = ucoin_ecc_verify_rs(rs, pTxHash, pPubKey);
     }
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-
-    if (ret == 0) {
+    if (ret) {
         DBG_PRINTF("ok: verify\n");
     } else {
-        DBG_PRINTF("fail ret=%d\n", ret);
+        DBG_PRINTF("fail\n");
         DBG_PRINTF("pSig: ");
         DUMPBIN(pSig->buf, pSig->len);
         DBG_PRINTF("txhash: ");
@@ -720,52 +698,31 @@ LABEL_EXIT:
         DBG_PRINTF("pub: ");
         DUMPBIN(pPubKey, UCOIN_SZ_PUBKEY);
     }
-    return ret == 0;
+    return ret;
 }
 
 
 bool ucoin_tx_verify_rs(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKey)
 {
-    int ret;
-    mbedtls_mpi r, s;
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    mbedtls_mpi_init(&r);
-    mbedtls_mpi_init(&s);
-    ret = mbedtls_mpi_read_binary(&r, pRS, 32);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = mbedtls_mpi_read_binary(&s, pRS + 32, 32);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = ucoin_util_set_keypair(&keypair, pPubKey);
+    bool ret = ucoin_ecc_verify_rs(pRS, pTxHash, pPubKey);
     if (!ret) {
-        ret = mbedtls_ecdsa_verify(&keypair.grp, pTxHash, UCOIN_SZ_HASH256, &keypair.Q, &r, &s);
-    } else {
-        DBG_PRINTF("fail keypair\n");
-    }
-
-LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-    mbedtls_mpi_free( &r );
-    mbedtls_mpi_free( &s );
-
-    if (ret == 0) {
-        //DBG_PRINTF("ok: verify\n");
-    } else {
-        DBG_PRINTF("fail ret=%d\n", ret);
+        DBG_PRINTF("fail\n");
         DBG_PRINTF("txhash: ");
         DUMPBIN(pTxHash, UCOIN_SZ_SIGHASH);
         DBG_PRINTF("pub: ");
         DUMPBIN(pPubKey, UCOIN_SZ_PUBKEY);
     }
-    return ret == 0;
+    return ret;
+}
+
+
+bool ucoin_tx_verify_rs_uncomp(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKeyUncomp)
+{
+    bool ret = ucoin_ecc_verify_rs_uncomp(pRS, pTxHash, pPubKeyUncomp);
+    if (!ret) {
+        DBG_PRINTF("fail\n");
+    }
+    return ret;
 }
 
 
@@ -1441,49 +1398,6 @@ static bool is_valid_signature_encoding(const uint8_t *sig, uint16_t size)
 }
 
 
-/** 署名r/s
- *
- */
-static int sign_rs(mbedtls_mpi *p_r, mbedtls_mpi *p_s, const uint8_t *pTxHash, const uint8_t *pPrivKey)
-{
-    int ret;
-    mbedtls_ecp_keypair keypair;
-
-    mbedtls_mpi_init(p_r);
-    mbedtls_mpi_init(p_s);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_mpi_read_binary(&keypair.d, pPrivKey, UCOIN_SZ_PRIVKEY);
-    if (ret) {
-        DBG_PRINTF("FAIL: ecdsa_sign: %d\n", ret);
-        assert(0);
-        goto LABEL_EXIT;
-    }
-
-    //canonizeするため、ecdsa.cのmbedtls_ecdsa_write_signature()をまねる
-    ret = mbedtls_ecdsa_sign_det(&keypair.grp, p_r, p_s, &keypair.d,
-                    pTxHash, UCOIN_SZ_HASH256, MBEDTLS_MD_SHA256);
-    if (ret) {
-        DBG_PRINTF("FAIL: ecdsa_sign: %d\n", ret);
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    mbedtls_mpi half_n;
-    mbedtls_mpi_init(&half_n);
-    mbedtls_mpi_copy(&half_n, &keypair.grp.N);
-    mbedtls_mpi_shift_r(&half_n, 1);
-    if (mbedtls_mpi_cmp_mpi(p_s, &half_n) == 1) {
-        mbedtls_mpi_sub_mpi(p_s, &keypair.grp.N, p_s);
-    }
-    mbedtls_mpi_free(&half_n);
-
-LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-
-    return ret;
-}
-
-
 //署名canonize処理用(mbedtls ecdsa.cからコピー)
 /*
  * Convert a signature (given by context) to ASN.1
@@ -1510,6 +1424,34 @@ static int ecdsa_signature_to_asn1( const mbedtls_mpi *r, const mbedtls_mpi *s,
 }
 
 
+/** DER形式署名からr/s取得
+ *
+ * @param[out]  pRS     署名(r[32] || s[32])
+ * @param[in]   pSig    DER形式署名(#is_valid_signature_encoding()でチェック済み)
+ * @retval  true    成功
+ */
+static bool signature_der2rs(uint8_t *pRS, const uint8_t *pSig)
+{
+    //30 [total-len] 02 [R-len] [R] 02 [S-len] [S]
+    const uint8_t *p = pSig + 3;
+    for (int lp = 0; lp < 2; lp++) {
+        uint8_t len = *p++;
+        //正の数にするための先頭0x00を除く
+        while ((len > 0) && (*p == 0x00)) {
+            p++;
+            len--;
+        }
+        if (len > UCOIN_SZ_FIELD) {
+            return false;
+        }
+        memset(pRS + UCOIN_SZ_FIELD * lp, 0, UCOIN_SZ_FIELD - len);
+        memcpy(pRS + UCOIN_SZ_FIELD * (lp + 1) - len, p, len);
+        p += len + 1;       //次の02をとばす
+    }
+    return true;
+}
+
+
 /**
  * @param[out]  pPubKey
  * @param[out]  pRecId
@@ -1519,166 +1461,33 @@ static int ecdsa_signature_to_asn1( const mbedtls_mpi *r, const mbedtls_mpi *s,
  */
 static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pOrgPubKey)
 {
-    bool bret = false;
-    int ret;
-
-    mbedtls_ecp_keypair keypair;
-    mbedtls_mpi me;
-    mbedtls_mpi r, s;
-    mbedtls_mpi inv_r;
-    mbedtls_mpi x;
-    mbedtls_ecp_point R;
-    mbedtls_ecp_point MR;
-    mbedtls_ecp_point pub;
-
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_mpi_init(&me);
-    mbedtls_mpi_init(&r);
-    mbedtls_mpi_init(&s);
-    mbedtls_mpi_init(&inv_r);
-    mbedtls_mpi_init(&x);
-    mbedtls_ecp_point_init(&R);
-    mbedtls_ecp_point_init(&MR);
-    mbedtls_ecp_point_init(&pub);
-    const mbedtls_ecp_point *pR[2] = { &R, &MR };
-    int is_zero;
-
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    // 1.5
-    //      e = Hash(M)
-    //      me = -e
-    ret = mbedtls_mpi_read_binary(&me, pTxHash, UCOIN_SZ_SIGHASH);
-    assert(ret == 0);
-
-    mbedtls_mpi zero;
-    mbedtls_mpi_init(&zero);
-    mbedtls_mpi_lset(&zero, 0);
-    ret = mbedtls_mpi_sub_mpi(&me, &zero, &me);
-    assert(ret == 0);
-    ret = mbedtls_mpi_mod_mpi(&me, &me, &keypair.grp.N);
-    assert(ret == 0);
-    mbedtls_mpi_free(&zero);
-
-    ret = mbedtls_mpi_read_binary(&r, pRS, UCOIN_SZ_FIELD);
-    assert(ret == 0);
-    ret = mbedtls_mpi_read_binary(&s, pRS + UCOIN_SZ_FIELD, UCOIN_SZ_FIELD);
-    assert(ret == 0);
-
-    //      inv_r = r^-1
-    ret = mbedtls_mpi_inv_mod(&inv_r, &r, &keypair.grp.N);
-    assert(ret == 0);
-
-    int start_j;
-    int start_k;
+    int start;
+    int end;
     if (*pRecId >= 0) {
-        start_j = (*pRecId & 0x02) >> 1;
-        start_k = *pRecId & 0x01;
+        start = *pRecId;
+        end = *pRecId + 1;
     } else {
-        start_j = 0;
-        start_k = 0;
-    }
-
-    // Iのb1
-    for (int j = start_j; j < 2; j++) {
-        // 1.1
-        //      x = r + jn
-        mbedtls_mpi tmpx;
-        mbedtls_mpi_init(&tmpx);
-        ret = mbedtls_mpi_mul_int(&tmpx, &keypair.grp.N, j);
-        assert(ret == 0);
-
-        ret = mbedtls_mpi_add_mpi(&x, &r, &tmpx);
-        assert(ret == 0);
-        mbedtls_mpi_free(&tmpx);
-        keypair.grp.modp(&x);
-
-        // 1.3
-        //      R = 02 || x
-        uint8_t pubx[UCOIN_SZ_PUBKEY];
-        pubx[0] = 0x02;
-        ret = mbedtls_mpi_write_binary(&x, pubx + 1, UCOIN_SZ_FIELD);
-        assert(ret == 0);
-        ret = ucoin_util_ecp_point_read_binary2(&R, pubx);
-        assert(ret == 0);
-
-        // 1.6.3
-        mbedtls_ecp_copy(&MR, &R);
-        ret = mbedtls_mpi_sub_mpi(&MR.Y, &keypair.grp.P, &MR.Y);        // -R.Y = P - R.Yになる(mod P不要)
-        assert(ret == 0);
-
-        // 1.4
-        //      error if nR != 0
-        mbedtls_ecp_point nR;
-        mbedtls_ecp_point_init(&nR);
-        ret = mbedtls_ecp_mul(&keypair.grp, &nR, &keypair.grp.N, &R, NULL, NULL);
-        is_zero = mbedtls_ecp_is_zero(&nR);
-        mbedtls_ecp_point_free(&nR);
-        if ((ret == 0) || !is_zero) {
-            DBG_PRINTF2("[%d]1.4 error(ret=%04x)\n", j, ret);
-            goto SKIP_LOOP;
-        }
+        start = 0;
+        end = 4;
+    }
 
-        // Iのb0
-        for (int k = start_k; k < 2; k++) {
-            // 1.6.1
-            //      Q = r^-1 * (sR - eG)
-
-            //      (sR - eG)
-            ret = mbedtls_ecp_muladd(&keypair.grp, &pub, &s, pR[k], &me, &keypair.grp.G);
-            assert(ret == 0);
-            //      Q = r^-1 * Q
-            ret = mbedtls_ecp_mul(&keypair.grp, &pub, &inv_r, &pub, NULL, NULL);
-            assert(ret == 0);
-
-            size_t sz;
-            ret = mbedtls_ecp_point_write_binary(
-                                &keypair.grp, &pub, MBEDTLS_ECP_PF_COMPRESSED,
-                                &sz, pPubKey, UCOIN_SZ_PUBKEY);
-            assert(ret == 0);
-
-            if (ret == 0) {
-                bret = ucoin_tx_verify_rs(pRS, pTxHash, pPubKey);
-                if (bret && pOrgPubKey) {
-                    bret = (memcmp(pOrgPubKey, pPubKey, UCOIN_SZ_PUBKEY) == 0);
-                }
-                if (bret) {
-                    //DBG_PRINTF("recover= ");
-                    //DUMPBIN(pPubKey, UCOIN_SZ_PUBKEY);
-                    if (*pRecId < 0) {
-                        *pRecId = (j << 1) | k;
-                    }
-                    j = 2;
-                    k = 2;
-                    break;
-                } else {
-                    //DBG_PRINTF("not match\n");
-                }
-            } else {
-                DBG_PRINTF("fail\n");
-            }
-            if (*pRecId >= 0) {
-                break;
-            }
+    for (int recid = start; recid < end; recid++) {
+        if (!ucoin_ecc_recover_pubkey(pPubKey, recid, pRS, pTxHash)) {
+            continue;
         }
-
-SKIP_LOOP:
-        if (*pRecId >= 0) {
-            break;
+        bool bret = ucoin_tx_verify_rs(pRS, pTxHash, pPubKey);
+        if (bret && pOrgPubKey) {
+            bret = (memcmp(pOrgPubKey, pPubKey, UCOIN_SZ_PUBKEY) == 0);
+        }
+        if (bret) {
+            //DBG_PRINTF("recover= ");
+            //DUMPBIN(pPubKey, UCOIN_SZ_PUBKEY);
+            *pRecId = recid;
+            return true;
         }
     }
 
-    mbedtls_ecp_point_free(&pub);
-    mbedtls_ecp_point_free(&MR);
-    mbedtls_ecp_point_free(&R);
-    mbedtls_mpi_free(&x);
-    mbedtls_mpi_free(&s);
-    mbedtls_mpi_free(&r);
-    mbedtls_mpi_free(&inv_r);
-    mbedtls_mpi_free(&me);
-    mbedtls_ecp_keypair_free(&keypair);
-
-    return bret;
+    return false;
 }
 
 
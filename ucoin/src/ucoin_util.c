@@ -23,6 +23,8 @@
  *  @brief  bitcoin処理: 汎用処理
  *  @author ueno@nayuta.co
  */
+#include <pthread.h>
+
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/md.h"
 
@@ -31,6 +33,33 @@
 #include "libbase58.h"
 
 
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_PUBCACHE_MAX          (4096)          ///< 展開済み公開鍵キャッシュ数
+#define M_PUBCACHE_HASH         (8192)          ///< 展開済み公開鍵キャッシュのhash数(2のべき乗)
+#define M_PUBCACHE_NONE         (UINT16_MAX)    ///< index無し
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct pubcache_t
+ *  @brief  展開済み公開鍵キャッシュ要素
+ *
+ *  X座標は圧縮公開鍵と同じなので、Y座標だけ持つ。
+ */
+typedef struct {
+    uint8_t     pubkey[UCOIN_SZ_PUBKEY];    ///< 圧縮公開鍵
+    uint8_t     y[UCOIN_SZ_FIELD];          ///< Y座標
+    uint16_t    hnext;                      ///< 同じhashの次要素
+    uint16_t    prev;                       ///< LRU:新しい側
+    uint16_t    next;                       ///< LRU:古い側
+} pubcache_t;
+
+
 /**************************************************************************
  * private variables
  **************************************************************************/
@@ -39,6 +68,18 @@
 static int mcount = 0;
 #endif  //UCOIN_DEBUG_MEM
 
+//secp256k1 group(Gのcomb table作成済み)
+static mbedtls_ecp_group    mEcpGroup;
+static pthread_once_t       mEcpOnce = PTHREAD_ONCE_INIT;
+
+//展開済み公開鍵キャッシュ(LRU)
+static pubcache_t           mPubCache[M_PUBCACHE_MAX];
+static uint16_t             mPubCacheHash[M_PUBCACHE_HASH];
+static uint16_t             mPubCacheNum;
+static uint16_t             mPubCacheHead;      ///< 最近使った要素
+static uint16_t             mPubCacheTail;      ///< 最も使っていない要素
+static pthread_mutex_t      mMuxPubCache = PTHREAD_MUTEX_INITIALIZER;
+
 
 /**************************************************************************
  * prototypes
@@ -50,6 +91,11 @@ static void create_scriptpk_native(uint8_t *p, const uint8_t *pPubKeyHash, uint8
 static ucoin_keys_sort_t keys_sort2of2(const uint8_t **pp1, const uint8_t **pp2, const uint8_t *pPubKey1, const uint8_t *pPubKey2);
 static int set_le32(uint8_t *pData, uint32_t val);
 static int set_le64(uint8_t *pData, uint64_t val);
+static void ecp_group_init(void);
+static bool pubcache_get(uint8_t *pY, const uint8_t *pPubKey);
+static void pubcache_put(const uint8_t *pPubKey, const uint8_t *pY);
+static void pubcache_unlink(uint16_t Idx);
+static inline uint32_t pubcache_hash(const uint8_t *pPubKey);
 
 
 /**************************************************************************
@@ -406,6 +452,20 @@ void HIDDEN ucoin_util_sha256cat(uint8_t *pSha256, const uint8_t *pData1, uint16
 }
 
 
+/** secp256k1 group取得
+ *
+ * 初回呼び出し時にgroupを読込み、Gのcomb tableを作成する。
+ * プロセスで共有するため、呼び出し元で変更・解放しないこと。
+ *
+ * @return      secp256k1 group
+ */
+mbedtls_ecp_group HIDDEN *ucoin_util_ecp_group(void)
+{
+    pthread_once(&mEcpOnce, ecp_group_init);
+    return &mEcpGroup;
+}
+
+
 /** 圧縮された公開鍵をkeypairに展開する
  *
  * @param[in]       pPubKey     圧縮された公開鍵
@@ -439,14 +499,13 @@ int HIDDEN ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uin
     uint8_t parity;
     size_t plen;
     mbedtls_mpi e, y2;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
+    uint8_t y[UCOIN_SZ_FIELD];
 
     mbedtls_mpi_init(&e);
     mbedtls_mpi_init(&y2);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
 
-    ret = mbedtls_ecp_point_read_binary(&keypair.grp, point, pPubKey, UCOIN_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_read_binary(p_grp, point, pPubKey, UCOIN_SZ_PUBKEY);
     if (MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE != ret) {
         return ret;
     }
@@ -459,7 +518,7 @@ int HIDDEN ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uin
         return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
     }
 
-    plen = mbedtls_mpi_size(&keypair.grp.P);
+    plen = mbedtls_mpi_size(&p_grp->P);
     if (UCOIN_SZ_PUBKEY != plen + 1) {
         return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
     }
@@ -475,6 +534,12 @@ int HIDDEN ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uin
         goto LABEL_EXIT;
     }
 
+    //展開済みならY座標の計算(平方根)を省略する
+    if (pubcache_get(y, pPubKey)) {
+        ret = mbedtls_mpi_read_binary(&point->Y, y, sizeof(y));
+        goto LABEL_EXIT;
+    }
+
     // Set y2 = X^3 + B
     ret = mbedtls_mpi_mul_mpi(&y2, &point->X, &point->X);
     if (ret) {
@@ -482,36 +547,36 @@ int HIDDEN ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uin
         goto LABEL_EXIT;
     }
 #if 0
-    ret = mbedtls_mpi_mod_mpi(&y2, &y2, &keypair.grp.P);
+    ret = mbedtls_mpi_mod_mpi(&y2, &y2, &p_grp->P);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
     }
 #else
-    keypair.grp.modp(&y2);
+    p_grp->modp(&y2);
 #endif
     ret = mbedtls_mpi_mul_mpi(&y2, &y2, &point->X);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
     }
-    ret = mbedtls_mpi_add_mpi(&y2, &y2, &keypair.grp.B);
+    ret = mbedtls_mpi_add_mpi(&y2, &y2, &p_grp->B);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
     }
 #if 0
-    ret = mbedtls_mpi_mod_mpi(&y2, &y2, &keypair.grp.P);
+    ret = mbedtls_mpi_mod_mpi(&y2, &y2, &p_grp->P);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
     }
 #else
-    keypair.grp.modp(&y2);
+    p_grp->modp(&y2);
 #endif
 
     // Compute square root of y2
-    ret = mbedtls_mpi_add_int(&e, &keypair.grp.P, 1);
+    ret = mbedtls_mpi_add_int(&e, &p_grp->P, 1);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
@@ -521,7 +586,7 @@ int HIDDEN ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uin
         assert(0);
         goto LABEL_EXIT;
     }
-    ret = mbedtls_mpi_exp_mod(&point->Y, &y2, &e, &keypair.grp.P, NULL);
+    ret = mbedtls_mpi_exp_mod(&point->Y, &y2, &e, &p_grp->P, NULL);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
@@ -529,11 +594,16 @@ int HIDDEN ucoin_util_ecp_point_read_binary2(mbedtls_ecp_point *point, const uin
 
     // Set parity
     if (mbedtls_mpi_get_bit(&point->Y, 0) != parity) {
-        ret = mbedtls_mpi_sub_mpi(&point->Y, &keypair.grp.P, &point->Y);
+        ret = mbedtls_mpi_sub_mpi(&point->Y, &p_grp->P, &point->Y);
+    }
+    if (ret == 0) {
+        ret = mbedtls_mpi_write_binary(&point->Y, y, sizeof(y));
+    }
+    if (ret == 0) {
+        pubcache_put(pPubKey, y);
     }
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&e);
     mbedtls_mpi_free(&y2);
 
@@ -649,13 +719,11 @@ int HIDDEN ucoin_util_ecp_muladd(uint8_t *pResult, const uint8_t *pPubKeyIn, con
     mbedtls_ecp_point P1;
     mbedtls_ecp_point P2;
     mbedtls_mpi one;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = ucoin_util_ecp_group();
 
     mbedtls_ecp_point_init(&P1);
     mbedtls_ecp_point_init(&P2);
     mbedtls_mpi_init(&one);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
 
     //P1: 前の公開鍵座標
     ret = ucoin_util_ecp_point_read_binary2(&P1, pPubKeyIn);
@@ -669,7 +737,7 @@ int HIDDEN ucoin_util_ecp_muladd(uint8_t *pResult, const uint8_t *pPubKeyIn, con
     if (ret) {
         goto LABEL_EXIT;
     }
-    ret = mbedtls_ecp_muladd(&keypair.grp, &P2, pA, &keypair.grp.G, &one, &P1);
+    ret = mbedtls_ecp_muladd(p_grp, &P2, pA, &p_grp->G, &one, &P1);
     if (ret) {
         goto LABEL_EXIT;
     }
@@ -682,10 +750,9 @@ int HIDDEN ucoin_util_ecp_muladd(uint8_t *pResult, const uint8_t *pPubKeyIn, con
 
     //圧縮公開鍵
     size_t sz;
-    ret = mbedtls_ecp_point_write_binary(&keypair.grp, &P2, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, UCOIN_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_write_binary(p_grp, &P2, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, UCOIN_SZ_PUBKEY);
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&one);
     mbedtls_ecp_point_free(&P2);
     mbedtls_ecp_point_free(&P1);
@@ -696,32 +763,7 @@ LABEL_EXIT:
 
 bool HIDDEN ucoin_util_mul_pubkey(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul, int MulLen)
 {
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    int ret = ucoin_util_set_keypair(&keypair, pPubKey);
-    if (!ret) {
-        // keypair.Qに公開鍵(x, y)が入っている
-        mbedtls_ecp_point pnt;
-        mbedtls_mpi m;
-
-        mbedtls_ecp_point_init(&pnt);
-        mbedtls_mpi_init(&m);
-
-        mbedtls_mpi_read_binary(&m, pMul, MulLen);
-        mbedtls_ecp_mul(&keypair.grp, &pnt, &m, &keypair.Q, NULL, NULL);  //TODO: RNGを指定すべきか？
-
-        //圧縮公開鍵
-        size_t sz;
-        ret = mbedtls_ecp_point_write_binary(&keypair.grp, &pnt, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, UCOIN_SZ_PUBKEY);
-
-        mbedtls_ecp_point_free(&pnt);
-        mbedtls_mpi_free(&m);
-    }
-    mbedtls_ecp_keypair_free(&keypair);
-
-    return ret == 0;
+    return ucoin_ecc_mul_pubkey(pResult, pPubKey, pMul, MulLen);
 }
 
 
@@ -1191,3 +1233,158 @@ static int set_le64(uint8_t *pData, uint64_t val)
 
     return (int)sizeof(uint64_t);
 }
+
+
+/** secp256k1 group初期化
+ *
+ * Gを掛けるとgroupにcomb tableが作られるため、共有する前に1度計算しておく。
+ * (作成済みのtableは読込みだけになる)
+ */
+static void ecp_group_init(void)
+{
+    int ret;
+    mbedtls_ecp_point pnt;
+    mbedtls_mpi one;
+
+    mbedtls_ecp_group_init(&mEcpGroup);
+    ret = mbedtls_ecp_group_load(&mEcpGroup, MBEDTLS_ECP_DP_SECP256K1);
+    assert(ret == 0);
+
+    mbedtls_ecp_point_init(&pnt);
+    mbedtls_mpi_init(&one);
+    mbedtls_mpi_lset(&one, 1);
+    ret = mbedtls_ecp_mul(&mEcpGroup, &pnt, &one, &mEcpGroup.G, NULL, NULL);
+    assert(ret == 0);
+    (void)ret;
+    mbedtls_mpi_free(&one);
+    mbedtls_ecp_point_free(&pnt);
+
+    memset(mPubCacheHash, 0xff, sizeof(mPubCacheHash));     //M_PUBCACHE_NONE
+    mPubCacheNum = 0;
+    mPubCacheHead = M_PUBCACHE_NONE;
+    mPubCacheTail = M_PUBCACHE_NONE;
+}
+
+
+/** 展開済み公開鍵キャッシュ検索
+ *
+ * 見つかった要素はLRUの先頭に移動する。
+ *
+ * @param[out]  pY          Y座標
+ * @param[in]   pPubKey     圧縮公開鍵
+ * @retval  true    キャッシュあり
+ */
+static bool pubcache_get(uint8_t *pY, const uint8_t *pPubKey)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMuxPubCache);
+    uint16_t idx = mPubCacheHash[pubcache_hash(pPubKey)];
+    while (idx != M_PUBCACHE_NONE) {
+        pubcache_t *p = &mPubCache[idx];
+        if (memcmp(p->pubkey, pPubKey, UCOIN_SZ_PUBKEY) == 0) {
+            memcpy(pY, p->y, UCOIN_SZ_FIELD);
+            if (idx != mPubCacheHead) {
+                pubcache_unlink(idx);
+                p->prev = M_PUBCACHE_NONE;
+                p->next = mPubCacheHead;
+                mPubCache[mPubCacheHead].prev = idx;
+                mPubCacheHead = idx;
+            }
+            ret = true;
+            break;
+        }
+        idx = p->hnext;
+    }
+    pthread_mutex_unlock(&mMuxPubCache);
+
+    return ret;
+}
+
+
+/** 展開済み公開鍵キャッシュ追加
+ *
+ * 満杯の場合は、最も使っていない要素を置き換える。
+ *
+ * @param[in]   pPubKey     圧縮公開鍵
+ * @param[in]   pY          Y座標
+ */
+static void pubcache_put(const uint8_t *pPubKey, const uint8_t *pY)
+{
+    uint32_t hash = pubcache_hash(pPubKey);
+    uint16_t idx;
+
+    pthread_mutex_lock(&mMuxPubCache);
+
+    //他スレッドが先に追加している
+    for (idx = mPubCacheHash[hash]; idx != M_PUBCACHE_NONE; idx = mPubCache[idx].hnext) {
+        if (memcmp(mPubCache[idx].pubkey, pPubKey, UCOIN_SZ_PUBKEY) == 0) {
+            goto LABEL_EXIT;
+        }
+    }
+
+    if (mPubCacheNum < M_PUBCACHE_MAX) {
+        idx = mPubCacheNum++;
+    } else {
+        //LRU末尾をhashから外して使う
+        idx = mPubCacheTail;
+        uint16_t *p_link = &mPubCacheHash[pubcache_hash(mPubCache[idx].pubkey)];
+        while (*p_link != idx) {
+            p_link = &mPubCache[*p_link].hnext;
+        }
+        *p_link = mPubCache[idx].hnext;
+        pubcache_unlink(idx);
+    }
+
+    pubcache_t *p = &mPubCache[idx];
+    memcpy(p->pubkey, pPubKey, UCOIN_SZ_PUBKEY);
+    memcpy(p->y, pY, UCOIN_SZ_FIELD);
+    p->hnext = mPubCacheHash[hash];
+    mPubCacheHash[hash] = idx;
+    p->prev = M_PUBCACHE_NONE;
+    p->next = mPubCacheHead;
+    if (mPubCacheHead != M_PUBCACHE_NONE) {
+        mPubCache[mPubCacheHead].prev = idx;
+    } else {
+        mPubCacheTail = idx;
+    }
+    mPubCacheHead = idx;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMuxPubCache);
+}
+
+
+/** LRUから外す
+ *
+ * @param[in]   Idx     外す要素
+ * @note
+ *      - mMuxPubCacheをlockして呼び出すこと
+ */
+static void pubcache_unlink(uint16_t Idx)
+{
+    pubcache_t *p = &mPubCache[Idx];
+
+    if (p->prev != M_PUBCACHE_NONE) {
+        mPubCache[p->prev].next = p->next;
+    } else {
+        mPubCacheHead = p->next;
+    }
+    if (p->next != M_PUBCACHE_NONE) {
+        mPubCache[p->next].prev = p->prev;
+    } else {
+        mPubCacheTail = p->prev;
+    }
+}
+
+
+/** 展開済み公開鍵キャッシュのhash
+ *
+ * 圧縮公開鍵のX座標は一様に分布しているので、先頭をそのまま使う。
+ */
+static inline uint32_t pubcache_hash(const uint8_t *pPubKey)
+{
+    uint32_t h = ((uint32_t)pPubKey[1] << 24) | ((uint32_t)pPubKey[2] << 16) |
+                    ((uint32_t)pPubKey[3] << 8) | (uint32_t)pPubKey[4];
+    return (h ^ pPubKey[0]) & (M_PUBCACHE_HASH - 1);
+}
@@ -50,6 +50,7 @@
 
 #define M_SZ_JSONSTR            (8192)
 #define M_SZ_PAYERR             (128)
+#define M_ROUTE_CANDIDATES      (5)         ///< routepayで1回に計算する経路候補数
 
 
 /********************************************************************
@@ -60,6 +61,13 @@ static struct jrpc_server   mJrpc;
 static char                 mLastPayErr[M_SZ_PAYERR];       //最後に送金エラーが発生した時刻
 static int                  mPayTryCount = 0;               //送金トライ回数
 
+//routepayの経路候補(再送時は計算せずに次の候補を使う)
+static ln_routing_result_t  mPayRoute[M_ROUTE_CANDIDATES];
+static uint8_t              mPayRouteNum = 0;               //mPayRouteの有効数
+static uint8_t              mPayRouteIdx = 0;               //次に使うmPayRoute
+static uint8_t              mPayRouteHash[LN_SZ_HASH];      //mPayRouteのpayment_hash
+static uint32_t             mPayRouteCltv;                  //mPayRouteのcltv_expiry
+
 static const char *kOK = "OK";
 static const char *kNG = "NG";
 
@@ -97,6 +105,13 @@ static bool routepay_param(cJSON *params, int index,
                     uint32_t *pMinFinalCltvExpiry,
                     uint8_t *pAddNum,
                     ln_fieldr_t **ppRField);
+static lnerr_route_t routepay_route(ln_routing_result_t *pResult,
+                    const uint8_t *pPayHash,
+                    const uint8_t *pPayeeId,
+                    uint32_t CltvExpiry,
+                    uint64_t AmountMsat,
+                    uint8_t AddNum,
+                    const ln_fieldr_t *pRField);
 static char *create_bolt11(const uint8_t *pPayHash, uint64_t Amount);
 static lnapp_conf_t *search_connected_lnapp_node(const uint8_t *p_node_id);
 
@@ -312,6 +327,26 @@ static cJSON *cmd_getinfo(jrpc_context *ctx, cJSON *params, cJSON *id)
     }
     cJSON_AddItemToObject(result, "last_errpay_date", cJSON_CreateString(mLastPayErr));
 
+    //routing cache
+    uint64_t cache_hit;
+    uint64_t cache_miss;
+    uint32_t cache_num;
+    ln_routing_cache_stat(&cache_hit, &cache_miss, &cache_num);
+    cJSON *result_cache = cJSON_CreateObject();
+    cJSON_AddNumber64ToObject(result_cache, "hit", cache_hit);
+    cJSON_AddNumber64ToObject(result_cache, "miss", cache_miss);
+    cJSON_AddItemToObject(result_cache, "entries", cJSON_CreateNumber(cache_num));
+    cJSON_AddItemToObject(result, "route_cache", result_cache);
+
+    //mission control
+    uint32_t mc_chan;
+    uint32_t mc_node;
+    ln_routing_mc_stat(&mc_chan, &mc_node);
+    cJSON *result_mc = cJSON_CreateObject();
+    cJSON_AddItemToObject(result_mc, "channels", cJSON_CreateNumber(mc_chan));
+    cJSON_AddItemToObject(result_mc, "nodes", cJSON_CreateNumber(mc_node));
+    cJSON_AddItemToObject(result, "mission_control", result_mc);
+
     return result;
 }
 
@@ -811,6 +846,7 @@ static cJSON *cmd_routepay_first(jrpc_context *ctx, cJSON *params, cJSON *id)
     SYSLOG_INFO("routepay_first");
     ln_db_annoskip_drop(true);
     mPayTryCount = 0;
+    mPayRouteNum = 0;
     return cmd_routepay(ctx, params, id);
 }
 
@@ -877,7 +913,7 @@ static cJSON *cmd_routepay(jrpc_context *ctx, cJSON *params, cJSON *id)
         goto LABEL_EXIT;
     }
     ln_routing_result_t rt_ret;
-    lnerr_route_t rerr = ln_routing_calculate(&rt_ret, ln_node_getid(), node_payee,
+    lnerr_route_t rerr = routepay_route(&rt_ret, payhash, node_payee,
                     blockcnt + min_final_cltv_expiry, amount_msat,
                     addnum, p_rfield);
     APP_FREE(p_rfield);
@@ -965,6 +1001,7 @@ LABEL_EXIT:
         //送金失敗
         ln_db_annoskip_invoice_del(payhash);
         ln_db_annoskip_drop(true);
+        mPayRouteNum = 0;
 
         //最後に失敗した時間
         char date[50];
@@ -1389,6 +1426,48 @@ LABEL_EXIT:
 }
 
 
+/** #cmd_routepay()の経路取得
+ *
+ * 同じ支払いの再送では、前回計算した候補のうちskip DBに載ったchannelを含まないものを使う。
+ * 候補が無くなった場合やblock高が変わった場合は計算し直す。
+ */
+static lnerr_route_t routepay_route(ln_routing_result_t *pResult,
+                    const uint8_t *pPayHash,
+                    const uint8_t *pPayeeId,
+                    uint32_t CltvExpiry,
+                    uint64_t AmountMsat,
+                    uint8_t AddNum,
+                    const ln_fieldr_t *pRField)
+{
+    if ((mPayRouteNum > 0) && (mPayRouteCltv == CltvExpiry) &&
+                (memcmp(mPayRouteHash, pPayHash, LN_SZ_HASH) == 0)) {
+        while (mPayRouteIdx < mPayRouteNum) {
+            const ln_routing_result_t *p_route = &mPayRoute[mPayRouteIdx++];
+            if (ln_routing_check_skip(p_route)) {
+                DBG_PRINTF("use route candidate: %d/%d\n", mPayRouteIdx, mPayRouteNum);
+                memcpy(pResult, p_route, sizeof(ln_routing_result_t));
+                return LNROUTE_NONE;
+            }
+        }
+    }
+
+    uint8_t num = M_ROUTE_CANDIDATES;
+    lnerr_route_t rerr = ln_routing_calculate_paths(mPayRoute, &num, ln_node_getid(), pPayeeId,
+                    CltvExpiry, AmountMsat, AddNum, pRField, NULL);
+    if (rerr == LNROUTE_NONE) {
+        DBG_PRINTF("route candidates: %d\n", num);
+        mPayRouteNum = num;
+        mPayRouteIdx = 1;
+        memcpy(mPayRouteHash, pPayHash, LN_SZ_HASH);
+        mPayRouteCltv = CltvExpiry;
+        memcpy(pResult, &mPayRoute[0], sizeof(ln_routing_result_t));
+    } else {
+        mPayRouteNum = 0;
+    }
+    return rerr;
+}
+
+
 static char *create_bolt11(const uint8_t *pPayHash, uint64_t Amount)
 {
     uint8_t type;
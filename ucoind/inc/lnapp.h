@@ -32,6 +32,13 @@
 #include "conf.h"
 
 
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define LNAPP_GOSSIP_SPENT      (16)        ///< #send_gossip()で覚えておく使用済みchannel数
+
+
 /********************************************************************
  * typedefs
  ********************************************************************/
@@ -102,8 +109,42 @@ typedef struct lnapp_conf_t {
 
     //last send announcement
     uint64_t        last_anno_cnl;                      ///< [#send_channel_anno()]最後にannouncementしたchannel
+    char            last_anno_cnl_type;                 ///< [#send_channel_anno()]最後にannouncementしたLN_DB_CNLANNO_xxx
     uint64_t        last_annocnl_sci;                   ///< [#send_channel_anno()]最後にcur_getしたchannel_announcementのshort_channel_id
     uint8_t         last_anno_node[UCOIN_SZ_PUBKEY];    ///< [#send_node_anno()]最後にannouncementしたnode
+    void            *p_gossip;                          ///< [#send_gossip()]gossip store cursor
+    uint32_t        gossip_rate;                        ///< [#send_gossip()]送信帯域[byte/sec]
+    int64_t         gossip_tokens;                      ///< [#send_gossip()]送信可能量[byte](負:超過分)
+    uint64_t        gossip_refill;                      ///< [#send_gossip()]gossip_tokensを補充した時刻[msec]
+    ucoin_buf_t     gossip_unsent;                      ///< [#send_gossip()]送信しきれなかった暗号化済みgossip(mux_sendで排他)
+    uint64_t        gossip_spent[LNAPP_GOSSIP_SPENT];   ///< [#send_gossip()]使用済みのため送信しないchannel(0:空き)
+    int             gossip_spent_pos;                   ///< [#send_gossip()]gossip_spentの次の書込み位置
+    ucoin_buf_t     gossip_retry;                       ///< [#send_gossip()]unspentチェックできず、次回送信し直すchannel_announcement
+    uint64_t        gossip_retry_sci;                   ///< [#send_gossip()]gossip_retryのshort_channel_id
+
+    //gossip queries
+    //  受信スレッドでリストに追加し、announceスレッドで送信する
+    //  p_query_xxxは全て標準のmalloc()/realloc()で確保し(p_query_have/p_query_rangeは #ln_db_annocnl_get_range())、free()で解放する
+    pthread_mutex_t mux_query;                          ///< query_xxxの排他
+    bool            query_filter;                       ///< true:gossip_timestamp_filter受信済み
+    bool            query_filter_upd;                   ///< true:gossip_timestamp_filterをcursorに未反映
+    uint32_t        query_first;                        ///< 受信したfirst_timestamp
+    uint32_t        query_range;                        ///< 受信したtimestamp_range
+    bool            query_wait;                         ///< true:reply_short_channel_ids_end待ち
+    uint32_t        query_wait_start;                   ///< query_short_channel_idsを送信した時刻
+    uint64_t        *p_query_have;                      ///< reply_channel_range比較用の自DBのshort_channel_id(昇順)
+    int             query_have_num;                     ///< p_query_have数(-1:未取得)
+    uint64_t        *p_query_want;                      ///< query_short_channel_idsで要求するshort_channel_id
+    int             query_want_num;                     ///< p_query_want数
+    int             query_want_pos;                     ///< p_query_wantの要求済み位置
+    uint64_t        *p_query_recv;                      ///< query_short_channel_idsで要求されたshort_channel_id(応答中はNULL以外)
+    int             query_recv_num;                     ///< p_query_recv数
+    int             query_recv_pos;                     ///< p_query_recvの応答済み位置
+    bool            query_range_req;                    ///< true:query_channel_rangeに応答中
+    ln_query_channel_range_t    query_range_msg;        ///< 応答中のquery_channel_range
+    uint64_t        *p_query_range;                     ///< query_channel_rangeの範囲にあるshort_channel_id
+    int             query_range_num;                    ///< p_query_range数(-1:未取得)
+    int             query_range_pos;                    ///< p_query_rangeの応答済み位置
 
     int             err;            ///< last error
     char            *p_errstr;      ///< last error string
@@ -222,4 +263,5 @@ bool lnapp_is_looping(const lnapp_conf_t *pAppConf);
  */
 bool lnapp_is_inited(const lnapp_conf_t *pAppConf);
 
+
 #endif /* LNAPP_H__ */
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   unspent.h
+ *  @brief  short_channel_idのfunding_tx未使用キャッシュ
+ */
+#ifndef UNSPENT_H__
+#define UNSPENT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define UNSPENT_CACHE_BLK       (144)       ///< キャッシュの有効ブロック数
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** [unspent]初期化
+ *
+ */
+void unspent_init(void);
+
+
+/** [unspent]終了
+ *
+ */
+void unspent_term(void);
+
+
+/** [unspent]short_channel_idのfunding_tx使用状態取得
+ *
+ * 結果はshort_channel_idごとにキャッシュし、UNSPENT_CACHE_BLKブロック経過するか、
+ * #unspent_update()で使用済みになったことを検出するまではbitcoindに問い合わせない。
+ *
+ * @param[in]   ShortChannelId      short_channel_id
+ * @param[out]  pUnspent            true:funding_tx未使用
+ * @retval  true    取得成功
+ * @retval  false   bitcoindへの問い合わせ失敗(pUnspentは不定。閉鎖済みとして扱わないこと)
+ */
+bool unspent_check(uint64_t ShortChannelId, bool *pUnspent);
+
+
+/** [unspent]short_channel_idのfunding_txが使用済みか
+ *
+ * @param[in]   ShortChannelId      short_channel_id
+ * @retval  true    使用済み(bitcoindへの問い合わせに失敗した場合はfalse)
+ */
+bool unspent_is_spent(uint64_t ShortChannelId);
+
+
+/** [unspent]キャッシュ更新
+ *
+ * block countが進んでいれば、新しいblockで使用されたoutpointと一致するキャッシュを使用済みにする。
+ * 未使用としてキャッシュしているものが無ければ、blockは取得しない。
+ *
+ * @param[in]   Height      現在のblock count
+ */
+void unspent_update(int32_t Height);
+
+#endif /* UNSPENT_H__ */
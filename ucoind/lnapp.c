@@ -43,6 +43,7 @@
 #include <inttypes.h>
 #include <time.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -50,6 +51,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 #include <assert.h>
 
 #include "cJSON.h"
@@ -62,6 +64,7 @@
 #include "ln_db.h"
 
 #include "monitoring.h"
+#include "unspent.h"
 
 
 /**************************************************************************
@@ -71,7 +74,8 @@
 #define M_WAIT_MUTEX_SEC        (1)         //mMuxNodeのロック解除待ち間隔[sec]
 #define M_WAIT_POLL_SEC         (10)        //監視スレッドの待ち間隔[sec]
 #define M_WAIT_PING_SEC         (60)        //ping送信待ち[sec](pingは30秒以上の間隔をあけること)
-#define M_WAIT_ANNO_SEC         (1)         //監視スレッドでのannounce処理間隔[sec]
+#define M_WAIT_ANNO_SEC         (1)         //監視スレッドでのannounce処理間隔[sec](DBから送信する場合)
+#define M_WAIT_ANNO_MSEC        (100)       //監視スレッドでのannounce処理間隔[msec](gossip storeから送信する場合)
 #define M_WAIT_MUTEX_MSEC       (100)       //mMuxNodeのロック解除待ち間隔[msec]
 #define M_WAIT_RECV_MULTI_MSEC  (1000)      //複数パケット受信した時の処理間隔[msec]
 #define M_WAIT_RECV_TO_MSEC     (100)       //socket受信待ちタイムアウト[msec]
@@ -98,6 +102,11 @@
 #define M_MIN_DEPTH                     (1)
 
 #define M_ANNO_UNIT             (3)         ///< 1回のsend_channel_anno()/send_node_anno()で送信する数
+#define M_GOSSIP_RATE           (65536)     ///< 接続先ごとのannouncement送信帯域のデフォルト値[byte/sec]
+#define M_GOSSIP_IOV            (16)        ///< send_gossip()で1回のwritev()にまとめる数
+#define M_QUERY_UNIT            (16)        ///< 1回のquery_reply()で応答するshort_channel_id数
+#define M_QUERY_FILTER_MARGIN   (3600)      ///< gossip_timestamp_filterで最新timestampから遡る時間[sec]
+#define M_QUERY_WAIT_SEC        (60)        ///< reply_short_channel_ids_end待ちのタイムアウト[sec]
 #define M_RECVIDLE_RETRY_MAX    (5)         ///< 受信アイドル時キュー処理のリトライ最大
 
 #define M_ERRSTR_REASON                 "fail: %s (hop=%d)(suggest:%s)"
@@ -256,12 +265,26 @@ static void cb_closed(lnapp_conf_t *p_conf, void *p_param);
 static void cb_send_req(lnapp_conf_t *p_conf, void *p_param);
 static void cb_set_latest_feerate(lnapp_conf_t *p_conf, void *p_param);
 static void cb_getblockcount(lnapp_conf_t *p_conf, void *p_param);
+static void cb_query_short_ids_recv(lnapp_conf_t *p_conf, void *p_param);
+static void cb_reply_short_ids_end_recv(lnapp_conf_t *p_conf, void *p_param);
+static void cb_reply_channel_range_recv(lnapp_conf_t *p_conf, void *p_param);
+static void cb_gossip_filter_recv(lnapp_conf_t *p_conf, void *p_param);
+static void cb_query_channel_range_recv(lnapp_conf_t *p_conf, void *p_param);
 
 static void stop_threads(lnapp_conf_t *p_conf);
 static void send_peer_raw(lnapp_conf_t *p_conf, const ucoin_buf_t *pBuf);
 static void send_peer_noise(lnapp_conf_t *p_conf, const ucoin_buf_t *pBuf);
+static void send_peer_iov(lnapp_conf_t *p_conf, struct iovec *pIov, int Cnt);
+static void send_peer_nowait(lnapp_conf_t *p_conf, const struct iovec *pIov, int Cnt);
 static void send_channel_anno(lnapp_conf_t *p_conf);
 static void send_node_anno(lnapp_conf_t *p_conf);
+static void send_gossip(lnapp_conf_t *p_conf);
+static bool gossip_is_spent(const lnapp_conf_t *p_conf, char Type, uint64_t ShortChannelId);
+static void query_start(lnapp_conf_t *p_conf);
+static void query_request(lnapp_conf_t *p_conf);
+static void query_reply(lnapp_conf_t *p_conf);
+static void query_range_reply(lnapp_conf_t *p_conf);
+static void query_clear(lnapp_conf_t *p_conf);
 
 static void set_establish_default(lnapp_conf_t *p_conf);
 static void nodeflag_set(node_flag_t Flag);
@@ -283,7 +306,7 @@ static const payment_conf_t* payroute_get(lnapp_conf_t *p_conf, uint64_t HtlcId)
 static void payroute_del(lnapp_conf_t *p_conf, uint64_t HtlcId);
 static void payroute_clear(lnapp_conf_t *p_conf);
 static void payroute_print(lnapp_conf_t *p_conf);
-static bool check_unspent_short_channel_id(uint64_t ShortChannelId);
+static int sci_cmp(const void *pA, const void *pB);
 
 static void show_self_param(const ln_self_t *self, FILE *fp, int line);
 
@@ -864,6 +887,7 @@ static void *thread_main_start(void *pArg)
         mAnnoPrm.fee_base_msat = M_FEE_BASE_MSAT;
         mAnnoPrm.fee_prop_millionths = M_FEE_PROP_MILLIONTHS;
     }
+    uint32_t gossip_rate = (ret && (aconf.gossip_rate != 0)) ? aconf.gossip_rate : M_GOSSIP_RATE;
 
     //スレッド
     pthread_t   th_peer;        //peer受信
@@ -881,7 +905,30 @@ static void *thread_main_start(void *pArg)
     p_conf->funding_confirm = 0;
     p_conf->flag_recv = 0;
     p_conf->last_anno_cnl = 0;
+    p_conf->last_anno_cnl_type = 0;
     p_conf->last_anno_node[0] = 0;      //pubkeyなので、0にはならない
+    p_conf->p_gossip = NULL;
+    p_conf->gossip_rate = gossip_rate;
+    ucoin_buf_init(&p_conf->gossip_unsent);
+    memset(p_conf->gossip_spent, 0, sizeof(p_conf->gossip_spent));
+    p_conf->gossip_spent_pos = 0;
+    ucoin_buf_init(&p_conf->gossip_retry);
+    p_conf->query_filter = false;
+    p_conf->query_filter_upd = false;
+    p_conf->query_wait = false;
+    p_conf->query_wait_start = 0;
+    p_conf->p_query_have = NULL;
+    p_conf->query_have_num = -1;
+    p_conf->p_query_want = NULL;
+    p_conf->query_want_num = 0;
+    p_conf->query_want_pos = 0;
+    p_conf->p_query_recv = NULL;
+    p_conf->query_recv_num = 0;
+    p_conf->query_recv_pos = 0;
+    p_conf->query_range_req = false;
+    p_conf->p_query_range = NULL;
+    p_conf->query_range_num = -1;
+    p_conf->query_range_pos = 0;
     p_conf->err = 0;
     p_conf->p_errstr = NULL;
     LIST_INIT(&p_conf->revack_head);
@@ -894,6 +941,7 @@ static void *thread_main_start(void *pArg)
     pthread_mutex_init(&p_conf->mux_send, NULL);
     pthread_mutex_init(&p_conf->mux_revack, NULL);
     pthread_mutex_init(&p_conf->mux_rcvidle, NULL);
+    pthread_mutex_init(&p_conf->mux_query, NULL);
 
     p_conf->loop = true;
 
@@ -1003,6 +1051,9 @@ static void *thread_main_start(void *pArg)
     DBG_PRINTF("\n\n*** message inited ***\n\n\n");
     p_conf->flag_recv |= RECV_MSG_END;
 
+    //gossip queriesで不足しているannouncementを要求する
+    query_start(p_conf);
+
     if (ln_check_need_funding_locked(p_conf->p_self)) {
         //funding_locked交換
         ret = exchange_funding_locked(p_conf);
@@ -1071,6 +1122,7 @@ LABEL_SHUTDOWN:
     payroute_clear(p_conf);
     rcvidle_clear(p_conf);
     revack_clear(p_conf);
+    query_clear(p_conf);
     memset(p_conf, 0, sizeof(lnapp_conf_t));
     p_conf->sock = -1;
     APP_FREE(p_self);
@@ -1708,9 +1760,10 @@ static bool get_short_channel_id(lnapp_conf_t *p_conf)
 static void *thread_anno_start(void *pArg)
 {
     lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
+    int tick = 0;
 
     while (p_conf->loop) {
-        sleep(M_WAIT_ANNO_SEC);
+        misc_msleep(M_WAIT_ANNO_MSEC);
 
         if (!p_conf->loop) {
             break;
@@ -1721,12 +1774,54 @@ static void *thread_anno_start(void *pArg)
             continue;
         }
 
-        //未送信channel_announcementチェック
-        send_channel_anno(p_conf);
+        //gossip queries
+        query_request(p_conf);
+        query_reply(p_conf);
+        query_range_reply(p_conf);
+        if (ln_is_gossip_queries(p_conf->p_self) && !p_conf->query_filter) {
+            //BOLT#7
+            //  gossip_queriesをネゴシエーションした場合、gossip_timestamp_filterを受信するまでgossipを送信しない
+            continue;
+        }
+
+        if ((p_conf->p_gossip == NULL) && ln_db_gossip_available()) {
+            //initial_routing_syncが無ければ、接続後に受信したものだけ送信する
+            ln_db_gossip_cur_open(&p_conf->p_gossip, ln_their_node_id(p_conf->p_self), p_conf->initial_routing_sync);
+            p_conf->gossip_tokens = 0;
+            p_conf->gossip_refill = 0;
+        }
+        if (p_conf->query_filter_upd) {
+            pthread_mutex_lock(&p_conf->mux_query);
+            p_conf->query_filter_upd = false;
+            uint32_t first = p_conf->query_first;
+            uint32_t range = p_conf->query_range;
+            pthread_mutex_unlock(&p_conf->mux_query);
+            if (p_conf->p_gossip != NULL) {
+                //filter範囲のものを先頭から送信し直す
+                ln_db_gossip_cur_filter(p_conf->p_gossip, first, range);
+            }
+        }
+        if (p_conf->p_gossip != NULL) {
+            //未送信announcementチェック
+            send_gossip(p_conf);
+        } else if (++tick >= M_WAIT_ANNO_SEC * 1000 / M_WAIT_ANNO_MSEC) {
+            tick = 0;
+
+            //未送信channel_announcementチェック
+            send_channel_anno(p_conf);
 
-        //未送信node_announcementチェック
-        send_node_anno(p_conf);
+            //未送信node_announcementチェック
+            send_node_anno(p_conf);
+        }
+    }
+    if (p_conf->p_gossip != NULL) {
+        ln_db_gossip_cur_close(p_conf->p_gossip);
+        p_conf->p_gossip = NULL;
     }
+    pthread_mutex_lock(&p_conf->mux_send);
+    ucoin_buf_free(&p_conf->gossip_unsent);
+    pthread_mutex_unlock(&p_conf->mux_send);
+    ucoin_buf_free(&p_conf->gossip_retry);
 
     DBG_PRINTF("[exit]anno thread\n");
 
@@ -2001,6 +2096,11 @@ static void notify_cb(ln_self_t *self, ln_cb_t reason, void *p_param)
         //    LN_CB_SEND_REQ,             ///< peerへの送信要求
         //    LN_CB_SET_LATEST_FEERATE,   ///< feerate_per_kw更新要求
         //    LN_CB_GETBLOCKCOUNT,        ///< getblockcount
+        //    LN_CB_QUERY_SHORT_IDS_RECV, ///< query_short_channel_ids受信通知
+        //    LN_CB_REPLY_SHORT_IDS_END_RECV, ///< reply_short_channel_ids_end受信通知
+        //    LN_CB_REPLY_CHANNEL_RANGE_RECV, ///< reply_channel_range受信通知
+        //    LN_CB_GOSSIP_FILTER_RECV,   ///< gossip_timestamp_filter受信通知
+        //    LN_CB_QUERY_CHANNEL_RANGE_RECV, ///< query_channel_range受信通知
 
         { "  LN_CB_ERROR: エラー有り", cb_error_recv },
         { "  LN_CB_INIT_RECV: init受信", cb_init_recv },
@@ -2025,6 +2125,11 @@ static void notify_cb(ln_self_t *self, ln_cb_t reason, void *p_param)
         { "  LN_CB_SEND_REQ: 送信要求", cb_send_req },
         { "  LN_CB_SET_LATEST_FEERATE: feerate_per_kw更新", cb_set_latest_feerate },
         { "  LN_CB_GETBLOCKCOUNT: getblockcount", cb_getblockcount },
+        { "  LN_CB_QUERY_SHORT_IDS_RECV: query_short_channel_ids受信", cb_query_short_ids_recv },
+        { "  LN_CB_REPLY_SHORT_IDS_END_RECV: reply_short_channel_ids_end受信", cb_reply_short_ids_end_recv },
+        { "  LN_CB_REPLY_CHANNEL_RANGE_RECV: reply_channel_range受信", cb_reply_channel_range_recv },
+        { "  LN_CB_GOSSIP_FILTER_RECV: gossip_timestamp_filter受信", cb_gossip_filter_recv },
+        { "  LN_CB_QUERY_CHANNEL_RANGE_RECV: query_channel_range受信", cb_query_channel_range_recv },
     };
 
     if (reason < LN_CB_MAX) {
@@ -2176,7 +2281,12 @@ static void cb_channel_anno_recv(lnapp_conf_t *p_conf, void *p_param)
     //DBGTRACE_BEGIN
 
     ln_cb_channel_anno_recv_t *p = (ln_cb_channel_anno_recv_t *)p_param;
-    p->is_unspent = check_unspent_short_channel_id(p->short_channel_id);
+    bool unspent;
+    if (!unspent_check(p->short_channel_id, &unspent)) {
+        //bitcoindに問い合わせできない: 保存せず、再受信した時にやり直す(閉鎖済みとしてDBからは削除しない)
+        unspent = false;
+    }
+    p->is_unspent = unspent;
 
     //DBGTRACE_END
 }
@@ -2395,6 +2505,10 @@ static void cb_fulfill_htlc_recv(lnapp_conf_t *p_conf, void *p_param)
     } else {
         //送金元
         DBG_PRINTF("payer node\n");
+        const payment_conf_t *p_payconf = payroute_get(p_conf, p_fulfill->id);
+        if (p_payconf != NULL) {
+            ln_routing_mc_success(p_payconf->hop_datain, p_payconf->hop_num);
+        }
         payroute_del(p_conf, p_fulfill->id);
 
         uint8_t hash[LN_SZ_HASH];
@@ -2479,6 +2593,10 @@ static void cb_fail_htlc_recv(lnapp_conf_t *p_conf, void *p_param)
             //      hopの0は相手
             char suggest[64];
             const payment_conf_t *p_payconf = payroute_get(p_conf, p_fail->orig_id);
+            if ((p_payconf != NULL) && ret) {
+                //失敗したchannel/nodeを次回以降のrouting計算で避ける
+                ln_routing_mc_fail(p_payconf->hop_datain, p_payconf->hop_num, hop, &onionerr);
+            }
             if (p_payconf != NULL) {
                 if (hop == p_payconf->hop_num - 2) {
                     //送金先がエラーを返した？
@@ -2770,6 +2888,112 @@ static void cb_getblockcount(lnapp_conf_t *p_conf, void *p_param)
 }
 
 
+//LN_CB_QUERY_SHORT_IDS_RECV: query_short_channel_ids受信
+static void cb_query_short_ids_recv(lnapp_conf_t *p_conf, void *p_param)
+{
+    const ln_cb_short_ids_recv_t *p_ids = (const ln_cb_short_ids_recv_t *)p_param;
+
+    //応答はannounceスレッドで行う
+    //  reply_short_channel_ids_endを送信するまでp_query_recvは解放されない
+    //  応答はM_QUERY_UNIT channelずつ行うため、LN_GOSSIPQ_SHORT_IDS_MAXを超えていても全て受け付ける
+    pthread_mutex_lock(&p_conf->mux_query);
+    bool busy = (p_conf->p_query_recv != NULL);
+    if (!busy) {
+        p_conf->p_query_recv = (uint64_t *)malloc(sizeof(uint64_t) * (p_ids->num + 1));
+        memcpy(p_conf->p_query_recv, p_ids->p_short_ids, sizeof(uint64_t) * p_ids->num);
+        p_conf->query_recv_num = p_ids->num;
+        p_conf->query_recv_pos = 0;
+    }
+    pthread_mutex_unlock(&p_conf->mux_query);
+
+    if (busy) {
+        //BOLT#7: reply_short_channel_ids_endを受信する前に次のquery_short_channel_idsを送信してはならない
+        DBG_PRINTF("fail: query_short_channel_ids before reply_short_channel_ids_end\n");
+        stop_threads(p_conf);
+    }
+}
+
+
+//LN_CB_REPLY_SHORT_IDS_END_RECV: reply_short_channel_ids_end受信
+static void cb_reply_short_ids_end_recv(lnapp_conf_t *p_conf, void *p_param)
+{
+    (void)p_param;
+
+    //次のquery_short_channel_idsを送信可能
+    pthread_mutex_lock(&p_conf->mux_query);
+    p_conf->query_wait = false;
+    pthread_mutex_unlock(&p_conf->mux_query);
+}
+
+
+//LN_CB_REPLY_CHANNEL_RANGE_RECV: reply_channel_range受信
+static void cb_reply_channel_range_recv(lnapp_conf_t *p_conf, void *p_param)
+{
+    const ln_cb_short_ids_recv_t *p_ids = (const ln_cb_short_ids_recv_t *)p_param;
+
+    pthread_mutex_lock(&p_conf->mux_query);
+    if (p_conf->query_have_num < 0) {
+        //reply_channel_rangeが分割されてもDB検索は1回だけにする
+        p_conf->query_have_num = ln_db_annocnl_get_range(&p_conf->p_query_have, 0, UINT32_MAX);
+    }
+
+    //DBに無いものを要求リストに追加する
+    int num = p_conf->query_want_num;
+    p_conf->p_query_want = (uint64_t *)realloc(p_conf->p_query_want, sizeof(uint64_t) * (num + p_ids->num + 1));
+    for (int lp = 0; lp < p_ids->num; lp++) {
+        if (bsearch(&p_ids->p_short_ids[lp], p_conf->p_query_have, p_conf->query_have_num, sizeof(uint64_t), sci_cmp) == NULL) {
+            p_conf->p_query_want[num++] = p_ids->p_short_ids[lp];
+        }
+    }
+    DBG_PRINTF("want: %d/%d\n", num - p_conf->query_want_num, p_ids->num);
+    p_conf->query_want_num = num;
+
+    if (p_ids->complete) {
+        free(p_conf->p_query_have);
+        p_conf->p_query_have = NULL;
+        p_conf->query_have_num = -1;
+    }
+    pthread_mutex_unlock(&p_conf->mux_query);
+}
+
+
+//LN_CB_GOSSIP_FILTER_RECV: gossip_timestamp_filter受信
+static void cb_gossip_filter_recv(lnapp_conf_t *p_conf, void *p_param)
+{
+    const ln_gossip_filter_t *p_filter = (const ln_gossip_filter_t *)p_param;
+
+    //cursorへの反映はannounceスレッドで行う
+    pthread_mutex_lock(&p_conf->mux_query);
+    p_conf->query_first = p_filter->first_timestamp;
+    p_conf->query_range = p_filter->timestamp_range;
+    p_conf->query_filter_upd = true;
+    p_conf->query_filter = true;
+    pthread_mutex_unlock(&p_conf->mux_query);
+}
+
+
+//LN_CB_QUERY_CHANNEL_RANGE_RECV: query_channel_range受信
+static void cb_query_channel_range_recv(lnapp_conf_t *p_conf, void *p_param)
+{
+    const ln_query_channel_range_t *p_query = (const ln_query_channel_range_t *)p_param;
+
+    //応答はannounceスレッドで行う
+    pthread_mutex_lock(&p_conf->mux_query);
+    bool busy = p_conf->query_range_req;
+    if (!busy) {
+        p_conf->query_range_msg = *p_query;
+        p_conf->query_range_req = true;
+    }
+    pthread_mutex_unlock(&p_conf->mux_query);
+
+    if (busy) {
+        //BOLT#7: 応答が終わる前に次のquery_channel_rangeを送信してはならない
+        DBG_PRINTF("fail: query_channel_range before reply complete\n");
+        stop_threads(p_conf);
+    }
+}
+
+
 /********************************************************************
  * スレッド共通処理
  ********************************************************************/
@@ -2819,15 +3043,36 @@ static void send_peer_noise(lnapp_conf_t *p_conf, const ucoin_buf_t *pBuf)
     uint16_t type = ln_misc_get16be(pBuf->buf);
     DBG_PRINTF("[SEND]type=%04x(%s): sock=%d, Len=%d\n", type, ln_misc_msgname(type), p_conf->sock, pBuf->len);
 
+    //暗号化した順にsocketへ書き込むため、書込みが終わるまでmux_sendを保持する
+    //  send_gossip()が送信しきれなかった分があれば、それを先に送る
     pthread_mutex_lock(&p_conf->mux_send);
     ucoin_buf_t buf_enc;
     bool ret = ln_noise_enc(p_conf->p_self, &buf_enc, pBuf);
-    pthread_mutex_unlock(&p_conf->mux_send);
     assert(ret);
+    (void)ret;
+
+    struct iovec iov[2];
+    int cnt = 0;
+    if (p_conf->gossip_unsent.len > 0) {
+        iov[cnt].iov_base = p_conf->gossip_unsent.buf;
+        iov[cnt].iov_len = p_conf->gossip_unsent.len;
+        cnt++;
+    }
+    iov[cnt].iov_base = buf_enc.buf;
+    iov[cnt].iov_len = buf_enc.len;
+    cnt++;
+    send_peer_iov(p_conf, iov, cnt);
+    ucoin_buf_free(&p_conf->gossip_unsent);
+    pthread_mutex_unlock(&p_conf->mux_send);
+    ucoin_buf_free(&buf_enc);
+}
 
+
+//peer送信(暗号化済みデータをまとめて送信)
+static void send_peer_iov(lnapp_conf_t *p_conf, struct iovec *pIov, int Cnt)
+{
     struct pollfd fds;
-    ssize_t len = buf_enc.len;
-    while ((p_conf->loop) && (len > 0)) {
+    while ((p_conf->loop) && (Cnt > 0)) {
         fds.fd = p_conf->sock;
         fds.events = POLLOUT;
         int polr = poll(&fds, 1, M_WAIT_RECV_TO_MSEC);
@@ -2835,15 +3080,63 @@ static void send_peer_noise(lnapp_conf_t *p_conf, const ucoin_buf_t *pBuf)
             SYSLOG_ERR("%s(): poll: %s", __func__, strerror(errno));
             break;
         }
-        ssize_t sz = write(p_conf->sock, buf_enc.buf, len);
+        ssize_t sz = writev(p_conf->sock, pIov, Cnt);
         if (sz < 0) {
-            SYSLOG_ERR("%s(): poll: %s", __func__, strerror(errno));
+            SYSLOG_ERR("%s(): writev: %s", __func__, strerror(errno));
             break;
         }
-        len -= sz;
-        misc_msleep(M_WAIT_SEND_WAIT_MSEC);
+        //送信できなかった位置から続ける
+        while ((Cnt > 0) && ((size_t)sz >= pIov->iov_len)) {
+            sz -= pIov->iov_len;
+            pIov++;
+            Cnt--;
+        }
+        if (Cnt > 0) {
+            pIov->iov_base = (uint8_t *)pIov->iov_base + sz;
+            pIov->iov_len -= sz;
+        }
+    }
+
+    //ping送信待ちカウンタ
+    p_conf->ping_counter = 0;
+}
+
+
+//peer送信(暗号化済みデータを、socketの送信バッファに入る分だけ送信)
+//  mux_sendを取得して呼ぶ。送信できなかった分はgossip_unsentに残し、次の送信で先に送る。
+static void send_peer_nowait(lnapp_conf_t *p_conf, const struct iovec *pIov, int Cnt)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)pIov;
+    msg.msg_iovlen = Cnt;
+    ssize_t sz = sendmsg(p_conf->sock, &msg, MSG_DONTWAIT);
+    if (sz < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            SYSLOG_ERR("%s(): sendmsg: %s", __func__, strerror(errno));
+            return;
+        }
+        sz = 0;
+    }
+
+    size_t rest = 0;
+    for (int lp = 0; lp < Cnt; lp++) {
+        rest += pIov[lp].iov_len;
+    }
+    rest -= sz;
+    if (rest > 0) {
+        ucoin_buf_alloc(&p_conf->gossip_unsent, (uint32_t)rest);
+        uint8_t *p = p_conf->gossip_unsent.buf;
+        for (int lp = 0; lp < Cnt; lp++) {
+            if ((size_t)sz >= pIov[lp].iov_len) {
+                sz -= pIov[lp].iov_len;
+                continue;
+            }
+            memcpy(p, (const uint8_t *)pIov[lp].iov_base + sz, pIov[lp].iov_len - sz);
+            p += pIov[lp].iov_len - sz;
+            sz = 0;
+        }
     }
-    ucoin_buf_free(&buf_enc);
 
     //ping送信待ちカウンタ
     p_conf->ping_counter = 0;
@@ -2880,27 +3173,27 @@ static void send_channel_anno(lnapp_conf_t *p_conf)
     void *p_cur;
     ret = ln_db_annocnl_cur_open(&p_cur, p_db);
     if (ret) {
-        char type;
+        char type = 0;
         ucoin_buf_t buf_cnl = UCOIN_BUF_INIT;
         if (p_conf->last_anno_cnl != 0) {
-            //前回のところまで検索する
-            while ((ret = ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
-                if (short_channel_id == p_conf->last_anno_cnl) {
-                    break;
-                }
-                ucoin_buf_free(&buf_cnl);
-            }
+            //前回の続きから取得する
+            ret = ln_db_annocnl_cur_seek(p_cur, p_conf->last_anno_cnl, p_conf->last_anno_cnl_type);
         }
-        ucoin_buf_free(&buf_cnl);
 
-        while ((ret = ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
+        while (ret && (ret = ln_db_annocnl_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
             if (!p_conf->loop) {
                 break;
             }
             if (type == LN_DB_CNLANNO_ANNO) {
                 //DBはkey順にソートされているため、channel_announcement→channel_update1→channel_update2の順になる。
-                p_conf->last_annocnl_sci = short_channel_id;
-                bool unspent = check_unspent_short_channel_id(short_channel_id);
+                bool unspent;
+                if (!unspent_check(short_channel_id, &unspent)) {
+                    //bitcoindに問い合わせできない: 閉鎖済みとはせず、このchannelは次の周回で送信する
+                    p_conf->last_annocnl_sci = 0;
+                    unspent = true;
+                } else {
+                    p_conf->last_annocnl_sci = short_channel_id;
+                }
                 if (!unspent) {
                     //使用済みのため、DBから削除
                     DBG_PRINTF("remove from DB: %0" PRIx64 "\n", short_channel_id);
@@ -2929,6 +3222,7 @@ static void send_channel_anno(lnapp_conf_t *p_conf)
         }
         if (ret) {
             p_conf->last_anno_cnl = short_channel_id;
+            p_conf->last_anno_cnl_type = type;
         } else {
             p_conf->last_anno_cnl = 0;
         }
@@ -2983,17 +3277,11 @@ static void send_node_anno(lnapp_conf_t *p_conf)
         uint8_t nodeid[UCOIN_SZ_PUBKEY];
 
         if (p_conf->last_anno_node[0] != 0) {
-            //前回のところまで検索する
-            while ((ret = ln_db_annonod_cur_get(p_cur, &buf_node, &timestamp, nodeid))) {
-                if (memcmp(nodeid, p_conf->last_anno_node, UCOIN_SZ_PUBKEY) == 0) {
-                    break;
-                }
-                ucoin_buf_free(&buf_node);
-            }
+            //前回の続きから取得する
+            ret = ln_db_annonod_cur_seek(p_cur, p_conf->last_anno_node);
         }
-        ucoin_buf_free(&buf_node);
 
-        while ((ret = ln_db_annonod_cur_get(p_cur, &buf_node, &timestamp, nodeid))) {
+        while (ret && (ret = ln_db_annonod_cur_get(p_cur, &buf_node, &timestamp, nodeid))) {
             if (!p_conf->loop) {
                 break;
             }
@@ -3035,6 +3323,412 @@ LABEL_EXIT:
 }
 
 
+/** gossip storeからのannouncement送信
+ *
+ * 接続先へ未送信のchannel_announcement/channel_update/node_announcementを、DBへの保存順に送信する。
+ * gossip storeから読み込むため、DB読込みやannouncement送信済み情報の更新は行わない。
+ * gossip storeのロックは #ln_db_gossip_cur_get() 内でしか保持しないため、
+ * unspentチェック(bitcoind RPC)やsocket送信中もcompactionは待たされない。
+ * 使用済みのchannelはDBから削除し、後から現れる同じchannelのchannel_updateも送信しない(gossip_spent)。
+ * bitcoindに問い合わせできなかったchannel_announcementは、次回そこから送信し直す(gossip_retry)。
+ *
+ * 送信量は接続先ごとのtoken bucketで制限する(gossip_rate[byte/sec]、最大1秒分)。
+ * tokenがある間は、最大M_GOSSIP_IOV個を暗号化してsocketの送信バッファに入る分だけ送信する。
+ * 送信しきれなかった分は次回(あるいは #send_peer_noise())に先に送り、送信を待ってmux_sendを保持することはない。
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ */
+static void send_gossip(lnapp_conf_t *p_conf)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (p_conf->gossip_refill != 0) {
+        p_conf->gossip_tokens += (int64_t)((now - p_conf->gossip_refill) * p_conf->gossip_rate / 1000);
+        if (p_conf->gossip_tokens > (int64_t)p_conf->gossip_rate) {
+            p_conf->gossip_tokens = p_conf->gossip_rate;
+        }
+    } else {
+        p_conf->gossip_tokens = p_conf->gossip_rate;
+    }
+    p_conf->gossip_refill = now;
+
+    uint64_t spent_sci = 0;
+    bool retry = false;
+    bool more = true;
+    while (p_conf->loop && more && (p_conf->gossip_tokens > 0) && (spent_sci == 0) && !retry) {
+        struct pollfd fds;
+        fds.fd = p_conf->sock;
+        fds.events = POLLOUT;
+        if (poll(&fds, 1, 0) <= 0) {
+            //送信バッファに空きが無い
+            break;
+        }
+
+        //前回送信しきれなかった分を先に送る
+        pthread_mutex_lock(&p_conf->mux_send);
+        if (p_conf->gossip_unsent.len > 0) {
+            ucoin_buf_t buf_unsent = p_conf->gossip_unsent;
+            struct iovec iov_unsent = { buf_unsent.buf, buf_unsent.len };
+            ucoin_buf_init(&p_conf->gossip_unsent);
+            send_peer_nowait(p_conf, &iov_unsent, 1);
+            ucoin_buf_free(&buf_unsent);
+        }
+        bool unsent = (p_conf->gossip_unsent.len > 0);
+        pthread_mutex_unlock(&p_conf->mux_send);
+        if (unsent) {
+            break;
+        }
+
+        //送信するものを集める(tokenが足りなくなる分までは送信する)
+        ucoin_buf_t buf[M_GOSSIP_IOV];
+        int cnt = 0;
+        int64_t tokens = p_conf->gossip_tokens;
+        while ((cnt < M_GOSSIP_IOV) && (tokens > 0)) {
+            char type;
+            uint64_t short_channel_id;
+            if (p_conf->gossip_retry.len > 0) {
+                //前回unspentチェックできなかったchannel_announcementからやり直す
+                buf[cnt] = p_conf->gossip_retry;
+                ucoin_buf_init(&p_conf->gossip_retry);
+                type = LN_DB_CNLANNO_ANNO;
+                short_channel_id = p_conf->gossip_retry_sci;
+            } else {
+                more = ln_db_gossip_cur_get(p_conf->p_gossip, &buf[cnt], &type, &short_channel_id);
+                if (!more) {
+                    break;
+                }
+            }
+            if (gossip_is_spent(p_conf, type, short_channel_id)) {
+                //使用済みchannelのchannel_updateは、channel_announcementの後に保存されていても送信しない
+                DBG_PRINTF("skip spent %c: %016" PRIx64 "\n", type, short_channel_id);
+                ucoin_buf_free(&buf[cnt]);
+                continue;
+            }
+            bool unspent = true;
+            if ((type == LN_DB_CNLANNO_ANNO) && !unspent_check(short_channel_id, &unspent)) {
+                //bitcoindに問い合わせできない: 閉鎖済みとはせず、送信も削除もしないで次回やり直す
+                p_conf->gossip_retry = buf[cnt];
+                p_conf->gossip_retry_sci = short_channel_id;
+                retry = true;
+                break;
+            }
+            if (!unspent) {
+                ucoin_buf_free(&buf[cnt]);
+                p_conf->gossip_spent[p_conf->gossip_spent_pos] = short_channel_id;
+                p_conf->gossip_spent_pos = (p_conf->gossip_spent_pos + 1) % LNAPP_GOSSIP_SPENT;
+                spent_sci = short_channel_id;
+                break;
+            }
+            DBG_PRINTF("send gossip %c: %016" PRIx64 "\n", type, short_channel_id);
+            //暗号化で長さ(2byte)とMAC(16byte*2)が付く
+            tokens -= buf[cnt].len + 2 + 16 * 2;
+            cnt++;
+        }
+
+        if (cnt > 0) {
+            //暗号化した順にsocketへ書き込む(送信バッファに入らない分は残して次回に回す)
+            ucoin_buf_t buf_enc[M_GOSSIP_IOV];
+            struct iovec iov[M_GOSSIP_IOV];
+            pthread_mutex_lock(&p_conf->mux_send);
+            for (int lp = 0; lp < cnt; lp++) {
+                bool ret = ln_noise_enc(p_conf->p_self, &buf_enc[lp], &buf[lp]);
+                assert(ret);
+                (void)ret;
+                iov[lp].iov_base = buf_enc[lp].buf;
+                iov[lp].iov_len = buf_enc[lp].len;
+            }
+            send_peer_nowait(p_conf, iov, cnt);
+            pthread_mutex_unlock(&p_conf->mux_send);
+            for (int lp = 0; lp < cnt; lp++) {
+                ucoin_buf_free(&buf_enc[lp]);
+                ucoin_buf_free(&buf[lp]);
+            }
+            p_conf->gossip_tokens = tokens;
+        }
+    }
+
+    if (spent_sci != 0) {
+        //使用済みのため、DBから削除(gossip storeからはcompactionで削除される)
+        DBG_PRINTF("remove from DB: %0" PRIx64 "\n", spent_sci);
+        (void)ln_db_annocnlall_del(spent_sci);
+    }
+}
+
+
+/** send_gossip()で使用済みとしたchannelのレコードか
+ *
+ * gossip storeは保存順のため、使用済みchannelのchannel_updateがchannel_announcementより後に現れる。
+ *
+ * @param[in]   p_conf          lnapp情報
+ * @param[in]   Type            LN_DB_CNLANNO_xxx / LN_DB_GOSSIP_NODE
+ * @param[in]   ShortChannelId  short_channel_id
+ * @retval  true    送信しない
+ */
+static bool gossip_is_spent(const lnapp_conf_t *p_conf, char Type, uint64_t ShortChannelId)
+{
+    if (Type == LN_DB_GOSSIP_NODE) {
+        return false;
+    }
+    for (int lp = 0; lp < LNAPP_GOSSIP_SPENT; lp++) {
+        if (p_conf->gossip_spent[lp] == ShortChannelId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** gossip queries開始
+ *
+ * 相手がgossip_queriesに対応している場合、gossip_timestamp_filterで保存済みより新しいものだけを要求し、
+ * query_channel_rangeでDBに無いchannelを探す(応答は #cb_reply_channel_range_recv())。
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ */
+static void query_start(lnapp_conf_t *p_conf)
+{
+    if (!ln_is_gossip_queries(p_conf->p_self)) {
+        return;
+    }
+
+    uint32_t first = ln_db_gossip_latest();
+    uint32_t now = (uint32_t)time(NULL);
+    if (first > now) {
+        first = now;
+    }
+    first = (first > M_QUERY_FILTER_MARGIN) ? first - M_QUERY_FILTER_MARGIN : 0;
+    DBG_PRINTF("first_timestamp=%" PRIu32 "\n", first);
+
+    ucoin_buf_t buf_bolt = UCOIN_BUF_INIT;
+    bool ret = ln_create_gossip_timestamp_filter(p_conf->p_self, &buf_bolt, first, UINT32_MAX - first);
+    if (ret) {
+        send_peer_noise(p_conf, &buf_bolt);
+        ucoin_buf_free(&buf_bolt);
+    }
+    ret = ln_create_query_channel_range(p_conf->p_self, &buf_bolt, 0, UINT32_MAX);
+    if (ret) {
+        send_peer_noise(p_conf, &buf_bolt);
+        ucoin_buf_free(&buf_bolt);
+    }
+}
+
+
+/** query_short_channel_ids送信
+ *
+ * 1回のquery_short_channel_idsで要求するのはLN_GOSSIPQ_SHORT_IDS_MAX channelまでで、
+ * 残りはp_query_wantに残し、reply_short_channel_ids_endを受信してから次のquery_short_channel_idsで要求する。
+ * reply_short_channel_ids_endを受信するまで次のquery_short_channel_idsは送信しない。
+ * M_QUERY_WAIT_SEC以内に受信できなければ、応答しない相手とみなして残りの要求を捨てる。
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ */
+static void query_request(lnapp_conf_t *p_conf)
+{
+    ucoin_buf_t buf_bolt = UCOIN_BUF_INIT;
+    bool ret = false;
+    int num = 0;
+
+    //query_waitは受信スレッドでも更新する
+    pthread_mutex_lock(&p_conf->mux_query);
+    if (p_conf->query_wait) {
+        if ((uint32_t)time(NULL) - p_conf->query_wait_start >= M_QUERY_WAIT_SEC) {
+            DBG_PRINTF("timeout: reply_short_channel_ids_end\n");
+            free(p_conf->p_query_want);
+            p_conf->p_query_want = NULL;
+            p_conf->query_want_num = 0;
+            p_conf->query_want_pos = 0;
+            p_conf->query_wait = false;
+        }
+    } else {
+        num = p_conf->query_want_num - p_conf->query_want_pos;
+        if (num > 0) {
+            if (num > LN_GOSSIPQ_SHORT_IDS_MAX) {
+                num = LN_GOSSIPQ_SHORT_IDS_MAX;
+            }
+            ret = ln_create_query_short_channel_ids(p_conf->p_self, &buf_bolt,
+                            p_conf->p_query_want + p_conf->query_want_pos, num);
+            p_conf->query_want_pos += num;
+        }
+        if ((p_conf->query_want_pos == p_conf->query_want_num) && (p_conf->p_query_want != NULL)) {
+            free(p_conf->p_query_want);
+            p_conf->p_query_want = NULL;
+            p_conf->query_want_num = 0;
+            p_conf->query_want_pos = 0;
+        }
+        if (ret) {
+            //送信前に立てておき、reply_short_channel_ids_endを取りこぼさない
+            p_conf->query_wait_start = (uint32_t)time(NULL);
+            p_conf->query_wait = true;
+        }
+    }
+    pthread_mutex_unlock(&p_conf->mux_query);
+
+    if (ret) {
+        DBG_PRINTF("query_short_channel_ids: %d\n", num);
+        send_peer_noise(p_conf, &buf_bolt);
+        ucoin_buf_free(&buf_bolt);
+    }
+}
+
+
+/** query_short_channel_idsへの応答
+ *
+ * 要求されたchannelのchannel_announcement/channel_update/node_announcementを、
+ * 1回あたりM_QUERY_UNIT channelずつ送信する。
+ * すべて送信し終わったらreply_short_channel_ids_endを送信する。
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ */
+static void query_reply(lnapp_conf_t *p_conf)
+{
+    uint64_t sci[M_QUERY_UNIT];
+    int num;
+    bool end = false;
+
+    pthread_mutex_lock(&p_conf->mux_query);
+    num = p_conf->query_recv_num - p_conf->query_recv_pos;
+    if (num > M_QUERY_UNIT) {
+        num = M_QUERY_UNIT;
+    }
+    if (num > 0) {
+        memcpy(sci, p_conf->p_query_recv + p_conf->query_recv_pos, sizeof(uint64_t) * num);
+        p_conf->query_recv_pos += num;
+    }
+    if ((p_conf->query_recv_pos == p_conf->query_recv_num) && (p_conf->p_query_recv != NULL)) {
+        free(p_conf->p_query_recv);
+        p_conf->p_query_recv = NULL;
+        p_conf->query_recv_num = 0;
+        p_conf->query_recv_pos = 0;
+        end = true;
+    }
+    pthread_mutex_unlock(&p_conf->mux_query);
+
+    for (int lp = 0; lp < num; lp++) {
+        ucoin_buf_t buf = UCOIN_BUF_INIT;
+        uint64_t short_channel_id;
+        uint8_t node_id[2][UCOIN_SZ_PUBKEY];
+        uint32_t timestamp;
+
+        if (!ln_db_annocnl_load(&buf, sci[lp])) {
+            DBG_PRINTF("not found: %016" PRIx64 "\n", sci[lp]);
+            continue;
+        }
+        bool ret = ln_getids_cnl_anno(&short_channel_id, node_id[0], node_id[1], buf.buf, buf.len);
+        send_peer_noise(p_conf, &buf);
+        ucoin_buf_free(&buf);
+        for (uint8_t dir = 0; dir < 2; dir++) {
+            if (ln_db_annocnlupd_load(&buf, &timestamp, sci[lp], dir)) {
+                send_peer_noise(p_conf, &buf);
+                ucoin_buf_free(&buf);
+            }
+        }
+        for (int idx = 0; ret && (idx < 2); idx++) {
+            if (ln_db_annonod_load(&buf, &timestamp, node_id[idx])) {
+                send_peer_noise(p_conf, &buf);
+                ucoin_buf_free(&buf);
+            }
+        }
+    }
+
+    if (end) {
+        ucoin_buf_t buf_bolt = UCOIN_BUF_INIT;
+        if (ln_create_reply_short_channel_ids_end(p_conf->p_self, &buf_bolt, true)) {
+            send_peer_noise(p_conf, &buf_bolt);
+            ucoin_buf_free(&buf_bolt);
+        }
+    }
+}
+
+
+/** query_channel_rangeへの応答
+ *
+ * 最初の呼び出しで範囲内のshort_channel_idをDBから取得し、
+ * 1回あたり1つのreply_channel_rangeを送信する(最後のものだけcomplete=1)。
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ */
+static void query_range_reply(lnapp_conf_t *p_conf)
+{
+    pthread_mutex_lock(&p_conf->mux_query);
+    bool req = p_conf->query_range_req;
+    pthread_mutex_unlock(&p_conf->mux_query);
+    if (!req) {
+        return;
+    }
+
+    if (p_conf->query_range_num < 0) {
+        //DB検索は受信スレッドを止めないよう、ここで行う
+        uint64_t *p_short_ids = NULL;
+        int num = ln_db_annocnl_get_range(&p_short_ids, p_conf->query_range_msg.first_blocknum, p_conf->query_range_msg.number_of_blocks);
+        if (num < 0) {
+            DBG_PRINTF("fail: ln_db_annocnl_get_range\n");
+            num = 0;
+        }
+        pthread_mutex_lock(&p_conf->mux_query);
+        p_conf->p_query_range = p_short_ids;
+        p_conf->query_range_num = num;
+        p_conf->query_range_pos = 0;
+        pthread_mutex_unlock(&p_conf->mux_query);
+    }
+
+    int pos = p_conf->query_range_pos;
+    int cnt = p_conf->query_range_num - pos;
+    if (cnt > LN_GOSSIPQ_SHORT_IDS_MAX) {
+        cnt = LN_GOSSIPQ_SHORT_IDS_MAX;
+    }
+    bool complete = (pos + cnt >= p_conf->query_range_num);
+    ucoin_buf_t buf_bolt = UCOIN_BUF_INIT;
+    if (ln_create_reply_channel_range(p_conf->p_self, &buf_bolt, &p_conf->query_range_msg,
+                    (p_conf->p_query_range != NULL) ? p_conf->p_query_range + pos : NULL, cnt, complete)) {
+        send_peer_noise(p_conf, &buf_bolt);
+        ucoin_buf_free(&buf_bolt);
+    } else {
+        complete = true;
+    }
+
+    pthread_mutex_lock(&p_conf->mux_query);
+    p_conf->query_range_pos = pos + cnt;
+    if (complete) {
+        free(p_conf->p_query_range);
+        p_conf->p_query_range = NULL;
+        p_conf->query_range_num = -1;
+        p_conf->query_range_pos = 0;
+        p_conf->query_range_req = false;
+    }
+    pthread_mutex_unlock(&p_conf->mux_query);
+}
+
+
+/** gossip queries用リスト解放
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ */
+static void query_clear(lnapp_conf_t *p_conf)
+{
+    pthread_mutex_lock(&p_conf->mux_query);
+    //p_query_xxxは全て標準のmalloc()/realloc()で確保している(lnapp_conf_t参照)
+    free(p_conf->p_query_have);
+    p_conf->p_query_have = NULL;
+    p_conf->query_have_num = -1;
+    free(p_conf->p_query_want);
+    p_conf->p_query_want = NULL;
+    p_conf->query_want_num = 0;
+    p_conf->query_want_pos = 0;
+    free(p_conf->p_query_recv);
+    p_conf->p_query_recv = NULL;
+    p_conf->query_recv_num = 0;
+    p_conf->query_recv_pos = 0;
+    free(p_conf->p_query_range);
+    p_conf->p_query_range = NULL;
+    p_conf->query_range_num = -1;
+    p_conf->query_range_pos = 0;
+    p_conf->query_range_req = false;
+    p_conf->query_wait = false;
+    pthread_mutex_unlock(&p_conf->mux_query);
+}
+
+
 /********************************************************************
  * その他
  ********************************************************************/
@@ -3611,24 +4305,14 @@ static void payroute_print(lnapp_conf_t *p_conf)
 }
 
 
-/** short_channel_idのfunding_tx未使用チェック
- * 
- * @param[in]   ShortChannelId      short_channel_id
- * @retval  true    funding_tx未使用
+/** short_channel_id比較(qsort/bsearch用)
+ *
  */
-static bool check_unspent_short_channel_id(uint64_t ShortChannelId)
+static int sci_cmp(const void *pA, const void *pB)
 {
-    uint32_t bheight;
-    uint32_t bindex;
-    uint32_t vindex;
-    ln_get_short_channel_id_param(&bheight, &bindex, &vindex, ShortChannelId);
-
-    bool ret = btcprc_is_short_channel_unspent(bheight, bindex, vindex);
-    if (!ret) {
-        DBG_PRINTF("already spent : %016" PRIx64 "(height=%" PRIu32 ", bindex=%" PRIu32 ", txindex=%" PRIu32 ")\n", ShortChannelId, bheight, bindex, vindex);
-    }
-
-    return ret;
+    uint64_t a = *(const uint64_t *)pA;
+    uint64_t b = *(const uint64_t *)pB;
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
 }
 
 
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 #include <assert.h>
 
 #define UCOIN_DEBUG_MEM
@@ -39,6 +40,7 @@
 #include "cmd_json.h"
 #include "misc.h"
 #include "ln_db.h"
+#include "unspent.h"
 
 #include "monitoring.h"
 
@@ -48,6 +50,21 @@
  **************************************************************************/
 
 #define M_WAIT_MON_SEC                  (30)        ///< 監視周期[sec]
+#define M_PRUNE_CYCLE                   (120)       ///< announcement削除周期(M_WAIT_MON_SEC単位)
+#define M_PRUNE_CHECK_MAX               (256)       ///< 1回のannouncement削除でbitcoindに閉鎖を問い合わせるchannel数
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct prune_param_t
+ *  @brief  #prune_closed()用
+ */
+typedef struct {
+    int         remain;             ///< 残り問い合わせ数
+    uint64_t    last;               ///< 最後に問い合わせたshort_channel_id
+} prune_param_t;
 
 
 /**************************************************************************
@@ -57,6 +74,7 @@
 static volatile bool        mMonitoring;                ///< true:監視thread継続
 static bool                 mDisableAutoConn;           ///< true:channelのある他nodeへの自動接続停止
 static uint32_t             mFeeratePerKw;              ///< 0:bitcoind estimatesmartfee使用 / 非0:強制feerate_per_kw
+static uint64_t             mPruneCheckSci;             ///< 前回最後に閉鎖を問い合わせたshort_channel_id(0:先頭から)
 
 
 /********************************************************************
@@ -64,6 +82,8 @@ static uint32_t             mFeeratePerKw;              ///< 0:bitcoind estimate
  ********************************************************************/
 
 static bool monfunc(ln_self_t *self, void *p_db_param, void *p_param);
+static void anno_prune(void);
+static bool prune_closed(uint64_t ShortChannelId, void *p_param);
 
 static bool funding_spent(ln_self_t *self, uint32_t confm, void *p_db_param);
 static bool channel_reconnect(ln_self_t *self, uint32_t confm, void *p_db_param);
@@ -96,6 +116,7 @@ void *monitor_thread_start(void *pArg)
 
     mMonitoring = true;
 
+    int prune_cnt = 0;
     while (mMonitoring) {
         //ループ解除まで時間が長くなるので、短くチェックする
         for (int lp = 0; lp < M_WAIT_MON_SEC; lp++) {
@@ -112,6 +133,21 @@ void *monitor_thread_start(void *pArg)
             feerate_per_kw = mFeeratePerKw;
         }
         ln_db_self_search(monfunc, &feerate_per_kw);
+
+        //gossipのshort_channel_id unspentキャッシュ
+        unspent_update(btcprc_getblockcount());
+
+        //routingコマンド用graph
+        ln_routing_snapshot_save();
+
+        //古いannouncement
+        if (++prune_cnt >= M_PRUNE_CYCLE) {
+            anno_prune();
+            prune_cnt = 0;
+        }
+
+        //announcement送信用ファイル
+        ln_db_gossip_compact();
     }
     DBG_PRINTF("stop\n");
 
@@ -336,6 +372,57 @@ static bool monfunc(ln_self_t *self, void *p_db_param, void *p_param)
 }
 
 
+/** 古いannouncementの削除
+ *
+ * channel_updateが更新されなくなったchannel、閉鎖されたchannel、channelの無いnode_announcementをDBから削除する。
+ * 閉鎖の問い合わせはbitcoindへの負荷を抑えるため1回M_PRUNE_CHECK_MAX channelまでとし、
+ * 残りは次回、最後に問い合わせたshort_channel_idより大きいものから行う。
+ * (channel一覧は毎回DBから作り直すため、位置ではなくshort_channel_idで続きを決める)
+ */
+static void anno_prune(void)
+{
+    ln_db_prune_t result;
+    prune_param_t param;
+
+    param.remain = M_PRUNE_CHECK_MAX;
+    param.last = 0;
+    bool ret = ln_db_anno_prune(&result, (uint32_t)time(NULL), btcprc_getblockcount(), prune_closed, &param);
+    if (param.remain > 0) {
+        //最後まで問い合わせた
+        mPruneCheckSci = 0;
+    } else {
+        mPruneCheckSci = param.last;
+    }
+    if (ret) {
+        DBG_PRINTF("prune: stale=%d, closed=%d, node=%d, records=%d\n",
+                    result.stale, result.closed, result.node, result.records);
+    } else {
+        DBG_PRINTF("fail: prune\n");
+    }
+}
+
+
+/** 閉鎖済みchannel判定(#ln_db_anno_prune())
+ *
+ * short_channel_idの昇順に呼ばれる。
+ *
+ * @param[in]       ShortChannelId  short_channel_id
+ * @param[in,out]   p_param         prune_param_t
+ * @retval  true    閉鎖済み
+ */
+static bool prune_closed(uint64_t ShortChannelId, void *p_param)
+{
+    prune_param_t *p_prm = (prune_param_t *)p_param;
+
+    if ((ShortChannelId <= mPruneCheckSci) || (p_prm->remain <= 0)) {
+        return false;
+    }
+    p_prm->remain--;
+    p_prm->last = ShortChannelId;
+    return unspent_is_spent(ShortChannelId);
+}
+
+
 /**
  * 
  * @param[in,out]   self        チャネル情報
@@ -55,6 +55,7 @@
 #include "lnapp.h"
 #include "monitoring.h"
 #include "cmd_json.h"
+#include "unspent.h"
 
 /********************************************************************
  * typedefs
@@ -233,7 +234,22 @@ int main(int argc, char *argv[])
         fclose(fp);
     }
 
+    //routing graph構築
+    bret = ln_routing_init();
+    if (!bret) {
+        //送金時に再構築する
+        DBG_PRINTF("fail: routing graph init\n");
+    }
+
+    //announcement署名検証
+    bret = ln_anno_verify_start(0);
+    if (!bret) {
+        //受信threadで検証する
+        DBG_PRINTF("fail: announcement verify thread\n");
+    }
+
     lnapp_init();
+    unspent_init();
 
     pthread_mutex_init(&mMuxPreimage, NULL);
 
@@ -261,8 +277,12 @@ int main(int argc, char *argv[])
 
     SYSLOG_INFO("end");
 
+    //検証待ちのannouncementを保存し終わってから、peerとbitcoindとの接続を終了する
+    ln_anno_verify_stop();
     lnapp_term();
+    unspent_term();
     btcprc_term();
+    ln_routing_term();
     ln_db_term();
 
     return 0;
@@ -0,0 +1,394 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   unspent.c
+ *  @brief  short_channel_idのfunding_tx未使用キャッシュ
+ *
+ *  channel_announcementを受信・送信するたびにbitcoindへ問い合わせると、
+ *  gossipの処理速度がRPCの往復時間で決まってしまう。
+ *  short_channel_idごとに結果を持ち、新しいblockで使用されたoutpointだけを反映する。
+ *
+ *  キャッシュはshort_channel_idをkeyにしたopen addressingのtableで、
+ *  channel数に合わせて拡張する(衝突で追い出さない)。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "ucoind.h"
+#include "btcrpc.h"
+#include "unspent.h"
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_UNSPENT_INIT          (4096)      ///< キャッシュtableの初期サイズ(2のべき乗)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct   unspent_cache_t
+ *  @brief  short_channel_idのfunding_tx未使用チェック結果
+ */
+typedef struct {
+    uint64_t    short_channel_id;           ///< 0:空き
+    uint8_t     txid[UCOIN_SZ_TXID];        ///< funding_txid
+    int32_t     height;                     ///< チェックしたblock height
+    int32_t     scanned;                    ///< 使用済みチェックを反映したblock height(mUnspentScanと異なれば無効)
+    bool        unspent;                    ///< true:funding_tx未使用
+} unspent_cache_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+//キャッシュtable(open addressing)
+static unspent_cache_t      *mpUnspent;
+static uint32_t             mUnspentSize;
+static uint32_t             mUnspentNum;
+
+static pthread_mutex_t      mMuxUnspent = PTHREAD_MUTEX_INITIALIZER;
+static volatile int32_t     mBlockCount;    ///< 最後に取得したblock count(0:未取得)
+static int32_t              mUnspentScan;   ///< 使用済みチェックをキャッシュに反映したblock height(mMuxUnspentで排他)
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static unspent_cache_t *unspent_cache_search(uint64_t ShortChannelId);
+static unspent_cache_t *unspent_cache_add(uint64_t ShortChannelId);
+static void unspent_cache_grow(void);
+static bool unspent_cache_valid(const unspent_cache_t *pCache);
+static void unspent_cache_clear(int32_t Height);
+static inline uint32_t unspent_cache_hash(uint64_t ShortChannelId);
+static int outpoint_cmp(const void *pA, const void *pB);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void unspent_init(void)
+{
+    pthread_mutex_lock(&mMuxUnspent);
+    mUnspentSize = M_UNSPENT_INIT;
+    mpUnspent = (unspent_cache_t *)APP_MALLOC(sizeof(unspent_cache_t) * mUnspentSize);      //APP_FREE: unspent_term()
+    memset(mpUnspent, 0, sizeof(unspent_cache_t) * mUnspentSize);
+    mUnspentNum = 0;
+    mBlockCount = 0;
+    mUnspentScan = 0;
+    pthread_mutex_unlock(&mMuxUnspent);
+}
+
+
+void unspent_term(void)
+{
+    pthread_mutex_lock(&mMuxUnspent);
+    if (mpUnspent != NULL) {
+        APP_FREE(mpUnspent);        //APP_MALLOC: unspent_init(), unspent_cache_grow()
+    }
+    mUnspentSize = 0;
+    mUnspentNum = 0;
+    pthread_mutex_unlock(&mMuxUnspent);
+}
+
+
+bool unspent_check(uint64_t ShortChannelId, bool *pUnspent)
+{
+    bool ret = false;
+    bool hit = false;
+
+    pthread_mutex_lock(&mMuxUnspent);
+    const unspent_cache_t *p_cache = (mpUnspent != NULL) ? unspent_cache_search(ShortChannelId) : NULL;
+    if ((p_cache != NULL) && unspent_cache_valid(p_cache)) {
+        ret = p_cache->unspent;
+        hit = true;
+    }
+    //RPC中に #unspent_update()がblockを反映した場合、取得結果は古い可能性がある
+    int32_t scanned = mUnspentScan;
+    pthread_mutex_unlock(&mMuxUnspent);
+    if (hit) {
+        *pUnspent = ret;
+        return true;
+    }
+
+    uint32_t bheight;
+    uint32_t bindex;
+    uint32_t vindex;
+    uint8_t txid[UCOIN_SZ_TXID];
+    uint64_t sat;
+    int32_t height = mBlockCount;
+    ln_get_short_channel_id_param(&bheight, &bindex, &vindex, ShortChannelId);
+
+    bool retval = btcprc_get_short_channel_txid(txid, bheight, bindex);
+    if (retval) {
+        retval = btcprc_getxout(&ret, &sat, txid, vindex);
+    }
+    if (!retval) {
+        //RPC失敗はキャッシュしない
+        DBG_PRINTF("fail: check unspent : %016" PRIx64 "\n", ShortChannelId);
+        return false;
+    }
+    if (!ret) {
+        DBG_PRINTF("already spent : %016" PRIx64 "(height=%" PRIu32 ", bindex=%" PRIu32 ", txindex=%" PRIu32 ")\n", ShortChannelId, bheight, bindex, vindex);
+    }
+
+    pthread_mutex_lock(&mMuxUnspent);
+    if (mpUnspent != NULL) {
+        unspent_cache_t *p_add = unspent_cache_add(ShortChannelId);
+        memcpy(p_add->txid, txid, UCOIN_SZ_TXID);
+        p_add->height = height;
+        p_add->scanned = scanned;
+        p_add->unspent = ret;
+    }
+    pthread_mutex_unlock(&mMuxUnspent);
+
+    *pUnspent = ret;
+    return true;
+}
+
+
+bool unspent_is_spent(uint64_t ShortChannelId)
+{
+    bool unspent;
+    return unspent_check(ShortChannelId, &unspent) && !unspent;
+}
+
+
+void unspent_update(int32_t Height)
+{
+    int32_t prev = mBlockCount;
+    if ((Height <= 0) || (Height == prev)) {
+        return;
+    }
+    mBlockCount = Height;
+    if (prev == 0) {
+        //初回は高さを覚えるだけ
+        unspent_cache_clear(Height);
+        return;
+    }
+    DBG_PRINTF("block count: %" PRId32 " --> %" PRId32 "\n", prev, Height);
+
+    if ((Height < prev) || (Height - prev >= UNSPENT_CACHE_BLK)) {
+        //reorg or キャッシュが全部期限切れになるほど進んだ
+        unspent_cache_clear(Height);
+        return;
+    }
+
+    //新しいblockで使用されたoutpointと一致する、未使用としてキャッシュしているfunding_txだけ使用済みにする
+    //  RPC中はキャッシュをロックしない
+    //  RPC中に追加されたキャッシュは、反映したblock height(scanned)が古ければ #unspent_check()で使わない
+    for (int32_t height = prev + 1; height <= Height; height++) {
+        ucoin_buf_t spent = UCOIN_BUF_INIT;
+
+        //未使用としてキャッシュしているものが無ければ、blockを取得しない
+        pthread_mutex_lock(&mMuxUnspent);
+        bool need = false;
+        for (uint32_t lp = 0; lp < mUnspentSize; lp++) {
+            const unspent_cache_t *p_cache = &mpUnspent[lp];
+            if ((p_cache->short_channel_id != 0) && p_cache->unspent && (p_cache->scanned == height - 1)) {
+                need = true;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&mMuxUnspent);
+        if (need && !btcprc_getblock_spent(&spent, height)) {
+            //取得できなかったblockの分は、次回の検索で取得し直す
+            DBG_PRINTF("fail: getblock_spent(%" PRId32 ")\n", height);
+            unspent_cache_clear(Height);
+            return;
+        }
+        btcprc_outpoint_t *p_spent = (btcprc_outpoint_t *)spent.buf;
+        size_t num = spent.len / sizeof(btcprc_outpoint_t);
+        if (num > 1) {
+            qsort(p_spent, num, sizeof(btcprc_outpoint_t), outpoint_cmp);
+        }
+
+        pthread_mutex_lock(&mMuxUnspent);
+        for (uint32_t lp = 0; lp < mUnspentSize; lp++) {
+            unspent_cache_t *p_cache = &mpUnspent[lp];
+            if ((p_cache->short_channel_id == 0) || (p_cache->scanned != height - 1)) {
+                //空き or 前のblockを反映していない
+                continue;
+            }
+            p_cache->scanned = height;
+            if (!p_cache->unspent || (num == 0)) {
+                continue;
+            }
+
+            uint32_t bheight;
+            uint32_t bindex;
+            uint32_t vindex;
+            btcprc_outpoint_t key;
+            ln_get_short_channel_id_param(&bheight, &bindex, &vindex, p_cache->short_channel_id);
+            memcpy(key.txid, p_cache->txid, UCOIN_SZ_TXID);
+            key.index = vindex;
+            if (bsearch(&key, p_spent, num, sizeof(btcprc_outpoint_t), outpoint_cmp) != NULL) {
+                DBG_PRINTF("spent : %016" PRIx64 "\n", p_cache->short_channel_id);
+                p_cache->unspent = false;
+                p_cache->height = Height;
+            }
+        }
+        mUnspentScan = height;
+        pthread_mutex_unlock(&mMuxUnspent);
+        ucoin_buf_free(&spent);
+    }
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** キャッシュ検索(ロックして呼ぶこと)
+ *
+ * @return  見つからない場合はNULL
+ */
+static unspent_cache_t *unspent_cache_search(uint64_t ShortChannelId)
+{
+    uint32_t mask = mUnspentSize - 1;
+    uint32_t pos = unspent_cache_hash(ShortChannelId) & mask;
+    while (mpUnspent[pos].short_channel_id != 0) {
+        if (mpUnspent[pos].short_channel_id == ShortChannelId) {
+            return &mpUnspent[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+    return NULL;
+}
+
+
+/** キャッシュ追加(ロックして呼ぶこと)
+ *
+ * @return  追加した要素(登録済みの場合はその要素)
+ */
+static unspent_cache_t *unspent_cache_add(uint64_t ShortChannelId)
+{
+    unspent_cache_t *p_cache = unspent_cache_search(ShortChannelId);
+    if (p_cache == NULL) {
+        if ((mUnspentNum + 1) * 2 > mUnspentSize) {
+            unspent_cache_grow();
+        }
+        uint32_t mask = mUnspentSize - 1;
+        uint32_t pos = unspent_cache_hash(ShortChannelId) & mask;
+        while (mpUnspent[pos].short_channel_id != 0) {
+            pos = (pos + 1) & mask;
+        }
+        p_cache = &mpUnspent[pos];
+        p_cache->short_channel_id = ShortChannelId;
+        mUnspentNum++;
+    }
+    return p_cache;
+}
+
+
+/** キャッシュtable作り直し(ロックして呼ぶこと)
+ *
+ * 期限切れ・block未反映の要素は捨て、残りが半分を超えるならサイズを倍にする。
+ */
+static void unspent_cache_grow(void)
+{
+    unspent_cache_t *p_old = mpUnspent;
+    uint32_t old_size = mUnspentSize;
+
+    uint32_t num = 0;
+    for (uint32_t lp = 0; lp < old_size; lp++) {
+        if ((p_old[lp].short_channel_id != 0) && unspent_cache_valid(&p_old[lp])) {
+            num++;
+        }
+    }
+    while ((num + 1) * 2 > mUnspentSize) {
+        mUnspentSize *= 2;
+    }
+    mpUnspent = (unspent_cache_t *)APP_MALLOC(sizeof(unspent_cache_t) * mUnspentSize);     //APP_FREE: unspent_term()
+    memset(mpUnspent, 0, sizeof(unspent_cache_t) * mUnspentSize);
+    uint32_t mask = mUnspentSize - 1;
+    for (uint32_t lp = 0; lp < old_size; lp++) {
+        if ((p_old[lp].short_channel_id != 0) && unspent_cache_valid(&p_old[lp])) {
+            uint32_t pos = unspent_cache_hash(p_old[lp].short_channel_id) & mask;
+            while (mpUnspent[pos].short_channel_id != 0) {
+                pos = (pos + 1) & mask;
+            }
+            mpUnspent[pos] = p_old[lp];
+        }
+    }
+    mUnspentNum = num;
+    APP_FREE(p_old);
+    DBG_PRINTF("unspent cache: %" PRIu32 "/%" PRIu32 "\n", mUnspentNum, mUnspentSize);
+}
+
+
+/** キャッシュが使えるか(ロックして呼ぶこと)
+ *
+ */
+static bool unspent_cache_valid(const unspent_cache_t *pCache)
+{
+    return (pCache->scanned == mUnspentScan) &&
+           ((mBlockCount == 0) || (mBlockCount - pCache->height < UNSPENT_CACHE_BLK));
+}
+
+
+/** キャッシュ全削除
+ *
+ * 次回の検索でbitcoindから取得し直す。
+ * 削除前に問い合わせを始めたものは、反映したblock heightが異なるためキャッシュから使われない。
+ * tableのサイズはそのままにする。
+ *
+ * @param[in]   Height      現在のblock count
+ */
+static void unspent_cache_clear(int32_t Height)
+{
+    pthread_mutex_lock(&mMuxUnspent);
+    if (mpUnspent != NULL) {
+        memset(mpUnspent, 0, sizeof(unspent_cache_t) * mUnspentSize);
+    }
+    mUnspentNum = 0;
+    mUnspentScan = Height;
+    pthread_mutex_unlock(&mMuxUnspent);
+}
+
+
+/** short_channel_idのhash
+ *
+ */
+static inline uint32_t unspent_cache_hash(uint64_t ShortChannelId)
+{
+    uint64_t h = ShortChannelId * UINT64_C(0x9e3779b97f4a7c15);
+    return (uint32_t)(h >> 32);
+}
+
+
+/** outpoint比較(qsort/bsearch用)
+ *
+ */
+static int outpoint_cmp(const void *pA, const void *pB)
+{
+    return memcmp(pA, pB, sizeof(btcprc_outpoint_t));
+}
@@ -35,3 +35,4 @@ func_upd libbase58 https://github.com/luke-jr/libbase58.git master
 func_tag libsodium https://github.com/jedisct1/libsodium.git master 1.0.16
 func_tag lmdb https://github.com/LMDB/lmdb.git mdb.master LMDB_0.9.22
 func_tag mbedtls https://github.com/ARMmbed/mbedtls.git development mbedtls-2.9.0
+func_tag secp256k1 https://github.com/bitcoin-core/secp256k1.git master refs/tags/v0.2.0